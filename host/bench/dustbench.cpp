@@ -0,0 +1,2049 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- dustbench - end-to-end benchmarks of the firmware running in the host build.
+//
+// --- Runs the managers in-process and measures the idle wakeups, datagram decoding, UART
+// --- to sensor value latency, the REST API (requests/s, p50/p99 per endpoint), MQTT
+// --- publishing (throughput, bytes per sample), heap allocations per operation and peak RAM.
+// --- The sample compression, the history downsampling and the accuracy of the quantiles
+// --- and the air quality indices run on the simulator or on a recorded capture (--capture).
+//
+// --- dustbench [--quick] [-o result.json] [--baseline baseline.json] [--capture file]
+//
+// --- Results are written as JSON. With --baseline every metric is compared to the
+// --- baseline using the tolerance stored there, a regression gives exit code 1.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cJSON.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "mqtt_client.h"
+#include "driver/uart.h"
+#include "sdkconfig.h"
+
+#include "config_manager.h"
+#include "config_manager_defines.h"
+#include "infomanager.h"
+#include "mqtt_manager.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "evlog.h"
+#include "response_cache.h"
+#include "sdcard_logger.h"
+#include "history.h"
+#include "quantiles.h"
+#include "aqi.h"
+#include "alarm_manager.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
+#include "tscodec.h"
+#include "sensor_manager.h"
+#include "pm1006.h"
+#include "pm1006_sim.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t start_rest_server(const char *base_path);
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- allocation counting: C++ new/delete of the whole program and all cJSON nodes
+////////////////////////////////////////////////////////////////////////////////////////
+
+static std::atomic<uint64_t> s_allocs(0);
+
+void *operator new(size_t f_size)
+{
+    ++s_allocs;
+
+    void *l_ptr = malloc(f_size ? f_size : 1);
+    if (!l_ptr) throw std::bad_alloc();
+
+    return l_ptr;
+}
+
+void *operator new[](size_t f_size)
+{
+    return operator new(f_size);
+}
+
+void operator delete(void *f_ptr) noexcept
+{
+    free(f_ptr);
+}
+
+void operator delete[](void *f_ptr) noexcept
+{
+    free(f_ptr);
+}
+
+void operator delete(void *f_ptr, size_t) noexcept
+{
+    free(f_ptr);
+}
+
+void operator delete[](void *f_ptr, size_t) noexcept
+{
+    free(f_ptr);
+}
+
+static void *CountingMalloc(size_t f_size)
+{
+    ++s_allocs;
+    return malloc(f_size);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- results
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct BenchMetric
+{
+    std::string     m_name;
+    double          m_value;
+    const char     *m_unit;
+    bool            m_higher_better;
+    double          m_tolerance;        // allowed relative change before it is a regression
+    double          m_slack;            // changes below this absolute value never count
+};
+
+static std::vector<BenchMetric> s_metrics;
+
+// --- timing depends on the machine, counts do not
+
+#define TOL_TIME    0.5
+#define TOL_TAIL    1.0
+#define TOL_COUNT   0.1
+#define TOL_WAKEUP  0.25
+
+// --- samples per message of the batched MQTT uplink
+
+#define MQTT_BENCH_BATCH    10
+
+static void AddMetric(const std::string &f_name, double f_value, const char *f_unit, bool f_higher_better, double f_tolerance,
+                      double f_slack = 0.01)
+{
+    BenchMetric l_m;
+
+    l_m.m_name          = f_name;
+    l_m.m_value         = f_value;
+    l_m.m_unit          = f_unit;
+    l_m.m_higher_better = f_higher_better;
+    l_m.m_tolerance     = f_tolerance;
+    l_m.m_slack         = f_slack;
+
+    s_metrics.push_back(l_m);
+
+    fprintf(stderr, "  %-36s %14.2f %s\n", f_name.c_str(), f_value, f_unit);
+}
+
+static double Percentile(std::vector<double> f_values, double f_p)
+{
+    if (f_values.empty()) return 0.0;
+
+    std::sort(f_values.begin(), f_values.end());
+
+    size_t l_idx = (size_t)(f_p * (f_values.size() - 1) + 0.5);
+
+    return f_values[l_idx];
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double ElapsedUs(BenchClock::time_point f_start)
+{
+    return std::chrono::duration<double, std::micro>(BenchClock::now() - f_start).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- datagram decoding
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchDecode(bool f_quick)
+{
+    fprintf(stderr, "decode:\n");
+
+    // --- a long simulated stream with some errors, chunked like the UART delivers it
+
+    Pm1006SimConfig l_config;
+
+    l_config.m_seed                 = 7;
+    l_config.m_checksum_permille    = 5;
+    l_config.m_noise_permille       = 5;
+
+    CPm1006Simulator l_sim;
+    l_sim.Init(l_config);
+
+    uint32_t l_frames = f_quick ? 20000 : 200000;
+
+    std::vector<uint8_t> l_stream;
+    l_stream.reserve(l_frames * 24);
+
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at;
+
+    while (l_sim.GetFrames() < l_frames)
+    {
+        size_t l_len = l_sim.NextChunk(l_buf, sizeof(l_buf), &l_at);
+        l_stream.insert(l_stream.end(), l_buf, l_buf + l_len);
+    }
+
+    CPm1006Receiver l_receiver;
+    uint64_t l_allocs = s_allocs;
+    uint32_t l_sum = 0;
+
+    auto l_start = BenchClock::now();
+
+    for (uint8_t l_byte : l_stream)
+    {
+        if (l_receiver.process_rx(l_byte)) l_sum += l_receiver.GetPM25();
+    }
+
+    double l_us = ElapsedUs(l_start);
+
+    if (!l_sum) fprintf(stderr, "  no datagram decoded!\n");
+
+    AddMetric("decode.datagrams_per_s", l_receiver.GetFrameCount() / (l_us / 1e6), "1/s", true, TOL_TIME);
+    AddMetric("decode.mbytes_per_s", l_stream.size() / l_us, "MB/s", true, TOL_TIME);
+    AddMetric("decode.allocs_per_datagram", (double)(s_allocs - l_allocs) / l_receiver.GetFrameCount(), "allocs", false, TOL_COUNT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- idle wakeups
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- a firmware thread which blocks was woken up before, so the voluntary context switches
+// --- of the process while nothing happens are the wakeups of the firmware
+
+static void BenchIdle(bool f_quick)
+{
+    fprintf(stderr, "idle:\n");
+
+    int l_seconds = f_quick ? 6 : 20;
+
+    struct rusage l_before, l_after;
+
+    getrusage(RUSAGE_SELF, &l_before);
+    uint64_t l_active_before = g_Scheduler.GetActiveUs();
+
+    std::this_thread::sleep_for(std::chrono::seconds(l_seconds));
+
+    getrusage(RUSAGE_SELF, &l_after);
+    uint64_t l_active_after = g_Scheduler.GetActiveUs();
+
+    // --- minus the sleep of the benchmark itself
+
+    double l_wakeups = (double)(l_after.ru_nvcsw - l_before.ru_nvcsw - 1);
+
+    AddMetric("idle.wakeups_per_hour", l_wakeups * 3600.0 / l_seconds, "1/h", false, TOL_WAKEUP);
+
+    // --- the time the firmware tasks were awake, as counted by themselves
+
+    double l_duty = (double)(l_active_after - l_active_before) * 100.0 / (l_seconds * 1e6);
+
+    AddMetric("idle.duty_pct", l_duty, "%", false, TOL_WAKEUP, 0.05);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- UART to sensor value latency
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchUartLatency(bool f_quick)
+{
+    fprintf(stderr, "uart:\n");
+
+    std::vector<double> l_lat;
+    int l_samples = f_quick ? 3 : 8;
+
+    uart_port_t l_port = (uart_port_t)CONFIG_TEMP_SENSOR1_UART_PORT_NUM;
+    CVindriktning &l_sensor = g_SensorManager.GetSensor(0);
+
+    for (int i = 0; i < l_samples; ++i)
+    {
+        // --- a value never seen before, split like a real UART read
+
+        uint16_t l_pm25 = 500 + i;
+        uint8_t l_frame[PM1006_FRAME_LEN];
+
+        pm1006_encode(l_frame, l_pm25, 1, 2);
+
+        // --- do not always hit the same phase of the receive task
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(137 * (i + 1)));
+
+        auto l_start = BenchClock::now();
+
+        host_uart_inject(l_port, l_frame, 8);
+        host_uart_inject(l_port, l_frame + 8, PM1006_FRAME_LEN - 8);
+
+        while (l_sensor.GetPM2() != l_pm25)
+        {
+            if (ElapsedUs(l_start) > 10e6)
+            {
+                fprintf(stderr, "  datagram %d never arrived\n", i);
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+
+        l_lat.push_back(ElapsedUs(l_start) / 1000.0);
+    }
+
+    // --- below a millisecond it is thread scheduling of the host, not the firmware
+
+    AddMetric("uart.latency_p50_ms", Percentile(l_lat, 0.5), "ms", false, TOL_TIME, 1.0);
+    AddMetric("uart.latency_max_ms", Percentile(l_lat, 1.0), "ms", false, TOL_TAIL, 1.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- REST API
+////////////////////////////////////////////////////////////////////////////////////////
+
+class BenchHttpClient
+{
+public:
+
+    BenchHttpClient(int f_port) : m_port(f_port), m_fd(-1) {}
+    ~BenchHttpClient(void) { Close(); }
+
+    void Close(void)
+    {
+        if (m_fd >= 0) close(m_fd);
+
+        m_fd = -1;
+        m_buf.clear();
+    }
+
+    bool Request(const char *f_method, const char *f_uri, const std::string &f_body, int *f_status, size_t *f_resp_len)
+    {
+        if (m_fd < 0 && !Connect()) return false;
+
+        char l_hdr[512];
+        snprintf(l_hdr, sizeof(l_hdr), "%s %s HTTP/1.1\r\nHost: localhost\r\nContent-Length: %zu\r\n\r\n", f_method, f_uri, f_body.size());
+
+        std::string l_req = l_hdr + f_body;
+
+        if (send(m_fd, l_req.data(), l_req.size(), MSG_NOSIGNAL) != (ssize_t)l_req.size())
+        {
+            Close();
+            return false;
+        }
+
+        // --- response header
+
+        size_t l_end;
+
+        while ((l_end = m_buf.find("\r\n\r\n")) == std::string::npos)
+        {
+            if (!Fill()) return false;
+        }
+
+        std::string l_head = m_buf.substr(0, l_end);
+        m_buf.erase(0, l_end + 4);
+
+        *f_status = atoi(l_head.c_str() + 9);
+
+        bool l_chunked = strcasestr(l_head.c_str(), "Transfer-Encoding: chunked") != NULL;
+        bool l_close = strcasestr(l_head.c_str(), "Connection: close") != NULL;
+
+        const char *l_cl = strcasestr(l_head.c_str(), "Content-Length:");
+        size_t l_len = l_cl ? strtoul(l_cl + 15, NULL, 10) : 0;
+
+        *f_resp_len = 0;
+
+        if (l_chunked)
+        {
+            for (;;)
+            {
+                while ((l_end = m_buf.find("\r\n")) == std::string::npos)
+                {
+                    if (!Fill()) return false;
+                }
+
+                size_t l_chunk = strtoul(m_buf.c_str(), NULL, 16);
+                m_buf.erase(0, l_end + 2);
+
+                while (m_buf.size() < l_chunk + 2)
+                {
+                    if (!Fill()) return false;
+                }
+
+                m_buf.erase(0, l_chunk + 2);
+                *f_resp_len += l_chunk;
+
+                if (!l_chunk) break;
+            }
+        }
+        else
+        {
+            while (m_buf.size() < l_len)
+            {
+                if (!Fill()) return false;
+            }
+
+            m_buf.erase(0, l_len);
+            *f_resp_len = l_len;
+        }
+
+        if (l_close) Close();
+
+        return true;
+    }
+
+private:
+
+    bool Connect(void)
+    {
+        m_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        struct sockaddr_in l_addr;
+        memset(&l_addr, 0, sizeof(l_addr));
+
+        l_addr.sin_family       = AF_INET;
+        l_addr.sin_port         = htons(m_port);
+        l_addr.sin_addr.s_addr  = htonl(INADDR_LOOPBACK);
+
+        if (connect(m_fd, (struct sockaddr *)&l_addr, sizeof(l_addr)) < 0)
+        {
+            Close();
+            return false;
+        }
+
+        int l_one = 1;
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &l_one, sizeof(l_one));
+
+        return true;
+    }
+
+    bool Fill(void)
+    {
+        char l_buf[4096];
+        ssize_t l_len = recv(m_fd, l_buf, sizeof(l_buf), 0);
+
+        if (l_len <= 0)
+        {
+            Close();
+            return false;
+        }
+
+        m_buf.append(l_buf, l_len);
+
+        return true;
+    }
+
+    int         m_port;
+    int         m_fd;
+    std::string m_buf;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchEndpoint(BenchHttpClient &f_client, const char *f_name, const char *f_method, const char *f_uri, 
+                          const std::vector<std::string> &f_bodies, int f_requests)
+{
+    std::vector<double> l_lat;
+    l_lat.reserve(f_requests);
+
+    int l_failed = 0;
+    size_t l_resp_bytes = 0;
+
+    uint64_t l_allocs = s_allocs;
+    auto l_total = BenchClock::now();
+
+    for (int i = 0; i < f_requests; ++i)
+    {
+        int l_status = 0;
+        size_t l_len = 0;
+
+        auto l_start = BenchClock::now();
+
+        if (!f_client.Request(f_method, f_uri, f_bodies.empty() ? std::string() : f_bodies[i % f_bodies.size()], &l_status, &l_len) || l_status != 200)
+        {
+            ++l_failed;
+        }
+
+        l_lat.push_back(ElapsedUs(l_start));
+        l_resp_bytes += l_len;
+    }
+
+    double l_us = ElapsedUs(l_total);
+
+    if (l_failed) fprintf(stderr, "  %s: %d of %d requests failed\n", f_name, l_failed, f_requests);
+
+    std::string l_prefix = std::string("rest.") + f_name;
+
+    AddMetric(l_prefix + ".req_per_s", f_requests / (l_us / 1e6), "1/s", true, TOL_TIME);
+    AddMetric(l_prefix + ".p50_us", Percentile(l_lat, 0.5), "us", false, TOL_TIME);
+    AddMetric(l_prefix + ".p99_us", Percentile(l_lat, 0.99), "us", false, TOL_TAIL);
+    AddMetric(l_prefix + ".allocs_per_req", (double)(s_allocs - l_allocs) / f_requests, "allocs", false, TOL_COUNT);
+    AddMetric(l_prefix + ".resp_bytes", (double)l_resp_bytes / f_requests, "bytes", false, TOL_COUNT);
+}
+
+static void BenchRest(int f_port, bool f_quick)
+{
+    fprintf(stderr, "rest:\n");
+
+    BenchHttpClient l_client(f_port);
+
+    int l_get = f_quick ? 300 : 3000;
+    int l_patch = f_quick ? 50 : 300;
+
+    std::vector<std::string> l_none;
+    std::vector<std::string> l_patches;
+
+    l_patches.push_back("{\"mqtt_time\":60}");
+    l_patches.push_back("{\"mqtt_time\":61}");
+
+    BenchEndpoint(l_client, "config_get", "GET", "/api/v1/config", l_none, l_get);
+    BenchEndpoint(l_client, "air_get", "GET", "/api/v1/air/1", l_none, l_get);
+    BenchEndpoint(l_client, "sensorcnt_get", "GET", "/api/v1/sensorcnt", l_none, l_get);
+    BenchEndpoint(l_client, "config_patch", "PATCH", "/api/v1/config", l_patches, l_patch);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- MQTT
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- takes one sample on the scheduler task, where the firmware handles the client events too
+
+static std::atomic<uint32_t> s_mqtt_samples(0);
+
+static uint32_t prvMqttSampleJob(void *f_ctx)
+{
+    g_MqttManager.ProcessCallback();
+    ++s_mqtt_samples;
+
+    return SCHED_STOP;
+}
+
+// --- the MQTT manager takes a new config over on the scheduler task, wait for it
+
+static void prvCommitMqtt(const ConfigTransaction &f_txn)
+{
+    g_ConfigManager.Commit(f_txn);
+
+    bool l_enabled = g_ConfigManager.GetIntValue(CFMGR_MQTT_ENABLE) == 1;
+    int l_batch = g_ConfigManager.GetIntValue(CFMGR_MQTT_BATCH);
+
+    auto l_wait = BenchClock::now();
+
+    while (g_MqttManager.IsEnabled() != l_enabled || g_MqttManager.GetBatch() != l_batch)
+    {
+        if (ElapsedUs(l_wait) > 5e6)
+        {
+            fprintf(stderr, "  mqtt config never applied\n");
+            break;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+static void BenchMqtt(bool f_quick)
+{
+    fprintf(stderr, "mqtt:\n");
+
+    // --- every callback publishes, the interval only matters to the scheduler
+
+    ConfigTransaction l_txn;
+
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 1);
+    l_txn.SetIntValue(CFMGR_MQTT_TIME, 5);
+
+    prvCommitMqtt(l_txn);
+
+    int l_rounds = f_quick ? 2000 : 20000;
+
+    host_mqtt_stats_t l_before, l_after;
+    host_mqtt_get_stats(&l_before);
+
+    uint64_t l_allocs = s_allocs;
+    auto l_start = BenchClock::now();
+
+    for (int i = 0; i < l_rounds; ++i) g_MqttManager.ProcessCallback();
+
+    double l_us = ElapsedUs(l_start);
+
+    host_mqtt_get_stats(&l_after);
+
+    uint32_t l_pubs = l_after.publishes - l_before.publishes;
+
+    if (!l_pubs)
+    {
+        fprintf(stderr, "  nothing published!\n");
+        return;
+    }
+
+    // --- every publish carries one sample of one sensor
+
+    AddMetric("mqtt.publish_per_s", l_pubs / (l_us / 1e6), "1/s", true, TOL_TIME);
+    AddMetric("mqtt.bytes_per_sample", (double)(l_after.bytes - l_before.bytes) / l_pubs, "bytes", false, TOL_COUNT);
+    AddMetric("mqtt.allocs_per_sample", (double)(s_allocs - l_allocs) / l_pubs, "allocs", false, TOL_COUNT);
+    AddMetric("mqtt.connects", l_after.connects, "connects", false, TOL_COUNT);
+
+    // --- batched uplink: one message per MQTT_BENCH_BATCH samples and a connect for each.
+    // --- Connect and acknowledge are handled by the scheduler task, so wait for them
+
+    l_txn = ConfigTransaction();
+    l_txn.SetIntValue(CFMGR_MQTT_BATCH, MQTT_BENCH_BATCH);
+    prvCommitMqtt(l_txn);
+
+    int l_samples = f_quick ? 20 * MQTT_BENCH_BATCH : 200 * MQTT_BENCH_BATCH;
+    int l_job = g_Scheduler.AddJob("bench_mqtt", prvMqttSampleJob, NULL, SCHED_STOP);
+
+    host_mqtt_get_stats(&l_before);
+    MqttStats l_stats_before = g_MqttManager.GetStats();
+
+    for (int i = 0; i < l_samples; ++i)
+    {
+        uint32_t l_done = s_mqtt_samples + 1;
+
+        g_Scheduler.SetJobDelay(l_job, 0);
+
+        // --- the sample, and after every full batch connect, publish, acknowledge and disconnect
+
+        auto l_wait = BenchClock::now();
+
+        while (s_mqtt_samples < l_done || g_MqttManager.GetPendingSamples() >= MQTT_BENCH_BATCH || g_MqttManager.IsConnected())
+        {
+            if (ElapsedUs(l_wait) > 5e6)
+            {
+                fprintf(stderr, "  batch never acknowledged\n");
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    host_mqtt_get_stats(&l_after);
+    MqttStats l_stats_after = g_MqttManager.GetStats();
+
+    uint32_t l_sent = l_stats_after.m_samples - l_stats_before.m_samples;
+
+    if (!l_sent)
+    {
+        fprintf(stderr, "  no batch published!\n");
+    }
+    else
+    {
+        AddMetric("mqtt.batch.bytes_per_sample", (double)(l_after.bytes - l_before.bytes) / l_sent, "bytes", false, TOL_COUNT);
+        AddMetric("mqtt.batch.connects_per_100", (double)(l_after.connects - l_before.connects) * 100.0 / l_sent, "connects", false, TOL_COUNT);
+    }
+
+    l_txn = ConfigTransaction();
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 0);
+    l_txn.SetIntValue(CFMGR_MQTT_BATCH, 1);
+    prvCommitMqtt(l_txn);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- event log
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- cost of a binary record against formatting the same line as text, which is what
+// --- ESP_LOGI does before it even reaches the UART
+
+static void BenchEvlog(bool f_quick)
+{
+    fprintf(stderr, "evlog:\n");
+
+    int l_rounds = f_quick ? 200000 : 2000000;
+
+    uint64_t l_allocs = s_allocs;
+    auto l_start = BenchClock::now();
+
+    for (int i = 0; i < l_rounds; ++i) g_EventLog.Add(EvlogId_SensorDatagram, 0, i & 0x3ff, i & 0xff, i & 0x7ff);
+
+    double l_add_us = ElapsedUs(l_start);
+    uint64_t l_add_allocs = s_allocs - l_allocs;
+
+    EvlogRecord l_rec = { 0, EvlogId_SensorDatagram, 4, 0 };
+    uint32_t l_args[4] = { 0 };
+    char l_line[128];
+    uint32_t l_sum = 0;
+
+    l_start = BenchClock::now();
+
+    for (int i = 0; i < l_rounds; ++i)
+    {
+        l_rec.m_time_ms = i;
+        l_args[1] = i & 0x3ff;
+        l_args[2] = i & 0xff;
+        l_args[3] = i & 0x7ff;
+
+        l_sum += EventLog::Format(l_line, sizeof(l_line), l_rec, l_args);
+    }
+
+    double l_text_us = ElapsedUs(l_start);
+
+    if (!l_sum) fprintf(stderr, "  nothing formatted!\n");
+
+    AddMetric("evlog.add_ns", l_add_us * 1000.0 / l_rounds, "ns", false, TOL_TIME);
+    AddMetric("evlog.text_ns", l_text_us * 1000.0 / l_rounds, "ns", false, TOL_TIME);
+    AddMetric("evlog.allocs_per_event", (double)l_add_allocs / l_rounds, "allocs", false, TOL_COUNT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- SD card logger
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the card is a temporary directory (a loop-mounted FAT image works the same). The
+// --- datagrams carry time stamps a few seconds apart, so the run spans several days
+// --- and has to rotate the file at every midnight
+
+#define SDLOG_BENCH_START       1767225600      // --- 2026-01-01 00:00:00 UTC
+#define SDLOG_BENCH_STEP_S      5
+#define SDLOG_BENCH_DAY_S       86400
+
+static void BenchSdLog(bool f_quick)
+{
+    fprintf(stderr, "sdlog:\n");
+
+    char l_dir[] = "/tmp/dustbench-sd-XXXXXX";
+
+    if (!mkdtemp(l_dir) || g_SdLogger.InitManager(l_dir) != ESP_OK)
+    {
+        fprintf(stderr, "  no SD card directory\n");
+        return;
+    }
+
+    uint32_t l_records = f_quick ? 60000 : 600000;
+
+    SdLogRecord l_rec;
+    memset(&l_rec, 0, sizeof(l_rec));
+
+    auto l_start = BenchClock::now();
+
+    for (uint32_t i = 0; i < l_records; ++i)
+    {
+        l_rec.m_time_s  = SDLOG_BENCH_START + (i / CONFIG_TEMP_SENSOR_CNT) * SDLOG_BENCH_STEP_S;
+        l_rec.m_time_ms = (i * 7) % 1000;
+        l_rec.m_sensor  = i % CONFIG_TEMP_SENSOR_CNT;
+        l_rec.m_pm1     = i & 0x1ff;
+        l_rec.m_pm2     = i & 0x3ff;
+        l_rec.m_pm10    = i & 0x7ff;
+
+        g_SdLogger.Push(l_rec, portMAX_DELAY);
+    }
+
+    if (g_SdLogger.Sync(pdMS_TO_TICKS(10000)) != ESP_OK) fprintf(stderr, "  sync timed out\n");
+
+    double l_us = ElapsedUs(l_start);
+
+    SdLogStats l_stats = g_SdLogger.GetStats();
+
+    uint32_t l_days = (l_rec.m_time_s - SDLOG_BENCH_START) / SDLOG_BENCH_DAY_S + 1;
+
+    if (l_stats.m_records != l_records || l_stats.m_files != l_days || l_stats.m_errors)
+    {
+        fprintf(stderr, "  %u of %u lines in %u files for %u days, %u errors\n",
+                l_stats.m_records, l_records, l_stats.m_files, l_days, l_stats.m_errors);
+    }
+
+    AddMetric("sdlog.records_per_s", l_records / (l_us / 1e6), "1/s", true, TOL_TIME);
+    AddMetric("sdlog.bytes_per_record", (double)l_stats.m_bytes / l_records, "bytes", false, TOL_COUNT);
+    AddMetric("sdlog.full_block_pct", 100.0 * (l_stats.m_writes - l_stats.m_partial) / l_stats.m_writes, "%", true, TOL_COUNT);
+    AddMetric("sdlog.files_per_day", (double)l_stats.m_files / l_days, "files", false, TOL_COUNT);
+
+    // --- what a datagram costs the receive task, the writer drops what does not fit
+
+    int l_logs = f_quick ? 100000 : 1000000;
+
+    l_start = BenchClock::now();
+
+    for (int i = 0; i < l_logs; ++i) g_SdLogger.Log(i % CONFIG_TEMP_SENSOR_CNT, 1, 2, 3);
+
+    AddMetric("sdlog.log_ns", ElapsedUs(l_start) * 1000.0 / l_logs, "ns", false, TOL_TIME);
+
+    g_SdLogger.Sync(pdMS_TO_TICKS(10000));
+
+    std::filesystem::remove_all(l_dir);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- sample compression
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the datagrams of a capture (--capture) or of the simulator as time series, encoded
+// --- in history blocks. Uncompressed a sample takes TSC_RAW_SAMPLE bytes: a 32 bit time
+// --- stamp in seconds and three 16 bit values
+
+#define TSC_RAW_SAMPLE          10
+#define TSC_BENCH_EPOCH_MS      1767225600000LL
+
+// --- the datagrams of the capture or of the simulator, false if there are none
+
+static bool LoadSamples(bool f_quick, const char *f_capture, std::vector<TsSample> &f_samples)
+{
+    CPm1006Simulator l_sim;
+    CPm1006Replay l_replay;
+    CPm1006Source *l_source = &l_sim;
+
+    if (f_capture)
+    {
+        if (!l_replay.Open(f_capture))
+        {
+            fprintf(stderr, "  cannot open %s\n", f_capture);
+            return false;
+        }
+
+        l_source = &l_replay;
+    }
+    else
+    {
+        Pm1006SimConfig l_config;
+        l_config.m_seed = 11;
+        l_sim.Init(l_config);
+    }
+
+    size_t l_max = f_quick ? 50000 : 500000;
+
+    f_samples.clear();
+    f_samples.reserve(l_max);
+
+    CPm1006Receiver l_receiver;
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at;
+    size_t l_len;
+
+    while (f_samples.size() < l_max && (l_len = l_source->NextChunk(l_buf, sizeof(l_buf), &l_at)) > 0)
+    {
+        for (size_t i = 0; i < l_len; ++i)
+        {
+            if (!l_receiver.process_rx(l_buf[i])) continue;
+
+            TsSample l_sample;
+
+            l_sample.m_time_ms  = TSC_BENCH_EPOCH_MS + l_at;
+            l_sample.m_val[0]   = l_receiver.GetPM1();
+            l_sample.m_val[1]   = l_receiver.GetPM25();
+            l_sample.m_val[2]   = l_receiver.GetPM10();
+
+            f_samples.push_back(l_sample);
+        }
+    }
+
+    if (f_samples.empty())
+    {
+        fprintf(stderr, "  no datagrams\n");
+        return false;
+    }
+
+    fprintf(stderr, "  %zu datagrams from %s\n", f_samples.size(), f_capture ? f_capture : "the simulator");
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchTsCodec(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "tscodec:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- encode a few rounds for a stable time
+
+    int l_rounds = f_quick ? 5 : 20;
+
+    std::vector<uint8_t> l_blocks((l_samples.size() / 8 + 1) * TSC_BLOCK_SIZE);
+    std::vector<uint16_t> l_lens;
+    TsBlockEncoder l_enc;
+
+    auto l_start = BenchClock::now();
+
+    for (int r = 0; r < l_rounds; ++r)
+    {
+        l_lens.clear();
+        l_enc.Begin(&l_blocks[0], TSC_BLOCK_SIZE);
+
+        for (const TsSample &l_sample : l_samples)
+        {
+            if (l_enc.Add(l_sample)) continue;
+
+            l_lens.push_back(l_enc.GetSize());
+            l_enc.Begin(&l_blocks[l_lens.size() * TSC_BLOCK_SIZE], TSC_BLOCK_SIZE);
+            l_enc.Add(l_sample);
+        }
+
+        l_lens.push_back(l_enc.GetSize());
+    }
+
+    double l_enc_us = ElapsedUs(l_start) / l_rounds;
+
+    // --- every block on its own, compared to the input
+
+    size_t l_bytes = 0;
+    size_t l_errors = 0;
+
+    l_start = BenchClock::now();
+
+    for (int r = 0; r < l_rounds; ++r)
+    {
+        size_t l_idx = 0;
+
+        l_bytes = 0;
+
+        for (size_t b = 0; b < l_lens.size(); ++b)
+        {
+            TsBlockDecoder l_dec;
+            TsSample l_sample;
+
+            l_dec.Begin(&l_blocks[b * TSC_BLOCK_SIZE], l_lens[b]);
+
+            while (l_dec.Next(&l_sample))
+            {
+                const TsSample &l_orig = l_samples[l_idx++];
+
+                if (l_sample.m_time_ms != l_orig.m_time_ms || memcmp(l_sample.m_val, l_orig.m_val, sizeof(l_sample.m_val))) ++l_errors;
+            }
+
+            l_bytes += l_lens[b];
+        }
+
+        if (l_idx != l_samples.size()) ++l_errors;
+    }
+
+    double l_dec_us = ElapsedUs(l_start) / l_rounds;
+
+    if (l_errors) fprintf(stderr, "  %zu samples decoded wrong\n", l_errors);
+
+    double l_raw = (double)l_samples.size() * TSC_RAW_SAMPLE;
+
+    AddMetric("tscodec.ratio", l_raw / l_bytes, "x", true, TOL_COUNT);
+    AddMetric("tscodec.bytes_per_sample", (double)l_bytes / l_samples.size(), "bytes", false, TOL_COUNT);
+    AddMetric("tscodec.encode_mb_per_s", l_raw / l_enc_us, "MB/s", true, TOL_TIME);
+    AddMetric("tscodec.decode_mb_per_s", l_raw / l_dec_us, "MB/s", true, TOL_TIME);
+
+    // --- the history of the last sensor filled up and downsampled for a 600 px chart,
+    // --- the peak has to survive
+
+    int l_sensor = CONFIG_TEMP_SENSOR_CNT - 1;
+    uint16_t l_peak = 0;
+
+    g_History.InitManager();
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        g_History.Add(l_sensor, l_sample);
+    }
+
+    uint8_t l_cursor_buf[2 * TSC_BLOCK_SIZE];
+    HistoryCursor l_cursor;
+    TsSample l_sample;
+
+    l_cursor.Begin(l_sensor, 0, INT64_MAX, l_cursor_buf);
+
+    while (l_cursor.Next(&l_sample))
+    {
+        if (l_sample.m_val[1] > l_peak) l_peak = l_sample.m_val[1];
+    }
+
+    HistoryDownsampler l_sampler;
+    uint32_t l_points = 0;
+    uint16_t l_kept = 0;
+
+    l_rounds = f_quick ? 20 : 100;
+    l_start = BenchClock::now();
+
+    for (int r = 0; r < l_rounds; ++r)
+    {
+        l_points = 0;
+        l_kept = 0;
+
+        l_sampler.Begin(l_sensor, 0, 600, l_cursor_buf);
+
+        while (l_sampler.Next(&l_sample))
+        {
+            if (l_sample.m_val[1] > l_kept) l_kept = l_sample.m_val[1];
+            ++l_points;
+        }
+    }
+
+    double l_lttb_us = ElapsedUs(l_start) / l_rounds;
+
+    fprintf(stderr, "  %u samples in the history, %u points\n", l_sampler.GetCount(), l_points);
+
+    AddMetric("history.lttb_us", l_lttb_us, "us", false, TOL_TIME);
+    AddMetric("history.lttb_points", l_points, "points", false, TOL_COUNT);
+    AddMetric("history.lttb_peak_pct", l_peak ? 100.0 * l_kept / l_peak : 100.0, "%", true, TOL_COUNT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- quantiles: the P² estimate of every complete hour of the replayed datagrams
+// --- compared to the exact quantile of its PM2.5 values
+////////////////////////////////////////////////////////////////////////////////////////
+
+static double ExactQuantile(std::vector<uint16_t> &f_values, double f_p)
+{
+    std::sort(f_values.begin(), f_values.end());
+
+    double l_rank = f_p * (f_values.size() - 1);
+    size_t l_lo = (size_t)l_rank;
+    size_t l_hi = std::min(l_lo + 1, f_values.size() - 1);
+
+    return f_values[l_lo] + (l_rank - l_lo) * (f_values[l_hi] - f_values[l_lo]);
+}
+
+static void BenchQuantiles(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "quantiles:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- the last sensor, the default config
+
+    int l_sensor = CONFIG_TEMP_SENSOR_CNT - 1;
+
+    g_Quantiles.UpdateConfig();
+
+    int l_cnt = g_Quantiles.GetQuantileCnt();
+
+    std::vector<uint16_t> l_hour;
+    std::vector<double> l_err(l_cnt, 0.0);
+    std::vector<double> l_err_max(l_cnt, 0.0);
+    int64_t l_start = -1;
+    int l_hours = 0;
+    int l_miscounted = 0;
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        int64_t l_hour_start = l_sample.m_time_ms - l_sample.m_time_ms % (3600LL * 1000);
+        bool l_ended = l_start >= 0 && l_hour_start != l_start;
+
+        g_Quantiles.Add(l_sensor, l_sample.m_time_ms, l_sample.m_val[1]);
+
+        if (l_ended)
+        {
+            QuantileState l_last = {};
+
+            if (!g_Quantiles.GetLast(l_sensor, QWindow_Hour, &l_last) || l_last.m_count != l_hour.size()) ++l_miscounted;
+
+            for (int q = 0; q < l_cnt; ++q)
+            {
+                double l_exact = ExactQuantile(l_hour, g_Quantiles.GetQuantile(q) / 100.0);
+                double l_rel = fabs(l_last.m_value[q] - l_exact) / std::max(l_exact, 1.0) * 100.0;
+
+                l_err[q] += l_rel;
+                l_err_max[q] = std::max(l_err_max[q], l_rel);
+            }
+
+            l_hour.clear();
+            ++l_hours;
+        }
+
+        l_start = l_hour_start;
+        l_hour.push_back(l_sample.m_val[1]);
+    }
+
+    if (!l_hours)
+    {
+        fprintf(stderr, "  less than an hour of datagrams\n");
+        return;
+    }
+
+    fprintf(stderr, "  %d complete hours\n", l_hours);
+
+    if (l_miscounted) fprintf(stderr, "  %d hours with a wrong sample count\n", l_miscounted);
+
+    // --- the cost per datagram, all windows and quantiles
+
+    g_Quantiles.UpdateConfig();
+
+    auto l_begin = BenchClock::now();
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        g_Quantiles.Add(l_sensor, l_sample.m_time_ms, l_sample.m_val[1]);
+    }
+
+    double l_add_us = ElapsedUs(l_begin);
+
+    g_Quantiles.UpdateConfig();
+
+    for (int q = 0; q < l_cnt; ++q)
+    {
+        char l_name[48];
+
+        snprintf(l_name, sizeof(l_name), "quantile.p%g_err_pct", g_Quantiles.GetQuantile(q));
+        AddMetric(l_name, l_err[q] / l_hours, "%", false, TOL_TAIL);
+
+        snprintf(l_name, sizeof(l_name), "quantile.p%g_err_max_pct", g_Quantiles.GetQuantile(q));
+        AddMetric(l_name, l_err_max[q], "%", false, TOL_TAIL);
+    }
+
+    AddMetric("quantile.add_ns", l_add_us * 1000.0 / l_samples.size(), "ns", false, TOL_TIME);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- air quality indices: every hour of the replayed datagrams the indices of the
+// --- bucketed windows compared to the ones of the exact rolling means
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchAqi(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "aqi:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- the last sensor, on a clock starting at 0 like the uptime
+
+    int l_sensor = CONFIG_TEMP_SENSOR_CNT - 1;
+    int64_t l_t0 = l_samples[0].m_time_ms;
+    int64_t l_span[2] = { 3600LL * 1000, 86400LL * 1000 };
+
+    g_Aqi.Reset();
+
+    // --- prefix sums of PM2.5 and PM10 for the exact means
+
+    std::vector<uint64_t> l_prefix[AqiPollutant_Cnt];
+
+    for (int p = 0; p < AqiPollutant_Cnt; ++p)
+    {
+        l_prefix[p].resize(l_samples.size() + 1, 0);
+
+        for (size_t i = 0; i < l_samples.size(); ++i) l_prefix[p][i + 1] = l_prefix[p][i] + l_samples[i].m_val[p == AqiPollutant_PM2 ? 1 : 2];
+    }
+
+    size_t l_first[2] = { 0, 0 };
+    int64_t l_next_check = 3600LL * 1000;
+    double l_err[AqiScale_Cnt] = { 0.0, 0.0 };
+    int l_checks = 0;
+    int l_category_diff = 0;
+
+    for (size_t i = 0; i < l_samples.size(); ++i)
+    {
+        int64_t l_time = l_samples[i].m_time_ms - l_t0;
+
+        g_Aqi.Add(l_sensor, l_time, l_samples[i].m_val[1], l_samples[i].m_val[2]);
+
+        if (l_time < l_next_check) continue;
+
+        l_next_check += 3600LL * 1000;
+
+        // --- the exact means of the last hour and day, up to this datagram
+
+        float l_exact[2][AqiPollutant_Cnt];
+
+        for (int w = 0; w < 2; ++w)
+        {
+            while (l_samples[l_first[w]].m_time_ms - l_t0 <= l_time - l_span[w]) ++l_first[w];
+
+            for (int p = 0; p < AqiPollutant_Cnt; ++p)
+            {
+                l_exact[w][p] = (float)(l_prefix[p][i + 1] - l_prefix[p][l_first[w]]) / (i + 1 - l_first[w]);
+            }
+        }
+
+        AqiResult l_result;
+
+        if (!g_Aqi.GetResult(l_sensor, l_time, &l_result)) continue;
+
+        AqiIndex l_epa  = AqiEngine::Calculate(AqiScale_EPA, l_exact[1]);
+        AqiIndex l_caqi = AqiEngine::Calculate(AqiScale_CAQI, l_exact[0]);
+
+        l_err[AqiScale_EPA]  += abs(l_result.m_index[AqiScale_EPA].m_value - l_epa.m_value);
+        l_err[AqiScale_CAQI] += abs(l_result.m_index[AqiScale_CAQI].m_value - l_caqi.m_value);
+
+        if (l_result.m_index[AqiScale_EPA].m_category != l_epa.m_category) ++l_category_diff;
+        if (l_result.m_index[AqiScale_CAQI].m_category != l_caqi.m_category) ++l_category_diff;
+
+        ++l_checks;
+    }
+
+    if (!l_checks)
+    {
+        fprintf(stderr, "  less than an hour of datagrams\n");
+        return;
+    }
+
+    fprintf(stderr, "  %d hourly checks, %d categories differ\n", l_checks, l_category_diff);
+
+    // --- the cost per datagram, both windows
+
+    g_Aqi.Reset();
+
+    auto l_begin = BenchClock::now();
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        g_Aqi.Add(l_sensor, l_sample.m_time_ms - l_t0, l_sample.m_val[1], l_sample.m_val[2]);
+    }
+
+    double l_add_us = ElapsedUs(l_begin);
+
+    g_Aqi.Reset();
+
+    AddMetric("aqi.epa_err", l_err[AqiScale_EPA] / l_checks, "points", false, TOL_TAIL);
+    AddMetric("aqi.caqi_err", l_err[AqiScale_CAQI] / l_checks, "points", false, TOL_TAIL);
+    AddMetric("aqi.add_ns", l_add_us * 1000.0 / l_samples.size(), "ns", false, TOL_TIME);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- sensor health: the replayed datagrams must never look stale, a sensor which stops
+// --- must be stale after a few intervals, and broken frames and frozen values are seen
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchHealth(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "health:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    int64_t l_t0 = l_samples[0].m_time_ms;
+
+    SensorHealth l_health;
+    l_health.Init(0);
+
+    // --- the state just before every datagram: stale there means the cadence was wrong
+
+    uint32_t l_false_stale = 0;
+
+    for (size_t i = 0; i < l_samples.size(); ++i)
+    {
+        const TsSample &l_sample = l_samples[i];
+        int64_t l_time_us = (l_sample.m_time_ms - l_t0) * 1000 + 1;
+
+        if (i && l_health.GetInfo(l_time_us - 1).m_state != SensorState_Ok) ++l_false_stale;
+
+        l_health.OnDatagram(l_time_us, l_sample.m_val[0], l_sample.m_val[1], l_sample.m_val[2]);
+    }
+
+    // --- the sensor stops: seconds until it is reported stale
+
+    int64_t l_last_us = (l_samples.back().m_time_ms - l_t0) * 1000 + 1;
+    int l_stale_s = 0;
+
+    while (l_stale_s < 3600 && l_health.GetInfo(l_last_us + (int64_t)l_stale_s * 1000000).m_state != SensorState_Stale) ++l_stale_s;
+
+    fprintf(stderr, "  cadence %u ms\n", l_health.GetInfo(l_last_us).m_cadence_ms);
+
+    // --- the values freeze, a datagram every 30 s for HEALTH_STUCK_CNT * 30 s
+
+    int64_t l_freeze_us = l_last_us;
+
+    for (int i = 0; i <= HEALTH_STUCK_CNT; ++i)
+    {
+        l_freeze_us += 30000000;
+        l_health.OnDatagram(l_freeze_us, 7, 9, 11);
+    }
+
+    bool l_stuck = l_health.GetInfo(l_freeze_us).m_state == SensorState_Stuck;
+
+    // --- the cost per datagram
+
+    l_health.Init(0);
+
+    auto l_begin = BenchClock::now();
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        l_health.OnDatagram((l_sample.m_time_ms - l_t0) * 1000 + 1, l_sample.m_val[0], l_sample.m_val[1], l_sample.m_val[2]);
+    }
+
+    double l_datagram_us = ElapsedUs(l_begin);
+
+    // --- one datagram in five broken: how often it is flagged
+
+    Pm1006SimConfig l_config;
+    l_config.m_seed                 = 11;
+    l_config.m_checksum_permille    = 200;
+
+    CPm1006Simulator l_sim;
+    l_sim.Init(l_config);
+
+    CPm1006Receiver l_receiver;
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at;
+    size_t l_len;
+    uint32_t l_valid = 0, l_checks = 0, l_flagged = 0;
+
+    l_health.Init(0);
+
+    while (l_valid < 2000 && (l_len = l_sim.NextChunk(l_buf, sizeof(l_buf), &l_at)) > 0)
+    {
+        for (size_t i = 0; i < l_len; ++i)
+        {
+            if (!l_receiver.process_rx(l_buf[i])) continue;
+
+            l_health.OnDatagram((int64_t)l_at * 1000 + 1, l_receiver.GetPM1(), l_receiver.GetPM25(), l_receiver.GetPM10());
+            ++l_valid;
+        }
+
+        l_health.OnErrors(l_receiver.GetChecksumErrors() + l_receiver.GetLengthErrors());
+
+        // --- the first 100 datagrams fill the average
+
+        if (l_valid <= 100) continue;
+
+        ++l_checks;
+        if (l_health.GetInfo((int64_t)l_at * 1000 + 1).m_state == SensorState_Errors) ++l_flagged;
+    }
+
+    AddMetric("health.false_stale", l_false_stale, "datagrams", false, TOL_COUNT, 1.0);
+    AddMetric("health.stale_after_s", l_stale_s, "s", false, TOL_COUNT);
+    AddMetric("health.stuck_detected", l_stuck ? 1 : 0, "bool", true, TOL_COUNT);
+    AddMetric("health.errors_flagged_pct", l_checks ? l_flagged * 100.0 / l_checks : 0, "%", true, TOL_COUNT);
+    AddMetric("health.datagram_ns", l_datagram_us * 1000.0 / l_samples.size(), "ns", false, TOL_TIME);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- alarms: the cost of the rules per datagram, and the time from a datagram on the
+// --- UART to the acknowledge of its alert by the broker
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void BenchAlarm(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "alarm:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- a full set of rules which never fire, so every datagram runs all of them
+
+    AlarmRule l_rules[ALARM_MAX_RULES];
+    memset(l_rules, 0, sizeof(l_rules));
+
+    for (int r = 0; r < ALARM_MAX_RULES; ++r)
+    {
+        l_rules[r].m_value      = r % 3;
+        l_rules[r].m_type       = r & 1 ? AlarmType_Rise : AlarmType_Above;
+        l_rules[r].m_threshold  = 1000;
+        l_rules[r].m_clear      = 1000;
+        l_rules[r].m_hold_s     = 60;
+    }
+
+    g_AlarmManager.SetRules(l_rules, ALARM_MAX_RULES);
+
+    int l_sensor = CONFIG_TEMP_SENSOR_CNT - 1;
+
+    auto l_begin = BenchClock::now();
+
+    for (const TsSample &l_sample : l_samples)
+    {
+        g_AlarmManager.Evaluate(l_sensor, l_sample.m_time_ms * 1000, l_sample.m_val[0], l_sample.m_val[1], l_sample.m_val[2]);
+    }
+
+    AddMetric("alarm.evaluate_ns", ElapsedUs(l_begin) * 1000.0 / l_samples.size(), "ns", false, TOL_TIME);
+
+    // --- one rule with hysteresis, every datagram alternately raises and clears it. In
+    // --- batch mode every alert connects the client, which disconnects after the PUBACK
+
+    memset(l_rules, 0, sizeof(l_rules));
+
+    l_rules[0].m_sensor     = 1;
+    l_rules[0].m_value      = 1;
+    l_rules[0].m_threshold  = 300;
+    l_rules[0].m_clear      = 200;
+
+    g_AlarmManager.SetRules(l_rules, 1);
+
+    ConfigTransaction l_txn;
+
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 1);
+    l_txn.SetIntValue(CFMGR_MQTT_BATCH, MQTT_BENCH_BATCH);
+
+    prvCommitMqtt(l_txn);
+
+    uart_port_t l_port = (uart_port_t)CONFIG_TEMP_SENSOR1_UART_PORT_NUM;
+    int l_alerts = f_quick ? 20 : 200;
+
+    host_mqtt_stats_t l_before, l_after;
+    host_mqtt_get_stats(&l_before);
+
+    AlarmStats l_stats = g_AlarmManager.GetStats();
+    uint32_t l_sent = l_stats.m_alerts;
+
+    for (int i = 0; i < l_alerts; ++i)
+    {
+        uint8_t l_frame[PM1006_FRAME_LEN];
+
+        pm1006_encode(l_frame, i & 1 ? 100 : 400, 1, 2);
+        host_uart_inject(l_port, l_frame, PM1006_FRAME_LEN);
+
+        // --- acknowledged, and the client is down again
+
+        auto l_wait = BenchClock::now();
+
+        while (g_AlarmManager.GetStats().m_alerts < l_sent + i + 1 || g_MqttManager.IsConnected())
+        {
+            if (ElapsedUs(l_wait) > 5e6)
+            {
+                fprintf(stderr, "  alert %d never acknowledged\n", i);
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    host_mqtt_get_stats(&l_after);
+
+    AlarmStats l_stats_after = g_AlarmManager.GetStats();
+
+    uint32_t l_acked = l_stats_after.m_alerts - l_stats.m_alerts;
+
+    l_txn = ConfigTransaction();
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 0);
+    l_txn.SetIntValue(CFMGR_MQTT_BATCH, 1);
+    prvCommitMqtt(l_txn);
+
+    g_AlarmManager.SetRules(l_rules, 0);
+
+    if (!l_acked)
+    {
+        fprintf(stderr, "  no alert acknowledged!\n");
+        return;
+    }
+
+    double l_avg_ms = (double)(l_stats_after.m_latency_sum_us - l_stats.m_latency_sum_us) / l_acked / 1000.0;
+
+    AddMetric("alarm.alerts_lost", l_alerts - (int)l_acked, "alerts", false, TOL_COUNT, 1.0);
+    AddMetric("alarm.latency_avg_ms", l_avg_ms, "ms", false, TOL_TIME, 1.0);
+    AddMetric("alarm.latency_max_ms", l_stats_after.m_latency_max_us / 1000.0, "ms", false, TOL_TAIL, 1.0);
+    AddMetric("alarm.connects_per_alert", (double)(l_after.connects - l_before.connects) / l_acked, "connects", false, TOL_COUNT);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- frames: how well the sensors read independently are aligned, whether the gaps of
+// --- one are flagged, and what one MQTT message for all sensors saves
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define FRAME_BENCH_WINDOW_MS   2000
+
+// --- every sensor from the capture, the bursts of the others spread over the next 1.5 s
+// --- and each datagram up to 200 ms off. Without f_last the last sensor is dead
+
+static void prvRunFrames(FrameAssembler &f_frames, const std::vector<TsSample> &f_samples, bool f_last)
+{
+    int l_sensors = f_last ? CONFIG_TEMP_SENSOR_CNT : CONFIG_TEMP_SENSOR_CNT - 1;
+    int l_spread = CONFIG_TEMP_SENSOR_CNT - 1;
+
+    int64_t l_t0 = f_samples[0].m_time_ms;
+
+    struct FrameInput
+    {
+        int64_t         m_time_us;
+        int             m_sensor;
+        const TsSample  *m_sample;
+    };
+
+    std::vector<FrameInput> l_inputs;
+
+    for (size_t i = 0; i < f_samples.size(); ++i)
+    {
+        int64_t l_time_us = (f_samples[i].m_time_ms - l_t0) * 1000 + 1;
+
+        l_inputs.push_back({ l_time_us, 0, &f_samples[i] });
+
+        for (int s = 1; s < l_sensors; ++s)
+        {
+            int64_t l_offset_ms = 1500 * s / l_spread + (int64_t)(i * 397 * s) % 200;
+
+            l_inputs.push_back({ l_time_us + l_offset_ms * 1000, s, &f_samples[i] });
+        }
+    }
+
+    std::stable_sort(l_inputs.begin(), l_inputs.end(), [](const FrameInput &a, const FrameInput &b) { return a.m_time_us < b.m_time_us; });
+
+    for (const FrameInput &l_input : l_inputs)
+    {
+        f_frames.Expire(l_input.m_time_us);
+        f_frames.Add(l_input.m_sensor, l_input.m_time_us, l_input.m_sample->m_val[0], l_input.m_sample->m_val[1], l_input.m_sample->m_val[2]);
+    }
+
+    f_frames.Expire(INT64_MAX);
+}
+
+static void BenchFrames(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "frames:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- the capture is one sensor, aligning needs at least two
+
+    if (CONFIG_TEMP_SENSOR_CNT < 2)
+    {
+        fprintf(stderr, "  skipped, built for %d sensor\n", CONFIG_TEMP_SENSOR_CNT);
+        return;
+    }
+
+    FrameAssembler l_frames;
+
+    l_frames.Init(FRAME_BENCH_WINDOW_MS);
+
+    auto l_begin = BenchClock::now();
+
+    prvRunFrames(l_frames, l_samples, true);
+
+    double l_add_us = ElapsedUs(l_begin);
+
+    FrameStats l_all = l_frames.GetStats();
+
+    fprintf(stderr, "  %u frames, %u replaced\n", l_all.m_frames, l_all.m_replaced);
+
+    // --- the last sensor is dead: every frame has to say so
+
+    l_frames.Init(FRAME_BENCH_WINDOW_MS);
+
+    prvRunFrames(l_frames, l_samples, false);
+
+    FrameStats l_dead = l_frames.GetStats();
+
+    // --- the MQTT message of a frame against one per sensor
+
+    ConfigTransaction l_txn;
+
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 1);
+    l_txn.SetIntValue(CFMGR_FRAME_WINDOW, FRAME_BENCH_WINDOW_MS);
+    prvCommitMqtt(l_txn);
+
+    int64_t l_now = esp_timer_get_time();
+
+    int l_spread = CONFIG_TEMP_SENSOR_CNT - 1;
+
+    for (int s = 0; s < CONFIG_TEMP_SENSOR_CNT; ++s)
+    {
+        g_Frames.Add(s, l_now + 400000 * s / l_spread, 10 + s, 12 + s, 14 + s);
+    }
+
+    int l_rounds = f_quick ? 200 : 2000;
+
+    host_mqtt_stats_t l_before, l_after;
+    host_mqtt_get_stats(&l_before);
+
+    for (int i = 0; i < l_rounds; ++i) g_MqttManager.ProcessCallback();
+
+    host_mqtt_get_stats(&l_after);
+
+    l_txn = ConfigTransaction();
+    l_txn.SetIntValue(CFMGR_MQTT_ENABLE, 0);
+    l_txn.SetIntValue(CFMGR_FRAME_WINDOW, 0);
+    prvCommitMqtt(l_txn);
+
+    AddMetric("frame.complete_pct", l_all.m_frames ? l_all.m_complete * 100.0 / l_all.m_frames : 0, "%", true, TOL_COUNT);
+    AddMetric("frame.spread_max_ms", l_all.m_spread_max_ms, "ms", false, TOL_COUNT);
+    AddMetric("frame.dead_flagged_pct", l_dead.m_frames ? (l_dead.m_frames - l_dead.m_complete) * 100.0 / l_dead.m_frames : 0, "%", true, TOL_COUNT);
+    AddMetric("frame.mqtt_msgs_per_sample", (double)(l_after.publishes - l_before.publishes) / l_rounds, "messages", false, TOL_COUNT);
+    AddMetric("frame.mqtt_bytes_per_sample", (double)(l_after.bytes - l_before.bytes) / l_rounds, "bytes", false, TOL_COUNT);
+    AddMetric("frame.add_ns", l_add_us * 1000.0 / (l_samples.size() * CONFIG_TEMP_SENSOR_CNT), "ns", false, TOL_TIME);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- sensor fusion: three co-located sensors, one of which goes wrong for a while.
+// --- How close the fused value stays to the truth, whether the bad one is flagged
+// --- and what a fusion step costs
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define FUSION_BENCH_TOL        30
+
+static uint16_t prvFusionNoise(uint32_t *f_rng, uint16_t f_value, int f_gain_pct)
+{
+    *f_rng = *f_rng * 1664525 + 1013904223;
+
+    int l_value = f_value * f_gain_pct / 100 + (int)(*f_rng >> 29) - 4;
+
+    return l_value > 0 ? (uint16_t)l_value : 0;
+}
+
+static void BenchFusion(bool f_quick, const char *f_capture)
+{
+    fprintf(stderr, "fusion:\n");
+
+    std::vector<TsSample> l_samples;
+
+    if (!LoadSamples(f_quick, f_capture, l_samples)) return;
+
+    // --- the sensors read the truth with a little noise, the second 5% high. The third
+    // --- one reads three times too much in the middle third
+
+    size_t l_fault_from = l_samples.size() / 3;
+    size_t l_fault_to   = l_samples.size() * 2 / 3;
+
+    std::vector<FusionInput> l_inputs(l_samples.size() * 3);
+    uint32_t l_rng = 11;
+
+    for (size_t i = 0; i < l_samples.size(); ++i)
+    {
+        bool l_fault = i >= l_fault_from && i < l_fault_to;
+
+        for (int s = 0; s < 3; ++s)
+        {
+            FusionInput &l_in = l_inputs[i * 3 + s];
+
+            l_in.m_valid = true;
+
+            for (int v = 0; v < 3; ++v)
+            {
+                l_in.m_pm[v] = prvFusionNoise(&l_rng, l_samples[i].m_val[v], s == 1 ? 105 : (s == 2 && l_fault ? 300 : 100));
+            }
+        }
+    }
+
+    // --- the fused PM2.5 against the truth, and the plain mean of all three for comparison
+
+    FusionResult l_result;
+    uint8_t l_prev = 0;
+    double l_truth = 0, l_err = 0, l_naive_err = 0;
+    uint32_t l_faults = 0, l_flagged = 0, l_healthy = 0, l_false = 0;
+
+    auto l_begin = BenchClock::now();
+
+    for (size_t i = 0; i < l_samples.size(); ++i)
+    {
+        const FusionInput *l_in = &l_inputs[i * 3];
+
+        SensorFusion::Fuse(FusionMode_Mean, FUSION_BENCH_TOL, l_in, 3, l_prev, &l_result);
+        l_prev = l_result.m_deviating;
+
+        int l_value = l_samples[i].m_val[1];
+        int l_naive = (l_in[0].m_pm[1] + l_in[1].m_pm[1] + l_in[2].m_pm[1] + 1) / 3;
+
+        l_truth     += l_value;
+        l_err       += abs(l_result.m_pm[1] - l_value);
+        l_naive_err += abs(l_naive - l_value);
+
+        if (i >= l_fault_from && i < l_fault_to)
+        {
+            ++l_faults;
+            if (l_result.m_deviating & 4) ++l_flagged;
+        }
+        else
+        {
+            ++l_healthy;
+            if (l_result.m_deviating) ++l_false;
+        }
+    }
+
+    double l_fuse_us = ElapsedUs(l_begin);
+
+    // --- only the first and the broken one: no majority, so no flag but a conflict
+
+    uint32_t l_conflicts = 0;
+
+    for (size_t i = l_fault_from; i < l_fault_to; ++i)
+    {
+        FusionInput l_pair[2] = { l_inputs[i * 3], l_inputs[i * 3 + 2] };
+
+        SensorFusion::Fuse(FusionMode_Median, FUSION_BENCH_TOL, l_pair, 2, 0, &l_result);
+
+        if (!l_result.m_agree && !l_result.m_deviating) ++l_conflicts;
+    }
+
+    // --- the whole step through g_Fusion.Add(): a thread per receive task feeding the
+    // --- health of its sensor and the fusion at once, the last sensor reads three times
+    // --- too much in every other block of 64 datagrams. After every burst the health
+    // --- flags have to match the fused result and no update may be lost
+
+    ConfigTransaction l_txn;
+
+    l_txn.SetIntValue(CFMGR_FUSION, FusionMode_Mean);
+    l_txn.SetIntValue(CFMGR_FUSION_TOL, FUSION_BENCH_TOL);
+    g_ConfigManager.Commit(l_txn);
+
+    for (int s = 0; s < CONFIG_TEMP_SENSOR_CNT; ++s) g_SensorManager.GetSensor(s).GetHealth().Init(s);
+
+    int l_bursts = f_quick ? 20 : 200;
+    int l_burst_len = 1000;
+    uint32_t l_mismatches = 0;
+    FusionStats l_add_before = g_Fusion.GetStats();
+
+    auto l_add_begin = BenchClock::now();
+
+    for (int b = 0; b < l_bursts; ++b)
+    {
+        std::vector<std::thread> l_tasks;
+        std::atomic<int> l_ready(0);
+
+        for (int s = 0; s < CONFIG_TEMP_SENSOR_CNT; ++s)
+        {
+            l_tasks.emplace_back([s, b, l_burst_len, &l_samples, &l_ready]()
+            {
+                uint32_t l_rng = 17 + s * 31 + b;
+                CVindriktning &l_sensor = g_SensorManager.GetSensor(s);
+
+                // --- all start together, so the steps really interleave
+
+                for (++l_ready; l_ready < CONFIG_TEMP_SENSOR_CNT;) {}
+
+                for (int i = 0; i < l_burst_len; ++i)
+                {
+                    const TsSample &l_sample = l_samples[(b * l_burst_len + i) % l_samples.size()];
+                    int l_gain = s == CONFIG_TEMP_SENSOR_CNT - 1 && (i & 64) ? 300 : 100;
+                    uint16_t l_pm[3];
+
+                    for (int v = 0; v < 3; ++v) l_pm[v] = prvFusionNoise(&l_rng, l_sample.m_val[v], l_gain);
+
+                    int64_t l_now = esp_timer_get_time();
+
+                    l_sensor.GetHealth().OnDatagram(l_now, l_pm[0], l_pm[1], l_pm[2]);
+                    g_Fusion.Add(s, l_now, l_pm[0], l_pm[1], l_pm[2]);
+                }
+            });
+        }
+
+        for (std::thread &l_task : l_tasks) l_task.join();
+
+        FusionResult l_last;
+        int64_t l_last_us;
+
+        g_Fusion.GetResult(&l_last, &l_last_us);
+
+        for (int s = 0; s < CONFIG_TEMP_SENSOR_CNT; ++s)
+        {
+            bool l_flagged_health = g_SensorManager.GetSensor(s).GetHealth().GetInfo(l_last_us).m_state == SensorState_Deviating;
+
+            if (l_flagged_health != ((l_last.m_deviating & (1 << s)) != 0)) ++l_mismatches;
+        }
+    }
+
+    double l_add_us = ElapsedUs(l_add_begin);
+
+    FusionStats l_add_after = g_Fusion.GetStats();
+    uint32_t l_adds = (uint32_t)(l_bursts * l_burst_len * CONFIG_TEMP_SENSOR_CNT);
+
+    fprintf(stderr, "  %u updates, %u deviations, %u conflicts through Add()\n", l_add_after.m_updates - l_add_before.m_updates,
+        l_add_after.m_deviations - l_add_before.m_deviations, l_add_after.m_conflicts - l_add_before.m_conflicts);
+
+    l_txn = ConfigTransaction();
+    l_txn.SetIntValue(CFMGR_FUSION, FusionMode_Off);
+    g_ConfigManager.Commit(l_txn);
+
+    AddMetric("fusion.err_pct", l_truth ? l_err * 100.0 / l_truth : 0, "%", false, TOL_COUNT);
+    AddMetric("fusion.naive_err_pct", l_truth ? l_naive_err * 100.0 / l_truth : 0, "%", false, TOL_COUNT);
+    AddMetric("fusion.fault_flagged_pct", l_faults ? l_flagged * 100.0 / l_faults : 0, "%", true, TOL_COUNT);
+    AddMetric("fusion.false_flag_pct", l_healthy ? l_false * 100.0 / l_healthy : 0, "%", false, TOL_COUNT, 1.0);
+    AddMetric("fusion.pair_conflict_pct", l_faults ? l_conflicts * 100.0 / l_faults : 0, "%", true, TOL_COUNT);
+    AddMetric("fusion.fuse_ns", l_fuse_us * 1000.0 / l_samples.size(), "ns", false, TOL_TIME);
+    AddMetric("fusion.add.updates_lost", l_adds - (l_add_after.m_updates - l_add_before.m_updates), "updates", false, TOL_COUNT, 1.0);
+    AddMetric("fusion.add.flag_mismatch", l_mismatches, "flags", false, TOL_COUNT, 1.0);
+    AddMetric("fusion.add.add_ns", l_add_us * 1000.0 / l_adds, "ns", false, TOL_TIME);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- output and baseline
+////////////////////////////////////////////////////////////////////////////////////////
+
+static cJSON *MetricsToJson(void)
+{
+    cJSON *l_root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(l_root, "version", 1);
+    cJSON_AddNumberToObject(l_root, "sensors", CONFIG_TEMP_SENSOR_CNT);
+
+    cJSON *l_metrics = cJSON_AddObjectToObject(l_root, "metrics");
+
+    for (const BenchMetric &l_m : s_metrics)
+    {
+        cJSON *l_obj = cJSON_AddObjectToObject(l_metrics, l_m.m_name.c_str());
+
+        cJSON_AddNumberToObject(l_obj, "value", l_m.m_value);
+        cJSON_AddStringToObject(l_obj, "unit", l_m.m_unit);
+        cJSON_AddStringToObject(l_obj, "better", l_m.m_higher_better ? "higher" : "lower");
+        cJSON_AddNumberToObject(l_obj, "tolerance", l_m.m_tolerance);
+        cJSON_AddNumberToObject(l_obj, "slack", l_m.m_slack);
+    }
+
+    return l_root;
+}
+
+// --- returns the number of regressions
+
+static int CompareBaseline(const char *f_path)
+{
+    FILE *l_file = fopen(f_path, "rb");
+
+    if (!l_file)
+    {
+        fprintf(stderr, "cannot open baseline %s\n", f_path);
+        return 1;
+    }
+
+    std::string l_text;
+    char l_buf[4096];
+    size_t l_len;
+
+    while ((l_len = fread(l_buf, 1, sizeof(l_buf), l_file)) > 0) l_text.append(l_buf, l_len);
+
+    fclose(l_file);
+
+    cJSON *l_root = cJSON_Parse(l_text.c_str());
+    cJSON *l_metrics = cJSON_GetObjectItem(l_root, "metrics");
+
+    if (!l_metrics)
+    {
+        fprintf(stderr, "baseline %s is not valid\n", f_path);
+        cJSON_Delete(l_root);
+        return 1;
+    }
+
+    int l_regressions = 0;
+
+    fprintf(stderr, "\n%-36s %14s %14s %8s\n", "metric", "baseline", "now", "change");
+
+    for (const BenchMetric &l_m : s_metrics)
+    {
+        cJSON *l_base = cJSON_GetObjectItem(l_metrics, l_m.m_name.c_str());
+
+        if (!l_base)
+        {
+            fprintf(stderr, "%-36s %14s %14.2f      new\n", l_m.m_name.c_str(), "-", l_m.m_value);
+            continue;
+        }
+
+        double l_ref = cJSON_GetObjectItem(l_base, "value")->valuedouble;
+        cJSON *l_tol_item = cJSON_GetObjectItem(l_base, "tolerance");
+        double l_tol = l_tol_item ? l_tol_item->valuedouble : l_m.m_tolerance;
+        cJSON *l_slack_item = cJSON_GetObjectItem(l_base, "slack");
+        double l_slack = l_slack_item ? l_slack_item->valuedouble : l_m.m_slack;
+
+        // --- the absolute slack keeps counts of zero from failing on rounding and tiny
+        // --- latencies from failing on scheduling jitter
+
+        bool l_bad = l_m.m_higher_better ? (l_m.m_value < l_ref * (1.0 - l_tol))
+                                         : (l_m.m_value > l_ref * (1.0 + l_tol) + l_slack);
+
+        double l_change = fabs(l_ref) >= 0.01 ? (l_m.m_value - l_ref) * 100.0 / l_ref : 0.0;
+
+        fprintf(stderr, "%-36s %14.2f %14.2f %+7.1f%%%s\n", l_m.m_name.c_str(), l_ref, l_m.m_value, l_change, l_bad ? "  REGRESSION" : "");
+
+        if (l_bad) ++l_regressions;
+    }
+
+    cJSON_Delete(l_root);
+
+    return l_regressions;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void Usage(void)
+{
+    fprintf(stderr, "usage: dustbench [--quick] [--port n] [-o result.json] [--baseline baseline.json] [--capture file]\n");
+    exit(2);
+}
+
+static void prvSchedulerTask(void *f_arg)
+{
+    g_Scheduler.Run();
+
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option l_options[] =
+    {
+        { "quick",      no_argument,        NULL, 'q' },
+        { "port",       required_argument,  NULL, 'p' },
+        { "output",     required_argument,  NULL, 'o' },
+        { "baseline",   required_argument,  NULL, 'b' },
+        { "capture",    required_argument,  NULL, 'c' },
+        { NULL,         0,                  NULL, 0 }
+    };
+
+    bool        l_quick     = false;
+    int         l_port      = 18480;
+    const char *l_out       = NULL;
+    const char *l_baseline  = NULL;
+    const char *l_capture   = NULL;
+    int         l_opt;
+
+    while ((l_opt = getopt_long(argc, argv, "qp:o:b:c:", l_options, NULL)) != -1)
+    {
+        switch (l_opt)
+        {
+            case 'q': l_quick = true; break;
+            case 'p': l_port = atoi(optarg); break;
+            case 'o': l_out = optarg; break;
+            case 'b': l_baseline = optarg; break;
+            case 'c': l_capture = optarg; break;
+            default:  Usage();
+        }
+    }
+
+    // --- a private config store, no UART sources and a quiet log
+
+    char l_nvs[64];
+    snprintf(l_nvs, sizeof(l_nvs), "/tmp/dustbench_nvs_%d.txt", (int)getpid());
+
+    char l_portstr[16];
+    snprintf(l_portstr, sizeof(l_portstr), "%d", l_port);
+
+    setenv("DUSTLOGGER_NVS", l_nvs, 1);
+    setenv("DUSTLOGGER_HTTP_PORT", l_portstr, 1);
+
+    for (int i = 0; i < UART_NUM_MAX; ++i)
+    {
+        char l_env[32];
+        snprintf(l_env, sizeof(l_env), "DUSTLOGGER_UART%d", i);
+        unsetenv(l_env);
+    }
+
+    esp_log_level_set("*", ESP_LOG_NONE);
+
+    cJSON_Hooks l_hooks = { CountingMalloc, free };
+    cJSON_InitHooks(&l_hooks);
+
+    // --- bring up the firmware like app_main
+
+    ESP_ERROR_CHECK(nvs_flash_init());
+    ESP_ERROR_CHECK(g_Scheduler.InitManager());
+
+    g_EventLog.InitManager();
+
+    g_PowerManager.InitManager();
+
+    g_InfoManager.InitManager();
+
+    ESP_ERROR_CHECK(g_ConfigManager.InitConfigManager());
+
+    g_InfoManager.SetMode(InfoMode_Connected);
+    g_History.InitManager();
+    g_Quantiles.InitManager();
+    g_Aqi.InitManager();
+    g_AlarmManager.InitManager();
+    g_Frames.InitManager();
+    g_Fusion.InitManager();
+    g_SensorManager.InitSensors();
+    g_ResponseCache.InitManager();
+
+    if (start_rest_server("/nonexistent") != ESP_OK) return 1;
+
+    g_MqttManager.InitManager();
+
+    // --- the scheduler loop is app_main, here it needs a task of its own
+
+    xTaskCreate(prvSchedulerTask, "main", 4096, NULL, 1, NULL);
+
+    // --- let the tasks settle
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    BenchIdle(l_quick);
+    BenchDecode(l_quick);
+    BenchUartLatency(l_quick);
+    BenchRest(l_port, l_quick);
+    BenchMqtt(l_quick);
+    BenchEvlog(l_quick);
+    BenchSdLog(l_quick);
+    BenchTsCodec(l_quick, l_capture);
+    BenchQuantiles(l_quick, l_capture);
+    BenchAqi(l_quick, l_capture);
+    BenchHealth(l_quick, l_capture);
+    BenchAlarm(l_quick, l_capture);
+    BenchFrames(l_quick, l_capture);
+    BenchFusion(l_quick, l_capture);
+
+    struct rusage l_usage;
+    getrusage(RUSAGE_SELF, &l_usage);
+
+    fprintf(stderr, "memory:\n");
+    AddMetric("mem.peak_rss_kb", l_usage.ru_maxrss, "KiB", false, TOL_TIME);
+
+    unlink(l_nvs);
+
+    // --- results
+
+    cJSON *l_json = MetricsToJson();
+    char *l_text = cJSON_Print(l_json);
+
+    if (l_out)
+    {
+        FILE *l_file = fopen(l_out, "w");
+
+        if (l_file)
+        {
+            fprintf(l_file, "%s\n", l_text);
+            fclose(l_file);
+        }
+        else
+        {
+            fprintf(stderr, "cannot write %s\n", l_out);
+        }
+    }
+    else
+    {
+        printf("%s\n", l_text);
+    }
+
+    free(l_text);
+    cJSON_Delete(l_json);
+
+    int l_regressions = l_baseline ? CompareBaseline(l_baseline) : 0;
+
+    if (l_regressions) fprintf(stderr, "\n%d regression(s) against %s\n", l_regressions, l_baseline);
+
+    // --- the firmware tasks never end
+
+    fflush(stdout);
+    _exit(l_regressions ? 1 : 0);
+}
@@ -0,0 +1,147 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- Entry point of the host build. It brings up the managers the same way
+// --- app_main does, minus Wi-Fi, mDNS and SPIFFS, and serves the web UI from
+// --- the local disk.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "sensor_manager.h"
+#include "config_manager.h"
+#include "infomanager.h"
+#include "config_manager_defines.h"
+#include "mqtt_manager.h"
+#include "diag_manager.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "evlog.h"
+#include "response_cache.h"
+#include "sdcard_logger.h"
+#include "history.h"
+#include "quantiles.h"
+#include "aqi.h"
+#include "alarm_manager.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HOST_WWW_DIR
+#define HOST_WWW_DIR    "front/webapp/dist"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "ESPDustLogger";
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t start_rest_server(const char *base_path);
+
+static uint32_t prvEndJob(void *f_ctx)
+{
+    g_Scheduler.Stop();
+
+    return SCHED_STOP;
+}
+
+int main(int argc, char **argv)
+{
+    // ---- init flash lib (a text file on the host)
+
+    ESP_ERROR_CHECK(nvs_flash_init());
+
+    ESP_ERROR_CHECK(g_Scheduler.InitManager());
+
+    g_EventLog.InitManager();
+
+    g_PowerManager.InitManager();
+
+    g_InfoManager.InitManager();
+
+    ESP_ERROR_CHECK(g_ConfigManager.InitConfigManager());
+
+    // ---- no AP on the host: behave like a configured device
+
+    g_InfoManager.SetMode(InfoMode_Connected);
+
+    g_History.InitManager();
+    g_Quantiles.InitManager();
+    g_Aqi.InitManager();
+    g_AlarmManager.InitManager();
+    g_Frames.InitManager();
+    g_Fusion.InitManager();
+
+    // ---- DUSTLOGGER_SDCARD is the directory standing in for the SD card
+
+    const char *l_sdcard = getenv("DUSTLOGGER_SDCARD");
+
+    if (l_sdcard) g_SdLogger.InitManager(l_sdcard);
+
+    // ---- sensors read from the UART sources given by DUSTLOGGER_UART<n>
+
+    g_SensorManager.InitSensors();
+    g_ResponseCache.InitManager();
+
+    const char *l_www = getenv("DUSTLOGGER_WWW");
+
+    start_rest_server(l_www ? l_www : HOST_WWW_DIR);
+
+    g_MqttManager.InitManager();
+
+    g_DiagManager.InitManager();
+
+    ESP_LOGI(TAG, "Host build running.");
+
+    // ---- DUSTLOGGER_RUN_SECONDS lets profiling runs end on their own
+
+    const char *l_run = getenv("DUSTLOGGER_RUN_SECONDS");
+
+    if (l_run) g_Scheduler.AddJob("end", prvEndJob, NULL, (uint32_t)atoi(l_run) * 1000);
+
+    g_Scheduler.Run();
+
+    g_SdLogger.Sync(pdMS_TO_TICKS(1000));
+
+    ESP_LOGI(TAG, "Host build done, %u wakeups (%u per hour).", g_Scheduler.GetWakeups(), g_Scheduler.GetWakeupsPerHour());
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- There is no SDMMC controller, the card is a directory of the host
+// --- (see esp_vfs_fat.h). Only what the firmware configures is here.
+
+#ifndef HOST_SDMMC_HOST_H_
+#define HOST_SDMMC_HOST_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SDMMC_HOST_SLOT_1                   1
+#define SDMMC_HOST_FLAG_4BIT                (1 << 2)
+#define SDMMC_FREQ_DEFAULT                  20000
+#define SDMMC_SLOT_FLAG_INTERNAL_PULLUP     (1 << 0)
+
+typedef struct {
+    uint32_t    flags;
+    int         slot;
+    int         max_freq_khz;
+} sdmmc_host_t;
+
+typedef struct {
+    uint8_t     width;
+    uint32_t    flags;
+} sdmmc_slot_config_t;
+
+#define SDMMC_HOST_DEFAULT()        { SDMMC_HOST_FLAG_4BIT, SDMMC_HOST_SLOT_1, SDMMC_FREQ_DEFAULT }
+#define SDMMC_SLOT_CONFIG_DEFAULT() { 0, 0 }
+
+typedef struct {
+    int         capacity;           // --- in sectors
+    int         sector_size;
+} sdmmc_csd_t;
+
+typedef struct {
+    sdmmc_host_t    host;
+    sdmmc_csd_t     csd;
+    char            name[8];
+} sdmmc_card_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
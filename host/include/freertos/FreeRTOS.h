@@ -0,0 +1,96 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- FreeRTOS types and the subset of the kernel API used by the firmware,
+// --- implemented on top of POSIX threads (see shim/freertos_shim.cpp).
+
+#ifndef HOST_FREERTOS_H_
+#define HOST_FREERTOS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t        TickType_t;
+typedef int             BaseType_t;
+typedef unsigned int    UBaseType_t;
+typedef uint8_t         StackType_t;        // like on the ESP32: stack depths are in bytes
+
+// --- buffers of the static create functions. The shim keeps its own state, they only take
+// --- the space of their ESP32 counterparts
+
+typedef struct { uint8_t m_space[352]; } StaticTask_t;
+typedef struct { uint8_t m_space[84]; }  StaticQueue_t;
+typedef StaticQueue_t                    StaticSemaphore_t;
+
+#define pdFALSE                 ((BaseType_t)0)
+#define pdTRUE                  ((BaseType_t)1)
+#define pdFAIL                  pdFALSE
+#define pdPASS                  pdTRUE
+
+#define portMAX_DELAY           ((TickType_t)0xffffffffUL)
+
+#define configTICK_RATE_HZ      CONFIG_FREERTOS_HZ
+#define configMAX_TASK_NAME_LEN CONFIG_FREERTOS_MAX_TASK_NAME_LEN
+#define portTICK_PERIOD_MS      ((TickType_t)1000 / configTICK_RATE_HZ)
+#define portTICK_RATE_MS        portTICK_PERIOD_MS
+#define pdMS_TO_TICKS(ms)       ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+
+#define portYIELD_FROM_ISR()    
+#define portNUM_PROCESSORS      1
+
+#define BIT(n)                  (1UL << (n))
+
+// --- critical sections: a spinlock, like on the ESP32
+
+typedef struct { volatile int m_owner; } portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED    { 0 }
+
+#define portENTER_CRITICAL(mux)         do { while (__atomic_exchange_n(&(mux)->m_owner, 1, __ATOMIC_ACQUIRE)) {} } while (0)
+#define portEXIT_CRITICAL(mux)          __atomic_store_n(&(mux)->m_owner, 0, __ATOMIC_RELEASE)
+#define portENTER_CRITICAL_ISR(mux)     portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux)      portEXIT_CRITICAL(mux)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
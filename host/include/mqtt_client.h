@@ -0,0 +1,111 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- With libmosquitto available (HOST_HAVE_MOSQUITTO) messages go to a real
+// --- broker, e.g. a local mosquitto. Without it every publish is logged.
+
+#ifndef HOST_MQTT_CLIENT_H_
+#define HOST_MQTT_CLIENT_H_
+
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct esp_mqtt_client *esp_mqtt_client_handle_t;
+
+typedef struct {
+    const char *uri;
+    const char *client_id;
+    int         keepalive;
+} esp_mqtt_client_config_t;
+
+// --- events: CONNECTED when the broker accepted the connection, PUBLISHED when a QoS 1 message
+// --- was acknowledged (with the msg_id returned by the publish)
+
+typedef enum {
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT
+} esp_mqtt_event_id_t;
+
+typedef struct {
+    esp_mqtt_event_id_t         event_id;
+    esp_mqtt_client_handle_t    client;
+    void                       *user_context;
+    char                       *data;
+    int                         data_len;
+    char                       *topic;
+    int                         topic_len;
+    int                         msg_id;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t *esp_mqtt_event_handle_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config);
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client, const char *uri);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client);
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain);
+
+// --- host only: traffic so far. Bytes are counted like on the wire (fixed header, topic
+// --- length, topic and payload, for QoS 1 the message id and the PUBACK), connects include
+// --- reconnects
+
+typedef struct {
+    uint32_t    publishes;
+    uint64_t    bytes;
+    uint32_t    connects;
+} host_mqtt_stats_t;
+
+void host_mqtt_get_stats(host_mqtt_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
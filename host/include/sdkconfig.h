@@ -0,0 +1,177 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- Stand-in for the generated sdkconfig.h. Mirrors the defaults of
+// --- main/Kconfig.projbuild and sdkconfig, every value can be overridden with -D.
+
+#ifndef HOST_SDKCONFIG_H_
+#define HOST_SDKCONFIG_H_
+
+#define CONFIG_IDF_TARGET_LINUX                 1
+
+#define CONFIG_FREERTOS_HZ                      100
+#define CONFIG_FREERTOS_MAX_TASK_NAME_LEN       16
+#define CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH  2048
+#define CONFIG_ESP_MAIN_TASK_STACK_SIZE         4096
+#define CONFIG_FREERTOS_USE_TRACE_FACILITY      1
+#define CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID 1
+#define CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS 1
+#define CONFIG_LOG_DEFAULT_LEVEL                3
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ       160
+#define CONFIG_ESP32_XTAL_FREQ                  40
+
+// --- ESP Dust Logger Configuration
+
+#ifndef CONFIG_PRODUCT_NAME
+#define CONFIG_PRODUCT_NAME                     "way2DustLogger"
+#endif
+
+#ifndef CONFIG_TEMP_SENSOR_CNT
+#define CONFIG_TEMP_SENSOR_CNT                  2
+#endif
+
+#ifndef CONFIG_TEMP_SENSOR1_DATA_GPIO
+#define CONFIG_TEMP_SENSOR1_DATA_GPIO           25
+#endif
+#ifndef CONFIG_TEMP_SENSOR1_UART_PORT_NUM
+#define CONFIG_TEMP_SENSOR1_UART_PORT_NUM       1
+#endif
+
+#ifndef CONFIG_TEMP_SENSOR2_DATA_GPIO
+#define CONFIG_TEMP_SENSOR2_DATA_GPIO           0
+#endif
+#ifndef CONFIG_TEMP_SENSOR2_UART_PORT_NUM
+#define CONFIG_TEMP_SENSOR2_UART_PORT_NUM       2
+#endif
+
+#ifndef CONFIG_TEMP_SENSOR3_DATA_GPIO
+#define CONFIG_TEMP_SENSOR3_DATA_GPIO           0
+#endif
+#ifndef CONFIG_TEMP_SENSOR3_UART_PORT_NUM
+#define CONFIG_TEMP_SENSOR3_UART_PORT_NUM       3
+#endif
+
+#ifndef CONFIG_BOOTSTRAP_GPIO
+#define CONFIG_BOOTSTRAP_GPIO                   35
+#endif
+
+#ifndef CONFIG_BUTTON_DEBOUNCE_MS
+#define CONFIG_BUTTON_DEBOUNCE_MS               50
+#endif
+
+#ifndef CONFIG_BUTTON_LONG_PRESS_MS
+#define CONFIG_BUTTON_LONG_PRESS_MS             3000
+#endif
+
+// --- not the default GPIO 2: that is D0 of the SD card, and the host build has the logger on
+
+#ifndef CONFIG_INFOLED_GPIO
+#define CONFIG_INFOLED_GPIO                     4
+#endif
+
+// --- CONFIG_PM1006_SIMULATOR is off, the host build feeds the UARTs via DUSTLOGGER_UART<n>
+
+// --- one receive task for all UARTs, build with -DHOST_UART_TASK_PER_SENSOR for the old way
+
+#if !defined(CONFIG_SENSOR_SHARED_RX) && !defined(CONFIG_PM1006_SIMULATOR) && !defined(HOST_UART_TASK_PER_SENSOR)
+#define CONFIG_SENSOR_SHARED_RX                 1
+#endif
+
+#ifndef CONFIG_DIAG_HEALTH_INTERVAL
+#define CONFIG_DIAG_HEALTH_INTERVAL             300
+#endif
+
+#ifndef CONFIG_DIAG_STACK_WARN_BYTES
+#define CONFIG_DIAG_STACK_WARN_BYTES            256
+#endif
+
+// --- CONFIG_POWER_SAVE is off, the host never sleeps (build with -DCONFIG_POWER_SAVE to run the code)
+
+#ifndef CONFIG_POWER_RX_HOLD_MS
+#define CONFIG_POWER_RX_HOLD_MS                 1500
+#endif
+
+#ifndef CONFIG_POWER_WIFI_LISTEN_INTERVAL
+#define CONFIG_POWER_WIFI_LISTEN_INTERVAL       3
+#endif
+
+// --- CONFIG_STATIC_ALLOC is off (build with -DCONFIG_STATIC_ALLOC for the static pools)
+
+// --- binary event log, build with -DHOST_NO_EVLOG to print the events instead
+
+#if !defined(CONFIG_EVLOG) && !defined(HOST_NO_EVLOG)
+#define CONFIG_EVLOG                            1
+#endif
+
+#ifndef CONFIG_EVLOG_SIZE
+#define CONFIG_EVLOG_SIZE                       4096
+#endif
+
+#ifndef CONFIG_EVLOG_SPILL_INTERVAL
+#define CONFIG_EVLOG_SPILL_INTERVAL             0
+#endif
+
+#ifndef CONFIG_HISTORY_SIZE
+#define CONFIG_HISTORY_SIZE                     8192
+#endif
+
+#ifndef CONFIG_AQI_PUBLISH_INTERVAL
+#define CONFIG_AQI_PUBLISH_INTERVAL             300
+#endif
+
+// --- webhook alerts, the host client only logs the requests
+
+#ifndef CONFIG_ALARM_WEBHOOK
+#define CONFIG_ALARM_WEBHOOK                    1
+#endif
+
+// --- SD card logger, only started when DUSTLOGGER_SDCARD names the directory of the card
+
+#ifndef CONFIG_SDCARD_LOG
+#define CONFIG_SDCARD_LOG                       1
+#endif
+
+#ifndef CONFIG_SDCARD_LOG_QUEUE_LEN
+#define CONFIG_SDCARD_LOG_QUEUE_LEN             64
+#endif
+
+#ifndef CONFIG_SDCARD_LOG_FLUSH_INTERVAL
+#define CONFIG_SDCARD_LOG_FLUSH_INTERVAL        60
+#endif
+
+#ifndef CONFIG_PM1006_SIM_ERROR_PERMILLE
+#define CONFIG_PM1006_SIM_ERROR_PERMILLE        0
+#endif
+
+#endif
@@ -0,0 +1,525 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- Logging, error names, system, heap, GPIO, Wi-Fi and SD card stubs and the newlib
+// --- extensions from host_compat.h.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include <mutex>
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "esp_wifi.h"
+#include "driver/gpio.h"
+#include "sdmmc_cmd.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- logging
+////////////////////////////////////////////////////////////////////////////////////////
+
+static std::mutex   s_log_mutex;
+static int          s_log_level = -1;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    // --- one global level, the tag is ignored
+
+    s_log_level = level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    if (s_log_level < 0)
+    {
+        const char *l_env = getenv("DUSTLOGGER_LOG_LEVEL");
+        s_log_level = l_env ? atoi(l_env) : CONFIG_LOG_DEFAULT_LEVEL;
+    }
+
+    if ((int)level > s_log_level) return;
+
+    static const char l_letters[] = "NEWIDV";
+
+    std::lock_guard<std::mutex> l_lock(s_log_mutex);
+
+    fprintf(stderr, "%c (%u) %s: ", l_letters[level], esp_log_timestamp(), tag);
+
+    va_list l_args;
+    va_start(l_args, format);
+    vfprintf(stderr, format, l_args);
+    va_end(l_args);
+
+    fputc('\n', stderr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+        case ESP_OK:                        return "ESP_OK";
+        case ESP_FAIL:                      return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:                return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:           return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE:         return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:          return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:             return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED:         return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:               return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_NVS_NOT_INITIALIZED:   return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND:         return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_TYPE_MISMATCH:     return "ESP_ERR_NVS_TYPE_MISMATCH";
+        case ESP_ERR_NVS_INVALID_LENGTH:    return "ESP_ERR_NVS_INVALID_LENGTH";
+        default:                            return "UNKNOWN ERROR";
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void esp_restart(void)
+{
+    fprintf(stderr, "esp_restart() called - exiting\n");
+    exit(0);
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return ESP_RST_POWERON;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- heap
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- glibc has no notion of capabilities or of a minimum ever free: every capability sees
+// --- the malloc arena, the top chunk counts as largest free block and the minimum is
+// --- tracked on each call
+
+static size_t s_heap_min_free = SIZE_MAX;
+
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    struct mallinfo2 l_mi = mallinfo2();
+
+    memset(info, 0, sizeof(*info));
+
+    info->total_free_bytes      = l_mi.fordblks;
+    info->total_allocated_bytes = l_mi.uordblks;
+    info->largest_free_block    = l_mi.keepcost;
+    info->free_blocks           = l_mi.ordblks + l_mi.smblks;
+    info->allocated_blocks      = 0;
+    info->total_blocks          = info->free_blocks;
+
+    if (l_mi.fordblks < s_heap_min_free) s_heap_min_free = l_mi.fordblks;
+    info->minimum_free_bytes    = s_heap_min_free;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    multi_heap_info_t l_info;
+    heap_caps_get_info(&l_info, caps);
+    return l_info.total_free_bytes;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    multi_heap_info_t l_info;
+    heap_caps_get_info(&l_info, caps);
+    return l_info.minimum_free_bytes;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    multi_heap_info_t l_info;
+    heap_caps_get_info(&l_info, caps);
+    return l_info.largest_free_block;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- gpio
+////////////////////////////////////////////////////////////////////////////////////////
+
+static volatile int s_gpio_level[GPIO_NUM_MAX];
+static volatile int s_gpio_input_set[GPIO_NUM_MAX];
+
+static gpio_int_type_t  s_gpio_intr[GPIO_NUM_MAX];
+static gpio_isr_t       s_gpio_isr[GPIO_NUM_MAX];
+static void            *s_gpio_isr_arg[GPIO_NUM_MAX];
+static volatile bool    s_gpio_intr_off[GPIO_NUM_MAX];
+static bool             s_gpio_isr_service;
+
+esp_err_t gpio_reset_pin(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_level[gpio_num] = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull)
+{
+    return (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_level[gpio_num] = level ? 1 : 0;
+
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return 0;
+
+    // --- unset inputs read as "pulled up"
+
+    return s_gpio_input_set[gpio_num] ? s_gpio_level[gpio_num] : 1;
+}
+
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_intr[gpio_num] = intr_type;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags)
+{
+    if (s_gpio_isr_service) return ESP_ERR_INVALID_STATE;
+
+    s_gpio_isr_service = true;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+    if (!s_gpio_isr_service) return ESP_ERR_INVALID_STATE;
+
+    s_gpio_isr_arg[gpio_num]    = args;
+    s_gpio_isr[gpio_num]        = isr_handler;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_isr_handler_remove(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_isr[gpio_num] = NULL;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_intr_off[gpio_num] = false;
+
+    return ESP_OK;
+}
+
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_gpio_intr_off[gpio_num] = true;
+
+    return ESP_OK;
+}
+
+void host_gpio_set_input_level(gpio_num_t gpio_num, int level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return;
+
+    int l_old = gpio_get_level(gpio_num);
+
+    s_gpio_input_set[gpio_num]  = 1;
+    s_gpio_level[gpio_num]      = level ? 1 : 0;
+
+    // --- the "interrupt" runs on the calling thread
+
+    int l_new = s_gpio_level[gpio_num];
+    bool l_fire = false;
+
+    switch (s_gpio_intr[gpio_num])
+    {
+        case GPIO_INTR_POSEDGE:     l_fire = !l_old && l_new; break;
+        case GPIO_INTR_NEGEDGE:     l_fire = l_old && !l_new; break;
+        case GPIO_INTR_ANYEDGE:     l_fire = l_old != l_new; break;
+        case GPIO_INTR_LOW_LEVEL:   l_fire = !l_new; break;
+        case GPIO_INTR_HIGH_LEVEL:  l_fire = l_new; break;
+        default:                    break;
+    }
+
+    if (l_fire && !s_gpio_intr_off[gpio_num] && s_gpio_isr[gpio_num]) s_gpio_isr[gpio_num](s_gpio_isr_arg[gpio_num]);
+}
+
+esp_err_t gpio_wakeup_enable(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    return (intr_type == GPIO_INTR_LOW_LEVEL || intr_type == GPIO_INTR_HIGH_LEVEL) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- power management: the host runs at full speed and never sleeps, locks only count
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct esp_pm_lock
+{
+    esp_pm_lock_type_t  m_type;
+    const char         *m_name;
+    int                 m_count;
+};
+
+static std::mutex s_pm_mutex;
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    return config ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle)
+{
+    esp_pm_lock *l_lock = new esp_pm_lock();
+
+    l_lock->m_type  = lock_type;
+    l_lock->m_name  = name;
+    l_lock->m_count = 0;
+
+    *out_handle = l_lock;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_delete(esp_pm_lock_handle_t handle)
+{
+    if (!handle) return ESP_ERR_INVALID_ARG;
+    if (handle->m_count) return ESP_ERR_INVALID_STATE;
+
+    delete handle;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    if (!handle) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(s_pm_mutex);
+    ++handle->m_count;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    if (!handle) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(s_pm_mutex);
+
+    if (!handle->m_count) return ESP_ERR_INVALID_STATE;
+    --handle->m_count;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_uart_wakeup(int uart_num)
+{
+    return (uart_num == 0 || uart_num == 1) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t esp_sleep_enable_gpio_wakeup(void)
+{
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- wifi
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t esp_wifi_scan_start(const wifi_scan_config_t *config, bool block)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_records(uint16_t *number, wifi_ap_record_t *ap_records)
+{
+    *number = 0;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_scan_get_ap_num(uint16_t *number)
+{
+    *number = 0;
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- SD card: a directory of the host
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t esp_vfs_fat_sdmmc_mount(const char *base_path, const sdmmc_host_t *host_config, const void *slot_config,
+                                  const esp_vfs_fat_mount_config_t *mount_config, sdmmc_card_t **out_card)
+{
+    static sdmmc_card_t s_card;
+
+    if (!base_path || !host_config || !mount_config) return ESP_ERR_INVALID_ARG;
+
+    if (mkdir(base_path, 0755) != 0 && errno != EEXIST) return ESP_FAIL;
+
+    // --- the size of the file system the directory is on
+
+    struct statvfs l_vfs;
+
+    memset(&s_card, 0, sizeof(s_card));
+
+    s_card.host             = *host_config;
+    s_card.csd.sector_size  = 512;
+
+    if (statvfs(base_path, &l_vfs) == 0) s_card.csd.capacity = (int)((uint64_t)l_vfs.f_blocks * l_vfs.f_frsize / 512);
+
+    strcpy(s_card.name, "HOST");
+
+    if (out_card) *out_card = &s_card;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_vfs_fat_sdcard_unmount(const char *base_path, sdmmc_card_t *card)
+{
+    return ESP_OK;
+}
+
+// --- logged instead of printed, stdout may carry the benchmark results
+
+void sdmmc_card_print_info(FILE *stream, const sdmmc_card_t *card)
+{
+    ESP_LOGI("sdmmc", "Name: %s, size: %lluMB", card->name, (unsigned long long)card->csd.capacity * card->csd.sector_size / (1024 * 1024));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- newlib extensions
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HOST_HAVE_STRLCPY
+
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t l_len = strlen(src);
+
+    if (size)
+    {
+        size_t l_copy = l_len >= size ? size - 1 : l_len;
+
+        memcpy(dst, src, l_copy);
+        dst[l_copy] = '\0';
+    }
+
+    return l_len;
+}
+
+size_t strlcat(char *dst, const char *src, size_t size)
+{
+    size_t l_dlen = strnlen(dst, size);
+
+    if (l_dlen == size) return size + strlen(src);
+
+    return l_dlen + strlcpy(dst + l_dlen, src, size - l_dlen);
+}
+
+#endif
+
+char *itoa(int value, char *str, int base)
+{
+    if (base == 10)
+    {
+        sprintf(str, "%d", value);
+        return str;
+    }
+
+    // --- other bases: unsigned like newlib
+
+    static const char l_digits[] = "0123456789abcdefghijklmnopqrstuvwxyz";
+
+    char l_tmp[33];
+    int l_pos = 0;
+    unsigned l_v = (unsigned)value;
+
+    do
+    {
+        l_tmp[l_pos++] = l_digits[l_v % base];
+        l_v /= base;
+    } while (l_v);
+
+    for (int i = 0; i < l_pos; ++i) str[i] = l_tmp[l_pos - 1 - i];
+    str[l_pos] = '\0';
+
+    return str;
+}
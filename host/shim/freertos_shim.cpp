@@ -0,0 +1,680 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- FreeRTOS tasks, timers, queues and semaphores on top of std::thread.
+
+#include <time.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point s_start = Clock::now();
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- convert a tick timeout into an absolute deadline. portMAX_DELAY waits forever
+
+static Clock::time_point TicksToDeadline(TickType_t f_ticks)
+{
+    if (f_ticks == portMAX_DELAY) return Clock::time_point::max();
+
+    return Clock::now() + std::chrono::milliseconds((uint64_t)f_ticks * portTICK_PERIOD_MS);
+}
+
+template <class Pred> static bool WaitUntil(std::condition_variable &f_cv, std::unique_lock<std::mutex> &f_lock,
+                                            Clock::time_point f_deadline, Pred f_pred)
+{
+    if (f_deadline == Clock::time_point::max())
+    {
+        f_cv.wait(f_lock, f_pred);
+        return true;
+    }
+
+    return f_cv.wait_until(f_lock, f_deadline, f_pred);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int64_t esp_timer_get_time(void)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s_start).count();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- tasks
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostTask
+{
+    std::string     m_name;
+    TaskFunction_t  m_fn;
+    void           *m_arg;
+    UBaseType_t     m_prio;
+    uint32_t        m_stack;
+    BaseType_t      m_core;
+    UBaseType_t     m_number;
+    pthread_t       m_thread;
+    bool            m_started;
+};
+
+static thread_local HostTask *s_current_task = NULL;
+
+// --- all tasks for the trace facility, the thread running main() is the "main" task
+
+static std::mutex               s_task_mutex;
+static std::vector<HostTask *>  s_tasks;
+
+static void RegisterTask(HostTask *f_task)
+{
+    std::lock_guard<std::mutex> l_lock(s_task_mutex);
+
+    f_task->m_number = s_tasks.size() + 1;
+    s_tasks.push_back(f_task);
+}
+
+// --- called on the thread of the task, its CPU clock is the run time counter
+
+static void StartTask(HostTask *f_task)
+{
+    std::lock_guard<std::mutex> l_lock(s_task_mutex);
+
+    s_current_task = f_task;
+    f_task->m_thread = pthread_self();
+    f_task->m_started = true;
+}
+
+static uint32_t TaskRunTime(HostTask *f_task)
+{
+    clockid_t l_clock;
+    struct timespec l_ts;
+
+    if (!f_task->m_started) return 0;
+    if (pthread_getcpuclockid(f_task->m_thread, &l_clock) != 0) return 0;
+    if (clock_gettime(l_clock, &l_ts) != 0) return 0;
+
+    return (uint32_t)((uint64_t)l_ts.tv_sec * 1000000 + l_ts.tv_nsec / 1000);
+}
+
+static HostTask s_main_task = { "main", NULL, NULL, 1, CONFIG_ESP_MAIN_TASK_STACK_SIZE, 0 };
+
+static struct HostMainTaskInit
+{
+    HostMainTaskInit(void)
+    {
+        RegisterTask(&s_main_task);
+        StartTask(&s_main_task);
+    }
+} s_main_task_init;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                       void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask, BaseType_t xCoreID)
+{
+    HostTask *l_task = new HostTask();
+
+    l_task->m_name  = std::string(pcName ? pcName : "").substr(0, configMAX_TASK_NAME_LEN - 1);
+    l_task->m_fn    = pvTaskCode;
+    l_task->m_arg   = pvParameters;
+    l_task->m_prio  = uxPriority;
+    l_task->m_stack = usStackDepth;
+    l_task->m_core  = xCoreID;
+
+    RegisterTask(l_task);
+
+    if (pxCreatedTask) *pxCreatedTask = l_task;
+
+    // --- tasks never return on FreeRTOS, so the threads are detached
+
+    std::thread([l_task]() 
+    {
+        StartTask(l_task);
+        l_task->m_fn(l_task->m_arg);
+    }).detach();
+
+    return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                       void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pxCreatedTask)
+{
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pxCreatedTask, 0);
+}
+
+TaskHandle_t xTaskCreateStatic(TaskFunction_t pxTaskCode, const char *pcName, uint32_t ulStackDepth,
+                       void *pvParameters, UBaseType_t uxPriority, StackType_t *puxStackBuffer, StaticTask_t *pxTaskBuffer)
+{
+    if (!puxStackBuffer || !pxTaskBuffer) return NULL;
+
+    TaskHandle_t l_task = NULL;
+
+    xTaskCreatePinnedToCore(pxTaskCode, pcName, ulStackDepth, pvParameters, uxPriority, &l_task, 0);
+
+    return l_task;
+}
+
+void vTaskDelete(TaskHandle_t xTask)
+{
+    // --- only deleting the calling task is supported: just end the thread
+
+    if (xTask == NULL || xTask == s_current_task) 
+    {
+        for (;;) std::this_thread::sleep_for(std::chrono::hours(24));
+    }
+}
+
+void vTaskDelay(TickType_t xTicksToDelay)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds((uint64_t)xTicksToDelay * portTICK_PERIOD_MS));
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return s_current_task;
+}
+
+const char *pcTaskGetName(TaskHandle_t xTask)
+{
+    if (!xTask) xTask = s_current_task;
+
+    return xTask ? xTask->m_name.c_str() : "main";
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    std::lock_guard<std::mutex> l_lock(s_task_mutex);
+
+    return s_tasks.size();
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t *pxTaskStatusArray, UBaseType_t uxArraySize, uint32_t *pulTotalRunTime)
+{
+    std::lock_guard<std::mutex> l_lock(s_task_mutex);
+
+    if (uxArraySize < s_tasks.size()) return 0;
+
+    for (size_t i = 0; i < s_tasks.size(); ++i)
+    {
+        HostTask *l_task = s_tasks[i];
+        TaskStatus_t &l_st = pxTaskStatusArray[i];
+
+        memset(&l_st, 0, sizeof(l_st));
+
+        l_st.xHandle                = l_task;
+        l_st.pcTaskName             = l_task->m_name.c_str();
+        l_st.xTaskNumber            = l_task->m_number;
+        l_st.eCurrentState          = (l_task == s_current_task) ? eRunning : eBlocked;
+        l_st.uxCurrentPriority      = l_task->m_prio;
+        l_st.uxBasePriority         = l_task->m_prio;
+        l_st.ulRunTimeCounter       = TaskRunTime(l_task);
+        l_st.usStackHighWaterMark   = l_task->m_stack;
+        l_st.xCoreID                = l_task->m_core;
+    }
+
+    // --- like portGET_RUN_TIME_COUNTER_VALUE() with the esp_timer as source
+
+    if (pulTotalRunTime) *pulTotalRunTime = (uint32_t)esp_timer_get_time();
+
+    return s_tasks.size();
+}
+
+TaskHandle_t xTaskGetIdleTaskHandleForCPU(UBaseType_t cpuid)
+{
+    // --- no idle tasks on the host
+
+    return NULL;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+    if (!xTask) xTask = s_current_task;
+
+    return xTask ? xTask->m_stack : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- queues
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostQueue
+{
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cv;
+    std::deque<std::string>     m_items;
+
+    UBaseType_t                 m_length;
+    UBaseType_t                 m_itemsize;
+
+    HostQueue                   *m_set;         // --- queue set this queue is a member of
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize)
+{
+    HostQueue *l_q = new HostQueue;
+
+    l_q->m_length   = uxQueueLength;
+    l_q->m_itemsize = uxItemSize;
+    l_q->m_set      = NULL;
+
+    return l_q;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t uxQueueLength, UBaseType_t uxItemSize, 
+                                 uint8_t *pucQueueStorage, StaticQueue_t *pxQueueBuffer)
+{
+    if (!pucQueueStorage || !pxQueueBuffer) return NULL;
+
+    return xQueueCreate(uxQueueLength, uxItemSize);
+}
+
+void vQueueDelete(QueueHandle_t xQueue)
+{
+    delete xQueue;
+}
+
+static BaseType_t QueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait, bool f_front)
+{
+    HostQueue *l_set = NULL;
+
+    {
+        std::unique_lock<std::mutex> l_lock(xQueue->m_mutex);
+
+        if (!WaitUntil(xQueue->m_cv, l_lock, TicksToDeadline(xTicksToWait), 
+                       [xQueue] { return xQueue->m_items.size() < xQueue->m_length; }))
+        {
+            return pdFAIL;
+        }
+
+        std::string l_item((const char *)pvItemToQueue, xQueue->m_itemsize);
+
+        if (f_front)
+            xQueue->m_items.push_front(l_item);
+        else
+            xQueue->m_items.push_back(l_item);
+
+        xQueue->m_cv.notify_all();
+
+        l_set = xQueue->m_set;
+    }
+
+    // --- the set is sized for all members, so this never has to wait
+
+    if (l_set) QueueSend(l_set, &xQueue, 0, false);
+
+    return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return QueueSend(xQueue, pvItemToQueue, xTicksToWait, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait)
+{
+    return QueueSend(xQueue, pvItemToQueue, xTicksToWait, true);
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t xQueue, const void *pvItemToQueue, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken) *pxHigherPriorityTaskWoken = pdFALSE;
+
+    return QueueSend(xQueue, pvItemToQueue, 0, false);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> l_lock(xQueue->m_mutex);
+
+    if (!WaitUntil(xQueue->m_cv, l_lock, TicksToDeadline(xTicksToWait), 
+                   [xQueue] { return !xQueue->m_items.empty(); }))
+    {
+        return pdFAIL;
+    }
+
+    memcpy(pvBuffer, xQueue->m_items.front().data(), xQueue->m_itemsize);
+    xQueue->m_items.pop_front();
+
+    xQueue->m_cv.notify_all();
+
+    return pdPASS;
+}
+
+BaseType_t xQueueReset(QueueHandle_t xQueue)
+{
+    std::lock_guard<std::mutex> l_lock(xQueue->m_mutex);
+
+    xQueue->m_items.clear();
+    xQueue->m_cv.notify_all();
+
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue)
+{
+    std::lock_guard<std::mutex> l_lock(xQueue->m_mutex);
+
+    return xQueue->m_items.size();
+}
+
+QueueSetHandle_t xQueueCreateSet(UBaseType_t uxEventQueueLength)
+{
+    return xQueueCreate(uxEventQueueLength, sizeof(HostQueue *));
+}
+
+BaseType_t xQueueAddToSet(QueueSetMemberHandle_t xQueueOrSemaphore, QueueSetHandle_t xQueueSet)
+{
+    std::lock_guard<std::mutex> l_lock(xQueueOrSemaphore->m_mutex);
+
+    // --- like FreeRTOS: only empty queues that are in no other set
+
+    if (xQueueOrSemaphore->m_set || !xQueueOrSemaphore->m_items.empty()) return pdFAIL;
+
+    xQueueOrSemaphore->m_set = xQueueSet;
+
+    return pdPASS;
+}
+
+QueueSetMemberHandle_t xQueueSelectFromSet(QueueSetHandle_t xQueueSet, TickType_t xTicksToWait)
+{
+    HostQueue *l_member = NULL;
+
+    if (xQueueReceive(xQueueSet, &l_member, xTicksToWait) != pdPASS) return NULL;
+
+    return l_member;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- semaphores
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostSemaphore
+{
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cv;
+
+    UBaseType_t                 m_count;
+    UBaseType_t                 m_max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t uxMaxCount, UBaseType_t uxInitialCount)
+{
+    HostSemaphore *l_sem = new HostSemaphore;
+
+    l_sem->m_count  = uxInitialCount;
+    l_sem->m_max    = uxMaxCount;
+
+    return l_sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return xSemaphoreCreateCounting(1, 1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *pxMutexBuffer)
+{
+    return pxMutexBuffer ? xSemaphoreCreateMutex() : NULL;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return xSemaphoreCreateCounting(1, 0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *pxSemaphoreBuffer)
+{
+    return pxSemaphoreBuffer ? xSemaphoreCreateBinary() : NULL;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t xSemaphore)
+{
+    delete xSemaphore;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xTicksToWait)
+{
+    std::unique_lock<std::mutex> l_lock(xSemaphore->m_mutex);
+
+    if (!WaitUntil(xSemaphore->m_cv, l_lock, TicksToDeadline(xTicksToWait), 
+                   [xSemaphore] { return xSemaphore->m_count > 0; }))
+    {
+        return pdFAIL;
+    }
+
+    --xSemaphore->m_count;
+
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore)
+{
+    std::lock_guard<std::mutex> l_lock(xSemaphore->m_mutex);
+
+    if (xSemaphore->m_count >= xSemaphore->m_max) return pdFAIL;
+
+    ++xSemaphore->m_count;
+    xSemaphore->m_cv.notify_one();
+
+    return pdPASS;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t xSemaphore, BaseType_t *pxHigherPriorityTaskWoken)
+{
+    if (pxHigherPriorityTaskWoken) *pxHigherPriorityTaskWoken = pdFALSE;
+
+    return xSemaphoreGive(xSemaphore);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- timers
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostTimer
+{
+    std::string             m_name;
+    TickType_t              m_period;
+    bool                    m_autoreload;
+    void                   *m_id;
+    TimerCallbackFunction_t m_callback;
+
+    bool                    m_active;
+    Clock::time_point       m_expiry;
+};
+
+// --- the timer service: one thread, one list of timers
+
+static std::mutex               s_timer_mutex;
+static std::condition_variable  s_timer_cv;
+static std::vector<HostTimer *> s_timers;
+static bool                     s_timer_thread_running = false;
+
+static void TimerServiceThread(void)
+{
+    static HostTask l_task = { "Tmr Svc", NULL, NULL, 1, CONFIG_FREERTOS_TIMER_TASK_STACK_DEPTH, 0 };
+
+    RegisterTask(&l_task);
+    StartTask(&l_task);
+
+    std::unique_lock<std::mutex> l_lock(s_timer_mutex);
+
+    for (;;)
+    {
+        // --- find the next timer to expire
+
+        HostTimer *l_next = NULL;
+
+        for (HostTimer *l_t : s_timers)
+        {
+            if (l_t->m_active && (!l_next || l_t->m_expiry < l_next->m_expiry)) l_next = l_t;
+        }
+
+        if (!l_next)
+        {
+            s_timer_cv.wait(l_lock);
+            continue;
+        }
+
+        if (s_timer_cv.wait_until(l_lock, l_next->m_expiry) != std::cv_status::timeout) continue;
+
+        if (!l_next->m_active || l_next->m_expiry > Clock::now()) continue;
+
+        // --- fire it. Callbacks run without the lock so they may use the timer API
+
+        if (l_next->m_autoreload)
+            l_next->m_expiry += std::chrono::milliseconds((uint64_t)l_next->m_period * portTICK_PERIOD_MS);
+        else
+            l_next->m_active = false;
+
+        l_lock.unlock();
+        l_next->m_callback(l_next);
+        l_lock.lock();
+    }
+}
+
+TimerHandle_t xTimerCreate(const char *pcTimerName, TickType_t xTimerPeriod, UBaseType_t uxAutoReload,
+                           void *pvTimerID, TimerCallbackFunction_t pxCallbackFunction)
+{
+    HostTimer *l_timer = new HostTimer;
+
+    l_timer->m_name         = pcTimerName ? pcTimerName : "";
+    l_timer->m_period       = xTimerPeriod;
+    l_timer->m_autoreload   = uxAutoReload != pdFALSE;
+    l_timer->m_id           = pvTimerID;
+    l_timer->m_callback     = pxCallbackFunction;
+    l_timer->m_active       = false;
+
+    std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+
+    s_timers.push_back(l_timer);
+
+    if (!s_timer_thread_running)
+    {
+        s_timer_thread_running = true;
+        std::thread(TimerServiceThread).detach();
+    }
+
+    return l_timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+
+    xTimer->m_active = true;
+    xTimer->m_expiry = Clock::now() + std::chrono::milliseconds((uint64_t)xTimer->m_period * portTICK_PERIOD_MS);
+
+    s_timer_cv.notify_all();
+
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    return xTimerStart(xTimer, xTicksToWait);
+}
+
+BaseType_t xTimerStop(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+
+    xTimer->m_active = false;
+    s_timer_cv.notify_all();
+
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t xTimer, TickType_t xNewPeriod, TickType_t xTicksToWait)
+{
+    {
+        std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+        xTimer->m_period = xNewPeriod;
+    }
+
+    // --- like on FreeRTOS, changing the period also starts the timer
+
+    return xTimerStart(xTimer, xTicksToWait);
+}
+
+BaseType_t xTimerDelete(TimerHandle_t xTimer, TickType_t xTicksToWait)
+{
+    std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+
+    for (auto l_it = s_timers.begin(); l_it != s_timers.end(); ++l_it)
+    {
+        if (*l_it == xTimer) 
+        {
+            s_timers.erase(l_it);
+            break;
+        }
+    }
+
+    s_timer_cv.notify_all();
+
+    // --- the timer may still be in its callback, so it is leaked on purpose
+
+    return pdPASS;
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t xTimer)
+{
+    std::lock_guard<std::mutex> l_lock(s_timer_mutex);
+
+    return xTimer->m_active ? pdTRUE : pdFALSE;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t xTimer)
+{
+    return xTimer->m_id;
+}
@@ -0,0 +1,237 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- esp_http_client on top of BSD sockets, HTTP/1.0 with Connection: close
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "esp_http_client.h"
+#include "esp_log.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "host_http_client";
+
+static const char *s_methods[] = { "GET", "POST", "PUT", "PATCH", "DELETE", "HEAD" };
+
+struct esp_http_client
+{
+    std::string                 m_host;
+    std::string                 m_port;
+    std::string                 m_path;
+    esp_http_client_method_t    m_method;
+    int                         m_timeout_ms;
+    std::string                 m_headers;
+    std::string                 m_body;
+    int                         m_status;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- split http://host:port/path into its parts
+
+static bool ParseUrl(const char *f_url, esp_http_client *f_client)
+{
+    std::string l_rest = f_url;
+
+    if (l_rest.compare(0, 7, "http://"))
+    {
+        ESP_LOGE(TAG, "Only http:// is supported: %s", f_url);
+        return false;
+    }
+
+    l_rest = l_rest.substr(7);
+
+    size_t l_pos = l_rest.find('/');
+
+    f_client->m_path = l_pos != std::string::npos ? l_rest.substr(l_pos) : "/";
+    if (l_pos != std::string::npos) l_rest = l_rest.substr(0, l_pos);
+
+    f_client->m_port = "80";
+    l_pos = l_rest.rfind(':');
+
+    if (l_pos != std::string::npos)
+    {
+        f_client->m_port = l_rest.substr(l_pos + 1);
+        l_rest = l_rest.substr(0, l_pos);
+    }
+
+    f_client->m_host = l_rest;
+
+    return !l_rest.empty();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    if (!config || !config->url) return NULL;
+
+    esp_http_client *l_client = new esp_http_client;
+
+    if (!ParseUrl(config->url, l_client))
+    {
+        delete l_client;
+        return NULL;
+    }
+
+    l_client->m_method      = config->method;
+    l_client->m_timeout_ms  = config->timeout_ms ? config->timeout_ms : 5000;
+    l_client->m_status      = 0;
+
+    return l_client;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    if (!client || !key || !value) return ESP_ERR_INVALID_ARG;
+
+    client->m_headers += key;
+    client->m_headers += ": ";
+    client->m_headers += value;
+    client->m_headers += "\r\n";
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char *data, int len)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    client->m_body.assign(data ? data : "", data ? len : 0);
+
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    struct addrinfo l_hints;
+    memset(&l_hints, 0, sizeof(l_hints));
+
+    l_hints.ai_family   = AF_UNSPEC;
+    l_hints.ai_socktype = SOCK_STREAM;
+
+    struct addrinfo *l_addr = NULL;
+
+    if (getaddrinfo(client->m_host.c_str(), client->m_port.c_str(), &l_hints, &l_addr) || !l_addr)
+    {
+        ESP_LOGE(TAG, "Cannot resolve %s", client->m_host.c_str());
+        return ESP_FAIL;
+    }
+
+    int l_fd = socket(l_addr->ai_family, l_addr->ai_socktype, l_addr->ai_protocol);
+
+    struct timeval l_tv;
+    l_tv.tv_sec     = client->m_timeout_ms / 1000;
+    l_tv.tv_usec    = (client->m_timeout_ms % 1000) * 1000;
+
+    if (l_fd >= 0)
+    {
+        setsockopt(l_fd, SOL_SOCKET, SO_RCVTIMEO, &l_tv, sizeof(l_tv));
+        setsockopt(l_fd, SOL_SOCKET, SO_SNDTIMEO, &l_tv, sizeof(l_tv));
+    }
+
+    if (l_fd < 0 || connect(l_fd, l_addr->ai_addr, l_addr->ai_addrlen))
+    {
+        ESP_LOGE(TAG, "Cannot connect to %s:%s", client->m_host.c_str(), client->m_port.c_str());
+
+        if (l_fd >= 0) close(l_fd);
+        freeaddrinfo(l_addr);
+        return ESP_FAIL;
+    }
+
+    freeaddrinfo(l_addr);
+
+    char l_line[32];
+    snprintf(l_line, sizeof(l_line), "%zu", client->m_body.size());
+
+    std::string l_req = s_methods[client->m_method];
+    l_req += " " + client->m_path + " HTTP/1.0\r\nHost: " + client->m_host + "\r\n";
+    l_req += client->m_headers;
+    l_req += "Content-Length: ";
+    l_req += l_line;
+    l_req += "\r\nConnection: close\r\n\r\n";
+    l_req += client->m_body;
+
+    size_t l_sent = 0;
+
+    while (l_sent < l_req.size())
+    {
+        ssize_t l_len = send(l_fd, l_req.data() + l_sent, l_req.size() - l_sent, MSG_NOSIGNAL);
+        if (l_len <= 0) break;
+        l_sent += l_len;
+    }
+
+    // --- the status line is all we want: HTTP/1.x <code> ...
+
+    char l_resp[64];
+    ssize_t l_len = l_sent == l_req.size() ? recv(l_fd, l_resp, sizeof(l_resp) - 1, 0) : -1;
+
+    close(l_fd);
+
+    if (l_len <= 0)
+    {
+        ESP_LOGE(TAG, "No response from %s:%s", client->m_host.c_str(), client->m_port.c_str());
+        return ESP_ERR_TIMEOUT;
+    }
+
+    l_resp[l_len] = '\0';
+
+    const char *l_code = strchr(l_resp, ' ');
+    client->m_status = l_code ? atoi(l_code + 1) : 0;
+
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client ? client->m_status : -1;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    delete client;
+
+    return ESP_OK;
+}
@@ -0,0 +1,591 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- esp_http_server on top of BSD sockets. Supports keep-alive, Content-Length
+// --- bodies and chunked responses - enough for the REST API and the web UI.
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "esp_http_server.h"
+#include "esp_log.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "host_httpd";
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostUriHandler
+{
+    std::string     m_uri;
+    httpd_uri_t     m_def;
+};
+
+struct HostHttpd
+{
+    int                             m_listen_fd;
+    httpd_config_t                  m_config;
+    std::vector<HostUriHandler>     m_handlers;
+
+    // --- handlers run one at a time like in the single httpd task
+
+    std::mutex                      m_handler_mutex;
+};
+
+// --- per request state, hung into httpd_req_t::aux
+
+struct HostReqAux
+{
+    int                                             m_fd;
+
+    std::string                                     m_pending;      // body bytes read together with the header
+    size_t                                          m_body_left;    // body bytes still in the socket
+
+    std::string                                     m_status;
+    std::string                                     m_type;
+    std::vector<std::pair<std::string,std::string>> m_headers;
+
+    bool                                            m_headers_sent;
+    bool                                            m_chunked;
+    bool                                            m_close;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static bool SendAll(int f_fd, const char *f_data, size_t f_len)
+{
+    while (f_len)
+    {
+        ssize_t l_sent = send(f_fd, f_data, f_len, MSG_NOSIGNAL);
+
+        if (l_sent < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        f_data  += l_sent;
+        f_len   -= l_sent;
+    }
+
+    return true;
+}
+
+static std::string BuildHeader(HostReqAux *f_aux, const char *f_length_hdr)
+{
+    std::string l_hdr = "HTTP/1.1 " + f_aux->m_status + "\r\n";
+
+    l_hdr += "Content-Type: " + f_aux->m_type + "\r\n";
+    l_hdr += f_length_hdr;
+
+    for (auto &l_h : f_aux->m_headers) l_hdr += l_h.first + ": " + l_h.second + "\r\n";
+
+    if (f_aux->m_close) l_hdr += "Connection: close\r\n";
+
+    l_hdr += "\r\n";
+
+    return l_hdr;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool httpd_uri_match_wildcard(const char *uri_template, const char *uri_to_match, size_t match_upto)
+{
+    size_t l_tpl_len = strlen(uri_template);
+
+    // --- a trailing '*' matches any rest, a '?' before it makes the last char optional
+
+    if (l_tpl_len && uri_template[l_tpl_len - 1] == '*')
+    {
+        size_t l_prefix = l_tpl_len - 1;
+
+        if (l_prefix && uri_template[l_prefix - 1] == '?')
+        {
+            --l_prefix;
+
+            if (match_upto == l_prefix - 1 && strncmp(uri_template, uri_to_match, l_prefix - 1) == 0) return true;
+        }
+
+        return match_upto >= l_prefix && strncmp(uri_template, uri_to_match, l_prefix) == 0;
+    }
+
+    return l_tpl_len == match_upto && strncmp(uri_template, uri_to_match, match_upto) == 0;
+}
+
+static bool UriMatches(HostHttpd *f_srv, const char *f_tpl, const char *f_uri, size_t f_len)
+{
+    if (f_srv->m_config.uri_match_fn) return f_srv->m_config.uri_match_fn(f_tpl, f_uri, f_len);
+
+    return strlen(f_tpl) == f_len && strncmp(f_tpl, f_uri, f_len) == 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int ParseMethod(const char *f_m)
+{
+    if (strcmp(f_m, "GET") == 0)        return HTTP_GET;
+    if (strcmp(f_m, "POST") == 0)       return HTTP_POST;
+    if (strcmp(f_m, "PUT") == 0)        return HTTP_PUT;
+    if (strcmp(f_m, "PATCH") == 0)      return HTTP_PATCH;
+    if (strcmp(f_m, "DELETE") == 0)     return HTTP_DELETE;
+    if (strcmp(f_m, "HEAD") == 0)       return HTTP_HEAD;
+    if (strcmp(f_m, "OPTIONS") == 0)    return HTTP_OPTIONS;
+
+    return -1;
+}
+
+static void ConnectionThread(HostHttpd *f_srv, int f_fd)
+{
+    std::string l_buf;
+    char l_chunk[2048];
+
+    for (;;)
+    {
+        // --- read the request header
+
+        size_t l_hdr_end;
+
+        while ((l_hdr_end = l_buf.find("\r\n\r\n")) == std::string::npos)
+        {
+            ssize_t l_len = recv(f_fd, l_chunk, sizeof(l_chunk), 0);
+
+            if (l_len <= 0 || l_buf.size() > 16384)
+            {
+                close(f_fd);
+                return;
+            }
+
+            l_buf.append(l_chunk, l_len);
+        }
+
+        std::string l_header = l_buf.substr(0, l_hdr_end);
+        l_buf.erase(0, l_hdr_end + 4);
+
+        // --- request line
+
+        char l_method[16], l_uri[HTTPD_MAX_URI_LEN + 1], l_version[16];
+
+        if (sscanf(l_header.c_str(), "%15s %512s %15s", l_method, l_uri, l_version) != 3)
+        {
+            close(f_fd);
+            return;
+        }
+
+        // --- the few header fields we care about
+
+        size_t  l_content_len   = 0;
+        bool    l_close         = strcmp(l_version, "HTTP/1.0") == 0;
+
+        size_t l_pos = l_header.find("\r\n");
+
+        while (l_pos != std::string::npos)
+        {
+            size_t l_next = l_header.find("\r\n", l_pos + 2);
+            std::string l_line = l_header.substr(l_pos + 2, l_next == std::string::npos ? std::string::npos : l_next - l_pos - 2);
+
+            if (strncasecmp(l_line.c_str(), "Content-Length:", 15) == 0) l_content_len = strtoul(l_line.c_str() + 15, NULL, 10);
+            if (strncasecmp(l_line.c_str(), "Connection:", 11) == 0) l_close = strcasestr(l_line.c_str() + 11, "close") != NULL;
+
+            l_pos = l_next;
+        }
+
+        // --- build the request
+
+        HostReqAux l_aux;
+
+        l_aux.m_fd              = f_fd;
+        l_aux.m_status          = HTTPD_200;
+        l_aux.m_type            = "text/html";
+        l_aux.m_headers_sent    = false;
+        l_aux.m_chunked         = false;
+        l_aux.m_close           = l_close;
+
+        size_t l_in_buf = l_buf.size() < l_content_len ? l_buf.size() : l_content_len;
+
+        l_aux.m_pending     = l_buf.substr(0, l_in_buf);
+        l_aux.m_body_left   = l_content_len - l_in_buf;
+        l_buf.erase(0, l_in_buf);
+
+        // --- uri is a const array like on the device, so the request is not default constructible
+
+        httpd_req_t *l_reqp = (httpd_req_t *)calloc(1, sizeof(httpd_req_t));
+        httpd_req_t &l_req = *l_reqp;
+
+        l_req.handle        = f_srv;
+        l_req.method        = ParseMethod(l_method);
+        l_req.content_len   = l_content_len;
+        l_req.aux           = &l_aux;
+
+        size_t l_uri_len = std::min(strlen(l_uri), (size_t)HTTPD_MAX_URI_LEN);
+
+        memcpy((char *)l_req.uri, l_uri, l_uri_len);
+        ((char *)l_req.uri)[l_uri_len] = 0;
+
+        const char *l_query = strchr(l_uri, '?');
+        size_t l_match_len = l_query ? (size_t)(l_query - l_uri) : strlen(l_uri);
+
+        // --- find the handler and run it
+
+        const HostUriHandler *l_handler = NULL;
+
+        for (const HostUriHandler &l_h : f_srv->m_handlers)
+        {
+            if (l_h.m_def.method == l_req.method && UriMatches(f_srv, l_h.m_uri.c_str(), l_uri, l_match_len))
+            {
+                l_handler = &l_h;
+                break;
+            }
+        }
+
+        esp_err_t l_err;
+
+        {
+            std::lock_guard<std::mutex> l_lock(f_srv->m_handler_mutex);
+
+            if (l_handler)
+            {
+                l_req.user_ctx = l_handler->m_def.user_ctx;
+                l_err = l_handler->m_def.handler(&l_req);
+            }
+            else
+            {
+                httpd_resp_send_err(&l_req, HTTPD_404_NOT_FOUND, "Nothing matches the given URI");
+                l_err = ESP_OK;
+            }
+        }
+
+        free(l_reqp);
+
+        // --- like esp_http_server: a failing handler closes the connection
+
+        if (l_err != ESP_OK || l_aux.m_close)
+        {
+            close(f_fd);
+            return;
+        }
+
+        // --- drop what the handler did not read
+
+        while (l_aux.m_body_left)
+        {
+            ssize_t l_len = recv(f_fd, l_chunk, l_aux.m_body_left < sizeof(l_chunk) ? l_aux.m_body_left : sizeof(l_chunk), 0);
+
+            if (l_len <= 0)
+            {
+                close(f_fd);
+                return;
+            }
+
+            l_aux.m_body_left -= l_len;
+        }
+    }
+}
+
+static void AcceptThread(HostHttpd *f_srv)
+{
+    for (;;)
+    {
+        int l_fd = accept(f_srv->m_listen_fd, NULL, NULL);
+
+        if (l_fd < 0)
+        {
+            if (errno == EINTR) continue;
+            ESP_LOGE(TAG, "accept failed: %s", strerror(errno));
+            return;
+        }
+
+        int l_one = 1;
+        setsockopt(l_fd, IPPROTO_TCP, TCP_NODELAY, &l_one, sizeof(l_one));
+
+        std::thread(ConnectionThread, f_srv, l_fd).detach();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
+{
+    HostHttpd *l_srv = new HostHttpd;
+
+    l_srv->m_config = *config;
+
+    const char *l_env = getenv("DUSTLOGGER_HTTP_PORT");
+    int l_port = l_env ? atoi(l_env) : config->server_port + 8000;
+
+    l_srv->m_listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    int l_one = 1;
+    setsockopt(l_srv->m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &l_one, sizeof(l_one));
+
+    struct sockaddr_in l_addr;
+    memset(&l_addr, 0, sizeof(l_addr));
+
+    l_addr.sin_family       = AF_INET;
+    l_addr.sin_port         = htons(l_port);
+    l_addr.sin_addr.s_addr  = htonl(INADDR_LOOPBACK);
+
+    if (bind(l_srv->m_listen_fd, (struct sockaddr *)&l_addr, sizeof(l_addr)) < 0 || listen(l_srv->m_listen_fd, 64) < 0)
+    {
+        ESP_LOGE(TAG, "Cannot listen on port %d: %s", l_port, strerror(errno));
+        close(l_srv->m_listen_fd);
+        delete l_srv;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Listening on http://127.0.0.1:%d/", l_port);
+
+    std::thread(AcceptThread, l_srv).detach();
+
+    *handle = l_srv;
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    HostHttpd *l_srv = (HostHttpd *)handle;
+
+    if (!l_srv) return ESP_ERR_INVALID_ARG;
+
+    shutdown(l_srv->m_listen_fd, SHUT_RDWR);
+
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    HostHttpd *l_srv = (HostHttpd *)handle;
+
+    if (!l_srv || !uri_handler) return ESP_ERR_INVALID_ARG;
+
+    if (l_srv->m_handlers.size() >= l_srv->m_config.max_uri_handlers)
+    {
+        ESP_LOGE(TAG, "No slot left for registering handler %s", uri_handler->uri);
+        return ESP_ERR_NO_MEM;
+    }
+
+    HostUriHandler l_h;
+
+    l_h.m_uri       = uri_handler->uri;
+    l_h.m_def       = *uri_handler;
+    l_h.m_def.uri   = NULL;
+
+    std::lock_guard<std::mutex> l_lock(l_srv->m_handler_mutex);
+    l_srv->m_handlers.push_back(l_h);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int httpd_req_recv(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    HostReqAux *l_aux = (HostReqAux *)r->aux;
+
+    if (!l_aux->m_pending.empty())
+    {
+        size_t l_len = l_aux->m_pending.size() < buf_len ? l_aux->m_pending.size() : buf_len;
+
+        memcpy(buf, l_aux->m_pending.data(), l_len);
+        l_aux->m_pending.erase(0, l_len);
+
+        return (int)l_len;
+    }
+
+    if (!l_aux->m_body_left) return 0;
+
+    ssize_t l_len = recv(l_aux->m_fd, buf, buf_len < l_aux->m_body_left ? buf_len : l_aux->m_body_left, 0);
+    if (l_len <= 0) return -1;
+
+    l_aux->m_body_left -= l_len;
+
+    return (int)l_len;
+}
+
+size_t httpd_req_get_url_query_len(httpd_req_t *r)
+{
+    const char *l_q = strchr(r->uri, '?');
+
+    return l_q ? strlen(l_q + 1) : 0;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *r, char *buf, size_t buf_len)
+{
+    const char *l_q = strchr(r->uri, '?');
+
+    if (!l_q) return ESP_ERR_NOT_FOUND;
+
+    strncpy(buf, l_q + 1, buf_len);
+    buf[buf_len - 1] = '\0';
+
+    return strlen(l_q + 1) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t l_keylen = strlen(key);
+    const char *l_p = qry;
+
+    while (l_p && *l_p)
+    {
+        const char *l_end = strchr(l_p, '&');
+        size_t l_len = l_end ? (size_t)(l_end - l_p) : strlen(l_p);
+
+        if (l_len > l_keylen && strncmp(l_p, key, l_keylen) == 0 && l_p[l_keylen] == '=')
+        {
+            size_t l_vlen = l_len - l_keylen - 1;
+            size_t l_copy = l_vlen < val_size - 1 ? l_vlen : val_size - 1;
+
+            memcpy(val, l_p + l_keylen + 1, l_copy);
+            val[l_copy] = '\0';
+
+            return l_vlen < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+
+        l_p = l_end ? l_end + 1 : NULL;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t httpd_resp_set_status(httpd_req_t *r, const char *status)
+{
+    ((HostReqAux *)r->aux)->m_status = status;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    ((HostReqAux *)r->aux)->m_type = type;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t *r, const char *field, const char *value)
+{
+    ((HostReqAux *)r->aux)->m_headers.push_back(std::make_pair(std::string(field), std::string(value)));
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    HostReqAux *l_aux = (HostReqAux *)r->aux;
+
+    if (buf_len == HTTPD_RESP_USE_STRLEN) buf_len = buf ? strlen(buf) : 0;
+
+    char l_length[64];
+    snprintf(l_length, sizeof(l_length), "Content-Length: %zd\r\n", buf_len);
+
+    std::string l_resp = BuildHeader(l_aux, l_length);
+    l_resp.append(buf ? buf : "", buf_len);
+
+    l_aux->m_headers_sent = true;
+
+    return SendAll(l_aux->m_fd, l_resp.data(), l_resp.size()) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len)
+{
+    HostReqAux *l_aux = (HostReqAux *)r->aux;
+
+    if (buf_len == HTTPD_RESP_USE_STRLEN) buf_len = buf ? strlen(buf) : 0;
+
+    std::string l_out;
+
+    if (!l_aux->m_headers_sent)
+    {
+        l_out = BuildHeader(l_aux, "Transfer-Encoding: chunked\r\n");
+
+        l_aux->m_headers_sent   = true;
+        l_aux->m_chunked        = true;
+    }
+
+    char l_size[32];
+    snprintf(l_size, sizeof(l_size), "%zx\r\n", buf_len);
+
+    l_out += l_size;
+    if (buf_len) l_out.append(buf, buf_len);
+    l_out += "\r\n";
+
+    return SendAll(l_aux->m_fd, l_out.data(), l_out.size()) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    const char *l_status;
+
+    switch (error)
+    {
+        case HTTPD_400_BAD_REQUEST:             l_status = HTTPD_400; break;
+        case HTTPD_404_NOT_FOUND:               l_status = HTTPD_404; break;
+        case HTTPD_405_METHOD_NOT_ALLOWED:      l_status = "405 Method Not Allowed"; break;
+        case HTTPD_408_REQ_TIMEOUT:             l_status = "408 Request Timeout"; break;
+        case HTTPD_501_METHOD_NOT_IMPLEMENTED:  l_status = "501 Method Not Implemented"; break;
+        default:                                l_status = HTTPD_500; break;
+    }
+
+    HostReqAux *l_aux = (HostReqAux *)req->aux;
+
+    // --- an error in the middle of a chunked response can only close the connection
+
+    if (l_aux->m_headers_sent)
+    {
+        l_aux->m_close = true;
+        return ESP_OK;
+    }
+
+    l_aux->m_headers.clear();
+
+    httpd_resp_set_status(req, l_status);
+    httpd_resp_set_type(req, "text/html");
+
+    return httpd_resp_send(req, msg, HTTPD_RESP_USE_STRLEN);
+}
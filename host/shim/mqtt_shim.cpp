@@ -0,0 +1,345 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- esp-mqtt client API. Publishes go to libmosquitto when HOST_HAVE_MOSQUITTO is
+// --- set, otherwise they are only logged.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+#ifdef HOST_HAVE_MOSQUITTO
+#include <mosquitto.h>
+#endif
+
+#include "esp_log.h"
+#include "mqtt_client.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "host_mqtt";
+
+static std::atomic<uint32_t>    s_publishes(0);
+static std::atomic<uint64_t>    s_bytes(0);
+static std::atomic<uint32_t>    s_connects(0);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct esp_mqtt_client
+{
+    std::string         m_uri;
+    std::string         m_client_id;
+    int                 m_keepalive;
+    bool                m_started;
+    int                 m_next_msg_id;
+    std::mutex          m_mutex;
+
+    esp_event_handler_t m_handler;
+    void               *m_handler_arg;
+
+#ifdef HOST_HAVE_MOSQUITTO
+    struct mosquitto   *m_mosq;
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- like esp-mqtt the handler gets the events on the client's own thread (with libmosquitto)
+// --- or, without a broker, directly on the calling thread. Never called with the lock held
+
+static void Dispatch(esp_mqtt_client *f_client, esp_mqtt_event_id_t f_id, int f_msg_id)
+{
+    if (!f_client->m_handler) return;
+
+    esp_mqtt_event_t l_event;
+    memset(&l_event, 0, sizeof(l_event));
+
+    l_event.event_id    = f_id;
+    l_event.client      = f_client;
+    l_event.msg_id      = f_msg_id;
+
+    f_client->m_handler(f_client->m_handler_arg, "MQTT_EVENTS", f_id, &l_event);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef HOST_HAVE_MOSQUITTO
+
+static void prvOnConnect(struct mosquitto *f_mosq, void *f_obj, int f_rc)
+{
+    Dispatch((esp_mqtt_client *)f_obj, f_rc == 0 ? MQTT_EVENT_CONNECTED : MQTT_EVENT_ERROR, 0);
+}
+
+static void prvOnDisconnect(struct mosquitto *f_mosq, void *f_obj, int f_rc)
+{
+    Dispatch((esp_mqtt_client *)f_obj, MQTT_EVENT_DISCONNECTED, 0);
+}
+
+static void prvOnPublish(struct mosquitto *f_mosq, void *f_obj, int f_mid)
+{
+    Dispatch((esp_mqtt_client *)f_obj, MQTT_EVENT_PUBLISHED, f_mid);
+}
+
+// --- split mqtt://host:port into its parts
+
+static void ParseUri(const std::string &f_uri, std::string &f_host, int &f_port)
+{
+    std::string l_rest = f_uri;
+    size_t l_pos = l_rest.find("://");
+
+    if (l_pos != std::string::npos) l_rest = l_rest.substr(l_pos + 3);
+
+    l_pos = l_rest.find('/');
+    if (l_pos != std::string::npos) l_rest = l_rest.substr(0, l_pos);
+
+    f_port = 1883;
+    l_pos = l_rest.rfind(':');
+
+    if (l_pos != std::string::npos)
+    {
+        f_port = atoi(l_rest.c_str() + l_pos + 1);
+        l_rest = l_rest.substr(0, l_pos);
+    }
+
+    f_host = l_rest;
+}
+
+static esp_err_t Connect(esp_mqtt_client *f_client)
+{
+    std::string l_host;
+    int l_port;
+
+    ParseUri(f_client->m_uri, l_host, l_port);
+
+    // --- like esp-mqtt we keep on trying in the background when the broker is away
+
+    int l_rc = mosquitto_connect_async(f_client->m_mosq, l_host.c_str(), l_port, f_client->m_keepalive);
+
+    if (l_rc != MOSQ_ERR_SUCCESS && l_rc != MOSQ_ERR_ERRNO)
+    {
+        ESP_LOGE(TAG, "Cannot connect to %s:%d: %s", l_host.c_str(), l_port, mosquitto_strerror(l_rc));
+        return ESP_FAIL;
+    }
+
+    ++s_connects;
+
+    return ESP_OK;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t *config)
+{
+    esp_mqtt_client *l_client = new esp_mqtt_client;
+
+    l_client->m_uri         = config->uri ? config->uri : "";
+    l_client->m_client_id   = config->client_id ? config->client_id : "dustlogger-host";
+    l_client->m_keepalive   = config->keepalive ? config->keepalive : 120;
+    l_client->m_started     = false;
+    l_client->m_next_msg_id = 0;
+    l_client->m_handler     = NULL;
+    l_client->m_handler_arg = NULL;
+
+#ifdef HOST_HAVE_MOSQUITTO
+    mosquitto_lib_init();
+
+    l_client->m_mosq = mosquitto_new(l_client->m_client_id.c_str(), true, l_client);
+
+    if (!l_client->m_mosq)
+    {
+        delete l_client;
+        return NULL;
+    }
+
+    mosquitto_reconnect_delay_set(l_client->m_mosq, 2, 30, true);
+
+    mosquitto_connect_callback_set(l_client->m_mosq, prvOnConnect);
+    mosquitto_disconnect_callback_set(l_client->m_mosq, prvOnDisconnect);
+    mosquitto_publish_callback_set(l_client->m_mosq, prvOnPublish);
+#endif
+
+    return l_client;
+}
+
+esp_err_t esp_mqtt_client_set_uri(esp_mqtt_client_handle_t client, const char *uri)
+{
+    if (!client || !uri) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(client->m_mutex);
+
+    if (client->m_uri == uri) return ESP_OK;
+
+    client->m_uri = uri;
+
+#ifdef HOST_HAVE_MOSQUITTO
+    if (client->m_started)
+    {
+        mosquitto_disconnect(client->m_mosq);
+        return Connect(client);
+    }
+#endif
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event, esp_event_handler_t event_handler, void *event_handler_arg)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    // --- one handler for all events is all the firmware needs
+
+    if (event != MQTT_EVENT_ANY) return ESP_ERR_NOT_SUPPORTED;
+
+    std::lock_guard<std::mutex> l_lock(client->m_mutex);
+
+    client->m_handler       = event_handler;
+    client->m_handler_arg   = event_handler_arg;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    {
+        std::lock_guard<std::mutex> l_lock(client->m_mutex);
+
+        if (client->m_started) return ESP_FAIL;
+
+#ifdef HOST_HAVE_MOSQUITTO
+        if (Connect(client) != ESP_OK) return ESP_FAIL;
+
+        mosquitto_loop_start(client->m_mosq);
+#else
+        ++s_connects;
+#endif
+
+        client->m_started = true;
+    }
+
+#ifndef HOST_HAVE_MOSQUITTO
+    Dispatch(client, MQTT_EVENT_CONNECTED, 0);
+#endif
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(client->m_mutex);
+
+    if (!client->m_started) return ESP_FAIL;
+
+#ifdef HOST_HAVE_MOSQUITTO
+    mosquitto_disconnect(client->m_mosq);
+    mosquitto_loop_stop(client->m_mosq, false);
+#endif
+
+    client->m_started = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_destroy(esp_mqtt_client_handle_t client)
+{
+    if (!client) return ESP_ERR_INVALID_ARG;
+
+    if (client->m_started) esp_mqtt_client_stop(client);
+
+#ifdef HOST_HAVE_MOSQUITTO
+    mosquitto_destroy(client->m_mosq);
+#endif
+
+    delete client;
+
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char *topic, const char *data, int len, int qos, int retain)
+{
+    if (!client || !topic) return -1;
+
+    if (len == 0 && data) len = strlen(data);
+
+    std::unique_lock<std::mutex> l_lock(client->m_mutex);
+
+    if (!client->m_started) return -1;
+
+    // --- QoS 1 adds the message id to the header and a PUBACK (4 bytes) from the broker
+
+    ++s_publishes;
+    s_bytes += 2 + 2 + strlen(topic) + len + (qos > 0 ? 2 + 4 : 0);
+
+#ifdef HOST_HAVE_MOSQUITTO
+    int l_mid = 0;
+
+    int l_rc = mosquitto_publish(client->m_mosq, &l_mid, topic, len, data, qos, retain != 0);
+
+    if (l_rc != MOSQ_ERR_SUCCESS)
+    {
+        ESP_LOGW(TAG, "Publish to %s failed: %s", topic, mosquitto_strerror(l_rc));
+        return -1;
+    }
+
+    return l_mid;
+#else
+    ESP_LOGI(TAG, "publish %s (%d bytes): %.*s", topic, len, len, data ? data : "");
+
+    if (!qos) return 0;
+
+    int l_msg_id = ++client->m_next_msg_id;
+
+    l_lock.unlock();
+    Dispatch(client, MQTT_EVENT_PUBLISHED, l_msg_id);
+
+    return l_msg_id;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void host_mqtt_get_stats(host_mqtt_stats_t *stats)
+{
+    stats->publishes    = s_publishes;
+    stats->bytes        = s_bytes;
+    stats->connects     = s_connects;
+}
@@ -0,0 +1,325 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- NVS in a text file: one entry per line "<namespace> <key> <type> <hex data>".
+// --- The whole file is rewritten on every change, which is fine for a handful of keys.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "nvs.h"
+#include "nvs_flash.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct NvsEntry
+{
+    char        m_type;     // 'i' int32, 's' string, 'b' blob
+    std::string m_data;
+};
+
+typedef std::map<std::string, NvsEntry> NvsNamespace;
+
+static std::mutex                           s_nvs_mutex;
+static bool                                 s_nvs_initialized = false;
+static std::map<std::string, NvsNamespace>  s_nvs;
+static std::vector<std::string>             s_handles;      // handle - 1 -> namespace
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *NvsFileName(void)
+{
+    const char *l_env = getenv("DUSTLOGGER_NVS");
+
+    return l_env ? l_env : "dustlogger_nvs.txt";
+}
+
+static std::string ToHex(const std::string &f_data)
+{
+    static const char l_hex[] = "0123456789abcdef";
+    std::string l_s;
+
+    for (unsigned char c : f_data)
+    {
+        l_s += l_hex[c >> 4];
+        l_s += l_hex[c & 15];
+    }
+
+    return l_s.empty() ? "-" : l_s;
+}
+
+static std::string FromHex(const char *f_s)
+{
+    std::string l_data;
+
+    if (strcmp(f_s, "-") == 0) return l_data;
+
+    for (size_t i = 0; f_s[i] && f_s[i+1]; i += 2)
+    {
+        char l_byte[3] = { f_s[i], f_s[i+1], 0 };
+        l_data += (char)strtoul(l_byte, NULL, 16);
+    }
+
+    return l_data;
+}
+
+static void LoadFile(void)
+{
+    s_nvs.clear();
+
+    FILE *l_f = fopen(NvsFileName(), "r");
+    if (!l_f) return;
+
+    char l_ns[64], l_key[64], l_type[4];
+    static char l_hex[2 * 65536 + 2];
+
+    while (fscanf(l_f, "%63s %63s %3s %131073s", l_ns, l_key, l_type, l_hex) == 4)
+    {
+        NvsEntry &l_e = s_nvs[l_ns][l_key];
+
+        l_e.m_type = l_type[0];
+        l_e.m_data = FromHex(l_hex);
+    }
+
+    fclose(l_f);
+}
+
+static void SaveFile(void)
+{
+    std::string l_tmpname = std::string(NvsFileName()) + ".tmp";
+
+    FILE *l_f = fopen(l_tmpname.c_str(), "w");
+    if (!l_f) return;
+
+    for (auto &l_ns : s_nvs)
+    {
+        for (auto &l_e : l_ns.second)
+        {
+            fprintf(l_f, "%s %s %c %s\n", l_ns.first.c_str(), l_e.first.c_str(), l_e.second.m_type, ToHex(l_e.second.m_data).c_str());
+        }
+    }
+
+    fclose(l_f);
+
+    // --- atomic replace, like a flash page write
+
+    rename(l_tmpname.c_str(), NvsFileName());
+}
+
+static NvsNamespace *GetNamespace(nvs_handle_t f_handle)
+{
+    if (!s_nvs_initialized || f_handle == 0 || f_handle > s_handles.size()) return NULL;
+
+    return &s_nvs[s_handles[f_handle - 1]];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t nvs_flash_init(void)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    if (!s_nvs_initialized)
+    {
+        LoadFile();
+        s_nvs_initialized = true;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_deinit(void)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    s_nvs_initialized = false;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    s_nvs.clear();
+    SaveFile();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    if (!s_nvs_initialized) return ESP_ERR_NVS_NOT_INITIALIZED;
+
+    s_handles.push_back(name);
+    *out_handle = s_handles.size();
+
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t SetEntry(nvs_handle_t f_handle, const char *f_key, char f_type, const std::string &f_data)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    NvsNamespace *l_ns = GetNamespace(f_handle);
+    if (!l_ns) return ESP_ERR_NVS_NOT_INITIALIZED;
+
+    if (strlen(f_key) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_INVALID_ARG;
+
+    NvsEntry &l_e = (*l_ns)[f_key];
+
+    l_e.m_type = f_type;
+    l_e.m_data = f_data;
+
+    SaveFile();
+
+    return ESP_OK;
+}
+
+static esp_err_t GetEntry(nvs_handle_t f_handle, const char *f_key, char f_type, std::string &f_data)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    NvsNamespace *l_ns = GetNamespace(f_handle);
+    if (!l_ns) return ESP_ERR_NVS_NOT_INITIALIZED;
+
+    auto l_it = l_ns->find(f_key);
+    if (l_it == l_ns->end()) return ESP_ERR_NVS_NOT_FOUND;
+
+    if (l_it->second.m_type != f_type) return ESP_ERR_NVS_TYPE_MISMATCH;
+
+    f_data = l_it->second.m_data;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return SetEntry(handle, key, 'i', std::string((const char *)&value, sizeof(value)));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+    std::string l_data;
+
+    esp_err_t l_err = GetEntry(handle, key, 'i', l_data);
+    if (l_err != ESP_OK) return l_err;
+
+    memcpy(out_value, l_data.data(), sizeof(int32_t));
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char *key, const char *value)
+{
+    return SetEntry(handle, key, 's', value);
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char *key, char *out_value, size_t *length)
+{
+    std::string l_data;
+
+    esp_err_t l_err = GetEntry(handle, key, 's', l_data);
+    if (l_err != ESP_OK) return l_err;
+
+    // --- like NVS: the length includes the terminating zero
+
+    if (out_value)
+    {
+        if (*length < l_data.length() + 1) return ESP_ERR_NVS_INVALID_LENGTH;
+
+        memcpy(out_value, l_data.c_str(), l_data.length() + 1);
+    }
+
+    *length = l_data.length() + 1;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return SetEntry(handle, key, 'b', std::string((const char *)value, length));
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    std::string l_data;
+
+    esp_err_t l_err = GetEntry(handle, key, 'b', l_data);
+    if (l_err != ESP_OK) return l_err;
+
+    if (out_value)
+    {
+        if (*length < l_data.length()) return ESP_ERR_NVS_INVALID_LENGTH;
+
+        memcpy(out_value, l_data.data(), l_data.length());
+    }
+
+    *length = l_data.length();
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    std::lock_guard<std::mutex> l_lock(s_nvs_mutex);
+
+    NvsNamespace *l_ns = GetNamespace(handle);
+    if (!l_ns) return ESP_ERR_NVS_NOT_INITIALIZED;
+
+    if (!l_ns->erase(key)) return ESP_ERR_NVS_NOT_FOUND;
+
+    SaveFile();
+
+    return ESP_OK;
+}
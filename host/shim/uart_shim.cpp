@@ -0,0 +1,359 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- UART receive path fed from a file, FIFO, pseudo terminal or host_uart_inject().
+// --- "sim[:seed][@speed]" runs the PM1006 simulator, "replay:file[@speed]" plays back a capture.
+
+#define _GNU_SOURCE 1
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "pm1006_sim.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "host_uart";
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct HostUart
+{
+    bool                        m_installed;
+    size_t                      m_rx_size;
+    QueueHandle_t               m_queue;
+
+    std::mutex                  m_mutex;
+    std::condition_variable     m_cv;
+    std::deque<uint8_t>         m_rx;
+};
+
+static HostUart s_uarts[UART_NUM_MAX];
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- append received bytes to the driver ring buffer and tell the event queue
+
+static void UartReceive(uart_port_t f_port, const uint8_t *f_data, size_t f_len)
+{
+    HostUart &l_uart = s_uarts[f_port];
+
+    uart_event_t l_event;
+    memset(&l_event, 0, sizeof(l_event));
+
+    {
+        std::lock_guard<std::mutex> l_lock(l_uart.m_mutex);
+
+        size_t l_free = l_uart.m_rx_size - l_uart.m_rx.size();
+        size_t l_take = f_len < l_free ? f_len : l_free;
+
+        l_uart.m_rx.insert(l_uart.m_rx.end(), f_data, f_data + l_take);
+        l_uart.m_cv.notify_all();
+
+        l_event.type = (l_take < f_len) ? UART_BUFFER_FULL : UART_DATA;
+        l_event.size = l_take;
+    }
+
+    if (l_uart.m_queue) xQueueSend(l_uart.m_queue, &l_event, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int OpenSource(uart_port_t f_port, const char *f_src)
+{
+    if (strcmp(f_src, "pty") == 0)
+    {
+        int l_master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (l_master < 0 || grantpt(l_master) || unlockpt(l_master)) return -1;
+
+        // --- keep the slave open in raw mode, so writers get an 8 bit clean line and
+        // --- the master does not see EOF while nobody is connected
+
+        int l_slave = open(ptsname(l_master), O_RDWR | O_NOCTTY);
+        if (l_slave >= 0)
+        {
+            struct termios l_tio;
+            tcgetattr(l_slave, &l_tio);
+            cfmakeraw(&l_tio);
+            tcsetattr(l_slave, TCSANOW, &l_tio);
+        }
+
+        ESP_LOGI(TAG, "UART %d: pseudo terminal %s", f_port, ptsname(l_master));
+
+        return l_master;
+    }
+
+    struct stat l_st;
+    bool l_fifo = stat(f_src, &l_st) == 0 && S_ISFIFO(l_st.st_mode);
+
+    // --- a FIFO is opened read/write so it does not report EOF between writers
+
+    int l_fd = open(f_src, l_fifo ? O_RDWR : O_RDONLY);
+    if (l_fd < 0) ESP_LOGE(TAG, "UART %d: cannot open %s: %s", f_port, f_src, strerror(errno));
+
+    return l_fd;
+}
+
+static void UartReaderThread(uart_port_t f_port, int f_fd)
+{
+    uint8_t l_buf[256];
+
+    for (;;)
+    {
+        ssize_t l_len = read(f_fd, l_buf, sizeof(l_buf));
+
+        if (l_len > 0)
+        {
+            UartReceive(f_port, l_buf, l_len);
+        }
+        else if (l_len == 0 || errno == EAGAIN || errno == EIO)
+        {
+            // --- EOF of a plain file: follow it like tail -f
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        else if (errno != EINTR)
+        {
+            ESP_LOGE(TAG, "UART %d: read error %s", f_port, strerror(errno));
+            return;
+        }
+    }
+}
+
+// --- push the stream of a PM1006 source into the UART, speed 1 is real time
+
+static void UartSourceThread(uart_port_t f_port, CPm1006Source *f_source, double f_speed)
+{
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at_ms;
+
+    auto l_start = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        size_t l_len = f_source->NextChunk(l_buf, sizeof(l_buf), &l_at_ms);
+
+        if (!l_len)
+        {
+            ESP_LOGI(TAG, "UART %d: end of the replayed stream", f_port);
+            break;
+        }
+
+        std::this_thread::sleep_until(l_start + std::chrono::microseconds((int64_t)(l_at_ms * 1000.0 / f_speed)));
+
+        UartReceive(f_port, l_buf, l_len);
+    }
+
+    delete f_source;
+}
+
+static bool StartSimSource(uart_port_t f_port, const char *f_src)
+{
+    double l_speed = 1.0;
+    const char *l_at = strchr(f_src, '@');
+
+    if (l_at) l_speed = atof(l_at + 1);
+    if (l_speed <= 0.0) l_speed = 1.0;
+
+    if (strncmp(f_src, "sim", 3) == 0 && (f_src[3] == '\0' || f_src[3] == ':' || f_src[3] == '@'))
+    {
+        Pm1006SimConfig l_config;
+
+        l_config.m_seed = (f_src[3] == ':') ? strtoul(f_src + 4, NULL, 0) : f_port + 1;
+
+        CPm1006Simulator *l_sim = new CPm1006Simulator;
+        l_sim->Init(l_config);
+
+        ESP_LOGI(TAG, "UART %d: PM1006 simulator, seed %u, speed %gx", f_port, l_config.m_seed, l_speed);
+
+        std::thread(UartSourceThread, f_port, l_sim, l_speed).detach();
+        return true;
+    }
+
+    if (strncmp(f_src, "replay:", 7) == 0)
+    {
+        std::string l_path(f_src + 7, l_at ? l_at : f_src + strlen(f_src));
+
+        CPm1006Replay *l_replay = new CPm1006Replay;
+
+        if (!l_replay->Open(l_path.c_str()))
+        {
+            delete l_replay;
+            return true;
+        }
+
+        ESP_LOGI(TAG, "UART %d: replay of %s, speed %gx", f_port, l_path.c_str(), l_speed);
+
+        std::thread(UartSourceThread, f_port, l_replay, l_speed).detach();
+        return true;
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t uart_driver_install(uart_port_t uart_num, int rx_buffer_size, int tx_buffer_size, 
+                              int queue_size, QueueHandle_t *uart_queue, int intr_alloc_flags)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    HostUart &l_uart = s_uarts[uart_num];
+
+    if (l_uart.m_installed) return ESP_FAIL;
+
+    l_uart.m_installed  = true;
+    l_uart.m_rx_size    = rx_buffer_size;
+    l_uart.m_queue      = NULL;
+
+    if (queue_size > 0 && uart_queue)
+    {
+        l_uart.m_queue  = xQueueCreate(queue_size, sizeof(uart_event_t));
+        *uart_queue     = l_uart.m_queue;
+    }
+
+    // --- hook up the data source, if there is one
+
+    char l_envname[32];
+    snprintf(l_envname, sizeof(l_envname), "DUSTLOGGER_UART%d", uart_num);
+
+    const char *l_src = getenv(l_envname);
+
+    if (l_src)
+    {
+        if (!StartSimSource(uart_num, l_src))
+        {
+            int l_fd = OpenSource(uart_num, l_src);
+            if (l_fd >= 0) std::thread(UartReaderThread, uart_num, l_fd).detach();
+        }
+    }
+    else
+    {
+        ESP_LOGI(TAG, "UART %d: no %s set, only host_uart_inject() feeds it", uart_num, l_envname);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t uart_driver_delete(uart_port_t uart_num)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    s_uarts[uart_num].m_installed = false;
+
+    return ESP_OK;
+}
+
+esp_err_t uart_param_config(uart_port_t uart_num, const uart_config_t *uart_config)
+{
+    return (uart_num < 0 || uart_num >= UART_NUM_MAX) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t uart_set_pin(uart_port_t uart_num, int tx_io_num, int rx_io_num, int rts_io_num, int cts_io_num)
+{
+    return (uart_num < 0 || uart_num >= UART_NUM_MAX) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t uart_set_wakeup_threshold(uart_port_t uart_num, int wakeup_threshold)
+{
+    return (uart_num < 0 || uart_num >= UART_NUM_MAX || wakeup_threshold < 3) ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t uart_flush_input(uart_port_t uart_num)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(s_uarts[uart_num].m_mutex);
+    s_uarts[uart_num].m_rx.clear();
+
+    return ESP_OK;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX) return ESP_ERR_INVALID_ARG;
+
+    std::lock_guard<std::mutex> l_lock(s_uarts[uart_num].m_mutex);
+    *size = s_uarts[uart_num].m_rx.size();
+
+    return ESP_OK;
+}
+
+int uart_read_bytes(uart_port_t uart_num, void *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || !s_uarts[uart_num].m_installed) return -1;
+
+    HostUart &l_uart = s_uarts[uart_num];
+    std::unique_lock<std::mutex> l_lock(l_uart.m_mutex);
+
+    // --- like the driver: wait until length bytes are there or the timeout expired
+
+    auto l_pred = [&l_uart, length] { return l_uart.m_rx.size() >= length; };
+
+    if (ticks_to_wait == portMAX_DELAY)
+        l_uart.m_cv.wait(l_lock, l_pred);
+    else
+        l_uart.m_cv.wait_for(l_lock, std::chrono::milliseconds((uint64_t)ticks_to_wait * portTICK_PERIOD_MS), l_pred);
+
+    size_t l_len = l_uart.m_rx.size() < length ? l_uart.m_rx.size() : length;
+
+    std::copy(l_uart.m_rx.begin(), l_uart.m_rx.begin() + l_len, (uint8_t *)buf);
+    l_uart.m_rx.erase(l_uart.m_rx.begin(), l_uart.m_rx.begin() + l_len);
+
+    return (int)l_len;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void host_uart_inject(uart_port_t uart_num, const uint8_t *data, size_t len)
+{
+    if (uart_num < 0 || uart_num >= UART_NUM_MAX || !s_uarts[uart_num].m_installed) return;
+
+    UartReceive(uart_num, data, len);
+}
@@ -0,0 +1,148 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- evlogdump - turn the binary event log of the firmware back into text
+//
+// --- curl -s http://<device>/api/v1/evlog | evlogdump
+// --- evlogdump evlog.bin
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "evlog.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: evlogdump [file]\n"
+        "         decodes a download of /api/v1/evlog (from stdin without a file)\n");
+
+    exit(2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 || (argc == 2 && argv[1][0] == '-' && argv[1][1])) Usage();
+
+    FILE *l_in = (argc == 2 && strcmp(argv[1], "-")) ? fopen(argv[1], "rb") : stdin;
+
+    if (!l_in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+
+    // --- read it all, the ring is a few KB
+
+    std::vector<uint8_t> l_data;
+    uint8_t l_buf[4096];
+    size_t l_len;
+
+    while ((l_len = fread(l_buf, 1, sizeof(l_buf), l_in)) > 0) l_data.insert(l_data.end(), l_buf, l_buf + l_len);
+
+    EvlogStreamHeader l_hdr;
+
+    if (l_data.size() < sizeof(l_hdr) || memcmp(l_data.data(), EVLOG_STREAM_MAGIC, sizeof(l_hdr.m_magic)))
+    {
+        fprintf(stderr, "evlogdump: not an event log\n");
+        return 1;
+    }
+
+    memcpy(&l_hdr, l_data.data(), sizeof(l_hdr));
+
+    size_t l_pos = sizeof(l_hdr);
+    uint32_t l_expected = 0;
+    uint32_t l_records = 0;
+    bool l_first = true;
+
+    while (l_pos + sizeof(EvlogBlockHeader) <= l_data.size())
+    {
+        EvlogBlockHeader l_block;
+        memcpy(&l_block, l_data.data() + l_pos, sizeof(l_block));
+        l_pos += sizeof(l_block);
+
+        if (l_pos + l_block.m_bytes > l_data.size())
+        {
+            fprintf(stderr, "evlogdump: truncated block\n");
+            return 1;
+        }
+
+        // --- the ring wrapped while the blocks were sent
+
+        if (!l_first && l_block.m_first_seq != l_expected)
+        {
+            printf("--- %u records lost\n", l_block.m_first_seq - l_expected);
+        }
+
+        l_first = false;
+
+        uint32_t l_seq = l_block.m_first_seq;
+        size_t l_end = l_pos + l_block.m_bytes;
+
+        while (l_pos + sizeof(EvlogRecord) <= l_end)
+        {
+            EvlogRecord l_rec;
+            memcpy(&l_rec, l_data.data() + l_pos, sizeof(l_rec));
+
+            size_t l_reclen = EVLOG_RECORD_LEN(l_rec.m_argc);
+            if (l_pos + l_reclen > l_end) break;
+
+            uint32_t l_args[256];
+            memcpy(l_args, l_data.data() + l_pos + sizeof(l_rec), l_rec.m_argc * sizeof(uint32_t));
+
+            char l_line[256];
+            EventLog::Format(l_line, sizeof(l_line), l_rec, l_args);
+
+            printf("%8u I (%u) %s: %s\n", l_seq, l_rec.m_time_ms, EventLog::GetTag(l_rec.m_id), l_line);
+
+            l_pos += l_reclen;
+            ++l_seq;
+            ++l_records;
+        }
+
+        l_pos = l_end;
+        l_expected = l_seq;
+    }
+
+    fprintf(stderr, "%u records, next record %u, uptime %u ms\n", l_records, l_hdr.m_next_seq, l_hdr.m_uptime_ms);
+
+    return 0;
+}
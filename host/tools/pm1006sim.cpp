@@ -0,0 +1,326 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- pm1006sim - generate, replay and decode VINDRIKTNING (PM1006) serial traffic.
+//
+// --- pm1006sim generate [options] -o capture.bin
+// --- pm1006sim replay <capture|sim[:seed]> [--speed x] [-o fifo|pty|file]
+// --- pm1006sim decode <capture>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+
+#include "pm1006.h"
+#include "pm1006_sim.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void Usage(void)
+{
+    fprintf(stderr,
+        "usage: pm1006sim generate [options] [-o file]\n"
+        "         --seed n        random seed (1)\n"
+        "         --duration s    length of the stream in seconds (300)\n"
+        "         --pm25 n        base PM2.5 value (25)\n"
+        "         --drift n       max change per datagram (3)\n"
+        "         --cycle ms      fan cycle (30000)\n"
+        "         --burst n       datagrams per fan cycle (5)\n"
+        "         --gap ms        time between datagrams of a burst (800)\n"
+        "         --max-chunk n   datagrams are split in pieces of 1..n bytes (8)\n"
+        "         --errors n      datagrams with a broken checksum per 1000 (0)\n"
+        "         --noise n       datagrams followed by line noise per 1000 (0)\n"
+        "         --raw           write the plain byte stream without timestamps\n"
+        "       pm1006sim replay <capture|sim[:seed]> [--speed x] [-o out]\n"
+        "         writes the stream with its timing (times x) to a file, FIFO or pty\n"
+        "       pm1006sim decode <capture> [--quiet]\n"
+        "         decodes the datagrams and prints statistics\n");
+
+    exit(2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+enum
+{
+    OPT_SEED = 256,
+    OPT_DURATION,
+    OPT_PM25,
+    OPT_DRIFT,
+    OPT_CYCLE,
+    OPT_BURST,
+    OPT_GAP,
+    OPT_MAXCHUNK,
+    OPT_ERRORS,
+    OPT_NOISE,
+    OPT_RAW,
+    OPT_SPEED,
+    OPT_QUIET
+};
+
+static const struct option s_options[] =
+{
+    { "seed",       required_argument,  NULL, OPT_SEED },
+    { "duration",   required_argument,  NULL, OPT_DURATION },
+    { "pm25",       required_argument,  NULL, OPT_PM25 },
+    { "drift",      required_argument,  NULL, OPT_DRIFT },
+    { "cycle",      required_argument,  NULL, OPT_CYCLE },
+    { "burst",      required_argument,  NULL, OPT_BURST },
+    { "gap",        required_argument,  NULL, OPT_GAP },
+    { "max-chunk",  required_argument,  NULL, OPT_MAXCHUNK },
+    { "errors",     required_argument,  NULL, OPT_ERRORS },
+    { "noise",      required_argument,  NULL, OPT_NOISE },
+    { "raw",        no_argument,        NULL, OPT_RAW },
+    { "speed",      required_argument,  NULL, OPT_SPEED },
+    { "quiet",      no_argument,        NULL, OPT_QUIET },
+    { "output",     required_argument,  NULL, 'o' },
+    { NULL,         0,                  NULL, 0 }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int Generate(const Pm1006SimConfig &f_config, uint32_t f_duration_s, bool f_raw, const char *f_out)
+{
+    FILE *l_file = f_out ? fopen(f_out, "wb") : stdout;
+
+    if (!l_file)
+    {
+        fprintf(stderr, "pm1006sim: cannot create %s: %s\n", f_out, strerror(errno));
+        return 1;
+    }
+
+    CPm1006Simulator l_sim;
+    l_sim.Init(f_config);
+
+    if (!f_raw) pm1006_capture_write_header(l_file);
+
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at_ms;
+    uint32_t l_frames = 0;
+
+    for (;;)
+    {
+        size_t l_len = l_sim.NextChunk(l_buf, sizeof(l_buf), &l_at_ms);
+
+        if (l_at_ms >= f_duration_s * 1000) break;
+
+        l_frames = l_sim.GetFrames();
+
+        if (f_raw)
+            fwrite(l_buf, 1, l_len, l_file);
+        else
+            pm1006_capture_write(l_file, l_at_ms, l_buf, l_len);
+    }
+
+    fprintf(stderr, "pm1006sim: %u datagrams in %u s\n", l_frames, f_duration_s);
+
+    if (f_out) fclose(l_file);
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- a capture file or "sim[:seed]" for a live generated stream
+
+static CPm1006Source *OpenSource(const char *f_name, const Pm1006SimConfig &f_config)
+{
+    if (strncmp(f_name, "sim", 3) == 0 && (f_name[3] == '\0' || f_name[3] == ':'))
+    {
+        Pm1006SimConfig l_config = f_config;
+
+        if (f_name[3] == ':') l_config.m_seed = strtoul(f_name + 4, NULL, 0);
+
+        CPm1006Simulator *l_sim = new CPm1006Simulator;
+        l_sim->Init(l_config);
+
+        return l_sim;
+    }
+
+    CPm1006Replay *l_replay = new CPm1006Replay;
+
+    if (!l_replay->Open(f_name))
+    {
+        delete l_replay;
+        return NULL;
+    }
+
+    return l_replay;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int Replay(CPm1006Source *f_source, double f_speed, const char *f_out)
+{
+    int l_fd = f_out ? open(f_out, O_WRONLY | O_CREAT | O_NOCTTY, 0644) : STDOUT_FILENO;
+
+    if (l_fd < 0)
+    {
+        fprintf(stderr, "pm1006sim: cannot open %s: %s\n", f_out, strerror(errno));
+        return 1;
+    }
+
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at_ms;
+    size_t l_total = 0;
+
+    auto l_start = std::chrono::steady_clock::now();
+
+    for (;;)
+    {
+        size_t l_len = f_source->NextChunk(l_buf, sizeof(l_buf), &l_at_ms);
+        if (!l_len) break;
+
+        std::this_thread::sleep_until(l_start + std::chrono::microseconds((int64_t)(l_at_ms * 1000.0 / f_speed)));
+
+        if (write(l_fd, l_buf, l_len) != (ssize_t)l_len)
+        {
+            fprintf(stderr, "pm1006sim: write failed: %s\n", strerror(errno));
+            break;
+        }
+
+        l_total += l_len;
+    }
+
+    fprintf(stderr, "pm1006sim: replayed %zu bytes\n", l_total);
+
+    if (f_out) close(l_fd);
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int Decode(CPm1006Source *f_source, bool f_quiet)
+{
+    CPm1006Receiver l_receiver;
+
+    uint8_t l_buf[PM1006_CHUNK_MAX];
+    uint32_t l_at_ms = 0;
+    size_t l_bytes = 0;
+
+    for (;;)
+    {
+        size_t l_len = f_source->NextChunk(l_buf, sizeof(l_buf), &l_at_ms);
+        if (!l_len) break;
+
+        l_bytes += l_len;
+
+        for (size_t i = 0; i < l_len; ++i)
+        {
+            if (l_receiver.process_rx(l_buf[i]) && !f_quiet)
+            {
+                printf("%10u ms  pm2.5 %4u  pm1 %4u  pm10 %4u\n", l_at_ms, 
+                    l_receiver.GetPM25(), l_receiver.GetPM1(), l_receiver.GetPM10());
+            }
+        }
+    }
+
+    printf("bytes %zu, duration %u ms, datagrams %u, checksum errors %u, length errors %u\n",
+        l_bytes, l_at_ms, l_receiver.GetFrameCount(), l_receiver.GetChecksumErrors(), l_receiver.GetLengthErrors());
+
+    return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) Usage();
+
+    const char *l_cmd = argv[1];
+
+    Pm1006SimConfig l_config;
+
+    uint32_t    l_duration  = 300;
+    bool        l_raw       = false;
+    bool        l_quiet     = false;
+    double      l_speed     = 1.0;
+    const char *l_out       = NULL;
+
+    int l_opt;
+
+    optind = 2;
+
+    while ((l_opt = getopt_long(argc, argv, "o:", s_options, NULL)) != -1)
+    {
+        switch (l_opt)
+        {
+            case OPT_SEED:      l_config.m_seed = strtoul(optarg, NULL, 0); break;
+            case OPT_DURATION:  l_duration = atoi(optarg); break;
+            case OPT_PM25:      l_config.m_pm25_base = atoi(optarg); break;
+            case OPT_DRIFT:     l_config.m_pm_drift = atoi(optarg); break;
+            case OPT_CYCLE:     l_config.m_cycle_ms = atoi(optarg); break;
+            case OPT_BURST:     l_config.m_burst_frames = atoi(optarg); break;
+            case OPT_GAP:       l_config.m_frame_gap_ms = atoi(optarg); break;
+            case OPT_MAXCHUNK:  l_config.m_max_chunk = atoi(optarg); break;
+            case OPT_ERRORS:    l_config.m_checksum_permille = atoi(optarg); break;
+            case OPT_NOISE:     l_config.m_noise_permille = atoi(optarg); break;
+            case OPT_RAW:       l_raw = true; break;
+            case OPT_SPEED:     l_speed = atof(optarg); break;
+            case OPT_QUIET:     l_quiet = true; break;
+            case 'o':           l_out = optarg; break;
+            default:            Usage();
+        }
+    }
+
+    if (l_speed <= 0.0) Usage();
+
+    if (strcmp(l_cmd, "generate") == 0) return Generate(l_config, l_duration, l_raw, l_out);
+
+    if (optind >= argc) Usage();
+
+    CPm1006Source *l_source = OpenSource(argv[optind], l_config);
+    if (!l_source) return 1;
+
+    int l_ret = 2;
+
+    if (strcmp(l_cmd, "replay") == 0)
+        l_ret = Replay(l_source, l_speed, l_out);
+    else if (strcmp(l_cmd, "decode") == 0)
+        l_ret = Decode(l_source, l_quiet);
+    else
+        Usage();
+
+    delete l_source;
+
+    return l_ret;
+}
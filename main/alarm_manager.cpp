@@ -0,0 +1,706 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#ifdef CONFIG_ALARM_WEBHOOK
+#include "esp_http_client.h"
+#endif
+
+#include "alarm_manager.h"
+#include "config_manager.h"
+#include "config_manager_defines.h"
+#include "mqtt_manager.h"
+#include "scheduler.h"
+#include "sensor_manager.h"
+#include "evlog.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "AlarmManager";
+
+#define ALARM_NVS_NAMESPACE     "alarm"
+#define ALARM_NVS_KEY           "rules"
+
+#define ALARM_WEBHOOK_STACK     4096
+#define ALARM_WEBHOOK_TIMEOUT   5000
+
+// --- the receive tasks evaluate, the REST server changes the rules, the scheduler sends
+
+static portMUX_TYPE s_alarm_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *s_value_names[3]             = { "pm1", "pm2", "pm10" };
+static const char *s_type_names[AlarmType_Cnt]  = { "above", "rise" };
+
+#if defined(CONFIG_ALARM_WEBHOOK) && defined(CONFIG_STATIC_ALLOC)
+
+// --- the queue and the webhook task live in .bss
+
+static uint8_t              s_queue_storage[ALARM_QUEUE_LEN * sizeof(AlarmEvent)];
+static StaticQueue_t        s_queue_buf;
+static StackType_t          s_stack[ALARM_WEBHOOK_STACK];
+static StaticTask_t         s_tcb;
+
+#endif
+
+AlarmManager g_AlarmManager;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void prvAlarmSchedHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    AlarmManager *l_alarmmgr = (AlarmManager *)f_ctx;
+
+    switch (f_event.m_type)
+    {
+        case SchedEvent_Alarm:              l_alarmmgr->SendAlerts(); break;
+        case SchedEvent_MqttPublished:      l_alarmmgr->OnPublished((int)f_event.m_arg); break;
+
+        // --- the mqtt manager may see the connect after us, so send from the next event
+
+        case SchedEvent_MqttConnected:      g_Scheduler.Post(SchedEvent_Alarm, 0); break;
+
+        default:                            break;
+    }
+}
+
+#ifdef CONFIG_ALARM_WEBHOOK
+
+static void prvWebhookTask(void *f_ctx)
+{
+    AlarmManager *l_alarmmgr = (AlarmManager *)f_ctx;
+
+    for (;;) l_alarmmgr->ProcessWebhook();
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t AlarmManager::InitManager(void)
+{
+    m_rule_cnt      = 0;
+    m_queue_head    = 0;
+    m_queue_cnt     = 0;
+    m_pending_next  = 0;
+    m_webhook_queue = NULL;
+
+    memset(m_state, 0, sizeof(m_state));
+    memset(m_pending, 0, sizeof(m_pending));
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    LoadRules();
+
+    // ---- alerts go out on the scheduler task, after a connect again and the acknowledges
+    // ---- give the latency
+
+    g_Scheduler.AddHandler(SchedEvent_Alarm, prvAlarmSchedHandler, this);
+    g_Scheduler.AddHandler(SchedEvent_MqttConnected, prvAlarmSchedHandler, this);
+    g_Scheduler.AddHandler(SchedEvent_MqttPublished, prvAlarmSchedHandler, this);
+
+#ifdef CONFIG_ALARM_WEBHOOK
+
+    // ---- the HTTP request may take seconds, so it gets a task of its own
+
+#ifdef CONFIG_STATIC_ALLOC
+    m_webhook_queue = xQueueCreateStatic(ALARM_QUEUE_LEN, sizeof(AlarmEvent), s_queue_storage, &s_queue_buf);
+
+    xTaskCreateStatic(prvWebhookTask, "webhook", ALARM_WEBHOOK_STACK, this, 4, s_stack, &s_tcb);
+#else
+    m_webhook_queue = xQueueCreate(ALARM_QUEUE_LEN, sizeof(AlarmEvent));
+
+    if (!m_webhook_queue || xTaskCreate(prvWebhookTask, "webhook", ALARM_WEBHOOK_STACK, this, 4, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Cannot start the webhook task");
+        m_webhook_queue = NULL;
+        return ESP_FAIL;
+    }
+#endif
+
+#endif
+
+    ESP_LOGI(TAG, "%d alarm rules", m_rule_cnt);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t AlarmManager::LoadRules(void)
+{
+    nvs_handle_t l_nvs;
+
+    esp_err_t l_err = nvs_open(ALARM_NVS_NAMESPACE, NVS_READONLY, &l_nvs);
+    if (l_err != ESP_OK) return l_err;
+
+    size_t l_size = sizeof(m_rules);
+
+    l_err = nvs_get_blob(l_nvs, ALARM_NVS_KEY, m_rules, &l_size);
+
+    nvs_close(l_nvs);
+
+    if (l_err != ESP_OK || l_size % sizeof(AlarmRule))
+    {
+        m_rule_cnt = 0;
+        return l_err != ESP_OK ? l_err : ESP_ERR_INVALID_SIZE;
+    }
+
+    m_rule_cnt = l_size / sizeof(AlarmRule);
+
+    return ESP_OK;
+}
+
+esp_err_t AlarmManager::SetRules(const AlarmRule *f_rules, int f_cnt)
+{
+    if (f_cnt < 0 || f_cnt > ALARM_MAX_RULES) return ESP_ERR_INVALID_ARG;
+
+    // --- first to flash, then take them. An empty blob is fine for NVS
+
+    nvs_handle_t l_nvs;
+    esp_err_t l_err = nvs_open(ALARM_NVS_NAMESPACE, NVS_READWRITE, &l_nvs);
+
+    if (l_err == ESP_OK)
+    {
+        l_err = nvs_set_blob(l_nvs, ALARM_NVS_KEY, f_rules, sizeof(AlarmRule) * f_cnt);
+        if (l_err == ESP_OK) l_err = nvs_commit(l_nvs);
+
+        nvs_close(l_nvs);
+    }
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error storing the alarm rules: %d", l_err);
+        return l_err;
+    }
+
+    // --- the rules start over, active alarms of the old ones are not cleared
+
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    memcpy(m_rules, f_rules, sizeof(AlarmRule) * f_cnt);
+    m_rule_cnt = f_cnt;
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        memset(m_state[i].m_since_us, 0, sizeof(m_state[i].m_since_us));
+        memset(m_state[i].m_active, 0, sizeof(m_state[i].m_active));
+    }
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    ESP_LOGI(TAG, "%d alarm rules stored", f_cnt);
+
+    return ESP_OK;
+}
+
+int AlarmManager::GetRules(AlarmRule *f_rules) const
+{
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    int l_cnt = m_rule_cnt;
+    memcpy(f_rules, m_rules, sizeof(AlarmRule) * l_cnt);
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    return l_cnt;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AlarmManager::Evaluate(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    Evaluate(f_sensor, esp_timer_get_time(), f_pm1, f_pm2, f_pm10);
+}
+
+void AlarmManager::Evaluate(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    const uint16_t l_pm[3] = { f_pm1, f_pm2, f_pm10 };
+
+    AlarmEvent l_events[ALARM_MAX_RULES];
+    int l_event_cnt = 0;
+
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    SensorState &l_state = m_state[f_sensor];
+
+    // --- rises are measured against the older of two references, which is 30 to 60 s old
+
+    if (!l_state.m_ref_us[1])
+    {
+        l_state.m_ref_us[0] = l_state.m_ref_us[1] = f_time_us;
+        memcpy(l_state.m_ref[0], l_pm, sizeof(l_pm));
+        memcpy(l_state.m_ref[1], l_pm, sizeof(l_pm));
+    }
+    else if (f_time_us - l_state.m_ref_us[1] >= (int64_t)ALARM_RISE_MS * 1000)
+    {
+        l_state.m_ref_us[0] = l_state.m_ref_us[1];
+        memcpy(l_state.m_ref[0], l_state.m_ref[1], sizeof(l_pm));
+
+        l_state.m_ref_us[1] = f_time_us;
+        memcpy(l_state.m_ref[1], l_pm, sizeof(l_pm));
+    }
+
+    for (int r = 0; r < m_rule_cnt; ++r)
+    {
+        const AlarmRule &l_rule = m_rules[r];
+
+        if (l_rule.m_sensor && l_rule.m_sensor != f_sensor + 1) continue;
+
+        int l_value = l_pm[l_rule.m_value];
+
+        if (l_rule.m_type == AlarmType_Rise)
+        {
+            l_value -= l_state.m_ref[0][l_rule.m_value];
+            if (l_value < 0) l_value = 0;
+        }
+
+        bool l_change = false;
+
+        if (!l_state.m_active[r])
+        {
+            // --- the condition has to hold m_hold_s seconds
+
+            if (l_value < l_rule.m_threshold)
+            {
+                l_state.m_since_us[r] = 0;
+            }
+            else
+            {
+                if (!l_state.m_since_us[r]) l_state.m_since_us[r] = f_time_us;
+
+                l_change = f_time_us - l_state.m_since_us[r] >= (int64_t)l_rule.m_hold_s * 1000000;
+            }
+        }
+        else
+        {
+            // --- hysteresis: clears below m_clear only
+
+            l_change = l_value < l_rule.m_clear;
+
+            if (l_change) l_state.m_since_us[r] = 0;
+        }
+
+        if (!l_change) continue;
+
+        l_state.m_active[r] = !l_state.m_active[r];
+
+        AlarmEvent &l_event = l_events[l_event_cnt++];
+
+        l_event.m_time_us   = f_time_us;
+        l_event.m_rule      = l_rule;
+        l_event.m_value     = (uint16_t)l_value;
+        l_event.m_rule_idx  = (uint8_t)r;
+        l_event.m_sensor    = (uint8_t)(f_sensor + 1);
+        l_event.m_active    = l_state.m_active[r];
+    }
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    if (!l_event_cnt) return;
+
+    for (int i = 0; i < l_event_cnt; ++i) Queue(l_events[i]);
+
+    // --- the scheduler publishes right away
+
+    g_Scheduler.Post(SchedEvent_Alarm, f_sensor);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AlarmManager::Queue(const AlarmEvent &f_event)
+{
+    EVLOG(AlarmChanged, f_event.m_rule_idx + 1, f_event.m_sensor, f_event.m_active, f_event.m_value);
+
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    if (m_queue_cnt < ALARM_QUEUE_LEN)
+    {
+        m_queue[(m_queue_head + m_queue_cnt) % ALARM_QUEUE_LEN] = f_event;
+        ++m_queue_cnt;
+    }
+    else
+    {
+        ++m_stats.m_dropped;
+    }
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    // --- the webhook task never blocks us, when it is behind the alert is dropped
+
+    if (m_webhook_queue && (f_event.m_rule.m_flags & ALARM_F_WEBHOOK))
+    {
+        if (xQueueSend(m_webhook_queue, &f_event, 0) != pdTRUE)
+        {
+            portENTER_CRITICAL(&s_alarm_mux);
+            ++m_stats.m_webhook_errors;
+            portEXIT_CRITICAL(&s_alarm_mux);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- {"rule":1,"sensor":1,"value":"pm2","type":"above","threshold":50,"level":63,
+// ---  "active":true,"health":"ok","age":0,"up":<seconds since boot>,"time":<unix time, when known>}
+
+char *AlarmManager::RenderAlert(const AlarmEvent &f_event) const
+{
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "rule", f_event.m_rule_idx + 1);
+    cJSON_AddNumberToObject(root, "sensor", f_event.m_sensor);
+    cJSON_AddStringToObject(root, "value", s_value_names[f_event.m_rule.m_value]);
+    cJSON_AddStringToObject(root, "type", s_type_names[f_event.m_rule.m_type]);
+    cJSON_AddNumberToObject(root, "threshold", f_event.m_active ? f_event.m_rule.m_threshold : f_event.m_rule.m_clear);
+    cJSON_AddNumberToObject(root, "level", f_event.m_value);
+    cJSON_AddBoolToObject(root, "active", f_event.m_active);
+    g_SensorManager.GetSensor(f_event.m_sensor - 1).GetHealth().AddToJson(root);
+    cJSON_AddNumberToObject(root, "up", (double)(f_event.m_time_us / 1000000));
+
+    time_t l_now = time(NULL);
+
+    if ((uint32_t)l_now >= MQTT_TIME_VALID)
+    {
+        cJSON_AddNumberToObject(root, "time", (double)(l_now - (esp_timer_get_time() - f_event.m_time_us) / 1000000));
+    }
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    return l_json;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AlarmManager::SendAlerts(void)
+{
+    // --- only the scheduler task takes alerts out of the queue, so the head stays ours
+
+    for (;;)
+    {
+        portENTER_CRITICAL(&s_alarm_mux);
+
+        bool l_empty = !m_queue_cnt;
+        AlarmEvent l_event;
+
+        if (!l_empty) l_event = m_queue[m_queue_head];
+
+        portEXIT_CRITICAL(&s_alarm_mux);
+
+        if (l_empty) return;
+
+        // --- without mqtt the alerts only go to the webhook
+
+        if (g_MqttManager.IsEnabled())
+        {
+            char *l_json = RenderAlert(l_event);
+
+            if (!l_json)
+            {
+                ESP_LOGE(TAG, "Error creating the alert message");
+                return;
+            }
+
+            int l_msg_id = g_MqttManager.PublishNow("alert", l_json);
+
+            free(l_json);
+
+            // --- not connected: again on SchedEvent_MqttConnected
+
+            if (l_msg_id < 0) return;
+
+            PendingAck &l_pending = m_pending[m_pending_next];
+
+            l_pending.m_msg_id  = l_msg_id;
+            l_pending.m_time_us = l_event.m_time_us;
+
+            m_pending_next = (m_pending_next + 1) % ALARM_QUEUE_LEN;
+        }
+
+        portENTER_CRITICAL(&s_alarm_mux);
+
+        m_queue_head = (m_queue_head + 1) % ALARM_QUEUE_LEN;
+        --m_queue_cnt;
+
+        portEXIT_CRITICAL(&s_alarm_mux);
+    }
+}
+
+void AlarmManager::OnPublished(int f_msg_id)
+{
+    for (int i = 0; i < ALARM_QUEUE_LEN; ++i)
+    {
+        PendingAck &l_pending = m_pending[i];
+
+        if (!l_pending.m_time_us || l_pending.m_msg_id != f_msg_id) continue;
+
+        // --- from the datagram to the acknowledge of the broker
+
+        uint32_t l_latency = (uint32_t)(esp_timer_get_time() - l_pending.m_time_us);
+
+        l_pending.m_time_us = 0;
+
+        portENTER_CRITICAL(&s_alarm_mux);
+
+        ++m_stats.m_alerts;
+        m_stats.m_latency_sum_us += l_latency;
+        if (l_latency > m_stats.m_latency_max_us) m_stats.m_latency_max_us = l_latency;
+
+        portEXIT_CRITICAL(&s_alarm_mux);
+
+        return;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AlarmManager::ProcessWebhook(void)
+{
+#ifdef CONFIG_ALARM_WEBHOOK
+    AlarmEvent l_event;
+
+    if (xQueueReceive(m_webhook_queue, &l_event, portMAX_DELAY) != pdTRUE) return;
+
+    std::string l_url = g_ConfigManager.GetStringValue(CFMGR_ALERT_WEBHOOK);
+
+    if (l_url.empty()) return;
+
+    char *l_json = RenderAlert(l_event);
+    if (!l_json) return;
+
+    esp_http_client_config_t l_config;
+    memset(&l_config, 0, sizeof(l_config));
+
+    l_config.url        = l_url.c_str();
+    l_config.method     = HTTP_METHOD_POST;
+    l_config.timeout_ms = ALARM_WEBHOOK_TIMEOUT;
+
+    esp_http_client_handle_t l_client = esp_http_client_init(&l_config);
+
+    esp_err_t l_err = ESP_FAIL;
+    int l_status = 0;
+
+    if (l_client)
+    {
+        esp_http_client_set_header(l_client, "Content-Type", "application/json");
+        esp_http_client_set_post_field(l_client, l_json, strlen(l_json));
+
+        l_err = esp_http_client_perform(l_client);
+        if (l_err == ESP_OK) l_status = esp_http_client_get_status_code(l_client);
+
+        esp_http_client_cleanup(l_client);
+    }
+
+    free(l_json);
+
+    bool l_ok = l_err == ESP_OK && l_status >= 200 && l_status < 300;
+
+    if (!l_ok) ESP_LOGE(TAG, "Webhook %s failed: %d, status %d", l_url.c_str(), l_err, l_status);
+
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    if (l_ok) ++m_stats.m_webhooks;
+    else ++m_stats.m_webhook_errors;
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+AlarmStats AlarmManager::GetStats(void) const
+{
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    AlarmStats l_stats = m_stats;
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    return l_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- {"rules":[{"sensor":0,"value":"pm2","type":"above","threshold":50,"clear":40,
+// ---  "hold":60,"webhook":false,"active":[1]}],"alerts":..} with the sensors a rule
+// --- is active for and the counters of the alerts
+
+void AlarmManager::AddToJson(cJSON *f_obj) const
+{
+    AlarmRule l_rules[ALARM_MAX_RULES];
+    uint8_t l_active[CONFIG_TEMP_SENSOR_CNT][ALARM_MAX_RULES];
+
+    portENTER_CRITICAL(&s_alarm_mux);
+
+    int l_cnt = m_rule_cnt;
+    memcpy(l_rules, m_rules, sizeof(AlarmRule) * l_cnt);
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i) memcpy(l_active[i], m_state[i].m_active, ALARM_MAX_RULES);
+
+    portEXIT_CRITICAL(&s_alarm_mux);
+
+    cJSON *l_array = cJSON_AddArrayToObject(f_obj, "rules");
+
+    for (int r = 0; r < l_cnt; ++r)
+    {
+        const AlarmRule &l_rule = l_rules[r];
+
+        cJSON *l_obj = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(l_obj, "sensor", l_rule.m_sensor);
+        cJSON_AddStringToObject(l_obj, "value", s_value_names[l_rule.m_value]);
+        cJSON_AddStringToObject(l_obj, "type", s_type_names[l_rule.m_type]);
+        cJSON_AddNumberToObject(l_obj, "threshold", l_rule.m_threshold);
+        cJSON_AddNumberToObject(l_obj, "clear", l_rule.m_clear);
+        cJSON_AddNumberToObject(l_obj, "hold", l_rule.m_hold_s);
+        cJSON_AddBoolToObject(l_obj, "webhook", (l_rule.m_flags & ALARM_F_WEBHOOK) != 0);
+
+        cJSON *l_sensors = cJSON_AddArrayToObject(l_obj, "active");
+
+        for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+        {
+            if (l_active[i][r]) cJSON_AddItemToArray(l_sensors, cJSON_CreateNumber(i + 1));
+        }
+
+        cJSON_AddItemToArray(l_array, l_obj);
+    }
+
+    AlarmStats l_stats = GetStats();
+
+    cJSON_AddNumberToObject(f_obj, "alerts", l_stats.m_alerts);
+    cJSON_AddNumberToObject(f_obj, "dropped", l_stats.m_dropped);
+    cJSON_AddNumberToObject(f_obj, "webhooks", l_stats.m_webhooks);
+    cJSON_AddNumberToObject(f_obj, "webhook_errors", l_stats.m_webhook_errors);
+    cJSON_AddNumberToObject(f_obj, "latency_avg_ms", l_stats.m_alerts ? (double)(l_stats.m_latency_sum_us / l_stats.m_alerts) / 1000.0 : 0.0);
+    cJSON_AddNumberToObject(f_obj, "latency_max_ms", l_stats.m_latency_max_us / 1000.0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int prvFindName(const char *f_name, const char **f_names, int f_cnt)
+{
+    for (int i = 0; i < f_cnt; ++i)
+    {
+        if (!strcmp(f_name, f_names[i])) return i;
+    }
+
+    return -1;
+}
+
+// --- the "rules" array of a POST. Missing fields: every sensor, pm2, above, no hysteresis,
+// --- no hold time, no webhook
+
+esp_err_t AlarmManager::RulesFromJson(cJSON *f_obj, AlarmRule *f_rules, int *f_cnt) const
+{
+    cJSON *l_array = cJSON_GetObjectItem(f_obj, "rules");
+
+    if (!cJSON_IsArray(l_array) || cJSON_GetArraySize(l_array) > ALARM_MAX_RULES) return ESP_ERR_INVALID_ARG;
+
+    int l_cnt = 0;
+    cJSON *l_item;
+
+    cJSON_ArrayForEach(l_item, l_array)
+    {
+        AlarmRule &l_rule = f_rules[l_cnt++];
+        memset(&l_rule, 0, sizeof(l_rule));
+
+        l_rule.m_value = 1;
+
+        cJSON *l_field = cJSON_GetObjectItem(l_item, "sensor");
+        if (l_field)
+        {
+            if (!cJSON_IsNumber(l_field) || l_field->valueint < 0 || l_field->valueint > CONFIG_TEMP_SENSOR_CNT) return ESP_ERR_INVALID_ARG;
+            l_rule.m_sensor = (uint8_t)l_field->valueint;
+        }
+
+        l_field = cJSON_GetObjectItem(l_item, "value");
+        if (l_field)
+        {
+            int l_idx = cJSON_IsString(l_field) ? prvFindName(l_field->valuestring, s_value_names, 3) : -1;
+            if (l_idx < 0) return ESP_ERR_INVALID_ARG;
+            l_rule.m_value = (uint8_t)l_idx;
+        }
+
+        l_field = cJSON_GetObjectItem(l_item, "type");
+        if (l_field)
+        {
+            int l_idx = cJSON_IsString(l_field) ? prvFindName(l_field->valuestring, s_type_names, AlarmType_Cnt) : -1;
+            if (l_idx < 0) return ESP_ERR_INVALID_ARG;
+            l_rule.m_type = (uint8_t)l_idx;
+        }
+
+        l_field = cJSON_GetObjectItem(l_item, "threshold");
+        if (!cJSON_IsNumber(l_field) || l_field->valueint < 1 || l_field->valueint > 1000) return ESP_ERR_INVALID_ARG;
+        l_rule.m_threshold = (uint16_t)l_field->valueint;
+
+        l_rule.m_clear = l_rule.m_threshold;
+
+        l_field = cJSON_GetObjectItem(l_item, "clear");
+        if (l_field)
+        {
+            if (!cJSON_IsNumber(l_field) || l_field->valueint < 1 || l_field->valueint > l_rule.m_threshold) return ESP_ERR_INVALID_ARG;
+            l_rule.m_clear = (uint16_t)l_field->valueint;
+        }
+
+        l_field = cJSON_GetObjectItem(l_item, "hold");
+        if (l_field)
+        {
+            if (!cJSON_IsNumber(l_field) || l_field->valueint < 0 || l_field->valueint > 3600) return ESP_ERR_INVALID_ARG;
+            l_rule.m_hold_s = (uint16_t)l_field->valueint;
+        }
+
+        l_field = cJSON_GetObjectItem(l_item, "webhook");
+        if (l_field)
+        {
+            if (!cJSON_IsBool(l_field)) return ESP_ERR_INVALID_ARG;
+            if (cJSON_IsTrue(l_field)) l_rule.m_flags |= ALARM_F_WEBHOOK;
+        }
+    }
+
+    *f_cnt = l_cnt;
+
+    return ESP_OK;
+}
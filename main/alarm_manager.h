@@ -0,0 +1,181 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ALARM_MANAGER_H_
+#define	ALARM_MANAGER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "cJSON.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define ALARM_MAX_RULES         8
+#define ALARM_QUEUE_LEN         8       // --- alerts waiting for the broker
+#define ALARM_RISE_MS           30000   // --- rises are measured against a value 30-60 s old
+
+enum AlarmType
+{
+    AlarmType_Above,                    // --- the value is at or above the threshold
+    AlarmType_Rise,                     // --- the value rose by the threshold within about a minute
+
+    AlarmType_Cnt
+};
+
+#define ALARM_F_WEBHOOK         0x01    // --- also POST the alert to the alert_webhook URL
+
+// --- one rule as stored in NVS. Fires when the condition holds for m_hold_s seconds,
+// --- clears when the value (the rise) falls below m_clear
+
+struct AlarmRule
+{
+    uint8_t     m_sensor;               // --- 1 .. n, 0 = every sensor
+    uint8_t     m_value;                // --- 0 pm1, 1 pm2.5, 2 pm10
+    uint8_t     m_type;                 // --- AlarmType
+    uint8_t     m_flags;
+    uint16_t    m_threshold;            // --- ug/m3
+    uint16_t    m_clear;                // --- ug/m3, at most m_threshold
+    uint16_t    m_hold_s;
+    uint16_t    m_reserved;
+};
+
+// --- a change of a rule's state, from the receive task to the scheduler and the webhook
+
+struct AlarmEvent
+{
+    int64_t     m_time_us;              // --- esp_timer time of the datagram
+    AlarmRule   m_rule;                 // --- as it was, the rules may change meanwhile
+    uint16_t    m_value;                // --- the value, or the rise
+    uint8_t     m_rule_idx;
+    uint8_t     m_sensor;               // --- 1 .. n
+    uint8_t     m_active;               // --- 1 alarm, 0 cleared
+};
+
+struct AlarmStats
+{
+    uint32_t    m_alerts;               // --- acknowledged by the broker
+    uint32_t    m_dropped;              // --- the queue was full
+    uint32_t    m_webhooks;
+    uint32_t    m_webhook_errors;
+    uint64_t    m_latency_sum_us;       // --- from the datagram to the PUBACK
+    uint32_t    m_latency_max_us;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Rules evaluated by the receive task on every datagram, before anything is
+// --- published. A change (alarm or clear) is queued and the scheduler publishes it at
+// --- once with QoS 1 to <topic>/alert, in batch mode the client is started for it. With
+// --- ALARM_WEBHOOK the alert is also POSTed to the alert_webhook URL by a task of its own.
+// --- The rules are set via /api/v1/rules and kept in NVS.
+
+class AlarmManager
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- a new datagram, called by the receive task
+
+    void Evaluate(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+    void Evaluate(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+
+    // --- the rules: replaced as a whole and stored, or as JSON for the REST API
+
+    esp_err_t SetRules(const AlarmRule *f_rules, int f_cnt);
+    int GetRules(AlarmRule *f_rules) const;
+
+    esp_err_t RulesFromJson(cJSON *f_obj, AlarmRule *f_rules, int *f_cnt) const;
+    void AddToJson(cJSON *f_obj) const;
+
+    AlarmStats GetStats(void) const;
+
+    // --- called on the scheduler task
+
+    void SendAlerts(void);
+    void OnPublished(int f_msg_id);
+
+    // --- called by the webhook task
+
+    void ProcessWebhook(void);
+
+private:
+    struct SensorState
+    {
+        int64_t     m_ref_us[2];        // --- two reference points for rises
+        uint16_t    m_ref[2][3];
+        int64_t     m_since_us[ALARM_MAX_RULES];    // --- the condition holds since, 0 = not
+        uint8_t     m_active[ALARM_MAX_RULES];
+    };
+
+    struct PendingAck
+    {
+        int         m_msg_id;
+        int64_t     m_time_us;
+    };
+
+    esp_err_t LoadRules(void);
+    void Queue(const AlarmEvent &f_event);
+    char *RenderAlert(const AlarmEvent &f_event) const;
+
+    AlarmRule       m_rules[ALARM_MAX_RULES];
+    int             m_rule_cnt;
+
+    SensorState     m_state[CONFIG_TEMP_SENSOR_CNT];
+
+    AlarmEvent      m_queue[ALARM_QUEUE_LEN];
+    int             m_queue_head;
+    int             m_queue_cnt;
+
+    PendingAck      m_pending[ALARM_QUEUE_LEN];
+    int             m_pending_next;
+
+    QueueHandle_t   m_webhook_queue;
+
+    AlarmStats      m_stats;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern AlarmManager g_AlarmManager;
+
+
+#endif
@@ -0,0 +1,439 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "aqi.h"
+#include "mqtt_manager.h"
+#include "scheduler.h"
+#include "sensor_manager.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "Aqi";
+
+// --- the receive tasks add, the REST server and the scheduler read
+
+static portMUX_TYPE s_aqi_mux = portMUX_INITIALIZER_UNLOCKED;
+
+AqiEngine g_Aqi;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- a concentration band and the index band it maps to, linear in between
+
+struct AqiBreakpoint
+{
+    float   m_c_lo;
+    float   m_c_hi;
+    int     m_i_lo;
+    int     m_i_hi;
+};
+
+#define AQI_BANDS   6
+
+struct AqiTable
+{
+    int             m_cnt;
+    AqiBreakpoint   m_bands[AQI_BANDS];
+};
+
+// --- US EPA, PM2.5 as revised in 2024, on 24 h means
+
+static const AqiTable s_epa[AqiPollutant_Cnt] =
+{
+    { 6, { { 0.0f,   9.0f,   0,   50  }, { 9.1f,   35.4f,  51,  100 }, { 35.5f,  55.4f,  101, 150 },
+           { 55.5f,  125.4f, 151, 200 }, { 125.5f, 225.4f, 201, 300 }, { 225.5f, 325.4f, 301, 500 } } },
+    { 6, { { 0.0f,   54.0f,  0,   50  }, { 55.0f,  154.0f, 51,  100 }, { 155.0f, 254.0f, 101, 150 },
+           { 255.0f, 354.0f, 151, 200 }, { 355.0f, 424.0f, 201, 300 }, { 425.0f, 604.0f, 301, 500 } } },
+};
+
+// --- CAQI background grid on hourly means, above 100 the last band goes on
+
+static const AqiTable s_caqi[AqiPollutant_Cnt] =
+{
+    { 4, { { 0.0f,  15.0f,  0,  25  }, { 15.0f, 30.0f,  25, 50  }, { 30.0f, 55.0f,  50, 75  },
+           { 55.0f, 110.0f, 75, 100 } } },
+    { 4, { { 0.0f,  25.0f,  0,  25  }, { 25.0f, 50.0f,  25, 50  }, { 50.0f, 90.0f,  50, 75  },
+           { 90.0f, 180.0f, 75, 100 } } },
+};
+
+static const char *s_epa_names[] = 
+{
+    "Good", "Moderate", "Unhealthy for Sensitive Groups", "Unhealthy", "Very Unhealthy", "Hazardous"
+};
+
+static const char *s_caqi_names[] =
+{
+    "Very low", "Low", "Medium", "High", "Very high"
+};
+
+static const char *s_scale_names[AqiScale_Cnt] = { "epa", "caqi" };
+static const char *s_pollutant_names[AqiPollutant_Cnt] = { "pm2", "pm10" };
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AqiWindow::Init(AqiBucket *f_buckets, int f_cnt, int32_t f_bucket_ms)
+{
+    m_buckets   = f_buckets;
+    m_cnt       = f_cnt;
+    m_bucket_ms = f_bucket_ms;
+    m_head      = 0;
+    m_count     = 0;
+    m_filled    = 0;
+
+    memset(m_sum, 0, sizeof(m_sum));
+    memset(m_buckets, 0, sizeof(AqiBucket) * f_cnt);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AqiWindow::Advance(int64_t f_time_ms)
+{
+    int64_t l_bucket = f_time_ms / m_bucket_ms;
+
+    if (l_bucket <= m_head) return;
+
+    // --- a gap longer than the window: everything is gone
+
+    if (l_bucket - m_head >= m_cnt)
+    {
+        memset(m_buckets, 0, sizeof(AqiBucket) * m_cnt);
+        memset(m_sum, 0, sizeof(m_sum));
+
+        m_count     = 0;
+        m_filled    = 0;
+        m_head      = l_bucket;
+        return;
+    }
+
+    // --- drop the buckets the window moves over, at most one per bucket time
+
+    while (m_head < l_bucket)
+    {
+        AqiBucket &l_old = m_buckets[++m_head % m_cnt];
+
+        if (l_old.m_count)
+        {
+            for (int p = 0; p < AqiPollutant_Cnt; ++p) m_sum[p] -= l_old.m_sum[p];
+
+            m_count -= l_old.m_count;
+            --m_filled;
+
+            memset(&l_old, 0, sizeof(l_old));
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AqiWindow::Add(int64_t f_time_ms, uint16_t f_pm2, uint16_t f_pm10)
+{
+    Advance(f_time_ms);
+
+    AqiBucket &l_bucket = m_buckets[m_head % m_cnt];
+
+    if (!l_bucket.m_count) ++m_filled;
+
+    l_bucket.m_sum[AqiPollutant_PM2]    += f_pm2;
+    l_bucket.m_sum[AqiPollutant_PM10]   += f_pm10;
+    ++l_bucket.m_count;
+
+    m_sum[AqiPollutant_PM2]     += f_pm2;
+    m_sum[AqiPollutant_PM10]    += f_pm10;
+    ++m_count;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool AqiWindow::GetMean(int64_t f_time_ms, float *f_mean)
+{
+    Advance(f_time_ms);
+
+    if (!m_count) return false;
+
+    for (int p = 0; p < AqiPollutant_Cnt; ++p) f_mean[p] = (float)m_sum[p] / m_count;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static int prvSubIndex(const AqiTable &f_table, float f_c, bool f_extrapolate)
+{
+    const AqiBreakpoint *l_band = &f_table.m_bands[0];
+
+    for (int i = 0; i < f_table.m_cnt; ++i)
+    {
+        l_band = &f_table.m_bands[i];
+
+        if (f_c <= l_band->m_c_hi) break;
+    }
+
+    // --- beyond the table: EPA stays at its maximum, CAQI goes on with the last band
+
+    if (f_c > l_band->m_c_hi && !f_extrapolate) return l_band->m_i_hi;
+
+    float l_index = l_band->m_i_lo + (f_c - l_band->m_c_lo) * (l_band->m_i_hi - l_band->m_i_lo) / (l_band->m_c_hi - l_band->m_c_lo);
+
+    return (int)floorf(l_index + 0.5f);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+AqiIndex AqiEngine::Calculate(AqiScale f_scale, const float *f_mean)
+{
+    AqiIndex l_index = { 0, 0, AqiPollutant_PM2 };
+
+    for (int p = 0; p < AqiPollutant_Cnt; ++p)
+    {
+        int l_sub;
+
+        if (f_scale == AqiScale_EPA)
+        {
+            // --- EPA truncates PM2.5 to 0.1 and PM10 to 1 ug/m3 first
+
+            float l_c = p == AqiPollutant_PM2 ? floorf(f_mean[p] * 10.0f) / 10.0f : floorf(f_mean[p]);
+
+            l_sub = prvSubIndex(s_epa[p], l_c, false);
+        }
+        else
+        {
+            l_sub = prvSubIndex(s_caqi[p], f_mean[p], true);
+        }
+
+        if (l_sub > l_index.m_value || p == 0)
+        {
+            l_index.m_value     = l_sub;
+            l_index.m_dominant  = (AqiPollutant)p;
+        }
+    }
+
+    if (f_scale == AqiScale_EPA)
+    {
+        static const int s_limits[] = { 50, 100, 150, 200, 300 };
+
+        while (l_index.m_category < 5 && l_index.m_value > s_limits[l_index.m_category]) ++l_index.m_category;
+    }
+    else
+    {
+        l_index.m_category = l_index.m_value > 100 ? 4 : (l_index.m_value < 75 ? l_index.m_value / 25 : 3);
+    }
+
+    return l_index;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+const char *AqiEngine::GetCategoryName(AqiScale f_scale, int f_category)
+{
+    if (f_scale == AqiScale_EPA) return s_epa_names[f_category];
+
+    return s_caqi_names[f_category];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t prvAqiJob(void *f_ctx)
+{
+    AqiEngine *l_aqi = (AqiEngine *)f_ctx;
+
+    l_aqi->Publish();
+
+    return CONFIG_AQI_PUBLISH_INTERVAL * 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t AqiEngine::InitManager(void)
+{
+    Reset();
+
+    // ---- the index messages are a scheduler job, interval 0 means none
+
+#if CONFIG_AQI_PUBLISH_INTERVAL > 0
+    if (g_Scheduler.AddJob("aqi", prvAqiJob, this, CONFIG_AQI_PUBLISH_INTERVAL * 1000) < 0)
+    {
+        ESP_LOGE(TAG, "Error adding the aqi job");
+        return ESP_FAIL;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AqiEngine::Reset(void)
+{
+    portENTER_CRITICAL(&s_aqi_mux);
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        Sensor &l_sensor = m_sensors[i];
+
+        l_sensor.m_hour.Init(l_sensor.m_hour_buckets, AQI_HOUR_BUCKETS, AQI_HOUR_BUCKET_MS);
+        l_sensor.m_day.Init(l_sensor.m_day_buckets, AQI_DAY_BUCKETS, AQI_DAY_BUCKET_MS);
+    }
+
+    portEXIT_CRITICAL(&s_aqi_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void AqiEngine::Add(int f_sensor, uint16_t f_pm2, uint16_t f_pm10)
+{
+    Add(f_sensor, esp_timer_get_time() / 1000, f_pm2, f_pm10);
+}
+
+void AqiEngine::Add(int f_sensor, int64_t f_time_ms, uint16_t f_pm2, uint16_t f_pm10)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    Sensor &l_sensor = m_sensors[f_sensor];
+
+    portENTER_CRITICAL(&s_aqi_mux);
+
+    l_sensor.m_hour.Add(f_time_ms, f_pm2, f_pm10);
+    l_sensor.m_day.Add(f_time_ms, f_pm2, f_pm10);
+
+    portEXIT_CRITICAL(&s_aqi_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool AqiEngine::GetResult(int f_sensor, AqiResult *f_result)
+{
+    return GetResult(f_sensor, esp_timer_get_time() / 1000, f_result);
+}
+
+bool AqiEngine::GetResult(int f_sensor, int64_t f_time_ms, AqiResult *f_result)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return false;
+
+    Sensor &l_sensor = m_sensors[f_sensor];
+
+    memset(f_result, 0, sizeof(AqiResult));
+
+    portENTER_CRITICAL(&s_aqi_mux);
+
+    bool l_hour = l_sensor.m_hour.GetMean(f_time_ms, f_result->m_hour);
+    bool l_day  = l_sensor.m_day.GetMean(f_time_ms, f_result->m_day);
+
+    f_result->m_hours = l_sensor.m_day.GetFilled() * (AQI_DAY_BUCKET_MS / 3600000.0f);
+
+    portEXIT_CRITICAL(&s_aqi_mux);
+
+    // --- EPA on the day, CAQI on the hour
+
+    f_result->m_index[AqiScale_EPA].m_value = -1;
+    f_result->m_index[AqiScale_CAQI].m_value = -1;
+
+    if (l_day) f_result->m_index[AqiScale_EPA] = Calculate(AqiScale_EPA, f_result->m_day);
+    if (l_hour) f_result->m_index[AqiScale_CAQI] = Calculate(AqiScale_CAQI, f_result->m_hour);
+
+    return l_day;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static double prvRound1(float f_value)
+{
+    return floorf(f_value * 10.0f + 0.5f) / 10.0;
+}
+
+void AqiEngine::AddToJson(const AqiResult &f_result, cJSON *f_obj) const
+{
+    cJSON_AddNumberToObject(f_obj, "pm2_1h", prvRound1(f_result.m_hour[AqiPollutant_PM2]));
+    cJSON_AddNumberToObject(f_obj, "pm10_1h", prvRound1(f_result.m_hour[AqiPollutant_PM10]));
+    cJSON_AddNumberToObject(f_obj, "pm2_24h", prvRound1(f_result.m_day[AqiPollutant_PM2]));
+    cJSON_AddNumberToObject(f_obj, "pm10_24h", prvRound1(f_result.m_day[AqiPollutant_PM10]));
+    cJSON_AddNumberToObject(f_obj, "hours", prvRound1(f_result.m_hours));
+
+    for (int s = 0; s < AqiScale_Cnt; ++s)
+    {
+        const AqiIndex &l_index = f_result.m_index[s];
+
+        if (l_index.m_value < 0) continue;
+
+        cJSON *l_obj = cJSON_AddObjectToObject(f_obj, s_scale_names[s]);
+
+        cJSON_AddNumberToObject(l_obj, "index", l_index.m_value);
+        cJSON_AddStringToObject(l_obj, "category", GetCategoryName((AqiScale)s, l_index.m_category));
+        cJSON_AddStringToObject(l_obj, "dominant", s_pollutant_names[l_index.m_dominant]);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- one message per sensor with data: {"pm2_1h":..,"epa":{"index":..,"category":..,
+// --- "dominant":..},"caqi":{...}}
+
+void AqiEngine::Publish(void)
+{
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        AqiResult l_result;
+
+        if (!GetResult(i, &l_result)) continue;
+
+        cJSON *root = cJSON_CreateObject();
+
+        g_SensorManager.GetSensor(i).GetHealth().AddToJson(root);
+        AddToJson(l_result, root);
+
+        char *l_json = cJSON_PrintUnformatted(root);
+        cJSON_Delete(root);
+
+        if (!l_json)
+        {
+            ESP_LOGE(TAG, "Error creating the index message");
+            return;
+        }
+
+        char l_topic[24];
+        snprintf(l_topic, sizeof(l_topic), "aqi/sensor%d", i + 1);
+
+        g_MqttManager.Publish(l_topic, l_json);
+
+        free(l_json);
+    }
+}
@@ -0,0 +1,176 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef AQI_H_
+#define	AQI_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "cJSON.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the rolling means: the last hour in 5 minute buckets, the last day in 30 minute
+// --- buckets. The bucket being filled counts, the oldest one is dropped as a whole
+
+#define AQI_HOUR_BUCKETS        12
+#define AQI_HOUR_BUCKET_MS      (5 * 60 * 1000)
+#define AQI_DAY_BUCKETS         48
+#define AQI_DAY_BUCKET_MS       (30 * 60 * 1000)
+
+enum AqiPollutant
+{
+    AqiPollutant_PM2,
+    AqiPollutant_PM10,
+
+    AqiPollutant_Cnt
+};
+
+// --- the indices: US EPA AQI (24 h means, 2024 breakpoints) and the European CAQI
+// --- (hourly background grid)
+
+enum AqiScale
+{
+    AqiScale_EPA,
+    AqiScale_CAQI,
+
+    AqiScale_Cnt
+};
+
+struct AqiIndex
+{
+    int             m_value;                // --- -1 without data
+    int             m_category;             // --- 0 = best
+    AqiPollutant    m_dominant;             // --- the one with the higher sub-index
+};
+
+struct AqiResult
+{
+    float       m_hour[AqiPollutant_Cnt];   // --- means in ug/m3
+    float       m_day[AqiPollutant_Cnt];
+    float       m_hours;                    // --- hours of the last day with data
+    AqiIndex    m_index[AqiScale_Cnt];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct AqiBucket
+{
+    uint32_t    m_sum[AqiPollutant_Cnt];
+    uint32_t    m_count;
+};
+
+// --- A mean over a sliding window of fixed time buckets: running sums, so adding a
+// --- value and reading the mean is O(1), moving the window only clears the buckets
+// --- it passes. Times in ms of a monotonic clock.
+
+class AqiWindow
+{
+
+public:
+    void Init(AqiBucket *f_buckets, int f_cnt, int32_t f_bucket_ms);
+
+    void Add(int64_t f_time_ms, uint16_t f_pm2, uint16_t f_pm10);
+
+    // --- false if the window is empty at f_time_ms
+
+    bool GetMean(int64_t f_time_ms, float *f_mean);
+    int GetFilled(void) const           { return m_filled; }
+
+private:
+    void Advance(int64_t f_time_ms);
+
+    AqiBucket           *m_buckets;
+    int                 m_cnt;
+    int32_t             m_bucket_ms;
+    int64_t             m_head;             // --- number of the newest bucket
+    uint32_t            m_sum[AqiPollutant_Cnt];
+    uint32_t            m_count;
+    int                 m_filled;           // --- buckets with data
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Air quality indices per sensor, updated with every datagram by the receive task.
+// --- The index with its category and dominant pollutant is served at /api/v1/aqi/<n>
+// --- and published to <topic>/aqi/sensor<n> every AQI_PUBLISH_INTERVAL seconds.
+
+class AqiEngine
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- empties all windows
+
+    void Reset(void);
+
+    void Add(int f_sensor, uint16_t f_pm2, uint16_t f_pm10);
+    void Add(int f_sensor, int64_t f_time_ms, uint16_t f_pm2, uint16_t f_pm10);
+
+    bool GetResult(int f_sensor, AqiResult *f_result);
+    bool GetResult(int f_sensor, int64_t f_time_ms, AqiResult *f_result);
+
+    void AddToJson(const AqiResult &f_result, cJSON *f_obj) const;
+
+    // --- the indices of a mean, also used by the benchmark
+
+    static AqiIndex Calculate(AqiScale f_scale, const float *f_mean);
+    static const char *GetCategoryName(AqiScale f_scale, int f_category);
+
+    void Publish(void);
+
+private:
+    struct Sensor
+    {
+        AqiBucket   m_hour_buckets[AQI_HOUR_BUCKETS];
+        AqiBucket   m_day_buckets[AQI_DAY_BUCKETS];
+        AqiWindow   m_hour;
+        AqiWindow   m_day;
+    };
+
+    Sensor      m_sensors[CONFIG_TEMP_SENSOR_CNT];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern AqiEngine g_Aqi;
+
+
+#endif
@@ -35,6 +35,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include "freertos/FreeRTOS.h"
 #include "nvs_flash.h"
@@ -45,6 +46,7 @@
 #include "esp_log.h"
 
 #include "config_manager.h"
+#include "config_manager_defines.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -54,10 +56,20 @@ using namespace std;
 
 static const char *TAG = "ConfigManager";
 
+// --- NVS key of the blob holding a transaction while it is applied
+
+#define CFMGR_JOURNAL_KEY       "cfg_journal"
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 ConfigManager g_ConfigManager;
 
+#ifdef CONFIG_STATIC_ALLOC
+static StaticSemaphore_t s_lock_buf;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
 esp_err_t ConfigManager::InitConfigManager(void)
 {
     // ----- Initialize NVS
@@ -86,7 +98,27 @@ esp_err_t ConfigManager::InitConfigManager(void)
         return err;      
     }
 
-    return ESP_OK;
+    // ---- the lock for the cache
+
+#ifdef CONFIG_STATIC_ALLOC
+    m_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+#else
+    m_lock = xSemaphoreCreateMutex();
+#endif
+    if (!m_lock)
+    {
+        ESP_LOGE(TAG, "Error creating config cache lock"); 
+        return ESP_ERR_NO_MEM;
+    }
+
+    // ---- finish a transaction which was interrupted by a power loss
+
+    err = ReplayJournal();
+    if (err != ESP_OK) return err;
+
+    // ---- and read all values once. After that NVS is only touched on writes
+
+    return LoadCache();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -108,121 +140,401 @@ void ConfigManager::ShutdownConfigManager(void)
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-esp_err_t ConfigManager::SetStringValue(const char *f_key,const char *f_value)
+esp_err_t ConfigManager::LoadCache(void)
 {
     assert(m_nvs_handle);
 
-    esp_err_t err = nvs_set_str(m_nvs_handle,f_key,f_value);
-    if (err != ESP_OK) 
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT; ++l_key)
     {
-        ESP_LOGE(TAG, "Error writing key '%s' to '%s': %s",f_key,f_value,esp_err_to_name(err)); 
-        return err;
+        const ConfigKeyDesc &l_desc = g_ConfigSchema[l_key];
+
+        if (l_desc.m_type == CfgType_Int)
+        {
+            int32_t f_i = 0;
+            esp_err_t err = nvs_get_i32(m_nvs_handle, l_desc.m_name,&f_i);
+
+            if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) 
+            {
+                ESP_LOGE(TAG, "Error reading key '%s': %s",l_desc.m_name,esp_err_to_name(err)); 
+            }
+
+            // --- missing or invalid values fall back to the default of the schema
+
+            if (err != ESP_OK || f_i < l_desc.m_min || f_i > l_desc.m_max) f_i = l_desc.m_default;
+
+            m_IntValues[l_desc.m_slot] = f_i;
+        }
+        else
+        {
+            // --- get the size first
+
+            size_t required_size;
+            esp_err_t err = nvs_get_str(m_nvs_handle, l_desc.m_name, NULL, &required_size);
+
+            if (err != ESP_OK)
+            {
+                if (err != ESP_ERR_NVS_NOT_FOUND) ESP_LOGE(TAG, "Error reading key '%s': %s",l_desc.m_name,esp_err_to_name(err)); 
+
+                m_StrValues[l_desc.m_slot] = l_desc.m_strdefault;
+                continue;
+            }
+
+            // --- allocate the buffer and read the string
+
+            char *buffer = (char *)malloc(required_size);
+            if (!buffer) return ESP_ERR_NO_MEM;
+
+            nvs_get_str(m_nvs_handle, l_desc.m_name, buffer, &required_size);
+            m_StrValues[l_desc.m_slot] = buffer;
+
+            free(buffer);
+        }
     }
 
-    err = nvs_commit(m_nvs_handle);
-    if (err != ESP_OK) 
+    ESP_LOGI(TAG, "Loaded %d config keys into cache",CFMGR_KEY_CNT); 
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t ConfigManager::RegisterListener(ConfigListener f_listener,void *f_ctx,uint32_t f_mask)
+{
+    assert(f_listener);
+
+    if (m_listener_cnt >= CFMGR_MAX_LISTENERS)
     {
-        ESP_LOGE(TAG, "Error to commit after writing key '%s' to '%s': %s",f_key,f_value,esp_err_to_name(err)); 
-        return err;
+        ESP_LOGE(TAG, "Too many config listeners"); 
+        return ESP_ERR_NO_MEM;
     }
 
+    m_listeners[m_listener_cnt].m_fn    = f_listener;
+    m_listeners[m_listener_cnt].m_ctx   = f_ctx;
+    m_listeners[m_listener_cnt].m_mask  = f_mask;
+
+    ++m_listener_cnt;
+
     return ESP_OK;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-std::string ConfigManager::GetStringValue(const char *f_key)
+void ConfigManager::NotifyListeners(uint32_t f_changed)
+{
+    // --- called without holding the lock, so listeners may read the config again
+
+    for (int i = 0; i < m_listener_cnt; ++i)
+    {
+        if (m_listeners[i].m_mask & f_changed) 
+        {
+            m_listeners[i].m_fn(m_listeners[i].m_mask & f_changed,m_listeners[i].m_ctx);
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t ConfigManager::SetStringValue(ConfigKey f_key,const char *f_value)
+{
+    ConfigTransaction l_txn;
+
+    esp_err_t err = l_txn.SetStringValue(f_key,f_value);
+    if (err != ESP_OK) return err;
+
+    return Commit(l_txn);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+std::string ConfigManager::GetStringValue(ConfigKey f_key)
 {    
-    assert(m_nvs_handle);
+    assert(g_ConfigSchema[f_key].m_type == CfgType_String);
 
-    // --- get the size first
+    // --- copy under the lock since a writer might replace the string
 
-    size_t required_size;
-    esp_err_t err = nvs_get_str(m_nvs_handle, f_key, NULL, &required_size);
+    xSemaphoreTake(m_lock,portMAX_DELAY);
+    string f_s(m_StrValues[g_ConfigSchema[f_key].m_slot]);
+    xSemaphoreGive(m_lock);
 
-    // --- check for "empty" string
+    return f_s;    
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
 
-    if (err == ESP_ERR_NVS_NOT_FOUND)
+esp_err_t ConfigManager::SetIntValue(ConfigKey f_key,int f_value)
+{
+    ConfigTransaction l_txn;
+
+    esp_err_t err = l_txn.SetIntValue(f_key,f_value);
+    if (err != ESP_OK) return err;
+
+    return Commit(l_txn);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t ConfigTransaction::SetStringValue(ConfigKey f_key,const char *f_value)
+{
+    const ConfigKeyDesc &l_desc = g_ConfigSchema[f_key];
+
+    if (l_desc.m_type != CfgType_String)
     {
-        // ---- return empty string
+        ESP_LOGE(TAG, "Config key '%s' is not a string",l_desc.m_name); 
+        return ESP_ERR_INVALID_ARG;
+    }
 
-        return string();
+    if (strlen(f_value) > (size_t)l_desc.m_max)
+    {
+        ESP_LOGE(TAG, "Config key '%s' longer than %d characters",l_desc.m_name,l_desc.m_max); 
+        return ESP_ERR_INVALID_SIZE;
     }
 
-    // --- every other error: fail
+    m_StrValues[l_desc.m_slot] = f_value;
+    m_staged |= CFMGR_KEYBIT(f_key);
 
-    if (err != ESP_OK) 
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t ConfigTransaction::SetIntValue(ConfigKey f_key,int f_value)
+{
+    const ConfigKeyDesc &l_desc = g_ConfigSchema[f_key];
+
+    if (l_desc.m_type != CfgType_Int)
     {
-        ESP_LOGE(TAG, "Error reading key '%s': %s",f_key,esp_err_to_name(err)); 
-        return string();
+        ESP_LOGE(TAG, "Config key '%s' is not an integer",l_desc.m_name); 
+        return ESP_ERR_INVALID_ARG;
     }
 
-    // --- allocate the buffer and read the string
+    if (f_value < l_desc.m_min || f_value > l_desc.m_max)
+    {
+        ESP_LOGE(TAG, "Config key '%s' value %d out of range [%d,%d]",l_desc.m_name,f_value,l_desc.m_min,l_desc.m_max); 
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    char *buffer = (char *)malloc(required_size);
-    nvs_get_str(m_nvs_handle, f_key, buffer, &required_size);
+    m_IntValues[l_desc.m_slot] = f_value;
+    m_staged |= CFMGR_KEYBIT(f_key);
 
-    // --- copy to c++ string
-    
-    string f_s(buffer);
+    return ESP_OK;
+}
 
-    // --- free temp buffer again
+////////////////////////////////////////////////////////////////////////////////////////
 
-    free(buffer);
+esp_err_t ConfigManager::WriteKey(int f_key,const ConfigTransaction &f_txn)
+{
+    const ConfigKeyDesc &l_desc = g_ConfigSchema[f_key];
+    esp_err_t err;
 
-    return f_s;    
+    if (l_desc.m_type == CfgType_Int)
+    {
+        err = nvs_set_i32(m_nvs_handle,l_desc.m_name,f_txn.m_IntValues[l_desc.m_slot]);
+    }
+    else
+    {
+        err = nvs_set_str(m_nvs_handle,l_desc.m_name,f_txn.m_StrValues[l_desc.m_slot].c_str());
+    }
+
+    if (err != ESP_OK) 
+    {
+        ESP_LOGE(TAG, "Error writing key '%s': %s",l_desc.m_name,esp_err_to_name(err)); 
+    }
+
+    return err;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-esp_err_t ConfigManager::SetIntValue(const char *f_key,int f_value)
+// --- journal layout: per changed key one byte key index, two bytes length (little 
+// --- endian) and the value (int32 or string without terminating zero)
+
+esp_err_t ConfigManager::Commit(const ConfigTransaction &f_txn,uint32_t *f_changed)
 {
     assert(m_nvs_handle);
 
-    esp_err_t err = nvs_set_i32(m_nvs_handle,f_key,(int32_t)f_value);
-    if (err != ESP_OK) 
+    if (f_changed) *f_changed = 0;
+
+    xSemaphoreTake(m_lock,portMAX_DELAY);
+
+    // --- find out what really changes and build the journal
+
+    uint32_t    l_dirty = 0;
+    std::string l_journal;
+
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT; ++l_key)
     {
-        ESP_LOGE(TAG, "Error writing key '%s' to '%d': %s",f_key,f_value,esp_err_to_name(err)); 
-        return err;
+        if (!(f_txn.m_staged & CFMGR_KEYBIT(l_key))) continue;
+
+        const ConfigKeyDesc &l_desc = g_ConfigSchema[l_key];
+
+        const char *l_data;
+        size_t      l_len;
+
+        if (l_desc.m_type == CfgType_Int)
+        {
+            if (m_IntValues[l_desc.m_slot] == f_txn.m_IntValues[l_desc.m_slot]) continue;
+
+            l_data  = (const char *)&f_txn.m_IntValues[l_desc.m_slot];
+            l_len   = sizeof(int32_t);
+        }
+        else
+        {
+            if (m_StrValues[l_desc.m_slot] == f_txn.m_StrValues[l_desc.m_slot]) continue;
+
+            l_data  = f_txn.m_StrValues[l_desc.m_slot].data();
+            l_len   = f_txn.m_StrValues[l_desc.m_slot].length();
+        }
+
+        l_journal += (char)l_key;
+        l_journal += (char)(l_len & 0xff);
+        l_journal += (char)(l_len >> 8);
+        l_journal.append(l_data,l_len);
+
+        l_dirty |= CFMGR_KEYBIT(l_key);
     }
 
-    err = nvs_commit(m_nvs_handle);
+    // --- nothing to do: no flash write at all
+
+    if (!l_dirty)
+    {
+        xSemaphoreGive(m_lock);
+        return ESP_OK;
+    }
+
+    // --- with more than one key, first persist the journal so a power loss can be 
+    // --- rolled forward on the next boot
+
+    bool l_use_journal = (l_dirty & (l_dirty - 1)) != 0;
+
+    esp_err_t err = ESP_OK;
+
+    if (l_use_journal)
+    {
+        err = nvs_set_blob(m_nvs_handle,CFMGR_JOURNAL_KEY,l_journal.data(),l_journal.length());
+        if (err != ESP_OK) 
+        {
+            xSemaphoreGive(m_lock);
+            ESP_LOGE(TAG, "Error writing config journal: %s",esp_err_to_name(err)); 
+            return err;
+        }
+    }
+
+    // --- now the keys themselves
+
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT && err == ESP_OK; ++l_key)
+    {
+        if (l_dirty & CFMGR_KEYBIT(l_key)) err = WriteKey(l_key,f_txn);
+    }
+
+    // --- on error the journal stays and is replayed on the next boot
+
+    if (err == ESP_OK && l_use_journal) err = nvs_erase_key(m_nvs_handle,CFMGR_JOURNAL_KEY);
+    if (err == ESP_OK) err = nvs_commit(m_nvs_handle);
+
     if (err != ESP_OK) 
     {
-        ESP_LOGE(TAG, "Error to commit after writing key '%s' to '%d': %s",f_key,f_value,esp_err_to_name(err)); 
+        xSemaphoreGive(m_lock);
+        ESP_LOGE(TAG, "Error to commit config transaction: %s",esp_err_to_name(err)); 
         return err;
     }
 
+    // --- everything is in flash, so update the cache
+
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT; ++l_key)
+    {
+        if (!(l_dirty & CFMGR_KEYBIT(l_key))) continue;
+
+        const ConfigKeyDesc &l_desc = g_ConfigSchema[l_key];
+
+        if (l_desc.m_type == CfgType_Int)
+            m_IntValues[l_desc.m_slot] = f_txn.m_IntValues[l_desc.m_slot];
+        else
+            m_StrValues[l_desc.m_slot] = f_txn.m_StrValues[l_desc.m_slot];
+    }
+
+    xSemaphoreGive(m_lock);
+
+    ESP_LOGI(TAG, "Committed config transaction, changed keys mask %x",l_dirty); 
+
+    if (f_changed) *f_changed = l_dirty;
+
+    NotifyListeners(l_dirty);
+
     return ESP_OK;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-int ConfigManager::GetIntValue(const char *f_key)
+esp_err_t ConfigManager::ReplayJournal(void)
 {
-   assert(m_nvs_handle);
+    size_t l_size = 0;
+    esp_err_t err = nvs_get_blob(m_nvs_handle,CFMGR_JOURNAL_KEY,NULL,&l_size);
+
+    // --- the normal case: no interrupted transaction
+
+    if (err == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
 
-    // --- get the size first
+    if (err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error reading config journal: %s",esp_err_to_name(err)); 
+        return err;
+    }
 
-    int32_t f_i;
-    esp_err_t err = nvs_get_i32(m_nvs_handle, f_key,&f_i);
+    ESP_LOGI(TAG, "Found interrupted config transaction (%u bytes), replaying",(unsigned)l_size); 
 
-    // --- check for "empty" string
+    uint8_t *l_buf = (uint8_t *)malloc(l_size);
+    if (!l_buf) return ESP_ERR_NO_MEM;
 
-    if (err == ESP_ERR_NVS_NOT_FOUND)
+    nvs_get_blob(m_nvs_handle,CFMGR_JOURNAL_KEY,l_buf,&l_size);
+
+    ConfigTransaction l_txn;
+    size_t l_pos = 0;
+
+    while (l_pos + 3 <= l_size)
     {
-        // ---- return empty string
+        int     l_key = l_buf[l_pos];
+        size_t  l_len = l_buf[l_pos+1] | (l_buf[l_pos+2] << 8);
+
+        l_pos += 3;
 
-        return 0;
+        if (l_key >= CFMGR_KEY_CNT || l_pos + l_len > l_size) 
+        {
+            ESP_LOGE(TAG, "Config journal corrupt, dropping it"); 
+            break;
+        }
+
+        const ConfigKeyDesc &l_desc = g_ConfigSchema[l_key];
+
+        if (l_desc.m_type == CfgType_Int && l_len == sizeof(int32_t))
+        {
+            memcpy(&l_txn.m_IntValues[l_desc.m_slot],&l_buf[l_pos],sizeof(int32_t));
+            l_txn.m_staged |= CFMGR_KEYBIT(l_key);
+        }
+        else if (l_desc.m_type == CfgType_String)
+        {
+            l_txn.m_StrValues[l_desc.m_slot].assign((const char *)&l_buf[l_pos],l_len);
+            l_txn.m_staged |= CFMGR_KEYBIT(l_key);
+        }
+
+        l_pos += l_len;
     }
 
-    // --- every other error: fail
+    free(l_buf);
 
-    if (err != ESP_OK) 
+    // --- write all keys of the journal, then drop it
+
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT && err == ESP_OK; ++l_key)
+    {
+        if (l_txn.m_staged & CFMGR_KEYBIT(l_key)) err = WriteKey(l_key,l_txn);
+    }
+
+    if (err == ESP_OK) err = nvs_erase_key(m_nvs_handle,CFMGR_JOURNAL_KEY);
+    if (err == ESP_OK) err = nvs_commit(m_nvs_handle);
+
+    if (err != ESP_OK)
     {
-        ESP_LOGE(TAG, "Error reading key '%s': %s",f_key,esp_err_to_name(err)); 
-        return 0;
+        ESP_LOGE(TAG, "Error replaying config journal: %s",esp_err_to_name(err)); 
     }
 
-    return (int)f_i;        
+    return err;
 }
@@ -37,9 +37,66 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-#include "vindriktning.h"
+#include <assert.h>
+#include <string>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "nvs.h"
 #include "sdkconfig.h"
 
+#include "config_manager_defines.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define CFMGR_MAX_LISTENERS     8
+
+// --- called after a write changed one or more keys. f_changed is a mask of CFMGR_KEYBIT()
+
+typedef void (*ConfigListener)(uint32_t f_changed, void *f_ctx);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- collects a set of changes which is then applied by ConfigManager::Commit with a 
+// --- single NVS commit. Either all staged values are stored or none of them.
+
+class ConfigTransaction
+{
+public:
+
+    ConfigTransaction()
+    {
+        m_staged = 0;
+
+        for (int i = 0; i < CFMGR_INT_CNT; ++i) m_IntValues[i] = 0;
+    }
+
+    // --- values are validated against the schema when staged
+
+    esp_err_t SetStringValue(ConfigKey f_key,const char *f_value);
+
+    esp_err_t SetStringValue(ConfigKey f_key,const std::string &f_value)
+    {
+        return SetStringValue(f_key,f_value.c_str());
+    }
+
+    esp_err_t SetIntValue(ConfigKey f_key,int f_value);
+
+    bool IsEmpty(void) const
+    {
+        return m_staged == 0;
+    }
+
+private:
+
+    friend class ConfigManager;
+
+    uint32_t        m_staged;
+
+    int32_t         m_IntValues[CFMGR_INT_CNT];
+    std::string     m_StrValues[CFMGR_STR_CNT];
+};
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 class ConfigManager
@@ -48,7 +105,11 @@ public:
 
     ConfigManager()
     {
-        m_nvs_handle = 0;
+        m_nvs_handle    = 0;
+        m_lock          = NULL;
+        m_listener_cnt  = 0;
+
+        for (int i = 0; i < CFMGR_INT_CNT; ++i) m_IntValues[i] = 0;
     }
 
     // --- init functions
@@ -56,24 +117,64 @@ public:
     esp_err_t InitConfigManager(void);
     void ShutdownConfigManager(void);
 
-    // --- getters / setters
+    // --- getters / setters. All reads are served from the RAM cache, writes go 
+    // --- through to NVS and notify the listeners
 
-    esp_err_t SetStringValue(const char *f_key,const char *f_value);
+    esp_err_t SetStringValue(ConfigKey f_key,const char *f_value);
 
-    esp_err_t SetStringValue(const char *f_key,const std::string &f_value)
+    esp_err_t SetStringValue(ConfigKey f_key,const std::string &f_value)
     {
         return SetStringValue(f_key,f_value.c_str());
     }
     
-    std::string GetStringValue(const char *f_key);
+    std::string GetStringValue(ConfigKey f_key);
+
+    esp_err_t SetIntValue(ConfigKey f_key,int f_value);
+
+    int GetIntValue(ConfigKey f_key) const
+    {
+        assert(g_ConfigSchema[f_key].m_type == CfgType_Int);
+
+        // --- 32 bit aligned load, no lock needed
+
+        return (int)m_IntValues[g_ConfigSchema[f_key].m_slot];
+    }
+
+    // --- apply a transaction. Only keys whose value differs are written, f_changed 
+    // --- (optional) receives the mask of those keys
+
+    esp_err_t Commit(const ConfigTransaction &f_txn,uint32_t *f_changed = NULL);
+
+    // --- change notification
+
+    esp_err_t RegisterListener(ConfigListener f_listener,void *f_ctx,uint32_t f_mask);
 
-    esp_err_t SetIntValue(const char *f_key,int f_value);
-    int GetIntValue(const char *f_key);
-    
 private:
 
-    nvs_handle_t m_nvs_handle;
+    esp_err_t LoadCache(void);
+    esp_err_t ReplayJournal(void);
+    esp_err_t WriteKey(int f_key,const ConfigTransaction &f_txn);
+    void NotifyListeners(uint32_t f_changed);
+
+    nvs_handle_t        m_nvs_handle;
     
+    // --- protects the string cache and serializes writers. Int values are 
+    // --- 32 bit aligned and read without taking the lock
+
+    SemaphoreHandle_t   m_lock;
+
+    volatile int32_t    m_IntValues[CFMGR_INT_CNT];
+    std::string         m_StrValues[CFMGR_STR_CNT];
+
+    struct Listener
+    {
+        ConfigListener  m_fn;
+        void           *m_ctx;
+        uint32_t        m_mask;
+    };
+
+    Listener            m_listeners[CFMGR_MAX_LISTENERS];
+    int                 m_listener_cnt;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
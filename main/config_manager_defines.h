@@ -37,14 +37,125 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-#define CFMGR_BOOTSTRAP_DONE    "Bootstrap_Done"
-#define CFMGR_WIFI_SSID         "Wifi_SSID"
-#define CFMGR_WIFI_PASSWORD     "Wifi_Password"
-#define CFMGR_DEVICE_NAME       "Device_Name"
-#define CFMGR_MQTT_SERVER       "mqtt_server"
-#define CFMGR_MQTT_TOPIC        "mqtt_topic"
-#define CFMGR_MQTT_TIME         "mqtt_time"
-#define CFMGR_MQTT_ENABLE       "mqtt_enable"
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- flags of a config key
+
+#define CFMGR_F_SECRET          0x01    // never returned by the REST API, empty value on POST keeps the old one
+#define CFMGR_F_READONLY        0x02    // maintained by the firmware, cannot be set via the REST API
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the config schema. Everything else (cache layout, defaults, validation, REST
+// --- GET/POST/PATCH) is generated from this table, so adding a setting is one line.
+// --- The key name is used for NVS and JSON and must not exceed 15 characters.
+//
+// --- CFMGR_INT(id, key, default, min, max, flags)
+// --- CFMGR_STR(id, key, default, max length, flags)
+
+#define CFMGR_SCHEMA(CFMGR_INT, CFMGR_STR) \
+    CFMGR_INT( CFMGR_BOOTSTRAP_DONE,    "Bootstrap_Done",   0,                      0, 1,       CFMGR_F_READONLY )  \
+    CFMGR_STR( CFMGR_WIFI_SSID,         "Wifi_SSID",        "",                     32,         0 )                 \
+    CFMGR_STR( CFMGR_WIFI_PASSWORD,     "Wifi_Password",    "",                     64,         CFMGR_F_SECRET )    \
+    CFMGR_STR( CFMGR_DEVICE_NAME,       "Device_Name",      "IoTDevice",            40,         0 )                 \
+    CFMGR_STR( CFMGR_MQTT_SERVER,       "mqtt_server",      "mqtt://192.168.1.20",  200,        0 )                 \
+    CFMGR_STR( CFMGR_MQTT_TOPIC,        "mqtt_topic",       "mytopic/templogger",   200,        0 )                 \
+    CFMGR_INT( CFMGR_MQTT_TIME,         "mqtt_time",        60,                     5, 86400,   0 )                 \
+    CFMGR_INT( CFMGR_MQTT_ENABLE,       "mqtt_enable",      0,                      0, 1,       0 )                 \
+    CFMGR_INT( CFMGR_MQTT_BATCH,        "mqtt_batch",       1,                      1, 60,      0 )                 \
+    CFMGR_STR( CFMGR_QUANTILES,         "quantiles",        "50,95,98",             40,         0 )                 \
+    CFMGR_STR( CFMGR_ALERT_WEBHOOK,     "alert_webhook",    "",                     200,        0 )                 \
+    CFMGR_INT( CFMGR_FRAME_WINDOW,      "frame_window",     0,                      0, 60000,   0 )                 \
+    CFMGR_INT( CFMGR_FUSION,            "fusion",           0,                      0, 2,       0 )                 \
+    CFMGR_INT( CFMGR_FUSION_TOL,        "fusion_tol",       30,                     5, 500,     0 )
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the key ids, used for all accesses to the config manager
+
+#define CFMGR_GEN_ENUM_INT(id, key, def, min, max, flags)   id,
+#define CFMGR_GEN_ENUM_STR(id, key, def, maxlen, flags)     id,
+
+enum ConfigKey
+{
+    CFMGR_SCHEMA(CFMGR_GEN_ENUM_INT, CFMGR_GEN_ENUM_STR)
+
+    CFMGR_KEY_CNT
+};
+
+// --- slots in the typed cache arrays
+
+#define CFMGR_GEN_SLOT_INT(id, key, def, min, max, flags)   id##_SLOT,
+#define CFMGR_GEN_SLOT_NONE(id, ...)
+
+enum ConfigIntSlot
+{
+    CFMGR_SCHEMA(CFMGR_GEN_SLOT_INT, CFMGR_GEN_SLOT_NONE)
+
+    CFMGR_INT_CNT
+};
+
+#define CFMGR_GEN_SLOT_STR(id, key, def, maxlen, flags)     id##_SLOT,
+
+enum ConfigStrSlot
+{
+    CFMGR_SCHEMA(CFMGR_GEN_SLOT_NONE, CFMGR_GEN_SLOT_STR)
+
+    CFMGR_STR_CNT
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+enum ConfigType
+{
+    CfgType_Int,
+    CfgType_String
+};
+
+struct ConfigKeyDesc
+{
+    const char *m_name;
+    ConfigType  m_type;
+    int         m_slot;
+
+    int32_t     m_default;      // int keys
+    const char *m_strdefault;   // string keys
+
+    int32_t     m_min;          // int keys: range. string keys: min is 0, max is the max. length
+    int32_t     m_max;
+
+    uint32_t    m_flags;
+};
+
+#define CFMGR_GEN_DESC_INT(id, key, def, min, max, flags)   { key, CfgType_Int,    id##_SLOT, def, "",  min, max,    flags },
+#define CFMGR_GEN_DESC_STR(id, key, def, maxlen, flags)     { key, CfgType_String, id##_SLOT, 0,   def, 0,   maxlen, flags },
+
+constexpr ConfigKeyDesc g_ConfigSchema[CFMGR_KEY_CNT] = 
+{
+    CFMGR_SCHEMA(CFMGR_GEN_DESC_INT, CFMGR_GEN_DESC_STR)
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- compile time checks of the schema
+
+#define CFMGR_GEN_CHECK_INT(id, key, def, min, max, flags) \
+    static_assert(sizeof(key) <= 16, "config key name too long for NVS: " key); \
+    static_assert((def) >= (min) && (def) <= (max), "config default out of range: " key);
+
+#define CFMGR_GEN_CHECK_STR(id, key, def, maxlen, flags) \
+    static_assert(sizeof(key) <= 16, "config key name too long for NVS: " key); \
+    static_assert(sizeof(def) <= (maxlen) + 1, "config default too long: " key);
+
+CFMGR_SCHEMA(CFMGR_GEN_CHECK_INT, CFMGR_GEN_CHECK_STR)
+
+static_assert(CFMGR_KEY_CNT <= 32, "change notification masks are limited to 32 config keys");
+
+// --- bit mask used to tell listeners which keys have been changed
+
+#define CFMGR_KEYBIT(k)         (1UL << (k))
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -0,0 +1,677 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "cJSON.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "diag_manager.h"
+#include "mqtt_manager.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "evlog.h"
+#include "response_cache.h"
+#include "sdcard_logger.h"
+#include "history.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
+#include "sensor_manager.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "DiagManager";
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the heaps we report, SPIRAM only when the board has some
+
+static const struct
+{
+    const char *m_name;
+    uint32_t    m_caps;
+} s_heaps[] = 
+{
+    { "8bit",       MALLOC_CAP_8BIT },
+    { "internal",   MALLOC_CAP_INTERNAL },
+    { "dma",        MALLOC_CAP_DMA },
+#ifdef CONFIG_ESP32_SPIRAM_SUPPORT
+    { "spiram",     MALLOC_CAP_SPIRAM },
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t prvDiagJob(void *f_ctx)
+{
+    DiagManager *l_diagmgr = (DiagManager *)f_ctx;
+
+    l_diagmgr->ProcessCallback();
+
+    return CONFIG_DIAG_HEALTH_INTERVAL * 1000;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- fragmentation: how much of the free memory can not be handed out in one block
+
+static int HeapFragmentation(const multi_heap_info_t &f_info)
+{
+    if (!f_info.total_free_bytes) return 0;
+
+    return 100 - (int)((uint64_t)f_info.largest_free_block * 100 / f_info.total_free_bytes);
+}
+
+static void AddHeap(cJSON *f_parent, const char *f_name, uint32_t f_caps, bool f_full)
+{
+    multi_heap_info_t l_info;
+
+    heap_caps_get_info(&l_info, f_caps);
+
+    cJSON *l_heap = cJSON_AddObjectToObject(f_parent, f_name);
+
+    cJSON_AddNumberToObject(l_heap, "free", l_info.total_free_bytes);
+    cJSON_AddNumberToObject(l_heap, "min_free", l_info.minimum_free_bytes);
+    cJSON_AddNumberToObject(l_heap, "largest", l_info.largest_free_block);
+    cJSON_AddNumberToObject(l_heap, "alloc_blocks", l_info.allocated_blocks);
+
+    if (f_full)
+    {
+        cJSON_AddNumberToObject(l_heap, "allocated", l_info.total_allocated_bytes);
+        cJSON_AddNumberToObject(l_heap, "free_blocks", l_info.free_blocks);
+    }
+
+    cJSON_AddNumberToObject(l_heap, "frag_pct", HeapFragmentation(l_info));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+
+static const char *TaskStateName(eTaskState f_state)
+{
+    switch (f_state)
+    {
+        case eRunning:      return "running";
+        case eReady:        return "ready";
+        case eBlocked:      return "blocked";
+        case eSuspended:    return "suspended";
+        case eDeleted:      return "deleted";
+        default:            return "invalid";
+    }
+}
+
+static int CompareHeadroom(const void *f_a, const void *f_b)
+{
+    const TaskStatus_t *l_a = (const TaskStatus_t *)f_a;
+    const TaskStatus_t *l_b = (const TaskStatus_t *)f_b;
+
+    if (l_a->usStackHighWaterMark < l_b->usStackHighWaterMark) return -1;
+    if (l_a->usStackHighWaterMark > l_b->usStackHighWaterMark) return 1;
+    return 0;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+cJSON *DiagManager::BuildReport(bool f_full)
+{
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "uptime_s", (double)(esp_timer_get_time() / 1000000));
+
+    // --- heaps
+
+    cJSON *l_heaps = cJSON_AddObjectToObject(root, "heap");
+
+    for (size_t i = 0; i < sizeof(s_heaps) / sizeof(s_heaps[0]); ++i)
+    {
+        // --- the compact report only carries the default heap
+
+        if (!f_full && i) break;
+
+        AddHeap(l_heaps, s_heaps[i].m_name, s_heaps[i].m_caps, f_full);
+    }
+
+    // --- tasks, sorted by stack headroom so the critical ones come first
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+
+    UBaseType_t l_count = uxTaskGetNumberOfTasks() + 2;   // --- tasks might get created meanwhile
+    TaskStatus_t *l_tasks = (TaskStatus_t *)malloc(l_count * sizeof(TaskStatus_t));
+
+    if (l_tasks)
+    {
+        l_count = uxTaskGetSystemState(l_tasks, l_count, NULL);
+
+        qsort(l_tasks, l_count, sizeof(TaskStatus_t), CompareHeadroom);
+
+        int l_low = 0;
+
+        for (UBaseType_t i = 0; i < l_count; ++i)
+        {
+            if (l_tasks[i].usStackHighWaterMark >= CONFIG_DIAG_STACK_WARN_BYTES) break;
+
+            ESP_LOGW(TAG, "Task %s has only %u bytes of stack left", l_tasks[i].pcTaskName, (unsigned)l_tasks[i].usStackHighWaterMark);
+            ++l_low;
+        }
+
+        if (l_low) ++m_stack_warnings;
+
+        cJSON_AddNumberToObject(root, "task_count", l_count);
+        cJSON_AddNumberToObject(root, "stack_low", l_low);
+
+        if (f_full)
+        {
+            cJSON *l_list = cJSON_AddArrayToObject(root, "tasks");
+
+            for (UBaseType_t i = 0; i < l_count; ++i)
+            {
+                cJSON *l_task = cJSON_CreateObject();
+
+                cJSON_AddStringToObject(l_task, "name", l_tasks[i].pcTaskName);
+                cJSON_AddNumberToObject(l_task, "prio", l_tasks[i].uxCurrentPriority);
+                cJSON_AddStringToObject(l_task, "state", TaskStateName(l_tasks[i].eCurrentState));
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+                cJSON_AddNumberToObject(l_task, "core", l_tasks[i].xCoreID == tskNO_AFFINITY ? -1 : l_tasks[i].xCoreID);
+#endif
+                cJSON_AddNumberToObject(l_task, "stack_free", l_tasks[i].usStackHighWaterMark);
+
+                cJSON_AddItemToArray(l_list, l_task);
+            }
+        }
+        else if (l_count)
+        {
+            cJSON *l_task = cJSON_AddObjectToObject(root, "stack_min");
+
+            cJSON_AddStringToObject(l_task, "name", l_tasks[0].pcTaskName);
+            cJSON_AddNumberToObject(l_task, "stack_free", l_tasks[0].usStackHighWaterMark);
+        }
+
+        free(l_tasks);
+    }
+
+#else
+
+    // --- without the trace facility we can only look at ourself
+
+    cJSON_AddNumberToObject(root, "stack_free", uxTaskGetStackHighWaterMark(NULL));
+
+#endif
+
+    cJSON_AddNumberToObject(root, "stack_warnings", m_stack_warnings);
+
+    // --- how often the firmware wakes up (scheduler and receive tasks) and how long it stays awake
+
+    cJSON_AddNumberToObject(root, "wakeups_per_hour", g_Scheduler.GetWakeupsPerHour());
+    cJSON_AddNumberToObject(root, "duty_pct", (double)(int)(g_Scheduler.GetDutyPercent() * 1000.0f) / 1000.0);
+    cJSON_AddBoolToObject(root, "power_save", g_PowerManager.IsEnabled());
+
+    if (f_full)
+    {
+        cJSON_AddNumberToObject(root, "wakeups", g_Scheduler.GetWakeups());
+        cJSON_AddNumberToObject(root, "events", g_Scheduler.GetEvents());
+        cJSON_AddNumberToObject(root, "active_ms", (double)(g_Scheduler.GetActiveUs() / 1000));
+        cJSON_AddNumberToObject(root, "rx_holds", g_PowerManager.GetRxHolds());
+
+        // --- cost of the uplink
+
+        MqttStats l_mqtt = g_MqttManager.GetStats();
+        cJSON *l_obj = cJSON_AddObjectToObject(root, "mqtt");
+
+        cJSON_AddBoolToObject(l_obj, "connected", g_MqttManager.IsConnected());
+        cJSON_AddNumberToObject(l_obj, "samples", l_mqtt.m_samples);
+        cJSON_AddNumberToObject(l_obj, "pending", g_MqttManager.GetPendingSamples());
+        cJSON_AddNumberToObject(l_obj, "dropped", l_mqtt.m_dropped);
+        cJSON_AddNumberToObject(l_obj, "messages", l_mqtt.m_messages);
+        cJSON_AddNumberToObject(l_obj, "bytes", (double)l_mqtt.m_bytes);
+        cJSON_AddNumberToObject(l_obj, "connects", l_mqtt.m_connects);
+        cJSON_AddNumberToObject(l_obj, "connected_ms", (double)(l_mqtt.m_connected_us / 1000));
+
+        if (l_mqtt.m_samples)
+        {
+            cJSON_AddNumberToObject(l_obj, "bytes_per_sample", (int)((double)l_mqtt.m_bytes * 10 / l_mqtt.m_samples + 0.5) / 10.0);
+        }
+
+        // --- the binary event log: records written since the first boot and still in the ring
+
+        l_obj = cJSON_AddObjectToObject(root, "evlog");
+
+        cJSON_AddNumberToObject(l_obj, "next", g_EventLog.GetNextSeq());
+        cJSON_AddNumberToObject(l_obj, "records", g_EventLog.GetNextSeq() - g_EventLog.GetFirstSeq());
+        cJSON_AddNumberToObject(l_obj, "bytes", g_EventLog.GetUsed());
+
+        // --- air responses sent from the cache and how often they had to be rendered
+
+        l_obj = cJSON_AddObjectToObject(root, "resp_cache");
+
+        cJSON_AddNumberToObject(l_obj, "hits", g_ResponseCache.GetHits());
+        cJSON_AddNumberToObject(l_obj, "renders", g_ResponseCache.GetRenders());
+
+        // --- the compressed RAM history of all sensors
+
+        uint32_t l_samples = 0;
+        size_t l_bytes = 0;
+
+        for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+        {
+            l_samples   += g_History.GetSamples(i);
+            l_bytes     += g_History.GetBytes(i);
+        }
+
+        l_obj = cJSON_AddObjectToObject(root, "history");
+
+        cJSON_AddNumberToObject(l_obj, "samples", l_samples);
+        cJSON_AddNumberToObject(l_obj, "bytes", l_bytes);
+
+        // --- the health of every sensor and what it is based on
+
+        l_obj = cJSON_AddArrayToObject(root, "sensors");
+
+        int64_t l_now = esp_timer_get_time();
+
+        for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+        {
+            SensorHealthInfo l_health = g_SensorManager.GetSensor(i).GetHealth().GetInfo(l_now);
+            cJSON *l_sensor = cJSON_CreateObject();
+
+            cJSON_AddStringToObject(l_sensor, "health", SensorHealth::GetStateName(l_health.m_state));
+            cJSON_AddNumberToObject(l_sensor, "age_ms", l_health.m_age_ms);
+            cJSON_AddNumberToObject(l_sensor, "cadence_ms", l_health.m_cadence_ms);
+            cJSON_AddNumberToObject(l_sensor, "datagrams", l_health.m_datagrams);
+            cJSON_AddNumberToObject(l_sensor, "errors", l_health.m_errors);
+            cJSON_AddNumberToObject(l_sensor, "error_permille", l_health.m_error_permille);
+            cJSON_AddNumberToObject(l_sensor, "same", l_health.m_same_cnt);
+
+            cJSON_AddItemToArray(l_obj, l_sensor);
+        }
+
+        // --- the frames of all sensors: how many were complete, how far apart the samples were
+
+        if (g_Frames.IsEnabled())
+        {
+            FrameStats l_frames = g_Frames.GetStats();
+
+            l_obj = cJSON_AddObjectToObject(root, "frames");
+
+            cJSON_AddNumberToObject(l_obj, "window_ms", g_Frames.GetWindow());
+            cJSON_AddNumberToObject(l_obj, "frames", l_frames.m_frames);
+            cJSON_AddNumberToObject(l_obj, "complete", l_frames.m_complete);
+            cJSON_AddNumberToObject(l_obj, "missing", l_frames.m_missing);
+            cJSON_AddNumberToObject(l_obj, "replaced", l_frames.m_replaced);
+            cJSON_AddNumberToObject(l_obj, "spread_max_ms", l_frames.m_spread_max_ms);
+        }
+
+        // --- the sensor fusion: how often a sensor started to deviate, updates without majority
+
+        if (g_Fusion.IsEnabled())
+        {
+            FusionStats l_fusion = g_Fusion.GetStats();
+
+            l_obj = cJSON_AddObjectToObject(root, "fusion");
+
+            cJSON_AddStringToObject(l_obj, "method", SensorFusion::GetModeName(g_Fusion.GetMode()));
+            cJSON_AddNumberToObject(l_obj, "updates", l_fusion.m_updates);
+            cJSON_AddNumberToObject(l_obj, "deviations", l_fusion.m_deviations);
+            cJSON_AddNumberToObject(l_obj, "conflicts", l_fusion.m_conflicts);
+        }
+
+        // --- SD card logger: lines written, datagrams lost because the card was too slow
+
+        if (g_SdLogger.IsEnabled())
+        {
+            const SdLogStats &l_sd = g_SdLogger.GetStats();
+
+            l_obj = cJSON_AddObjectToObject(root, "sdcard");
+
+            cJSON_AddNumberToObject(l_obj, "records", l_sd.m_records);
+            cJSON_AddNumberToObject(l_obj, "dropped", l_sd.m_dropped);
+            cJSON_AddNumberToObject(l_obj, "queued", g_SdLogger.GetQueued());
+            cJSON_AddNumberToObject(l_obj, "writes", l_sd.m_writes);
+            cJSON_AddNumberToObject(l_obj, "partial_writes", l_sd.m_partial);
+            cJSON_AddNumberToObject(l_obj, "bytes", (double)l_sd.m_bytes);
+            cJSON_AddNumberToObject(l_obj, "files", l_sd.m_files);
+            cJSON_AddNumberToObject(l_obj, "errors", l_sd.m_errors);
+        }
+    }
+
+    return root;
+}
+
+char *DiagManager::CreateReport(bool f_full)
+{
+    cJSON *root = BuildReport(f_full);
+
+    char *l_json = f_full ? cJSON_Print(root) : cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    return l_json;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- CPU usage
+////////////////////////////////////////////////////////////////////////////////////////
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+// --- the run time counters are 32 bit microseconds and wrap after ~71 minutes. Differences
+// --- between two snapshots survive one wrap, the numbers since boot do not
+
+static void FreeSnapshot(RunTimeSnapshot &f_snap)
+{
+    free(f_snap.m_tasks);
+
+    f_snap.m_tasks = NULL;
+    f_snap.m_count = 0;
+    f_snap.m_total = 0;
+}
+
+static bool TakeSnapshot(RunTimeSnapshot &f_snap)
+{
+    FreeSnapshot(f_snap);
+
+    UBaseType_t l_count = uxTaskGetNumberOfTasks() + 2;   // --- tasks might get created meanwhile
+
+    f_snap.m_tasks = (TaskStatus_t *)malloc(l_count * sizeof(TaskStatus_t));
+    if (!f_snap.m_tasks) return false;
+
+    f_snap.m_count = uxTaskGetSystemState(f_snap.m_tasks, l_count, &f_snap.m_total);
+
+    return f_snap.m_count != 0;
+}
+
+struct TaskLoad
+{
+    const TaskStatus_t *m_task;
+    uint32_t            m_delta;
+};
+
+static int CompareLoad(const void *f_a, const void *f_b)
+{
+    const TaskLoad *l_a = (const TaskLoad *)f_a;
+    const TaskLoad *l_b = (const TaskLoad *)f_b;
+
+    if (l_a->m_delta > l_b->m_delta) return -1;
+    if (l_a->m_delta < l_b->m_delta) return 1;
+    return 0;
+}
+
+static double Percent(uint64_t f_part, uint64_t f_whole)
+{
+    if (!f_whole) return 0;
+
+    double l_pct = (double)f_part * 100.0 / (double)f_whole;
+    if (l_pct > 100) l_pct = 100;
+
+    return (int)(l_pct * 100 + 0.5) / 100.0;
+}
+
+// --- adds "cores" (load per core) and the tasks by CPU usage between both snapshots. Without
+// --- f_prev the counters since boot are used. A task's share is of the whole chip, so all
+// --- tasks sum up to 100%; the load of a core is 100% minus its idle task
+
+static void AddCpuUsage(cJSON *f_parent, const RunTimeSnapshot *f_prev, const RunTimeSnapshot &f_cur, bool f_full)
+{
+    uint32_t l_elapsed = f_cur.m_total - (f_prev ? f_prev->m_total : 0);
+
+    TaskLoad *l_loads = (TaskLoad *)malloc(f_cur.m_count * sizeof(TaskLoad));
+    if (!l_loads) return;
+
+    for (UBaseType_t i = 0; i < f_cur.m_count; ++i)
+    {
+        const TaskStatus_t &l_task = f_cur.m_tasks[i];
+
+        l_loads[i].m_task = &l_task;
+        l_loads[i].m_delta = l_task.ulRunTimeCounter;
+
+        // --- the same task in the previous snapshot (the task number tells reused handles apart)
+
+        for (UBaseType_t j = 0; f_prev && j < f_prev->m_count; ++j)
+        {
+            if (f_prev->m_tasks[j].xHandle == l_task.xHandle && f_prev->m_tasks[j].xTaskNumber == l_task.xTaskNumber)
+            {
+                l_loads[i].m_delta = l_task.ulRunTimeCounter - f_prev->m_tasks[j].ulRunTimeCounter;
+                break;
+            }
+        }
+    }
+
+    cJSON_AddNumberToObject(f_parent, "window_ms", l_elapsed / 1000);
+
+    // --- per core load
+
+    cJSON *l_cores = cJSON_AddArrayToObject(f_parent, "cores");
+
+    for (int l_core = 0; l_core < portNUM_PROCESSORS; ++l_core)
+    {
+        TaskHandle_t l_idle = xTaskGetIdleTaskHandleForCPU(l_core);
+        uint64_t l_busy = 0;
+
+        for (UBaseType_t i = 0; i < f_cur.m_count; ++i)
+        {
+            if (l_idle)
+            {
+                if (l_loads[i].m_task->xHandle == l_idle) l_busy = l_elapsed - (uint64_t)l_loads[i].m_delta;
+            }
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+            else if (l_loads[i].m_task->xCoreID == l_core || l_loads[i].m_task->xCoreID == tskNO_AFFINITY) 
+            {
+                // --- no idle task to look at (host build): sum up the tasks which may run there
+
+                l_busy += l_loads[i].m_delta;
+            }
+#endif
+        }
+
+        cJSON_AddItemToArray(l_cores, cJSON_CreateNumber(Percent(l_busy, l_elapsed)));
+    }
+
+    // --- tasks by usage, the compact version only the top three
+
+    qsort(l_loads, f_cur.m_count, sizeof(TaskLoad), CompareLoad);
+
+    cJSON *l_list = cJSON_AddArrayToObject(f_parent, f_full ? "tasks" : "top");
+
+    for (UBaseType_t i = 0; i < f_cur.m_count; ++i)
+    {
+        if (!f_full && i >= 3) break;
+
+        cJSON *l_task = cJSON_CreateObject();
+
+        cJSON_AddStringToObject(l_task, "name", l_loads[i].m_task->pcTaskName);
+        cJSON_AddNumberToObject(l_task, "cpu_pct", Percent(l_loads[i].m_delta, (uint64_t)l_elapsed * portNUM_PROCESSORS));
+
+        if (f_full)
+        {
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+            cJSON_AddNumberToObject(l_task, "core", l_loads[i].m_task->xCoreID == tskNO_AFFINITY ? -1 : l_loads[i].m_task->xCoreID);
+#endif
+            cJSON_AddNumberToObject(l_task, "runtime_us", l_loads[i].m_delta);
+        }
+
+        cJSON_AddItemToArray(l_list, l_task);
+    }
+
+    free(l_loads);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+char *DiagManager::CreateCpuReport(uint32_t f_window_ms)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+
+    RunTimeSnapshot l_prev = { NULL, 0, 0 };
+    RunTimeSnapshot l_cur = { NULL, 0, 0 };
+
+    if (f_window_ms > DIAG_CPU_WINDOW_MAX_MS) f_window_ms = DIAG_CPU_WINDOW_MAX_MS;
+
+    // --- sampling mode: look at the given window only
+
+    if (f_window_ms)
+    {
+        if (!TakeSnapshot(l_prev)) 
+        {
+            FreeSnapshot(l_prev);
+            return NULL;
+        }
+
+        vTaskDelay(f_window_ms / portTICK_PERIOD_MS);
+    }
+
+    if (!TakeSnapshot(l_cur))
+    {
+        FreeSnapshot(l_prev);
+        FreeSnapshot(l_cur);
+        return NULL;
+    }
+
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "uptime_s", (double)(esp_timer_get_time() / 1000000));
+    AddCpuUsage(root, f_window_ms ? &l_prev : NULL, l_cur, true);
+
+    FreeSnapshot(l_prev);
+    FreeSnapshot(l_cur);
+
+    char *l_json = cJSON_Print(root);
+    cJSON_Delete(root);
+
+    return l_json;
+
+#else
+
+    ESP_LOGE(TAG, "CPU report needs CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS");
+    return NULL;
+
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void DiagManager::ProcessCallback(void)
+{
+    cJSON *root = BuildReport(false);
+
+    // --- CPU usage since the last health message
+
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    RunTimeSnapshot l_cur = { NULL, 0, 0 };
+
+    if (TakeSnapshot(l_cur))
+    {
+        cJSON *l_cpu = cJSON_AddObjectToObject(root, "cpu");
+
+        AddCpuUsage(l_cpu, m_last_cpu.m_tasks ? &m_last_cpu : NULL, l_cur, false);
+
+#ifdef CONFIG_STATIC_ALLOC
+        // --- keep the snapshot in the static pool, only the current one comes from the heap
+
+        if (l_cur.m_count > DIAG_MAX_TASKS)
+        {
+            ESP_LOGW(TAG, "%u tasks, only %d kept for the next CPU report", l_cur.m_count, DIAG_MAX_TASKS);
+            l_cur.m_count = DIAG_MAX_TASKS;
+        }
+
+        memcpy(m_last_tasks, l_cur.m_tasks, l_cur.m_count * sizeof(TaskStatus_t));
+
+        m_last_cpu.m_tasks = m_last_tasks;
+        m_last_cpu.m_count = l_cur.m_count;
+        m_last_cpu.m_total = l_cur.m_total;
+
+        FreeSnapshot(l_cur);
+#else
+        FreeSnapshot(m_last_cpu);
+        m_last_cpu = l_cur;
+#endif
+    }
+    else
+    {
+        FreeSnapshot(l_cur);
+    }
+#endif
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    if (!l_json) 
+    {
+        ESP_LOGE(TAG, "Error creating the health report");
+        return;
+    }
+
+    ESP_LOGD(TAG, "Health: %s", l_json);
+
+    g_MqttManager.Publish("health", l_json);
+
+    free(l_json);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t DiagManager::InitManager(void)
+{
+    m_stack_warnings = 0;
+
+    m_last_cpu.m_tasks = NULL;
+    m_last_cpu.m_count = 0;
+    m_last_cpu.m_total = 0;
+
+    // ---- health messages are a scheduler job, interval 0 means none
+
+#if CONFIG_DIAG_HEALTH_INTERVAL > 0
+    if (g_Scheduler.AddJob("health", prvDiagJob, this, CONFIG_DIAG_HEALTH_INTERVAL * 1000) < 0)
+    {
+        ESP_LOGE(TAG, "Error adding the health job");
+        return ESP_FAIL;
+    }
+#endif
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+DiagManager g_DiagManager;
+
+////////////////////////////////////////////////////////////////////////////////////////
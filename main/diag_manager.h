@@ -0,0 +1,108 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef DIAG_MANAGER_H_
+#define	DIAG_MANAGER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+#include "cJSON.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- longest sampling window of the CPU report, the caller blocks meanwhile
+
+#define DIAG_CPU_WINDOW_MAX_MS      10000
+
+// --- static allocation: tasks kept from one health message to the next
+
+#define DIAG_MAX_TASKS              24
+
+// --- run time counters of all tasks at one point in time
+
+struct RunTimeSnapshot
+{
+    TaskStatus_t   *m_tasks;
+    UBaseType_t     m_count;
+    uint32_t        m_total;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Collects the stack headroom of every task and the state of every heap, so stack sizes
+// --- and buffers can be chosen with evidence and slow leaks show up before a device dies.
+// --- Also measures where the CPU time goes (FreeRTOS run time stats).
+// --- The reports are served at /api/v1/diag and /api/v1/cpu, a summary of both is sent as
+// --- health message over MQTT.
+
+class DiagManager
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- JSON report, the caller has to free() it. The full report lists every task,
+    // --- the compact one (health message) only the totals and the task with the least headroom
+
+    char *CreateReport(bool f_full);
+
+    // --- CPU usage per task and per core. With a window the counters are sampled twice,
+    // --- f_window_ms apart (the caller blocks meanwhile), without it the usage since boot
+
+    char *CreateCpuReport(uint32_t f_window_ms);
+
+    void ProcessCallback(void);
+
+private:
+    cJSON *BuildReport(bool f_full);
+
+    RunTimeSnapshot m_last_cpu;
+    uint32_t        m_stack_warnings;
+
+#ifdef CONFIG_STATIC_ALLOC
+    TaskStatus_t    m_last_tasks[DIAG_MAX_TASKS];
+#endif
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern DiagManager g_DiagManager;
+
+
+#endif
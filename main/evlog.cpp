@@ -0,0 +1,407 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs.h"
+
+#include "evlog.h"
+#include "scheduler.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONFIG_EVLOG
+static const char *TAG = "evlog";
+#endif
+
+#define EVLOG_NVS_NAMESPACE     "evlog"
+#define EVLOG_NVS_KEY           "ring"
+
+// --- the text of the events
+
+struct EvlogEvent
+{
+    const char  *m_tag;
+    const char  *m_format;
+};
+
+static const EvlogEvent s_events[EvlogId_Cnt] =
+{
+#define EVLOG_EVENT(name, tag, format) { tag, format },
+#include "evlog_events.h"
+#undef EVLOG_EVENT
+};
+
+// --- the ring, and the lock of it: adding an event must not block
+
+static uint8_t          s_ring[CONFIG_EVLOG_SIZE];
+static portMUX_TYPE     s_ring_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#if CONFIG_EVLOG_SPILL_INTERVAL > 0
+
+// --- the ring as written to NVS: the header, then the records from the oldest on
+
+struct EvlogSpillHeader
+{
+    uint32_t    m_first_seq;
+    uint32_t    m_count;
+    uint32_t    m_bytes;
+};
+
+#ifdef CONFIG_STATIC_ALLOC
+static uint8_t          s_spill[sizeof(EvlogSpillHeader) + CONFIG_EVLOG_SIZE];
+#endif
+
+#endif
+
+EventLog g_EventLog;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#if CONFIG_EVLOG_SPILL_INTERVAL > 0
+
+static uint32_t prvSpillJob(void *f_ctx)
+{
+    EventLog *l_evlog = (EventLog *)f_ctx;
+
+    l_evlog->Spill();
+
+    return CONFIG_EVLOG_SPILL_INTERVAL * 1000;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+const char *EventLog::GetTag(uint16_t f_id)
+{
+    return f_id < EvlogId_Cnt ? s_events[f_id].m_tag : "evlog";
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int EventLog::Format(char *f_buf, size_t f_size, const EvlogRecord &f_rec, const uint32_t *f_args)
+{
+    // --- unknown IDs come from a newer firmware, show them raw
+
+    if (f_rec.m_id >= EvlogId_Cnt || f_rec.m_argc > EVLOG_MAX_ARGS)
+    {
+        int l_len = snprintf(f_buf, f_size, "event %u:", f_rec.m_id);
+
+        for (int i = 0; i < f_rec.m_argc && i < EVLOG_MAX_ARGS && l_len > 0 && (size_t)l_len < f_size; ++i)
+        {
+            l_len += snprintf(f_buf + l_len, f_size - l_len, " %u", (unsigned)f_args[i]);
+        }
+
+        return l_len;
+    }
+
+    uint32_t l_args[EVLOG_MAX_ARGS] = { 0 };
+
+    memcpy(l_args, f_args, f_rec.m_argc * sizeof(uint32_t));
+
+    return snprintf(f_buf, f_size, s_events[f_rec.m_id].m_format, l_args[0], l_args[1], l_args[2], l_args[3]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void EventLog::CopyOut(size_t f_pos, void *f_dst, size_t f_len) const
+{
+    size_t l_first = CONFIG_EVLOG_SIZE - f_pos;
+
+    if (l_first >= f_len)
+    {
+        memcpy(f_dst, s_ring + f_pos, f_len);
+    }
+    else
+    {
+        memcpy(f_dst, s_ring + f_pos, l_first);
+        memcpy((uint8_t *)f_dst + l_first, s_ring, f_len - l_first);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- drops the oldest record, called with the ring locked
+
+void EventLog::Drop(void)
+{
+    EvlogRecord l_rec;
+
+    CopyOut(m_tail, &l_rec, sizeof(l_rec));
+
+    size_t l_len = EVLOG_RECORD_LEN(l_rec.m_argc);
+
+    m_tail = (m_tail + l_len) % CONFIG_EVLOG_SIZE;
+    m_used -= l_len;
+    ++m_first_seq;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void EventLog::Write(EvlogId f_id, uint8_t f_argc, const uint32_t *f_args)
+{
+    EvlogRecord l_rec;
+
+    l_rec.m_time_ms     = (uint32_t)(esp_timer_get_time() / 1000);
+    l_rec.m_id          = f_id;
+    l_rec.m_argc        = f_argc;
+    l_rec.m_reserved    = 0;
+
+    size_t l_len = EVLOG_RECORD_LEN(f_argc);
+
+    portENTER_CRITICAL(&s_ring_mux);
+
+    // --- make room by dropping the oldest records
+
+    while (m_used + l_len > CONFIG_EVLOG_SIZE) Drop();
+
+    // --- the record and its arguments, both may wrap around
+
+    const uint8_t *l_parts[2] = { (const uint8_t *)&l_rec, (const uint8_t *)f_args };
+    size_t l_sizes[2] = { sizeof(l_rec), f_argc * sizeof(uint32_t) };
+
+    for (int p = 0; p < 2; ++p)
+    {
+        size_t l_first = CONFIG_EVLOG_SIZE - m_head;
+
+        if (l_first >= l_sizes[p])
+        {
+            memcpy(s_ring + m_head, l_parts[p], l_sizes[p]);
+        }
+        else
+        {
+            memcpy(s_ring + m_head, l_parts[p], l_first);
+            memcpy(s_ring, l_parts[p] + l_first, l_sizes[p] - l_first);
+        }
+
+        m_head = (m_head + l_sizes[p]) % CONFIG_EVLOG_SIZE;
+    }
+
+    m_used += l_len;
+    ++m_next_seq;
+
+    portEXIT_CRITICAL(&s_ring_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+size_t EventLog::Read(uint32_t f_from, uint8_t *f_buf, size_t f_size, uint32_t *f_first, uint32_t *f_count)
+{
+    size_t l_bytes = 0;
+    uint32_t l_count = 0;
+
+    portENTER_CRITICAL(&s_ring_mux);
+
+    // --- walk to the first wanted record
+
+    size_t l_pos = m_tail;
+    size_t l_left = m_used;
+    uint32_t l_seq = m_first_seq;
+
+    while (l_left && (int32_t)(f_from - l_seq) > 0)
+    {
+        EvlogRecord l_rec;
+        CopyOut(l_pos, &l_rec, sizeof(l_rec));
+
+        size_t l_len = EVLOG_RECORD_LEN(l_rec.m_argc);
+
+        l_pos = (l_pos + l_len) % CONFIG_EVLOG_SIZE;
+        l_left -= l_len;
+        ++l_seq;
+    }
+
+    *f_first = l_seq;
+
+    // --- and copy as many whole records as fit
+
+    while (l_left)
+    {
+        EvlogRecord l_rec;
+        CopyOut(l_pos, &l_rec, sizeof(l_rec));
+
+        size_t l_len = EVLOG_RECORD_LEN(l_rec.m_argc);
+
+        if (l_bytes + l_len > f_size) break;
+
+        CopyOut(l_pos, f_buf + l_bytes, l_len);
+
+        l_bytes += l_len;
+        l_pos = (l_pos + l_len) % CONFIG_EVLOG_SIZE;
+        l_left -= l_len;
+        ++l_count;
+    }
+
+    portEXIT_CRITICAL(&s_ring_mux);
+
+    *f_count = l_count;
+
+    return l_bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t EventLog::Spill(void)
+{
+#if CONFIG_EVLOG_SPILL_INTERVAL > 0
+
+#ifdef CONFIG_STATIC_ALLOC
+    uint8_t *l_buf = s_spill;
+#else
+    uint8_t *l_buf = (uint8_t *)malloc(sizeof(EvlogSpillHeader) + CONFIG_EVLOG_SIZE);
+    if (!l_buf) return ESP_ERR_NO_MEM;
+#endif
+
+    EvlogSpillHeader l_hdr;
+
+    l_hdr.m_bytes = Read(m_first_seq, l_buf + sizeof(l_hdr), CONFIG_EVLOG_SIZE, &l_hdr.m_first_seq, &l_hdr.m_count);
+    memcpy(l_buf, &l_hdr, sizeof(l_hdr));
+
+    nvs_handle_t l_nvs;
+    esp_err_t l_err = nvs_open(EVLOG_NVS_NAMESPACE, NVS_READWRITE, &l_nvs);
+
+    if (l_err == ESP_OK)
+    {
+        l_err = nvs_set_blob(l_nvs, EVLOG_NVS_KEY, l_buf, sizeof(l_hdr) + l_hdr.m_bytes);
+        if (l_err == ESP_OK) l_err = nvs_commit(l_nvs);
+
+        nvs_close(l_nvs);
+    }
+
+#ifndef CONFIG_STATIC_ALLOC
+    free(l_buf);
+#endif
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error spilling the event log: %s", esp_err_to_name(l_err));
+        return l_err;
+    }
+
+    EVLOG(EvlogSpill, l_hdr.m_count, l_hdr.m_bytes);
+
+    return ESP_OK;
+
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t EventLog::InitManager(void)
+{
+    m_head      = 0;
+    m_tail      = 0;
+    m_used      = 0;
+    m_first_seq = 0;
+    m_next_seq  = 0;
+
+    uint32_t l_restored = 0;
+
+#if CONFIG_EVLOG_SPILL_INTERVAL > 0
+
+    // --- the records of the last run go first
+
+    nvs_handle_t l_nvs;
+
+    if (nvs_open(EVLOG_NVS_NAMESPACE, NVS_READONLY, &l_nvs) == ESP_OK)
+    {
+#ifdef CONFIG_STATIC_ALLOC
+        uint8_t *l_buf = s_spill;
+#else
+        uint8_t *l_buf = (uint8_t *)malloc(sizeof(EvlogSpillHeader) + CONFIG_EVLOG_SIZE);
+#endif
+        size_t l_size = sizeof(EvlogSpillHeader) + CONFIG_EVLOG_SIZE;
+
+        if (l_buf && nvs_get_blob(l_nvs, EVLOG_NVS_KEY, l_buf, &l_size) == ESP_OK && l_size >= sizeof(EvlogSpillHeader))
+        {
+            EvlogSpillHeader l_hdr;
+            memcpy(&l_hdr, l_buf, sizeof(l_hdr));
+
+            size_t l_pos = sizeof(l_hdr);
+
+            m_first_seq = m_next_seq = l_hdr.m_first_seq;
+
+            for (uint32_t i = 0; i < l_hdr.m_count && l_pos + sizeof(EvlogRecord) <= l_size; ++i)
+            {
+                EvlogRecord l_rec;
+                memcpy(&l_rec, l_buf + l_pos, sizeof(l_rec));
+
+                size_t l_len = EVLOG_RECORD_LEN(l_rec.m_argc);
+                if (l_rec.m_argc > EVLOG_MAX_ARGS || l_pos + l_len > l_size) break;
+
+                // --- at the same place in the empty ring, keeping its time stamp
+
+                memcpy(s_ring + m_head, l_buf + l_pos, l_len);
+
+                m_head += l_len;
+                m_used += l_len;
+                ++m_next_seq;
+                ++l_restored;
+
+                l_pos += l_len;
+            }
+
+            m_head %= CONFIG_EVLOG_SIZE;
+        }
+
+#ifndef CONFIG_STATIC_ALLOC
+        free(l_buf);
+#endif
+        nvs_close(l_nvs);
+    }
+
+    if (g_Scheduler.AddJob("evlog", prvSpillJob, this, CONFIG_EVLOG_SPILL_INTERVAL * 1000) < 0)
+    {
+        ESP_LOGE(TAG, "Error adding the spill job");
+        return ESP_FAIL;
+    }
+
+#endif
+
+#ifdef CONFIG_EVLOG
+    ESP_LOGI(TAG, "Event log with %d bytes, %u records restored", CONFIG_EVLOG_SIZE, (unsigned)l_restored);
+#endif
+
+    EVLOG(Boot, esp_reset_reason(), l_restored);
+
+    return ESP_OK;
+}
@@ -0,0 +1,187 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef EVLOG_H_
+#define	EVLOG_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+#include "esp_log.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define EVLOG_MAX_ARGS          4
+
+// --- without CONFIG_EVLOG the events are printed, the ring stays empty
+
+#ifndef CONFIG_EVLOG
+#undef CONFIG_EVLOG_SIZE
+#undef CONFIG_EVLOG_SPILL_INTERVAL
+#define CONFIG_EVLOG_SIZE               64
+#define CONFIG_EVLOG_SPILL_INTERVAL     0
+#endif
+
+// --- the event IDs, generated from evlog_events.h
+
+enum EvlogId
+{
+#define EVLOG_EVENT(name, tag, format) EvlogId_##name,
+#include "evlog_events.h"
+#undef EVLOG_EVENT
+    EvlogId_Cnt
+};
+
+// --- one record in the ring: the header followed by m_argc 32 bit arguments
+
+struct EvlogRecord
+{
+    uint32_t    m_time_ms;          // --- since boot
+    uint16_t    m_id;               // --- EvlogId
+    uint8_t     m_argc;
+    uint8_t     m_reserved;
+};
+
+#define EVLOG_RECORD_LEN(argc)  (sizeof(EvlogRecord) + (argc) * sizeof(uint32_t))
+
+// --- GET /api/v1/evlog streams an EvlogStreamHeader followed by blocks of records, each
+// --- with an EvlogBlockHeader. Records are numbered since the first boot, a gap between
+// --- two blocks means the ring wrapped meanwhile. All numbers are little endian.
+
+#define EVLOG_STREAM_MAGIC      "EVL1"
+
+struct EvlogStreamHeader
+{
+    char        m_magic[4];
+    uint32_t    m_next_seq;         // --- number of the next record to be written
+    uint32_t    m_uptime_ms;
+};
+
+struct EvlogBlockHeader
+{
+    uint32_t    m_first_seq;
+    uint16_t    m_count;
+    uint16_t    m_bytes;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Binary event log: instead of formatting a line for the console the hot paths store
+// --- the event ID and the raw arguments in a RAM ring (CONFIG_EVLOG_SIZE bytes), which
+// --- takes a fraction of the CPU time of ESP_LOGI. The ring is downloaded at /api/v1/evlog
+// --- and turned back into text with host/tools/evlogdump. With CONFIG_EVLOG_SPILL_INTERVAL
+// --- the ring is also written to NVS periodically and before a reboot, and restored at boot.
+
+class EventLog
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- add an event, the arguments are stored as 32 bit values
+
+    template<typename... T> void Add(EvlogId f_id, T... f_args)
+    {
+        static_assert(sizeof...(T) <= EVLOG_MAX_ARGS, "too many arguments for the event log");
+
+        uint32_t l_args[sizeof...(T) + 1] = { (uint32_t)f_args... };
+
+        Write(f_id, sizeof...(T), l_args);
+    }
+
+    // --- copies whole records starting at record f_from (or the oldest one if that is gone)
+    // --- to f_buf. Returns the bytes copied, f_first and f_count describe the records
+
+    size_t Read(uint32_t f_from, uint8_t *f_buf, size_t f_size, uint32_t *f_first, uint32_t *f_count);
+
+    // --- write the ring to NVS, only with CONFIG_EVLOG_SPILL_INTERVAL
+
+    esp_err_t Spill(void);
+
+    // --- statistics
+
+    uint32_t GetNextSeq(void) const     { return m_next_seq; }
+    uint32_t GetFirstSeq(void) const    { return m_first_seq; }
+    size_t GetUsed(void) const          { return m_used; }
+
+    // --- the text of a record, also used by the decoder on the host
+
+    static int Format(char *f_buf, size_t f_size, const EvlogRecord &f_rec, const uint32_t *f_args);
+    static const char *GetTag(uint16_t f_id);
+
+private:
+    void Write(EvlogId f_id, uint8_t f_argc, const uint32_t *f_args);
+    void Drop(void);
+    void CopyOut(size_t f_pos, void *f_dst, size_t f_len) const;
+
+    size_t      m_head;             // --- where the next record goes
+    size_t      m_tail;             // --- the oldest record
+    size_t      m_used;
+    uint32_t    m_first_seq;        // --- number of the oldest record
+    uint32_t    m_next_seq;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- logging on the hot paths: EVLOG(SensorDatagram, uart, pm25, pm1, pm10). Without
+// --- CONFIG_EVLOG the line is formatted and printed like ESP_LOGI
+
+#ifdef CONFIG_EVLOG
+#define EVLOG(name, ...)    g_EventLog.Add(EvlogId_##name, ##__VA_ARGS__)
+#else
+#define EVLOG(name, ...)    EvlogPrint(EvlogId_##name, ##__VA_ARGS__)
+
+template<typename... T> void EvlogPrint(EvlogId f_id, T... f_args)
+{
+    uint32_t    l_args[sizeof...(T) + 1] = { (uint32_t)f_args... };
+    EvlogRecord l_rec = { 0, (uint16_t)f_id, (uint8_t)sizeof...(T), 0 };
+    char        l_line[128];
+
+    EventLog::Format(l_line, sizeof(l_line), l_rec, l_args);
+    ESP_LOGI(EventLog::GetTag(f_id), "%s", l_line);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern EventLog g_EventLog;
+
+
+#endif
@@ -0,0 +1,61 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- The events of the binary log (see evlog.h): EVLOG_EVENT(name, tag, format).
+// --- The formats take integer arguments only (%d %u %x %c, at most EVLOG_MAX_ARGS),
+// --- the log stores the index of the line and the raw arguments. Only append new events,
+// --- stored and downloaded logs refer to them by index.
+
+EVLOG_EVENT(Boot,               "evlog",            "Boot, reset reason %d, %u records from the last run")
+EVLOG_EVENT(SensorDatagram,     "vindriktning",     "Datagram valid on uart %d: pm25 %d pm1 %d pm10 %d")
+EVLOG_EVENT(SensorValues,       "SensorManager",    "Sensor %d: pm1 %d, pm2.5 %d, pm10 %d")
+EVLOG_EVENT(MqttSent,           "MqttManager",      "Sent sample of sensor %d (%d bytes)")
+EVLOG_EVENT(MqttBatchSent,      "MqttManager",      "Sent batch of %d samples (%d bytes)")
+EVLOG_EVENT(RestAir,            "esp-rest",         "GET /api/v1/air/%d")
+EVLOG_EVENT(RestSensorCnt,      "esp-rest",         "GET /api/v1/sensorcnt")
+EVLOG_EVENT(RestDiag,           "esp-rest",         "GET /api/v1/diag")
+EVLOG_EVENT(RestCpu,            "esp-rest",         "GET /api/v1/cpu, window %u ms")
+EVLOG_EVENT(RestConfigGet,      "esp-rest",         "GET /api/v1/config")
+EVLOG_EVENT(RestEvlog,          "esp-rest",         "GET /api/v1/evlog, from record %u")
+EVLOG_EVENT(EvlogSpill,         "evlog",            "Spilled %u records (%u bytes) to flash")
+EVLOG_EVENT(RestHistory,        "esp-rest",         "GET /api/v1/history/%d, binary %d")
+EVLOG_EVENT(RestQuantiles,      "esp-rest",         "GET /api/v1/quantiles/%d")
+EVLOG_EVENT(RestAqi,            "esp-rest",         "GET /api/v1/aqi/%d")
+EVLOG_EVENT(AlarmChanged,       "AlarmManager",     "Rule %d on sensor %d: active %d, level %d")
+EVLOG_EVENT(RestRules,          "esp-rest",         "GET /api/v1/rules")
+EVLOG_EVENT(SensorBack,         "SensorHealth",     "Sensor %d delivers again after %u s")
+EVLOG_EVENT(RestFrame,          "esp-rest",         "GET /api/v1/frame")
+EVLOG_EVENT(MqttFrameSent,      "MqttManager",      "Sent frame %u (%d bytes)")
+EVLOG_EVENT(FusionDeviating,    "Fusion",           "Sensor %d at PM2.5 %u against %u fused: deviating %d")
+EVLOG_EVENT(RestFused,          "esp-rest",         "GET /api/v1/fused")
@@ -0,0 +1,354 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "frame_assembler.h"
+#include "config_manager.h"
+#include "config_manager_defines.h"
+#include "history.h"
+#include "mqtt_manager.h"
+#include "scheduler.h"
+#include "sensor_manager.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "Frames";
+
+// --- the receive tasks fill, the scheduler closes, the REST server and MQTT read
+
+static portMUX_TYPE s_frame_mux = portMUX_INITIALIZER_UNLOCKED;
+
+FrameAssembler g_Frames;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static uint32_t prvFrameJob(void *f_ctx)
+{
+    FrameAssembler *l_frames = (FrameAssembler *)f_ctx;
+
+    return l_frames->Expire(esp_timer_get_time());
+}
+
+static void prvFrameConfigChanged(uint32_t f_changed, void *f_ctx)
+{
+    FrameAssembler *l_frames = (FrameAssembler *)f_ctx;
+
+    l_frames->SetWindow(g_ConfigManager.GetIntValue(CFMGR_FRAME_WINDOW));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t FrameAssembler::InitManager(void)
+{
+    Init(g_ConfigManager.GetIntValue(CFMGR_FRAME_WINDOW));
+
+    // ---- the job closes frames with missing sensors, it only runs while one is open
+
+    m_job = g_Scheduler.AddJob("frame", prvFrameJob, this, SCHED_STOP);
+
+    if (m_job < 0)
+    {
+        ESP_LOGE(TAG, "Error adding the frame job");
+        return ESP_FAIL;
+    }
+
+    g_ConfigManager.RegisterListener(prvFrameConfigChanged, this, CFMGR_KEYBIT(CFMGR_FRAME_WINDOW));
+
+    ESP_LOGI(TAG, "Frame window %u ms", m_window_ms);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameAssembler::Init(uint32_t f_window_ms)
+{
+    portENTER_CRITICAL(&s_frame_mux);
+
+    m_window_ms = f_window_ms;
+    m_job       = -1;
+    m_open      = false;
+
+    memset(&m_frame, 0, sizeof(m_frame));
+    memset(&m_last, 0, sizeof(m_last));
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    portEXIT_CRITICAL(&s_frame_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameAssembler::SetWindow(uint32_t f_window_ms)
+{
+    if (f_window_ms > FRAME_WINDOW_MAX_MS) f_window_ms = FRAME_WINDOW_MAX_MS;
+
+    portENTER_CRITICAL(&s_frame_mux);
+
+    // --- off: the open frame is dropped. A new window applies from the next frame on
+
+    m_window_ms = f_window_ms;
+    if (!m_window_ms) m_open = false;
+
+    portEXIT_CRITICAL(&s_frame_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameAssembler::Open(int64_t f_time_us, int64_t f_wall_ms)
+{
+    memset(&m_frame, 0, sizeof(m_frame));
+
+    m_frame.m_time_us   = f_time_us;
+    m_frame.m_wall_ms   = f_wall_ms;
+    m_open              = true;
+}
+
+// --- with the lock held
+
+void FrameAssembler::Close(SensorFrame *f_closed)
+{
+    m_frame.m_seq = ++m_stats.m_frames;
+
+    uint32_t l_spread_ms = 0;
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        if (!(m_frame.m_present & (1UL << i)))
+        {
+            ++m_stats.m_missing;
+            continue;
+        }
+
+        if (m_frame.m_offset_ms[i] > l_spread_ms) l_spread_ms = m_frame.m_offset_ms[i];
+    }
+
+    if (m_frame.m_present == FRAME_ALL_SENSORS) ++m_stats.m_complete;
+    if (l_spread_ms > m_stats.m_spread_max_ms) m_stats.m_spread_max_ms = l_spread_ms;
+
+    m_last  = m_frame;
+    m_open  = false;
+
+    *f_closed = m_frame;
+}
+
+// --- without the lock: the history gets the sensors of the frame with its time stamp,
+// --- the missing ones leave a gap
+
+void FrameAssembler::Deliver(const SensorFrame &f_frame)
+{
+    TsSample l_sample;
+
+    l_sample.m_time_ms = f_frame.m_wall_ms;
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        if (!(f_frame.m_present & (1UL << i))) continue;
+
+        memcpy(l_sample.m_val, f_frame.m_pm[i], sizeof(l_sample.m_val));
+
+        g_History.Add(i, l_sample);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameAssembler::Add(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    if (!m_window_ms || f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    struct timeval l_now;
+    gettimeofday(&l_now, NULL);
+
+    int64_t l_wall_ms = (int64_t)l_now.tv_sec * 1000 + l_now.tv_usec / 1000;
+
+    // --- at most one frame closes here: an overdue one before this sample opens the next,
+    // --- or the one this sample completes. A new frame only completes with one sensor
+
+    SensorFrame l_closed;
+    bool l_deliver  = false;
+    bool l_opened   = false;
+
+    portENTER_CRITICAL(&s_frame_mux);
+
+    if (m_open && f_time_us - m_frame.m_time_us >= (int64_t)m_window_ms * 1000)
+    {
+        // --- the job has not come around yet
+
+        Close(&l_closed);
+        l_deliver = true;
+    }
+
+    if (!m_open)
+    {
+        Open(f_time_us, l_wall_ms);
+        l_opened = true;
+    }
+
+    uint32_t l_bit = 1UL << f_sensor;
+
+    if (m_frame.m_present & l_bit) ++m_stats.m_replaced;
+
+    m_frame.m_present               |= l_bit;
+    m_frame.m_offset_ms[f_sensor]   = (uint16_t)((f_time_us - m_frame.m_time_us) / 1000);
+    m_frame.m_pm[f_sensor][0]       = f_pm1;
+    m_frame.m_pm[f_sensor][1]       = f_pm2;
+    m_frame.m_pm[f_sensor][2]       = f_pm10;
+
+    if (m_frame.m_present == FRAME_ALL_SENSORS && !l_deliver)
+    {
+        Close(&l_closed);
+        l_deliver = true;
+    }
+
+    // --- a frame still open after this sample is closed by the job at the latest
+
+    bool l_schedule         = l_opened && m_open;
+    uint32_t l_window_ms    = m_window_ms;
+
+    portEXIT_CRITICAL(&s_frame_mux);
+
+    if (l_deliver) Deliver(l_closed);
+    if (l_schedule) g_Scheduler.SetJobDelay(m_job, l_window_ms);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t FrameAssembler::Expire(int64_t f_now_us)
+{
+    SensorFrame l_closed;
+
+    portENTER_CRITICAL(&s_frame_mux);
+
+    if (!m_open)
+    {
+        portEXIT_CRITICAL(&s_frame_mux);
+        return SCHED_STOP;
+    }
+
+    int64_t l_due_us = m_frame.m_time_us + (int64_t)m_window_ms * 1000;
+
+    if (f_now_us < l_due_us)
+    {
+        portEXIT_CRITICAL(&s_frame_mux);
+        return (uint32_t)((l_due_us - f_now_us + 999) / 1000);
+    }
+
+    Close(&l_closed);
+
+    portEXIT_CRITICAL(&s_frame_mux);
+
+    Deliver(l_closed);
+
+    return SCHED_STOP;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool FrameAssembler::GetLast(SensorFrame *f_frame) const
+{
+    portENTER_CRITICAL(&s_frame_mux);
+
+    *f_frame = m_last;
+
+    portEXIT_CRITICAL(&s_frame_mux);
+
+    return f_frame->m_seq != 0;
+}
+
+FrameStats FrameAssembler::GetStats(void) const
+{
+    portENTER_CRITICAL(&s_frame_mux);
+
+    FrameStats l_stats = m_stats;
+
+    portEXIT_CRITICAL(&s_frame_mux);
+
+    return l_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void FrameAssembler::AddToJson(const SensorFrame &f_frame, int64_t f_now_us, cJSON *f_obj)
+{
+    static const char *s_names[3] = { "pm1", "pm2", "pm10" };
+
+    cJSON_AddNumberToObject(f_obj, "seq", f_frame.m_seq);
+
+    if (f_frame.m_wall_ms / 1000 >= (int64_t)MQTT_TIME_VALID)
+    {
+        cJSON_AddNumberToObject(f_obj, "time", (double)(f_frame.m_wall_ms / 1000));
+    }
+    else
+    {
+        cJSON_AddNumberToObject(f_obj, "up", (double)(f_frame.m_time_us / 1000000));
+    }
+
+    int64_t l_age_us = f_now_us - f_frame.m_time_us;
+
+    cJSON_AddNumberToObject(f_obj, "age", l_age_us > 0 ? (double)(l_age_us / 1000000) : 0.0);
+    cJSON_AddBoolToObject(f_obj, "complete", f_frame.m_present == FRAME_ALL_SENSORS);
+
+    cJSON *l_sensors = cJSON_AddArrayToObject(f_obj, "sensors");
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        cJSON *l_sensor = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(l_sensor, "sensor", i + 1);
+
+        if (f_frame.m_present & (1UL << i))
+        {
+            for (int v = 0; v < 3; ++v) cJSON_AddNumberToObject(l_sensor, s_names[v], f_frame.m_pm[i][v]);
+
+            cJSON_AddNumberToObject(l_sensor, "offset", f_frame.m_offset_ms[i]);
+        }
+        else
+        {
+            cJSON_AddBoolToObject(l_sensor, "missing", true);
+        }
+
+        // --- the health now, tells why a sensor is missing
+
+        g_SensorManager.GetSensor(i).GetHealth().AddToJson(l_sensor);
+
+        cJSON_AddItemToArray(l_sensors, l_sensor);
+    }
+}
@@ -0,0 +1,136 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FRAME_ASSEMBLER_H_
+#define	FRAME_ASSEMBLER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "cJSON.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define FRAME_WINDOW_MAX_MS     60000
+#define FRAME_ALL_SENSORS       ((1UL << CONFIG_TEMP_SENSOR_CNT) - 1)
+
+// --- the latest sample of every sensor within one window
+
+struct SensorFrame
+{
+    uint32_t    m_seq;                  // --- counts from boot, 0 = no frame yet
+    int64_t     m_time_us;              // --- esp_timer time of the first sample
+    int64_t     m_wall_ms;              // --- and the wall clock (uptime before SNTP)
+    uint32_t    m_present;              // --- bit per sensor, clear = missing
+    uint16_t    m_offset_ms[CONFIG_TEMP_SENSOR_CNT];    // --- sample time after the first one
+    uint16_t    m_pm[CONFIG_TEMP_SENSOR_CNT][3];        // --- PM1, PM2.5, PM10
+};
+
+struct FrameStats
+{
+    uint32_t    m_frames;
+    uint32_t    m_complete;             // --- all sensors within the window
+    uint32_t    m_missing;              // --- sensors missing in the closed frames
+    uint32_t    m_replaced;             // --- samples replaced by a newer one of the same sensor
+    uint32_t    m_spread_max_ms;        // --- from the first to the last sample of a frame
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Aligns the sensors, which are read independently: the first datagram opens a frame,
+// --- every sensor puts its latest sample in, and the frame is closed as soon as all
+// --- sensors are in or the window has passed. Sensors still missing then are marked as
+// --- such. A closed frame goes to the history with one time stamp for all sensors, is
+// --- served at /api/v1/frame and replaces the per-sensor MQTT messages with one message
+// --- to <topic>/frame. The window is the config key frame_window, 0 turns frames off.
+
+class FrameAssembler
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- without the scheduler job, the open frame is closed by Add() and Expire() only
+
+    void Init(uint32_t f_window_ms);
+
+    void SetWindow(uint32_t f_window_ms);
+    uint32_t GetWindow(void) const      { return m_window_ms; }
+    bool IsEnabled(void) const          { return m_window_ms > 0; }
+
+    // --- the receive tasks, at esp_timer time f_time_us
+
+    void Add(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+
+    // --- closes the open frame if its window has passed at f_now_us. Returns the ms until
+    // --- it is due, SCHED_STOP without an open frame
+
+    uint32_t Expire(int64_t f_now_us);
+
+    // --- the last closed frame, false if there is none yet
+
+    bool GetLast(SensorFrame *f_frame) const;
+
+    FrameStats GetStats(void) const;
+
+    // --- "seq":12,"time":<unix s>,"age":3,"complete":false,"sensors":[{"sensor":1,
+    // --- "pm1":3,"pm2":5,"pm10":6,"offset":<ms>,"health":"ok",...},{"sensor":2,
+    // --- "missing":true,"health":"stale",...}]. "up" (seconds since boot) replaces "time"
+    // --- as long as the clock is not set
+
+    static void AddToJson(const SensorFrame &f_frame, int64_t f_now_us, cJSON *f_obj);
+
+private:
+    void Open(int64_t f_time_us, int64_t f_wall_ms);
+    void Close(SensorFrame *f_closed);
+    void Deliver(const SensorFrame &f_frame);
+
+    uint32_t    m_window_ms;
+    int         m_job;
+    bool        m_open;
+    SensorFrame m_frame;                // --- being filled
+    SensorFrame m_last;
+    FrameStats  m_stats;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern FrameAssembler g_Frames;
+
+
+#endif
@@ -0,0 +1,441 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "history.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "History";
+
+// --- adding a sample must not block the receive task for long, the readers copy one
+// --- block at a time
+
+static portMUX_TYPE s_history_mux = portMUX_INITIALIZER_UNLOCKED;
+
+SampleHistory g_History;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t SampleHistory::InitManager(void)
+{
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        Ring &l_ring = m_rings[i];
+
+        memset(l_ring.m_len, 0, sizeof(l_ring.m_len));
+
+        l_ring.m_first_seq  = 0;
+        l_ring.m_head_seq   = 0;
+        l_ring.m_samples    = 0;
+
+        l_ring.m_enc.Begin(l_ring.m_blocks[0], TSC_BLOCK_SIZE);
+        l_ring.m_len[0] = l_ring.m_enc.GetSize();
+    }
+
+    ESP_LOGI(TAG, "History of %d blocks per sensor, %d bytes", HISTORY_BLOCKS, (int)sizeof(m_rings));
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SampleHistory::Add(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    struct timeval l_now;
+    gettimeofday(&l_now, NULL);
+
+    TsSample l_sample;
+
+    l_sample.m_time_ms  = (int64_t)l_now.tv_sec * 1000 + l_now.tv_usec / 1000;
+    l_sample.m_val[0]   = f_pm1;
+    l_sample.m_val[1]   = f_pm2;
+    l_sample.m_val[2]   = f_pm10;
+
+    Add(f_sensor, l_sample);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SampleHistory::Add(int f_sensor, const TsSample &f_sample)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    Ring &l_ring = m_rings[f_sensor];
+
+    portENTER_CRITICAL(&s_history_mux);
+
+    if (!l_ring.m_enc.Add(f_sample))
+    {
+        // --- the block is full: start the next one, over the oldest if the ring is full
+
+        ++l_ring.m_head_seq;
+
+        if (l_ring.m_head_seq - l_ring.m_first_seq >= HISTORY_BLOCKS)
+        {
+            uint8_t *l_oldest = l_ring.m_blocks[l_ring.m_first_seq % HISTORY_BLOCKS];
+
+            l_ring.m_samples -= l_oldest[0] | (l_oldest[1] << 8);
+            ++l_ring.m_first_seq;
+        }
+
+        uint32_t l_slot = l_ring.m_head_seq % HISTORY_BLOCKS;
+
+        l_ring.m_enc.Begin(l_ring.m_blocks[l_slot], TSC_BLOCK_SIZE);
+        l_ring.m_enc.Add(f_sample);
+    }
+
+    l_ring.m_len[l_ring.m_head_seq % HISTORY_BLOCKS] = l_ring.m_enc.GetSize();
+    ++l_ring.m_samples;
+
+    portEXIT_CRITICAL(&s_history_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+size_t SampleHistory::ReadBlock(int f_sensor, uint32_t *f_seq, uint8_t *f_buf)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return 0;
+
+    Ring &l_ring = m_rings[f_sensor];
+    size_t l_len = 0;
+
+    portENTER_CRITICAL(&s_history_mux);
+
+    if ((int32_t)(*f_seq - l_ring.m_first_seq) < 0) *f_seq = l_ring.m_first_seq;
+
+    if ((int32_t)(*f_seq - l_ring.m_head_seq) <= 0)
+    {
+        uint32_t l_slot = *f_seq % HISTORY_BLOCKS;
+
+        l_len = l_ring.m_len[l_slot];
+        memcpy(f_buf, l_ring.m_blocks[l_slot], l_len);
+    }
+
+    portEXIT_CRITICAL(&s_history_mux);
+
+    return l_len;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SampleHistory::GetFirstSeq(int f_sensor) const
+{
+    return m_rings[f_sensor].m_first_seq;
+}
+
+uint32_t SampleHistory::GetSamples(int f_sensor) const
+{
+    return m_rings[f_sensor].m_samples;
+}
+
+size_t SampleHistory::GetBytes(int f_sensor) const
+{
+    const Ring &l_ring = m_rings[f_sensor];
+    size_t l_bytes = 0;
+
+    for (uint32_t l_seq = l_ring.m_first_seq; (int32_t)(l_seq - l_ring.m_head_seq) <= 0; ++l_seq)
+    {
+        l_bytes += l_ring.m_len[l_seq % HISTORY_BLOCKS];
+    }
+
+    return l_bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void HistoryCursor::Begin(int f_sensor, int64_t f_from, int64_t f_to, uint8_t *f_buf)
+{
+    m_sensor    = f_sensor;
+    m_from      = f_from;
+    m_to        = f_to;
+    m_seq       = g_History.GetFirstSeq(f_sensor);
+    m_buf       = f_buf;
+    m_open      = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool HistoryCursor::Next(TsSample *f_sample)
+{
+    for (;;)
+    {
+        if (!m_open)
+        {
+            size_t l_len = g_History.ReadBlock(m_sensor, &m_seq, m_buf);
+
+            if (!l_len) return false;
+
+            m_dec.Begin(m_buf, l_len);
+            m_open = true;
+        }
+
+        if (!m_dec.Next(f_sample))
+        {
+            m_open = false;
+            ++m_seq;
+            continue;
+        }
+
+        // --- the clock may have been set meanwhile, so look at every block
+
+        if (f_sample->m_time_ms < m_from || f_sample->m_time_ms > m_to) continue;
+
+        return true;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+enum
+{
+    LTTB_FIRST,
+    LTTB_BUCKETS,
+    LTTB_DONE,
+    LTTB_ALL
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void HistoryDownsampler::Begin(int f_sensor, int64_t f_from, uint32_t f_points, uint8_t *f_buf)
+{
+    TsSample l_sample;
+
+    // --- a first pass for the range and the number of samples, later ones are left out
+
+    m_count = 0;
+    m_first = 0;
+    m_last  = 0;
+
+    m_sel.Begin(f_sensor, f_from, INT64_MAX, f_buf);
+
+    while (m_sel.Next(&l_sample))
+    {
+        if (!m_count) m_first = l_sample.m_time_ms;
+        if (l_sample.m_time_ms > m_last) m_last = l_sample.m_time_ms;
+
+        ++m_count;
+    }
+
+    if (f_points < 3) f_points = 3;
+
+    m_buckets = f_points - 2;
+
+    if (!m_count) m_state = LTTB_DONE;
+    else if (m_count <= f_points) m_state = LTTB_ALL;
+    else m_state = LTTB_FIRST;
+
+    m_sel.Begin(f_sensor, f_from, m_last, f_buf);
+    m_ahead.Begin(f_sensor, f_from, m_last, f_buf + TSC_BLOCK_SIZE);
+
+    m_sel_index     = 0;
+    m_ahead_index   = 0;
+    m_sel_have      = false;
+    m_ahead_have    = false;
+    m_sel_bucket    = 0;
+    m_ahead_bucket  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool HistoryDownsampler::Next(TsSample *f_sample)
+{
+    switch (m_state)
+    {
+        case LTTB_FIRST:
+            // --- the first sample as it is, the look ahead starts behind it
+
+            if (!m_sel.Next(&m_prev) || !m_ahead.Next(&m_ahead_next))
+            {
+                m_state = LTTB_DONE;
+                return false;
+            }
+
+            *f_sample = m_prev;
+            m_state = LTTB_BUCKETS;
+            return true;
+
+        case LTTB_BUCKETS:
+            break;
+
+        case LTTB_ALL:
+            return m_sel.Next(f_sample);
+
+        default:
+            return false;
+    }
+
+    if (!m_sel_have)
+    {
+        if (!m_sel.Next(&m_sel_next))
+        {
+            m_state = LTTB_DONE;
+            return false;
+        }
+
+        m_sel_have = true;
+        ++m_sel_index;
+    }
+
+    int l_bucket = Bucket(m_sel_index, m_sel_next.m_time_ms, m_sel_bucket);
+
+    if (l_bucket >= m_buckets)
+    {
+        // --- the last sample closes the series
+
+        *f_sample = m_sel_next;
+        m_state = LTTB_DONE;
+        return true;
+    }
+
+    if (m_ahead_bucket <= l_bucket) LookAhead(l_bucket);
+
+    // --- the sample of this bucket with the largest triangle between the previous point
+    // --- and the average of the next bucket (twice the area, that does not matter)
+
+    float l_ax = (float)(m_prev.m_time_ms - m_first);
+    float l_best = -1.0f;
+
+    m_sel_bucket = l_bucket;
+
+    do
+    {
+        float l_bx = (float)(m_sel_next.m_time_ms - m_first);
+        float l_area = 0.0f;
+
+        for (int c = 0; c < TSC_CHANNELS; ++c)
+        {
+            float l_av = (float)m_prev.m_val[c];
+
+            l_area += fabsf((l_ax - m_avg_time) * ((float)m_sel_next.m_val[c] - l_av) - (l_ax - l_bx) * (m_avg_val[c] - l_av));
+        }
+
+        if (l_area > l_best)
+        {
+            l_best = l_area;
+            *f_sample = m_sel_next;
+        }
+
+        m_sel_have = m_sel.Next(&m_sel_next);
+        if (m_sel_have) ++m_sel_index;
+    }
+    while (m_sel_have && Bucket(m_sel_index, m_sel_next.m_time_ms, l_bucket) == l_bucket);
+
+    m_prev = *f_sample;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int HistoryDownsampler::Bucket(uint32_t f_index, int64_t f_time, int f_min) const
+{
+    if (f_time >= m_last) return m_buckets;
+
+    // --- by index, the sensors send in bursts. Samples 1 .. m_count - 2 are split up,
+    // --- blocks dropped meanwhile only shift the buckets a bit
+
+    int l_bucket = f_index ? (int)((uint64_t)(f_index - 1) * m_buckets / (m_count - 2)) : 0;
+
+    if (l_bucket >= m_buckets) l_bucket = m_buckets - 1;
+
+    return l_bucket < f_min ? f_min : l_bucket;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void HistoryDownsampler::LookAhead(int f_bucket)
+{
+    // --- the average of the first bucket behind f_bucket with samples in it, the last
+    // --- sample counts as a bucket of its own
+
+    int64_t l_time = 0;
+    uint32_t l_val[TSC_CHANNELS] = { 0 };
+    uint32_t l_n = 0;
+    int l_min = m_ahead_bucket;
+
+    for (;;)
+    {
+        if (!m_ahead_have)
+        {
+            if (!m_ahead.Next(&m_ahead_next)) break;
+
+            m_ahead_have = true;
+            ++m_ahead_index;
+        }
+
+        int l_bucket = Bucket(m_ahead_index, m_ahead_next.m_time_ms, l_min);
+
+        if (l_bucket <= f_bucket)
+        {
+            m_ahead_have = false;
+            continue;
+        }
+
+        if (l_n && l_bucket != m_ahead_bucket) break;
+
+        m_ahead_bucket = l_bucket;
+        l_min = l_bucket;
+
+        l_time += m_ahead_next.m_time_ms - m_first;
+
+        for (int c = 0; c < TSC_CHANNELS; ++c) l_val[c] += m_ahead_next.m_val[c];
+
+        ++l_n;
+        m_ahead_have = false;
+    }
+
+    if (!l_n)
+    {
+        // --- nothing left (blocks dropped meanwhile): aim at the previous point
+
+        m_ahead_bucket = m_buckets;
+        m_avg_time = (float)(m_prev.m_time_ms - m_first);
+
+        for (int c = 0; c < TSC_CHANNELS; ++c) m_avg_val[c] = m_prev.m_val[c];
+
+        return;
+    }
+
+    m_avg_time = (float)l_time / l_n;
+
+    for (int c = 0; c < TSC_CHANNELS; ++c) m_avg_val[c] = (float)l_val[c] / l_n;
+}
@@ -0,0 +1,182 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef HISTORY_H_
+#define	HISTORY_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "tscodec.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define HISTORY_BLOCKS          (CONFIG_HISTORY_SIZE / TSC_BLOCK_SIZE)
+
+// --- the export stream of /api/v1/history/<n>?format=bin: the magic, then every block
+// --- with its length (u16, little endian) in front
+
+#define HISTORY_STREAM_MAGIC    "TSC1"
+
+// --- the most points a downsampled query (?points=N) may ask for
+
+#define HISTORY_MAX_POINTS      2000
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Every datagram of every sensor kept in RAM, compressed with tscodec: each sensor has
+// --- a ring of HISTORY_BLOCKS blocks, the newest one is being filled and the oldest is
+// --- dropped when a new one starts. Blocks are numbered from boot, a reader copies them
+// --- one by one and only holds the lock for the copy.
+
+class SampleHistory
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- a new datagram, time stamped with the wall clock (uptime before SNTP)
+
+    void Add(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+    void Add(int f_sensor, const TsSample &f_sample);
+
+    // --- copies block *f_seq, or the oldest one if it is gone already, to f_buf
+    // --- (TSC_BLOCK_SIZE bytes). Returns the length, 0 when there are no more blocks
+
+    size_t ReadBlock(int f_sensor, uint32_t *f_seq, uint8_t *f_buf);
+
+    // --- statistics
+
+    uint32_t GetFirstSeq(int f_sensor) const;
+    uint32_t GetSamples(int f_sensor) const;
+    size_t GetBytes(int f_sensor) const;
+
+private:
+    struct Ring
+    {
+        uint8_t         m_blocks[HISTORY_BLOCKS][TSC_BLOCK_SIZE];
+        uint16_t        m_len[HISTORY_BLOCKS];
+        uint32_t        m_first_seq;        // --- the oldest block
+        uint32_t        m_head_seq;         // --- the block being filled
+        uint32_t        m_samples;          // --- in all blocks
+        TsBlockEncoder  m_enc;
+    };
+
+    Ring m_rings[CONFIG_TEMP_SENSOR_CNT];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern SampleHistory g_History;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Walks the samples of one sensor between f_from and f_to (ms, both included), block
+// --- by block. f_buf holds the current block (TSC_BLOCK_SIZE bytes). Blocks dropped while
+// --- walking are skipped.
+
+class HistoryCursor
+{
+
+public:
+    void Begin(int f_sensor, int64_t f_from, int64_t f_to, uint8_t *f_buf);
+    bool Next(TsSample *f_sample);
+
+private:
+    int             m_sensor;
+    int64_t         m_from;
+    int64_t         m_to;
+    uint32_t        m_seq;
+    uint8_t         *m_buf;
+    bool            m_open;
+    TsBlockDecoder  m_dec;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Largest-Triangle-Three-Buckets downsampling of the samples from f_from on to at most
+// --- f_points points. The first and the last sample are kept, the samples between are
+// --- split into f_points - 2 buckets and of each bucket the sample is taken that spans the
+// --- largest triangle with the previous point and the average of the next bucket (the
+// --- areas of all three channels added up).
+// ---
+// --- Streams: one cursor selects, a second one runs a bucket ahead for the average, so
+// --- the memory is two blocks (f_buf, 2 * TSC_BLOCK_SIZE bytes) whatever the range. If
+// --- there are not more than f_points samples, all of them are returned.
+
+class HistoryDownsampler
+{
+
+public:
+    void Begin(int f_sensor, int64_t f_from, uint32_t f_points, uint8_t *f_buf);
+    bool Next(TsSample *f_sample);
+
+    // --- the samples in the range
+
+    uint32_t GetCount(void) const       { return m_count; }
+
+private:
+    int Bucket(uint32_t f_index, int64_t f_time, int f_min) const;
+    void LookAhead(int f_bucket);
+
+    HistoryCursor   m_sel;
+    HistoryCursor   m_ahead;
+
+    TsSample        m_prev;             // --- the last point returned
+    TsSample        m_sel_next;         // --- read ahead by m_sel, not in the current bucket
+    TsSample        m_ahead_next;       // --- read ahead by m_ahead, not in its bucket
+    uint32_t        m_sel_index;        // --- of the sample read last
+    uint32_t        m_ahead_index;
+    bool            m_sel_have;
+    bool            m_ahead_have;
+    int             m_sel_bucket;
+    int             m_ahead_bucket;     // --- the bucket m_avg belongs to
+
+    float           m_avg_time;         // --- ms after m_first
+    float           m_avg_val[TSC_CHANNELS];
+
+    int64_t         m_first;
+    int64_t         m_last;
+    uint32_t        m_count;
+    int             m_buckets;
+    int             m_state;
+};
+
+
+#endif
@@ -37,13 +37,15 @@
 #include <stdio.h>
 #include <string>
 #include "freertos/FreeRTOS.h"
-#include "freertos/timers.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "driver/gpio.h"
+#include "esp_attr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "infomanager.h"
+#include "scheduler.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -55,52 +57,185 @@ static const char *TAG = "InfoManager";
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-// The buffer used to hold the software timer's data structure.
+// --- LED patterns: alternating on/off times in ms, starting with on. Every pattern
+// --- repeats after 2 s
 
-//static StaticTimer_t xTimerBuffer;
+// --- one 100ms flash --> allright, connected
+
+static const uint16_t s_led_connected[]     = { 100, 1900 };
+
+// --- two 100ms flashes --> waiting for WLAN connection
+
+static const uint16_t s_led_waitconnect[]   = { 100, 100, 100, 1700 };
+
+// --- one long flash -> bootstrapping
+
+static const uint16_t s_led_bootstrap[]     = { 500, 1500 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-static void prvTimerCallback( TimerHandle_t xExpiredTimer )
+static uint32_t prvLedJob(void *f_ctx)
 {
-    InfoManager *l_infomgr;
+    InfoManager *l_infomgr = (InfoManager *)f_ctx;
 
-    // --- Obtain the address of the info manager
+    return l_infomgr->ProcessLed();
+}
 
-    l_infomgr = (InfoManager *) pvTimerGetTimerID( xExpiredTimer );
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the bootstrap button: the first edge goes to the scheduler, the interrupt stays off
+// --- until the debounce job looked at the pin, so bounces do not fill the event queue
+
+static volatile uint32_t s_button_dropped = 0;
+
+static void IRAM_ATTR prvButtonIsr(void *f_arg)
+{
+    gpio_num_t l_pin = (gpio_num_t)(intptr_t)f_arg;
 
-    // --- one 100ms flash --> allright, connected
+    gpio_intr_disable(l_pin);
 
-    if (l_infomgr->GetMode() == InfoMode_Connected)
+    if (!g_Scheduler.PostFromISR(SchedEvent_ButtonEdge, gpio_get_level(l_pin)))
     {
-        l_infomgr->SetInfoPin(true);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        l_infomgr->SetInfoPin(false);
+        // --- queue full: count it and keep listening, the next edge gets another chance
+
+        s_button_dropped = s_button_dropped + 1;
+        gpio_intr_enable(l_pin);
     }
+}
 
-    // --- two 100ms flashes --> waiting for WLAN connection
-    
-    if (l_infomgr->GetMode() == InfoMode_WaitToConnect)
+static void prvButtonEdgeHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    InfoManager *l_infomgr = (InfoManager *)f_ctx;
+
+    l_infomgr->ButtonEdge();
+}
+
+static uint32_t prvButtonJob(void *f_ctx)
+{
+    InfoManager *l_infomgr = (InfoManager *)f_ctx;
+
+    return l_infomgr->ProcessButton();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t InfoManager::ProcessLed(void)
+{
+    const uint16_t *l_pattern = NULL;
+    int l_len = 0;
+
+    switch (m_InfoMode)
     {
-        l_infomgr->SetInfoPin(true);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        l_infomgr->SetInfoPin(false);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-
-        l_infomgr->SetInfoPin(true);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
-        l_infomgr->SetInfoPin(false);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        case InfoMode_Connected:        l_pattern = s_led_connected; l_len = 2; break;
+        case InfoMode_WaitToConnect:    l_pattern = s_led_waitconnect; l_len = 4; break;
+        case InfoMode_Bootstrap:        l_pattern = s_led_bootstrap; l_len = 2; break;
+        default:                        break;
     }
 
-    // --- one long flash -> bootstrapping
+    // --- nothing to show: LED off and no more wakeups until the mode changes
 
-   if (l_infomgr->GetMode() == InfoMode_Bootstrap)
+    if (!l_pattern)
     {
-        l_infomgr->SetInfoPin(true);
-        vTaskDelay(500 / portTICK_PERIOD_MS);
-        l_infomgr->SetInfoPin(false);
+        SetInfoPin(false);
+        return SCHED_STOP;
     }
+
+    if (m_step >= l_len) m_step = 0;
+
+    SetInfoPin((m_step & 1) == 0);
+
+    return l_pattern[m_step++];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void InfoManager::ButtonEdge(void)
+{
+    // --- debounce: look at the pin when it did not change for a while
+
+    g_Scheduler.SetJobDelay(m_button_job, CONFIG_BUTTON_DEBOUNCE_MS);
+}
+
+uint32_t InfoManager::ProcessButton(void)
+{
+    // --- debounced: listen again before the pin is read, so no edge after it gets lost
+
+    gpio_intr_enable(m_bootstrappin);
+
+    uint32_t l_dropped = s_button_dropped;
+
+    if (l_dropped != m_button_dropped)
+    {
+        ESP_LOGW(TAG, "Button edges dropped, event queue full (%u total)", (unsigned)l_dropped);
+        m_button_dropped = l_dropped;
+    }
+
+    bool l_down = IsBootstrapActivated();
+    int64_t l_now = esp_timer_get_time();
+
+    // --- pressed: come back when it becomes a long press
+
+    if (l_down && !m_pressed)
+    {
+        m_pressed = true;
+        m_long_sent = false;
+        m_press_us = l_now - CONFIG_BUTTON_DEBOUNCE_MS * 1000;
+
+        return CONFIG_BUTTON_LONG_PRESS_MS - CONFIG_BUTTON_DEBOUNCE_MS;
+    }
+
+    // --- still held
+
+    if (l_down)
+    {
+        int64_t l_held_ms = (l_now - m_press_us) / 1000;
+
+        if (m_long_sent) return SCHED_STOP;
+
+        if (l_held_ms < CONFIG_BUTTON_LONG_PRESS_MS) return CONFIG_BUTTON_LONG_PRESS_MS - l_held_ms;
+
+        ESP_LOGI(TAG, "Button long press");
+
+        m_long_sent = true;
+        g_Scheduler.Post(SchedEvent_LongPress, 0);
+
+        return SCHED_STOP;
+    }
+
+    // --- released: a short press unless the long one was reported already
+
+    if (m_pressed)
+    {
+        m_pressed = false;
+
+        if (!m_long_sent)
+        {
+            ESP_LOGI(TAG, "Button short press (%d ms)", (int)((l_now - m_press_us) / 1000));
+
+            g_Scheduler.Post(SchedEvent_ShortPress, 0);
+        }
+    }
+
+    return SCHED_STOP;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void InfoManager::SetMode(InfoMode f_mode)
+{
+    if (f_mode == m_InfoMode) return;
+
+    m_InfoMode = f_mode;
+
+    // --- start the new pattern right away
+
+    RestartPattern();
+}
+
+void InfoManager::RestartPattern(void)
+{
+    m_step = 0;
+    g_Scheduler.SetJobDelay(m_job, 0);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -125,12 +260,25 @@ esp_err_t InfoManager::InitManager(void)
     l_err = gpio_set_direction(m_infopin,GPIO_MODE_OUTPUT);
 	if (l_err != ESP_OK) { ESP_LOGE(TAG, "Error setting info LED pin (%d) direction to output",m_infopin); return l_err;}
 
-    // ---- timer stuff
+    // ---- the button interrupts on both edges, the button job debounces them
 
-    m_timer = xTimerCreate( "T1", 2000 / portTICK_PERIOD_MS, pdTRUE, (void *)this, prvTimerCallback);
-    
-    // The scheduler has not started yet so a block time is not used.
-    xTimerStart( m_timer, 0 );
+    l_err = gpio_set_intr_type(m_bootstrappin, GPIO_INTR_ANYEDGE);
+	if (l_err != ESP_OK) { ESP_LOGE(TAG, "Error setting bootstrap pin (%d) interrupt type",m_bootstrappin); return l_err; }
+
+    l_err = gpio_install_isr_service(0);
+	if (l_err != ESP_OK && l_err != ESP_ERR_INVALID_STATE) { ESP_LOGE(TAG, "Error installing the GPIO ISR service"); return l_err; }
+
+    l_err = gpio_isr_handler_add(m_bootstrappin, prvButtonIsr, (void *)(intptr_t)m_bootstrappin);
+	if (l_err != ESP_OK) { ESP_LOGE(TAG, "Error adding bootstrap pin (%d) ISR",m_bootstrappin); return l_err; }
+
+    // ---- the LED pattern is a scheduler job, idle until there is a mode to show
+
+    m_job = g_Scheduler.AddJob("led", prvLedJob, this, m_InfoMode == InfoMode_Nothing ? SCHED_STOP : 0);
+
+    // ---- a button held down during boot counts from now on
+
+    m_button_job = g_Scheduler.AddJob("button", prvButtonJob, this, IsBootstrapActivated() ? 0 : SCHED_STOP);
+    g_Scheduler.AddHandler(SchedEvent_ButtonEdge, prvButtonEdgeHandler, this);
 
     return ESP_OK;
 }
@@ -38,7 +38,7 @@
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #include "sdkconfig.h"
-#include "freertos/timers.h"
+#include "driver/gpio.h"
 
 
 enum InfoMode
@@ -57,6 +57,13 @@ public:
     InfoManager()
     {
         m_InfoMode = InfoMode_Nothing;
+        m_job = -1;
+        m_step = 0;
+        m_button_job = -1;
+        m_pressed = false;
+        m_long_sent = false;
+        m_press_us = 0;
+        m_button_dropped = 0;
     }
 
     esp_err_t InitManager(void);
@@ -71,23 +78,40 @@ public:
         gpio_set_level(m_infopin,f_value ? 1 : 0);
     }
 
-    void SetMode(InfoMode f_mode)
-    {
-        m_InfoMode = f_mode;
-    }
+    void SetMode(InfoMode f_mode);
+
+    // --- shows the pattern of the current mode again from its start
+
+    void RestartPattern(void);
 
     InfoMode GetMode(void) const
     {
         return m_InfoMode;
     }
 
+    // --- scheduler job: next step of the LED pattern of the current mode
+
+    uint32_t ProcessLed(void);
+
+    // --- the button: edges come from the ISR, the job looks at the pin once it is stable
+
+    void ButtonEdge(void);
+    uint32_t ProcessButton(void);
+
 private:
 
     gpio_num_t      m_bootstrappin;
     gpio_num_t      m_infopin;
 
-    TimerHandle_t   m_timer;
+    int             m_job;
+    int             m_step;
     InfoMode        m_InfoMode;
+
+    int             m_button_job;
+    bool            m_pressed;
+    bool            m_long_sent;
+    int64_t         m_press_us;
+    uint32_t        m_button_dropped;
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
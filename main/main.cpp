@@ -52,6 +52,9 @@
 #include "esp_netif.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "esp_sntp.h"
 #include "mdns.h"
 #include "sdkconfig.h"
 #include "vindriktning.h"
@@ -60,8 +63,21 @@
 #include "infomanager.h"
 #include "config_manager_defines.h"
 #include "mqtt_manager.h"
+#include "diag_manager.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "evlog.h"
+#include "response_cache.h"
+#include "sdcard_logger.h"
+#include "history.h"
+#include "quantiles.h"
+#include "aqi.h"
+#include "alarm_manager.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
 
 #define CONFIG_EXAMPLE_WEB_MOUNT_POINT "/www"
+#define SDCARD_MOUNT_POINT "/sdcard"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -109,6 +125,16 @@ static void on_got_ip(void *arg, esp_event_base_t event_base,
     // --- now we are connected
 
     g_InfoManager.SetMode(InfoMode_Connected);
+
+    // --- the clock is needed for the timestamps of batched samples, SNTP keeps it
+    // --- up to date from now on
+
+    if (!sntp_enabled())
+    {
+        sntp_setoperatingmode(SNTP_OPMODE_POLL);
+        sntp_setservername(0, CONFIG_SNTP_SERVER);
+        sntp_init();
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -158,6 +184,39 @@ void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id
 }
 
 
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- called by the config manager when the user changed the wifi credentials
+
+static void on_wifi_config_changed(uint32_t f_changed, void *f_ctx)
+{
+    // --- in bootstrap mode we run the AP, the new credentials are used after the reboot
+
+    if (g_ConfigManager.GetIntValue(CFMGR_BOOTSTRAP_DONE) == 0) return;
+
+    wifi_config_t wifi_config;
+    memset(&wifi_config,0,sizeof(wifi_config_t));
+
+    std::string l_ssid      = g_ConfigManager.GetStringValue(CFMGR_WIFI_SSID);
+    std::string l_wlanpwd   = g_ConfigManager.GetStringValue(CFMGR_WIFI_PASSWORD);
+
+    strncpy((char *)wifi_config.sta.ssid,l_ssid.c_str(),32);
+    strncpy((char *)wifi_config.sta.password,l_wlanpwd.c_str(),64);
+
+#ifdef CONFIG_POWER_SAVE
+    wifi_config.sta.listen_interval = CONFIG_POWER_WIFI_LISTEN_INTERVAL;
+#endif
+
+    ESP_LOGI(TAG, "Wi-Fi config changed, reconnecting to '%s'...", wifi_config.sta.ssid);
+
+    g_InfoManager.SetMode(InfoMode_WaitToConnect);
+
+    // --- the disconnect handler will connect again using the new config
+
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
+    esp_wifi_disconnect();
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 // --- not: at least 8 chars!
@@ -232,17 +291,33 @@ static void start_wifi_client()
         strncpy((char *)wifi_config.sta.ssid,l_ssid.c_str(),32);
         strncpy((char *)wifi_config.sta.password,l_wlanpwd.c_str(),64);
 
+#ifdef CONFIG_POWER_SAVE
+        wifi_config.sta.listen_interval = CONFIG_POWER_WIFI_LISTEN_INTERVAL;
+#endif
+
         ESP_LOGI(TAG, "Connecting to '%s'...", wifi_config.sta.ssid);
 
         ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
         ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_config));
         ESP_ERROR_CHECK(esp_wifi_start());
+
+#ifdef CONFIG_POWER_SAVE
+
+        // --- the radio sleeps between the beacons it listens to, MQTT publishes wake it up
+
+        ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
+#endif
         ESP_ERROR_CHECK(esp_wifi_connect());
+
+        g_ConfigManager.RegisterListener(on_wifi_config_changed,NULL,
+            CFMGR_KEYBIT(CFMGR_WIFI_SSID) | CFMGR_KEYBIT(CFMGR_WIFI_PASSWORD));
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////////////
+
 /*
 
 static void stop_wifi_client()
@@ -297,13 +372,62 @@ esp_err_t init_fs(void)
 void init_sensors(void)
 {
     g_SensorManager.InitSensors();
+    g_ResponseCache.InitManager();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-void ProcessMeasurements(void)
+// --- short press on the bootstrap button: tell the user how we are doing
+
+static void prvShortPressHandler(const SchedEvent &f_event, void *f_ctx)
 {
+    ESP_LOGI(TAG, "Status: mode %d, up %lld s, free heap %u, %u wakeups/h",
+        (int)g_InfoManager.GetMode(),
+        (long long)(esp_timer_get_time() / 1000000),
+        (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+        (unsigned)g_Scheduler.GetWakeupsPerHour());
+
     g_SensorManager.ProcessMeasurements();
+
+    // --- restart the led pattern so the mode can be read from the start
+
+    g_InfoManager.RestartPattern();
+}
+
+// --- long press on the bootstrap button: back to the bootstrap mode
+
+static void prvLongPressHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    ESP_LOGI(TAG, "Bootstrap activated by user. Reset bootstrap flag and reboot!");
+
+    if (g_ConfigManager.GetIntValue(CFMGR_BOOTSTRAP_DONE) == 0)
+    {
+        ESP_LOGI(TAG, "Device not bootstrapped - ignore!");
+    }
+    else
+    {
+        ESP_LOGI(TAG, "Reset bootstrap flag and reboot!");
+
+        // --- set the flash flag to "not configured"
+
+        g_ConfigManager.SetIntValue(CFMGR_BOOTSTRAP_DONE,0);
+
+        // --- keep the event log for the next run
+
+        g_EventLog.Spill();
+
+        // --- and the datagrams still buffered for the SD card
+
+        g_SdLogger.Sync(pdMS_TO_TICKS(1000));
+
+        // --- be sure to let the flash write the stuff
+
+        nvs_flash_deinit();
+
+        // --- and reboot
+
+        esp_restart();
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -325,6 +449,18 @@ void app_main()
 
     ESP_ERROR_CHECK(nvs_flash_init());
 
+    // --- the scheduler first, the managers register their jobs there
+
+    ESP_ERROR_CHECK(g_Scheduler.InitManager());
+
+    // --- the binary event log, with the records of the last run if they were spilled
+
+    g_EventLog.InitManager();
+
+    // --- frequency scaling and light sleep, before the sensor UARTs are set up
+
+    g_PowerManager.InitManager();
+
     // --- start the info manager
 
     g_InfoManager.InitManager();
@@ -353,19 +489,7 @@ void app_main()
 
         g_InfoManager.SetMode(InfoMode_Bootstrap);
 
-        // ---- default values
-
-        if (g_ConfigManager.GetStringValue(CFMGR_DEVICE_NAME).length() == 0)
-            g_ConfigManager.SetStringValue(CFMGR_DEVICE_NAME,"IoTDevice");
-
-        if (g_ConfigManager.GetStringValue(CFMGR_MQTT_SERVER).length() == 0)
-            g_ConfigManager.SetStringValue(CFMGR_MQTT_SERVER,"mqtt://192.168.1.20");
-        
-        if (g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC).length() == 0)
-            g_ConfigManager.SetStringValue(CFMGR_MQTT_TOPIC,"mytopic/templogger");
-
-        if (g_ConfigManager.GetIntValue(CFMGR_MQTT_TIME) == 0)
-            g_ConfigManager.SetIntValue(CFMGR_MQTT_TIME,60);
+        // ---- missing values already carry the defaults of the config schema
     }
     else
     {
@@ -384,6 +508,17 @@ void app_main()
 
     ESP_ERROR_CHECK(init_fs());
     
+    // ---- the history, the quantiles, the indices, the alarms and the SD card before the
+    // ---- sensors, so they get the first datagram
+
+    g_History.InitManager();
+    g_Quantiles.InitManager();
+    g_Aqi.InitManager();
+    g_AlarmManager.InitManager();
+    g_Frames.InitManager();
+    g_Fusion.InitManager();
+    g_SdLogger.InitManager(SDCARD_MOUNT_POINT);
+
     // ---- initialize all the sensors
 
     init_sensors();
@@ -396,40 +531,16 @@ void app_main()
 
     g_MqttManager.InitManager();
 
-	// ---- main measurement loop
+    // --- and the diagnostics (health messages)
 
-    while(1) 
-    {
-        // --- check for the user pressing the bootstrap key
-
-        if (g_InfoManager.IsBootstrapActivated())  
-        {
-            ESP_LOGI(TAG, "Bootstrap activated by user. Reset bootstrap flag and reboot!");
-
-            if (g_ConfigManager.GetIntValue(CFMGR_BOOTSTRAP_DONE) == 0)
-            {
-                ESP_LOGI(TAG, "Device not bootstrapped - ignore!");
-            }
-            else
-            {
-                ESP_LOGI(TAG, "Reset bootstrap flag and reboot!");
+    g_DiagManager.InitManager();
 
-                // --- set the flash flag to "not configured"
+    // ---- the user pressing the bootstrap key (a long press also when held down during boot)
 
-                g_ConfigManager.SetIntValue(CFMGR_BOOTSTRAP_DONE,0);
+    g_Scheduler.AddHandler(SchedEvent_ShortPress, prvShortPressHandler, NULL);
+    g_Scheduler.AddHandler(SchedEvent_LongPress, prvLongPressHandler, NULL);
 
-                // --- be sure to let the flash write the stuff
+	// ---- main loop: sleep until something is due
 
-                nvs_flash_deinit();
-
-                // --- and reboot
-
-                esp_restart();
-            }
-            
-        }    
-
-		ProcessMeasurements();
-        vTaskDelay(5000 / portTICK_PERIOD_MS);
-    }
+    g_Scheduler.Run();
 }
@@ -35,33 +35,25 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <string>
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "freertos/event_groups.h"
-#include "driver/gpio.h"
 #include "cJSON.h"
 #include "esp_event.h"
-#include "driver/sdmmc_host.h"
-#include "driver/gpio.h"
-#include "driver/uart.h"
-#include "esp_vfs_semihost.h"
-#include "esp_vfs_fat.h"
-#include "esp_spiffs.h"
-#include "esp_wifi.h"
-#include "sdmmc_cmd.h"
-#include "nvs_flash.h"
-#include "esp_netif.h"
-#include "esp_event.h"
 #include "esp_log.h"
-#include "mdns.h"
+#include "esp_timer.h"
 #include "mqtt_client.h"
 
 #include "config_manager.h"
 #include "config_manager_defines.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
 #include "mqtt_manager.h"
+#include "scheduler.h"
 #include "sensor_manager.h"
+#include "evlog.h"
 
 /*
 #define CFMGR_MQTT_SERVER       "mqtt_server"
@@ -77,15 +69,63 @@ static const char *TAG = "MqttManager";
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-static void prvMqttTimerCallback( TimerHandle_t xExpiredTimer )
+static uint32_t prvMqttJob(void *f_ctx)
 {
-    MqttManager *l_mqttmgr;
+    MqttManager *l_mqttmgr = (MqttManager *)f_ctx;
 
-    // --- Obtain the address of the info manager
+    l_mqttmgr->ProcessCallback();
 
-    l_mqttmgr = (MqttManager *) pvTimerGetTimerID( xExpiredTimer );
+    return l_mqttmgr->GetPublishDelay();
+}
 
-    l_mqttmgr->ProcessCallback();
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- runs on the task that committed the config: the values are taken over by the scheduler
+
+static void prvMqttConfigChanged(uint32_t f_changed, void *f_ctx)
+{
+    g_Scheduler.Post(SchedEvent_MqttConfig, f_changed);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- runs on the task of the mqtt client: hand the events over to the scheduler
+
+static void prvMqttEventHandler(void *f_arg, esp_event_base_t f_base, int32_t f_id, void *f_data)
+{
+    esp_mqtt_event_handle_t l_event = (esp_mqtt_event_handle_t)f_data;
+
+    switch (f_id)
+    {
+        case MQTT_EVENT_CONNECTED:
+            g_Scheduler.Post(SchedEvent_MqttConnected, 0);
+            break;
+
+        case MQTT_EVENT_DISCONNECTED:
+            g_Scheduler.Post(SchedEvent_MqttDisconnected, 0);
+            break;
+
+        case MQTT_EVENT_PUBLISHED:
+            g_Scheduler.Post(SchedEvent_MqttPublished, (uint32_t)l_event->msg_id);
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void prvMqttSchedHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    MqttManager *l_mqttmgr = (MqttManager *)f_ctx;
+
+    switch (f_event.m_type)
+    {
+        case SchedEvent_MqttConnected:      l_mqttmgr->OnConnected(); break;
+        case SchedEvent_MqttDisconnected:   l_mqttmgr->OnDisconnected(); break;
+        case SchedEvent_MqttPublished:      l_mqttmgr->OnPublished((int)f_event.m_arg); break;
+        case SchedEvent_MqttConfig:         l_mqttmgr->UpdateConfig(); break;
+        default:                            break;
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -96,55 +136,469 @@ void MqttManager::ProcessCallback(void)
 
     if (!m_mqtt_enabled) return;
 
-    // ---- decrease the counter and send message, when zero
+    // ---- the scheduler calls us when the next sample is due. Left over samples of an
+    // ---- earlier batch setting go out as batch as well
+
+    if (m_batch <= 1 && !m_sample_cnt)
+    {
+        PublishSamples();
+        return;
+    }
+
+    AddSample();
+
+    if (m_sample_cnt >= m_batch) FlushBatch();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- one message per sensor right away
+
+void MqttManager::PublishSamples(void)
+{
+    // --- frames: all sensors in one message
+
+    if (g_Frames.IsEnabled())
+    {
+        PublishFrame();
+        return;
+    }
+
+    std::string l_topic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
 
-    --m_delay_current;
+    // --- now loop over all sensors and send a message
 
-    if (!m_delay_current)
+    for (int l_senidx = 0; l_senidx < g_SensorManager.GetSensorCount(); ++l_senidx)
     {
-        // --- reload our counter
 
-        m_delay_current = m_mqtt_delay;
+        // ---- now ask the sensor for the values and create a JSON from that    
+
+        cJSON *root = cJSON_CreateObject();
+        
+        cJSON_AddNumberToObject(root, "pm1", g_SensorManager.GetSensor(l_senidx).GetPM1());
+        cJSON_AddNumberToObject(root, "pm2", g_SensorManager.GetSensor(l_senidx).GetPM2());
+        cJSON_AddNumberToObject(root, "pm10", g_SensorManager.GetSensor(l_senidx).GetPM10());
 
-        std::string l_topic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+        g_SensorManager.GetSensor(l_senidx).GetHealth().AddToJson(root);
+        
+        const char *sys_info = cJSON_Print(root);
+        
+        char l_snum[5];
 
-        // --- now loop over all sensors and send a message
+        std::string l_fulltopic = l_topic;
+        l_fulltopic += "/sensor";
+        l_fulltopic += itoa(l_senidx+1,l_snum,10);
 
-        for (int l_senidx = 0; l_senidx < g_SensorManager.GetSensorCount(); ++l_senidx)
+        int l_err = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), sys_info,0, 0,0);
+        if (l_err == -1)
+        {
+            ESP_LOGE(TAG, "Error sending mqtt message '%s' to topic %s", sys_info,l_fulltopic.c_str());
+        }
+        else
         {
+            EVLOG(MqttSent, l_senidx + 1, (int)strlen(sys_info));
+
+            CountMessage(l_fulltopic.c_str(), strlen(sys_info), 0);
+        }
+
+        free((void *)sys_info);
+        cJSON_Delete(root);
+    }
+
+    if (g_Fusion.IsEnabled()) PublishFused();
+
+    ++m_stats.m_samples;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the last frame to <topic>/frame, the health tells why a sensor is missing
+
+void MqttManager::PublishFrame(void)
+{
+    SensorFrame l_frame;
+
+    // --- no frame closed yet, the next callback tries again
+
+    if (!g_Frames.GetLast(&l_frame)) return;
+
+    cJSON *root = cJSON_CreateObject();
+
+    FrameAssembler::AddToJson(l_frame, esp_timer_get_time(), root);
+
+    if (g_Fusion.IsEnabled()) g_Fusion.AddToJson(cJSON_AddObjectToObject(root, "fused"));
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    std::string l_fulltopic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+    l_fulltopic += "/frame";
+
+    int l_err = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), l_json, 0, 0, 0);
+
+    if (l_err == -1)
+    {
+        ESP_LOGE(TAG, "Error sending frame %u to topic %s", l_frame.m_seq, l_fulltopic.c_str());
+    }
+    else
+    {
+        EVLOG(MqttFrameSent, l_frame.m_seq, (int)strlen(l_json));
+
+        CountMessage(l_fulltopic.c_str(), strlen(l_json), 0);
+    }
+
+    free(l_json);
+
+    ++m_stats.m_samples;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the fused value of all sensors to <topic>/fused, next to the per-sensor messages
+
+void MqttManager::PublishFused(void)
+{
+    cJSON *root = cJSON_CreateObject();
+
+    g_Fusion.AddToJson(root);
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    std::string l_fulltopic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+    l_fulltopic += "/fused";
+
+    if (esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), l_json, 0, 0, 0) == -1)
+    {
+        ESP_LOGE(TAG, "Error sending the fused value to topic %s", l_fulltopic.c_str());
+    }
+    else
+    {
+        CountMessage(l_fulltopic.c_str(), strlen(l_json), 0);
+    }
+
+    free(l_json);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void MqttManager::CountMessage(const char *f_topic, int f_len, int f_qos)
+{
+    ++m_stats.m_messages;
+
+    // --- fixed header, topic length, topic and payload. QoS 1: message id and the PUBACK
+
+    m_stats.m_bytes += 2 + 2 + strlen(f_topic) + f_len + (f_qos > 0 ? 2 + 4 : 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void MqttManager::AddSample(void)
+{
+    // --- full: drop the oldest sample, unless it is on the way to the broker
+
+    if (m_sample_cnt >= MQTT_BATCH_MAX)
+    {
+        ++m_stats.m_dropped;
+
+        if (m_wait_msg_id >= 0) return;
+
+        memmove(&m_samples[0], &m_samples[1], sizeof(MqttSample) * (MQTT_BATCH_MAX - 1));
+        --m_sample_cnt;
+    }
+
+    MqttSample &l_sample = m_samples[m_sample_cnt++];
+
+    time_t l_now = time(NULL);
+
+    l_sample.m_uptime_s = (uint32_t)(esp_timer_get_time() / 1000000);
+    l_sample.m_time     = (uint32_t)l_now >= MQTT_TIME_VALID ? (uint32_t)l_now : 0;
+
+    for (int l_senidx = 0; l_senidx < g_SensorManager.GetSensorCount(); ++l_senidx)
+    {
+        CVindriktning &l_sensor = g_SensorManager.GetSensor(l_senidx);
+
+        l_sample.m_pm[l_senidx][0] = (uint16_t)l_sensor.GetPM1();
+        l_sample.m_pm[l_senidx][1] = (uint16_t)l_sensor.GetPM2();
+        l_sample.m_pm[l_senidx][2] = (uint16_t)l_sensor.GetPM10();
+    }
+
+    FusionResult l_fused;
+    int64_t l_fused_us;
+
+    if (g_Fusion.IsEnabled() && g_Fusion.GetResult(&l_fused, &l_fused_us))
+    {
+        memcpy(l_sample.m_fused, l_fused.m_pm, sizeof(l_sample.m_fused));
+    }
+    else
+    {
+        for (int v = 0; v < 3; ++v) l_sample.m_fused[v] = MQTT_NO_VALUE;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void MqttManager::FlushBatch(void)
+{
+    // --- the last batch is still on the way, the next sample tries again
+
+    if (m_wait_msg_id >= 0) return;
+
+    m_flush_pending = true;
+
+    if (m_connected)
+    {
+        PublishBatch();
+    }
+    else
+    {
+        // --- OnConnected() publishes
+
+        StartClient();
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- {"t0":<unix time of the first sample>,"ts":[<seconds after the first sample>,...],
+// ---  "sensor1":{"health":"ok","age":12,"pm1":[...],"pm2":[...],"pm10":[...]},...}
+// --- "up0" (seconds since boot) replaces "t0" as long as the clock is not set. With
+// --- sensor fusion "fused":{"pm1":[...],...}, null where there was no fused value
+
+void MqttManager::PublishBatch(void)
+{
+    m_flush_pending = false;
+
+    if (!m_sample_cnt) return;
+
+    static const char *s_names[3] = { "pm1", "pm2", "pm10" };
+
+    const MqttSample &l_first   = m_samples[0];
+    const MqttSample &l_last    = m_samples[m_sample_cnt - 1];
+
+    cJSON *root = cJSON_CreateObject();
+
+    if (l_last.m_time)
+    {
+        cJSON_AddNumberToObject(root, "t0", (double)(l_last.m_time - (l_last.m_uptime_s - l_first.m_uptime_s)));
+    }
+    else
+    {
+        cJSON_AddNumberToObject(root, "up0", l_first.m_uptime_s);
+    }
+
+    cJSON *l_ts = cJSON_AddArrayToObject(root, "ts");
+
+    for (int i = 0; i < m_sample_cnt; ++i)
+    {
+        cJSON_AddItemToArray(l_ts, cJSON_CreateNumber(m_samples[i].m_uptime_s - l_first.m_uptime_s));
+    }
+
+    for (int l_senidx = 0; l_senidx < g_SensorManager.GetSensorCount(); ++l_senidx)
+    {
+        char l_name[12];
+        snprintf(l_name, sizeof(l_name), "sensor%d", l_senidx + 1);
 
-            // ---- now ask the sensor for the values and create a JSON from that    
+        cJSON *l_sensor = cJSON_AddObjectToObject(root, l_name);
 
-            cJSON *root = cJSON_CreateObject();
-            
-            cJSON_AddNumberToObject(root, "pm1", g_SensorManager.GetSensor(l_senidx).GetPM1());
-            cJSON_AddNumberToObject(root, "pm2", g_SensorManager.GetSensor(l_senidx).GetPM2());
-            cJSON_AddNumberToObject(root, "pm10", g_SensorManager.GetSensor(l_senidx).GetPM10());
-            
-            const char *sys_info = cJSON_Print(root);
-            
-            char l_snum[5];
+        // --- the health now, the samples may be older
 
-            std::string l_fulltopic = l_topic;
-            l_fulltopic += "/sensor";
-            l_fulltopic += itoa(l_senidx+1,l_snum,10);
+        g_SensorManager.GetSensor(l_senidx).GetHealth().AddToJson(l_sensor);
 
-            int l_err = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), sys_info,0, 0,0);
-            if (l_err == -1)
+        for (int v = 0; v < 3; ++v)
+        {
+            cJSON *l_values = cJSON_AddArrayToObject(l_sensor, s_names[v]);
+
+            for (int i = 0; i < m_sample_cnt; ++i)
             {
-                ESP_LOGE(TAG, "Error sending mqtt message '%s' to topic %s", sys_info,l_fulltopic.c_str());
+                cJSON_AddItemToArray(l_values, cJSON_CreateNumber(m_samples[i].m_pm[l_senidx][v]));
             }
-            else
+        }
+    }
+
+    if (g_Fusion.IsEnabled())
+    {
+        cJSON *l_fused = cJSON_AddObjectToObject(root, "fused");
+
+        for (int v = 0; v < 3; ++v)
+        {
+            cJSON *l_values = cJSON_AddArrayToObject(l_fused, s_names[v]);
+
+            for (int i = 0; i < m_sample_cnt; ++i)
             {
-                ESP_LOGI(TAG, "Successfully send mqtt message.");
-            }
+                uint16_t l_value = m_samples[i].m_fused[v];
 
-            free((void *)sys_info);
-            cJSON_Delete(root);
+                cJSON_AddItemToArray(l_values, l_value == MQTT_NO_VALUE ? cJSON_CreateNull() : cJSON_CreateNumber(l_value));
+            }
         }
+    }
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    std::string l_fulltopic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+    l_fulltopic += "/batch";
+
+    // --- QoS 1: the samples are only dropped when the broker has them
+
+    int l_msg_id = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), l_json, 0, 1, 0);
 
+    if (l_msg_id < 0)
+    {
+        ESP_LOGE(TAG, "Error sending batch of %d samples to topic %s", m_sample_cnt, l_fulltopic.c_str());
+    }
+    else
+    {
+        EVLOG(MqttBatchSent, m_sample_cnt, (int)strlen(l_json));
+
+        CountMessage(l_fulltopic.c_str(), strlen(l_json), 1);
 
+        m_wait_msg_id   = l_msg_id;
+        m_sent_cnt      = m_sample_cnt;
     }
+
+    free(l_json);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void MqttManager::OnConnected(void)
+{
+    if (!m_connected)
+    {
+        m_connected     = true;
+        m_connect_us    = esp_timer_get_time();
+
+        ++m_stats.m_connects;
+    }
+
+    if (m_flush_pending) PublishBatch();
+}
+
+void MqttManager::OnDisconnected(void)
+{
+    if (m_connected)
+    {
+        m_connected = false;
+        m_stats.m_connected_us += esp_timer_get_time() - m_connect_us;
+    }
+
+    // --- no acknowledge will come anymore, the samples go with the next batch
+
+    m_wait_msg_id = -1;
+}
+
+void MqttManager::OnPublished(int f_msg_id)
+{
+    if (f_msg_id != m_wait_msg_id)
+    {
+        // --- a PublishNow() message, in batch mode the radio idles again when nothing waits
+
+        if (m_batch > 1 && m_wait_msg_id < 0 && !m_flush_pending) StopClient();
+        return;
+    }
+
+    // --- the broker has them, samples added meanwhile stay
+
+    m_stats.m_samples += m_sent_cnt;
+
+    m_sample_cnt -= m_sent_cnt;
+    memmove(&m_samples[0], &m_samples[m_sent_cnt], sizeof(MqttSample) * m_sample_cnt);
+
+    m_sent_cnt      = 0;
+    m_wait_msg_id   = -1;
+
+    // --- the radio can idle until the next batch is complete
+
+    if (m_batch > 1 && m_sample_cnt < m_batch) StopClient();
+    else if (m_sample_cnt) PublishBatch();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void MqttManager::StartClient(void)
+{
+    if (m_client_started || !m_mqtt_hdl) return;
+
+    esp_err_t l_err = esp_mqtt_client_start(m_mqtt_hdl);
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error on esp_mqtt_client_start: %d", l_err);
+        return;
+    }
+
+    m_client_started = true;
+}
+
+void MqttManager::StopClient(void)
+{
+    if (!m_client_started) return;
+
+    esp_mqtt_client_stop(m_mqtt_hdl);
+
+    m_client_started = false;
+
+    OnDisconnected();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+MqttStats MqttManager::GetStats(void) const
+{
+    MqttStats l_stats = m_stats;
+
+    if (m_connected) l_stats.m_connected_us += esp_timer_get_time() - m_connect_us;
+
+    return l_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool MqttManager::Publish(const char *f_subtopic, const char *f_data)
+{
+    if (!m_mqtt_enabled || !m_mqtt_hdl) return false;
+
+    std::string l_fulltopic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+    l_fulltopic += "/";
+    l_fulltopic += f_subtopic;
+
+    int l_err = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), f_data, 0, 0, 0);
+    if (l_err == -1)
+    {
+        ESP_LOGE(TAG, "Error sending mqtt message to topic %s", l_fulltopic.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+int MqttManager::PublishNow(const char *f_subtopic, const char *f_data)
+{
+    if (!m_mqtt_enabled || !m_mqtt_hdl) return -1;
+
+    if (!m_connected)
+    {
+        // --- the caller tries again on SchedEvent_MqttConnected
+
+        StartClient();
+        return -1;
+    }
+
+    std::string l_fulltopic = g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC);
+    l_fulltopic += "/";
+    l_fulltopic += f_subtopic;
+
+    int l_msg_id = esp_mqtt_client_publish(m_mqtt_hdl, l_fulltopic.c_str(), f_data, 0, 1, 0);
+    if (l_msg_id < 0)
+    {
+        ESP_LOGE(TAG, "Error sending mqtt message to topic %s", l_fulltopic.c_str());
+        return -1;
+    }
+
+    CountMessage(l_fulltopic.c_str(), strlen(f_data), 1);
+
+    return l_msg_id;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -153,6 +607,18 @@ esp_err_t MqttManager::InitManager(void)
 {
     ESP_LOGE(TAG, "initmgr");
 
+    m_job = -1;
+    m_batch = 1;
+    m_client_started = false;
+    m_connected = false;
+    m_connect_us = 0;
+    m_sample_cnt = 0;
+    m_sent_cnt = 0;
+    m_wait_msg_id = -1;
+    m_flush_pending = false;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
     std::string l_server = g_ConfigManager.GetStringValue(CFMGR_MQTT_SERVER);
 
     esp_mqtt_client_config_t mqtt_cfg;
@@ -169,24 +635,28 @@ esp_err_t MqttManager::InitManager(void)
     }
     ESP_LOGE(TAG, "after esp_mqtt_client_init");
 
-    esp_err_t l_ee = esp_mqtt_client_start(m_mqtt_hdl);
-    if (l_ee != ESP_OK)
-    {
-        ESP_LOGE(TAG, "Error on esp_mqtt_client_start (%s): %d", l_server.c_str(),l_ee);
-        return l_ee;
-    }
-   ESP_LOGE(TAG, "after esp_mqtt_client_start");
+    // ---- connects, disconnects and acknowledges come via the scheduler
+
+    esp_mqtt_client_register_event(m_mqtt_hdl, MQTT_EVENT_ANY, prvMqttEventHandler, this);
 
-    // ---- get all config values to the manager
+    g_Scheduler.AddHandler(SchedEvent_MqttConnected, prvMqttSchedHandler, this);
+    g_Scheduler.AddHandler(SchedEvent_MqttDisconnected, prvMqttSchedHandler, this);
+    g_Scheduler.AddHandler(SchedEvent_MqttPublished, prvMqttSchedHandler, this);
+    g_Scheduler.AddHandler(SchedEvent_MqttConfig, prvMqttSchedHandler, this);
+
+    // ---- get all config values to the manager, this also starts the client
 
     UpdateConfig();
 
-    // ---- timer stuff
+    // ---- and get informed when the user changes them
 
-    m_timer = xTimerCreate( "T1", 1000 / portTICK_PERIOD_MS, pdTRUE, (void *)this, prvMqttTimerCallback);
-    xTimerStart( m_timer, 0 );
+    g_ConfigManager.RegisterListener(prvMqttConfigChanged,this,
+        CFMGR_KEYBIT(CFMGR_MQTT_SERVER) | CFMGR_KEYBIT(CFMGR_MQTT_TIME) | CFMGR_KEYBIT(CFMGR_MQTT_ENABLE) |
+        CFMGR_KEYBIT(CFMGR_MQTT_BATCH));
 
+    // ---- publishing is a scheduler job, due every mqtt_time seconds
 
+    m_job = g_Scheduler.AddJob("mqtt", prvMqttJob, this, GetPublishDelay());
 
     return ESP_OK;
 }
@@ -199,8 +669,11 @@ void MqttManager::UpdateConfig(void)
 
     m_mqtt_enabled = g_ConfigManager.GetIntValue(CFMGR_MQTT_ENABLE) == 1;
     m_mqtt_delay = g_ConfigManager.GetIntValue(CFMGR_MQTT_TIME);
+    m_batch = g_ConfigManager.GetIntValue(CFMGR_MQTT_BATCH);
+
+    // ---- restart the publish interval (or stop it)
 
-    m_delay_current = m_mqtt_delay;
+    g_Scheduler.SetJobDelay(m_job, GetPublishDelay());
 
     // ---- the broker might have changed, so close the existing connection
 
@@ -211,6 +684,11 @@ void MqttManager::UpdateConfig(void)
         esp_mqtt_client_set_uri(m_mqtt_hdl,l_server.c_str());
     }
 
+    // ---- publishing every sample keeps the connection, batches connect when they are complete
+
+    if (!m_mqtt_enabled) StopClient();
+    else if (m_batch <= 1) StartClient();
+    else if (!m_flush_pending && m_wait_msg_id < 0) StopClient();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
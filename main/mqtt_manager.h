@@ -37,12 +37,53 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+#include <stdint.h>
+
 #include "sdkconfig.h"
-#include "freertos/timers.h"
 #include "mqtt_client.h"
+#include "scheduler.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- most samples kept for one batch message (the maximum of mqtt_batch)
+
+#define MQTT_BATCH_MAX          60
+
+// --- unix times below this mean the clock was not set by SNTP yet
+
+#define MQTT_TIME_VALID         1600000000UL
+#define MQTT_NO_VALUE           0xffff
+
+// --- the values of all sensors at one point in time
+
+struct MqttSample
+{
+    uint32_t    m_uptime_s;
+    uint32_t    m_time;                             // --- unix time, 0 when not known
+    uint16_t    m_pm[CONFIG_TEMP_SENSOR_CNT][3];    // --- pm1, pm2.5, pm10
+    uint16_t    m_fused[3];                         // --- MQTT_NO_VALUE without sensor fusion
+};
+
+// --- what the uplink costs. Bytes count the MQTT header, topic and payload of every
+// --- message (QoS 1: plus the PUBACK), connected time is the time the radio has to be up
+
+struct MqttStats
+{
+    uint32_t    m_samples;
+    uint32_t    m_messages;
+    uint64_t    m_bytes;
+    uint32_t    m_connects;
+    uint64_t    m_connected_us;
+    uint32_t    m_dropped;
+};
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+// --- With mqtt_batch 1 every sample is published right away to <topic>/sensor<n> and the
+// --- connection is kept open. With mqtt_batch N the samples are collected and every N-th
+// --- sample the client connects, publishes all of them in one message to <topic>/batch and
+// --- disconnects again once the broker acknowledged it, so the radio idles in between.
+
 class MqttManager
 {
 
@@ -52,14 +93,69 @@ public:
     void UpdateConfig(void);
     void ProcessCallback(void);
 
+    // --- events of the client, called on the scheduler task
+
+    void OnConnected(void);
+    void OnDisconnected(void);
+    void OnPublished(int f_msg_id);
+
+    // --- ms until the next publish, SCHED_STOP when mqtt is off
+
+    uint32_t GetPublishDelay(void) const
+    {
+        return m_mqtt_enabled ? (uint32_t)m_mqtt_delay * 1000 : SCHED_STOP;
+    }
+
+    // --- publish to <mqtt topic>/<subtopic>, does nothing when mqtt is off
+
+    bool Publish(const char *f_subtopic, const char *f_data);
+
+    // --- publish to <mqtt topic>/<subtopic> with QoS 1 right away, also in batch mode.
+    // --- Returns the message id for OnPublished(), -1 when not connected: the client is
+    // --- started then and the caller tries again on SchedEvent_MqttConnected
+
+    int PublishNow(const char *f_subtopic, const char *f_data);
+
+    // --- statistics, the connected time includes the current connection
+
+    MqttStats GetStats(void) const;
+    int GetPendingSamples(void) const   { return m_sample_cnt; }
+    bool IsConnected(void) const        { return m_connected; }
+    bool IsEnabled(void) const          { return m_mqtt_enabled; }
+    int GetBatch(void) const            { return m_batch; }
+
 private:
-    TimerHandle_t   m_timer;
+    void PublishSamples(void);
+    void PublishFrame(void);
+    void PublishFused(void);
+    void AddSample(void);
+    void FlushBatch(void);
+    void PublishBatch(void);
+    void StartClient(void);
+    void StopClient(void);
+    void CountMessage(const char *f_topic, int f_len, int f_qos);
+
+    int             m_job;
     bool            m_mqtt_enabled;
     int             m_mqtt_delay;
-    int             m_delay_current;
+    int             m_batch;
 
     esp_mqtt_client_handle_t m_mqtt_hdl;
 
+    bool            m_client_started;
+    bool            m_connected;
+    int64_t         m_connect_us;
+
+    // --- the batch: m_sent_cnt samples are waiting for the acknowledge of m_wait_msg_id
+
+    MqttSample      m_samples[MQTT_BATCH_MAX];
+    int             m_sample_cnt;
+    int             m_sent_cnt;
+    int             m_wait_msg_id;
+    bool            m_flush_pending;
+
+    MqttStats       m_stats;
+
 };
 
 ////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,241 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+
+	This code is based on Bertrik Sikken PM1006 class available at
+	https://github.com/bertrik/pm1006
+
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef ESP32_pm1006_H_
+#define	ESP32_pm1006_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <assert.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "esp_log.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- a PM1006 datagram: 0x16 0x11 0x0B DF1..DF16 CS, the checksum makes the byte sum zero
+
+#define PM1006_HEADER_BYTE	0x16
+#define PM1006_FRAME_LEN	20
+#define DATAGRAM_LEN		30
+
+#define PM1006_TAG			"pm1006"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+    PM1006_HEADER,
+    PM1006_LENGTH,
+    PM1006_DATA,
+    PM1006_CHECK
+} pm1006_state_t;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- build a valid datagram like the sensor sends it, f_buf needs PM1006_FRAME_LEN bytes
+
+inline size_t pm1006_encode(uint8_t *f_buf, uint16_t f_pm25, uint16_t f_pm1, uint16_t f_pm10)
+{
+	memset(f_buf, 0, PM1006_FRAME_LEN);
+
+	f_buf[0] 	= PM1006_HEADER_BYTE;
+	f_buf[1] 	= PM1006_FRAME_LEN - 3;
+	f_buf[2] 	= 0x0B;
+
+	// --- DFn is at index n + 2
+
+	f_buf[5] 	= f_pm25 >> 8;
+	f_buf[6] 	= f_pm25 & 0xff;
+	f_buf[9] 	= f_pm1 >> 8;
+	f_buf[10] 	= f_pm1 & 0xff;
+	f_buf[13] 	= f_pm10 >> 8;
+	f_buf[14] 	= f_pm10 & 0xff;
+
+	uint8_t l_sum = 0;
+
+	for (int i = 0; i < PM1006_FRAME_LEN - 1; ++i) l_sum += f_buf[i];
+
+	f_buf[PM1006_FRAME_LEN - 1] = (uint8_t)(0x100 - l_sum);
+
+	return PM1006_FRAME_LEN;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- byte wise decoder of the PM1006 serial stream
+
+class CPm1006Receiver
+{
+
+public:
+
+	CPm1006Receiver(void)
+	{
+		_state 		= PM1006_HEADER;
+		_rxlen 		= 0;
+		_index 		= 0;
+		_checksum 	= 0;		
+
+		_frames 			= 0;
+		_checksum_errors 	= 0;
+		_length_errors 		= 0;
+
+		memset(_rxbuf, 0, sizeof(_rxbuf));
+	}
+
+	// --------------------------------------------
+
+	void dump(void)
+	{
+		char l_s[100];
+
+		strcpy(l_s,"Buffer:");
+
+		for (size_t i=0;i<_rxlen;++i)
+		{
+			char l_buf[5];
+			snprintf(l_buf,5,"%0x ",_rxbuf[i]);
+			strcat(l_s,l_buf);
+		}
+		ESP_LOGI(PM1006_TAG, "%s",l_s); 
+
+	}
+
+	// --------------------------------------------
+
+	bool process_rx(uint8_t c)
+	{
+		//ESP_LOGI(PM1006_TAG, "process_rx(%x): IN state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+
+		switch (_state) {
+		case PM1006_HEADER:
+			_checksum = c;
+			if (c == PM1006_HEADER_BYTE) {
+				_state = PM1006_LENGTH;
+			}
+			break;
+
+		case PM1006_LENGTH:
+			_checksum += c;
+			if (c <= sizeof(_rxbuf)) {
+				_rxlen = c;
+				_index = 0;
+				_state = (_rxlen > 0) ? PM1006_DATA : PM1006_CHECK;
+			} 
+			else 
+			{
+				ESP_LOGE(PM1006_TAG, "process_rx(%x): message too long for buffer!",c);
+				++_length_errors;
+				_state = PM1006_HEADER;
+			}
+			break;
+
+		case PM1006_DATA:
+			_checksum += c;
+			_rxbuf[_index++] = c;
+			if (_index == _rxlen) {
+				_state = PM1006_CHECK;
+			}
+			break;
+
+		case PM1006_CHECK:
+			_checksum += c;
+			_state = PM1006_HEADER;
+	
+			if (_checksum) 
+			{
+				ESP_LOGE(PM1006_TAG, "process_rx(%x): checksum error. Expected 0, got %x",c,_checksum);
+				++_checksum_errors;
+				return false;
+			}
+
+			//ESP_LOGI(PM1006_TAG, "process_rx(%x): OUT state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+
+			++_frames;
+			return true;
+
+		default:
+			_state = PM1006_HEADER;
+			break;
+		}
+
+		//ESP_LOGI(PM1006_TAG, "process_rx(%x): OUT state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+
+		return false;
+	}
+
+	// --------------------------------------------
+
+	uint8_t GetByte(int f_idx)
+	{
+		assert(f_idx < DATAGRAM_LEN);
+		
+		return _rxbuf[f_idx];
+	}
+
+	// --- header and length are not stored in the receiver. We start with "0x0B" --> idx0, DF1 --> idx 1
+
+	uint16_t GetPM25(void) 	{ return (GetByte(3) << 8) | GetByte(4); }
+	uint16_t GetPM1(void) 	{ return (GetByte(7) << 8) | GetByte(8); }
+	uint16_t GetPM10(void) 	{ return (GetByte(11) << 8) | GetByte(12); }
+
+	// --- statistics
+
+	uint32_t GetFrameCount(void) const 			{ return _frames; }
+	uint32_t GetChecksumErrors(void) const 		{ return _checksum_errors; }
+	uint32_t GetLengthErrors(void) const 		{ return _length_errors; }
+
+	// --------------------------------------------
+
+    pm1006_state_t 	_state;
+    size_t 			_rxlen;
+    size_t 			_index;
+    uint8_t 		_rxbuf[DATAGRAM_LEN];
+    uint8_t 		_checksum;
+
+	uint32_t 		_frames;
+	uint32_t 		_checksum_errors;
+	uint32_t 		_length_errors;
+ 
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
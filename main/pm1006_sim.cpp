@@ -0,0 +1,373 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "pm1006_sim.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "pm1006_sim";
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+CPm1006Source::CPm1006Source(void)
+{
+    m_chunk_len     = 0;
+    m_chunk_pos     = 0;
+    m_chunk_at      = 0;
+
+    m_started       = false;
+    m_time_base     = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int CPm1006Source::Read(uint8_t *f_buf, uint32_t f_len, uint32_t f_now_ms)
+{
+    if (!m_started)
+    {
+        m_started   = true;
+        m_time_base = f_now_ms;
+    }
+
+    uint32_t l_now = f_now_ms - m_time_base;
+    uint32_t l_len = 0;
+
+    while (l_len < f_len)
+    {
+        // --- fetch the next piece of the stream
+
+        if (m_chunk_pos == m_chunk_len)
+        {
+            m_chunk_len = NextChunk(m_chunk, sizeof(m_chunk), &m_chunk_at);
+            m_chunk_pos = 0;
+
+            if (!m_chunk_len) break;
+        }
+
+        // --- not yet on the line
+
+        if ((int32_t)(m_chunk_at - l_now) > 0) break;
+
+        size_t l_copy = m_chunk_len - m_chunk_pos;
+        if (l_copy > f_len - l_len) l_copy = f_len - l_len;
+
+        memcpy(f_buf + l_len, m_chunk + m_chunk_pos, l_copy);
+
+        m_chunk_pos += l_copy;
+        l_len       += l_copy;
+    }
+
+    return (int)l_len;
+}
+
+uint32_t CPm1006Source::GetWaitMs(uint32_t f_now_ms) const
+{
+    if (!m_started || m_chunk_pos == m_chunk_len) return 0;
+
+    int32_t l_wait = (int32_t)(m_chunk_at - (f_now_ms - m_time_base));
+
+    return l_wait > 0 ? (uint32_t)l_wait : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+
+Pm1006SimConfig::Pm1006SimConfig(void)
+{
+    m_seed              = 1;
+
+    m_pm25_base         = 25;
+    m_pm_drift          = 3;
+
+    // --- the VINDRIKTNING runs the fan every 30s and the sensor reports a few times
+
+    m_cycle_ms          = 30000;
+    m_burst_frames      = 5;
+    m_frame_gap_ms      = 800;
+
+    m_max_chunk         = 8;
+    m_checksum_permille = 0;
+    m_noise_permille    = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+
+CPm1006Simulator::CPm1006Simulator(void)
+{
+    Init(Pm1006SimConfig());
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void CPm1006Simulator::Init(const Pm1006SimConfig &f_config)
+{
+    m_config        = f_config;
+
+    if (!m_config.m_max_chunk) m_config.m_max_chunk = 1;
+    if (!m_config.m_burst_frames) m_config.m_burst_frames = 1;
+
+    // --- xorshift must not start with 0
+
+    m_rng           = m_config.m_seed ? m_config.m_seed : 0x9e3779b9;
+
+    m_frame_len     = 0;
+    m_frame_pos     = 0;
+    m_frame_at_us   = 0;
+
+    m_burst_idx     = 0;
+    m_cycle_at_us   = 0;
+
+    m_pm25          = m_config.m_pm25_base;
+    m_pm1           = 0;
+    m_pm10          = 0;
+
+    m_frames        = 0;
+    m_broken_frames = 0;
+    m_noise_bytes   = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t CPm1006Simulator::Random(void)
+{
+    m_rng ^= m_rng << 13;
+    m_rng ^= m_rng >> 17;
+    m_rng ^= m_rng << 5;
+
+    return m_rng;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void CPm1006Simulator::NextFrame(void)
+{
+    // --- schedule: a burst of datagrams at the start of every fan cycle
+
+    if (m_frames)
+    {
+        if (++m_burst_idx < m_config.m_burst_frames)
+        {
+            m_frame_at_us += (uint64_t)m_config.m_frame_gap_ms * 1000;
+        }
+        else
+        {
+            m_burst_idx     = 0;
+            m_cycle_at_us  += (uint64_t)m_config.m_cycle_ms * 1000;
+            m_frame_at_us   = m_cycle_at_us;
+        }
+    }
+
+    // --- random walk of the values, pulled back to the base value
+
+    int l_drift = m_config.m_pm_drift;
+    int l_pm25  = m_pm25 + (int)Random(2 * l_drift + 1) - l_drift + ((int)m_config.m_pm25_base - (int)m_pm25) / 8;
+
+    if (l_pm25 < 0)     l_pm25 = 0;
+    if (l_pm25 > 999)   l_pm25 = 999;
+
+    m_pm25  = l_pm25;
+    m_pm1   = m_pm25 * 3 / 4;
+    m_pm10  = m_pm25 * 5 / 4 + Random(3);
+
+    m_frame_len = pm1006_encode(m_frame, m_pm25, m_pm1, m_pm10);
+    m_frame_pos = 0;
+
+    ++m_frames;
+
+    // --- a flipped bit somewhere behind the length byte
+
+    if (Random(1000) < m_config.m_checksum_permille)
+    {
+        m_frame[3 + Random(PM1006_FRAME_LEN - 3)] ^= 1 << Random(8);
+        ++m_broken_frames;
+    }
+
+    // --- garbage on the line after the datagram
+
+    if (Random(1000) < m_config.m_noise_permille)
+    {
+        size_t l_noise = 1 + Random(sizeof(m_frame) - PM1006_FRAME_LEN);
+
+        for (size_t i = 0; i < l_noise; ++i) m_frame[m_frame_len++] = (uint8_t)Random();
+
+        m_noise_bytes += l_noise;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+size_t CPm1006Simulator::NextChunk(uint8_t *f_buf, size_t f_len, uint32_t *f_at_ms)
+{
+    if (m_frame_pos == m_frame_len) NextFrame();
+
+    // --- the receiver sees the datagram in pieces of random size
+
+    size_t l_len = 1 + Random(m_config.m_max_chunk);
+
+    if (l_len > m_frame_len - m_frame_pos) l_len = m_frame_len - m_frame_pos;
+    if (l_len > f_len) l_len = f_len;
+
+    memcpy(f_buf, m_frame + m_frame_pos, l_len);
+
+    m_frame_pos += l_len;
+
+    // --- available when the last byte of the piece is on the line
+
+    *f_at_ms = (uint32_t)((m_frame_at_us + (uint64_t)m_frame_pos * PM1006_BYTE_TIME_US) / 1000);
+
+    return l_len;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+
+CPm1006Replay::CPm1006Replay(void)
+{
+    m_file      = NULL;
+    m_raw       = false;
+    m_raw_at_us = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+CPm1006Replay::~CPm1006Replay(void)
+{
+    Close();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool CPm1006Replay::Open(const char *f_path)
+{
+    Close();
+
+    m_file = fopen(f_path, "rb");
+
+    if (!m_file)
+    {
+        ESP_LOGE(TAG, "Cannot open capture %s", f_path);
+        return false;
+    }
+
+    char l_magic[PM1006_CAPTURE_MAGIC_LEN];
+
+    m_raw = fread(l_magic, 1, sizeof(l_magic), m_file) != sizeof(l_magic) ||
+            memcmp(l_magic, PM1006_CAPTURE_MAGIC, sizeof(l_magic)) != 0;
+
+    if (m_raw) rewind(m_file);
+
+    m_raw_at_us = 0;
+
+    ESP_LOGI(TAG, "Replaying %s capture %s", m_raw ? "raw" : "timestamped", f_path);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void CPm1006Replay::Close(void)
+{
+    if (m_file) fclose(m_file);
+
+    m_file = NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+size_t CPm1006Replay::NextChunk(uint8_t *f_buf, size_t f_len, uint32_t *f_at_ms)
+{
+    if (!m_file) return 0;
+
+    // --- a raw dump arrives with line speed
+
+    if (m_raw)
+    {
+        size_t l_len = fread(f_buf, 1, f_len < 16 ? f_len : 16, m_file);
+
+        m_raw_at_us += (uint64_t)l_len * PM1006_BYTE_TIME_US;
+        *f_at_ms     = (uint32_t)(m_raw_at_us / 1000);
+
+        return l_len;
+    }
+
+    uint8_t l_hdr[6];
+
+    if (fread(l_hdr, 1, sizeof(l_hdr), m_file) != sizeof(l_hdr)) return 0;
+
+    *f_at_ms = l_hdr[0] | (l_hdr[1] << 8) | (l_hdr[2] << 16) | ((uint32_t)l_hdr[3] << 24);
+
+    size_t l_len = l_hdr[4] | (l_hdr[5] << 8);
+    size_t l_take = l_len < f_len ? l_len : f_len;
+
+    if (fread(f_buf, 1, l_take, m_file) != l_take) return 0;
+
+    if (l_take < l_len)
+    {
+        ESP_LOGW(TAG, "Capture record of %d bytes truncated to %d", (int)l_len, (int)l_take);
+        fseek(m_file, l_len - l_take, SEEK_CUR);
+    }
+
+    return l_take;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool pm1006_capture_write_header(FILE *f_file)
+{
+    return fwrite(PM1006_CAPTURE_MAGIC, 1, PM1006_CAPTURE_MAGIC_LEN, f_file) == PM1006_CAPTURE_MAGIC_LEN;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool pm1006_capture_write(FILE *f_file, uint32_t f_at_ms, const uint8_t *f_data, uint16_t f_len)
+{
+    uint8_t l_hdr[6];
+
+    l_hdr[0] = f_at_ms & 0xff;
+    l_hdr[1] = (f_at_ms >> 8) & 0xff;
+    l_hdr[2] = (f_at_ms >> 16) & 0xff;
+    l_hdr[3] = (f_at_ms >> 24) & 0xff;
+    l_hdr[4] = f_len & 0xff;
+    l_hdr[5] = f_len >> 8;
+
+    return fwrite(l_hdr, 1, sizeof(l_hdr), f_file) == sizeof(l_hdr) && fwrite(f_data, 1, f_len, f_file) == f_len;
+}
@@ -0,0 +1,204 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef PM1006_SIM_H_
+#define	PM1006_SIM_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "pm1006.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- capture files: the magic followed by records of u32 time in ms, u16 length and the
+// --- bytes (little endian). Files without the magic are raw dumps of a serial line.
+
+#define PM1006_CAPTURE_MAGIC        "PM1006CAP1\n"
+#define PM1006_CAPTURE_MAGIC_LEN    11
+#define PM1006_CHUNK_MAX            64
+
+// --- 9600 baud, 8N1
+
+#define PM1006_BYTE_TIME_US         1042
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- a source of serial bytes with their arrival time, driven like a UART
+
+class CPm1006Source
+{
+public:
+
+    CPm1006Source(void);
+    virtual ~CPm1006Source(void) {}
+
+    // --- the next piece of the stream and when it arrives (ms since start), 0 at the end
+
+    virtual size_t NextChunk(uint8_t *f_buf, size_t f_len, uint32_t *f_at_ms) = 0;
+
+    // --- everything which arrived until f_now_ms, the first call sets the time base
+
+    int Read(uint8_t *f_buf, uint32_t f_len, uint32_t f_now_ms);
+
+    // --- ms until the piece Read() stopped at arrives, 0 when unknown
+
+    uint32_t GetWaitMs(uint32_t f_now_ms) const;
+
+private:
+
+    uint8_t     m_chunk[PM1006_CHUNK_MAX];
+    size_t      m_chunk_len;
+    size_t      m_chunk_pos;
+    uint32_t    m_chunk_at;
+
+    bool        m_started;
+    uint32_t    m_time_base;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+struct Pm1006SimConfig
+{
+    uint32_t    m_seed;
+
+    // --- PM2.5 wanders around this value, PM1 and PM10 follow it
+
+    uint16_t    m_pm25_base;
+    uint16_t    m_pm_drift;             // max change per datagram
+
+    // --- the fan runs once per cycle and the sensor sends a burst of datagrams
+
+    uint32_t    m_cycle_ms;
+    uint16_t    m_burst_frames;
+    uint32_t    m_frame_gap_ms;
+
+    // --- line behaviour
+
+    uint16_t    m_max_chunk;            // datagrams arrive split in pieces of 1..m_max_chunk bytes
+    uint16_t    m_checksum_permille;    // datagrams with a broken checksum
+    uint16_t    m_noise_permille;       // datagrams followed by line noise
+
+    Pm1006SimConfig(void);
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- generates a deterministic VINDRIKTNING datagram stream
+
+class CPm1006Simulator : public CPm1006Source
+{
+public:
+
+    CPm1006Simulator(void);
+
+    void Init(const Pm1006SimConfig &f_config);
+
+    size_t NextChunk(uint8_t *f_buf, size_t f_len, uint32_t *f_at_ms) override;
+
+    // --- statistics of what was generated so far
+
+    uint32_t GetFrames(void) const          { return m_frames; }
+    uint32_t GetBrokenFrames(void) const    { return m_broken_frames; }
+    uint32_t GetNoiseBytes(void) const      { return m_noise_bytes; }
+
+    // --- values of the last datagram
+
+    uint16_t GetPM25(void) const            { return m_pm25; }
+    uint16_t GetPM1(void) const             { return m_pm1; }
+    uint16_t GetPM10(void) const            { return m_pm10; }
+
+private:
+
+    uint32_t Random(void);
+    uint32_t Random(uint32_t f_max)         { return Random() % f_max; }
+
+    void NextFrame(void);
+
+    Pm1006SimConfig m_config;
+    uint32_t        m_rng;
+
+    // --- the datagram (plus noise) currently sent
+
+    uint8_t         m_frame[PM1006_FRAME_LEN + 16];
+    size_t          m_frame_len;
+    size_t          m_frame_pos;
+    uint64_t        m_frame_at_us;
+
+    uint32_t        m_burst_idx;
+    uint64_t        m_cycle_at_us;
+
+    uint16_t        m_pm25;
+    uint16_t        m_pm1;
+    uint16_t        m_pm10;
+
+    uint32_t        m_frames;
+    uint32_t        m_broken_frames;
+    uint32_t        m_noise_bytes;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- plays back a capture file, either timestamped or a raw dump at line speed
+
+class CPm1006Replay : public CPm1006Source
+{
+public:
+
+    CPm1006Replay(void);
+    ~CPm1006Replay(void);
+
+    bool Open(const char *f_path);
+    void Close(void);
+
+    size_t NextChunk(uint8_t *f_buf, size_t f_len, uint32_t *f_at_ms) override;
+
+private:
+
+    FILE       *m_file;
+    bool        m_raw;
+    uint64_t    m_raw_at_us;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool pm1006_capture_write_header(FILE *f_file);
+bool pm1006_capture_write(FILE *f_file, uint32_t f_at_ms, const uint8_t *f_data, uint16_t f_len);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
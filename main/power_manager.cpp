@@ -0,0 +1,203 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+
+#include "power_manager.h"
+#include "scheduler.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "PowerManager";
+
+// --- the ESP32 UART wakes up after this many rising edges on RX (the minimum)
+
+#define POWER_UART_WAKEUP_EDGES     3
+
+#if defined(CONFIG_POWER_SAVE) && defined(CONFIG_STATIC_ALLOC)
+static StaticSemaphore_t s_mutex_buf;
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONFIG_POWER_SAVE
+static uint32_t prvRxHoldJob(void *f_ctx)
+{
+    PowerManager *l_powermgr = (PowerManager *)f_ctx;
+
+    return l_powermgr->ProcessRxHold();
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t PowerManager::InitManager(void)
+{
+    m_enabled   = false;
+    m_job       = -1;
+    m_rx_held   = false;
+    m_rx_holds  = 0;
+    m_mutex     = NULL;
+
+#ifdef CONFIG_POWER_SAVE
+#ifdef CONFIG_STATIC_ALLOC
+    m_mutex = xSemaphoreCreateMutexStatic(&s_mutex_buf);
+#else
+    m_mutex = xSemaphoreCreateMutex();
+#endif
+
+    if (!m_mutex)
+    {
+        ESP_LOGE(TAG, "Error creating the mutex");
+        return ESP_FAIL;
+    }
+
+    esp_err_t l_err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "sensor_rx", &m_rx_lock);
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error creating the receive lock (%s)", esp_err_to_name(l_err));
+        return l_err;
+    }
+
+    // --- scale between the crystal and the configured frequency, sleep whenever possible
+
+    esp_pm_config_esp32_t l_config;
+
+    l_config.max_freq_mhz       = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+    l_config.min_freq_mhz       = CONFIG_ESP32_XTAL_FREQ;
+    l_config.light_sleep_enable = true;
+
+    l_err = esp_pm_configure(&l_config);
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Error enabling power management (%s), running at full speed", esp_err_to_name(l_err));
+        return l_err;
+    }
+
+    m_job = g_Scheduler.AddJob("rx_hold", prvRxHoldJob, this, SCHED_STOP);
+
+    m_enabled = true;
+
+    ESP_LOGI(TAG, "Power save enabled: %d..%d MHz, light sleep", l_config.min_freq_mhz, l_config.max_freq_mhz);
+#else
+    ESP_LOGI(TAG, "Power save disabled");
+#endif
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void PowerManager::SetupUart(uart_port_t f_uart, gpio_num_t f_rx_pin)
+{
+    if (!m_enabled) return;
+
+#ifdef CONFIG_POWER_SAVE
+
+    // --- only UART 0 and 1 can wake the ESP32, for the others the start bit on the pin does
+
+    if (f_uart <= UART_NUM_1)
+    {
+        ESP_ERROR_CHECK(uart_set_wakeup_threshold(f_uart, POWER_UART_WAKEUP_EDGES));
+        ESP_ERROR_CHECK(esp_sleep_enable_uart_wakeup(f_uart));
+    }
+    else
+    {
+        ESP_ERROR_CHECK(gpio_wakeup_enable(f_rx_pin, GPIO_INTR_LOW_LEVEL));
+        ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+    }
+
+    ESP_LOGI(TAG, "UART %d wakes up from light sleep", f_uart);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void PowerManager::RxActivity(void)
+{
+    if (!m_enabled) return;
+
+#ifdef CONFIG_POWER_SAVE
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    if (!m_rx_held)
+    {
+        esp_pm_lock_acquire(m_rx_lock);
+
+        m_rx_held = true;
+        ++m_rx_holds;
+    }
+
+    // --- every piece of data pushes the end of the hold time out. Under the lock, a release
+    // --- running meanwhile must not leave us with a pending hold but no lock
+
+    g_Scheduler.SetJobDelay(m_job, CONFIG_POWER_RX_HOLD_MS);
+
+    xSemaphoreGive(m_mutex);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t PowerManager::ProcessRxHold(void)
+{
+#ifdef CONFIG_POWER_SAVE
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    if (m_rx_held)
+    {
+        esp_pm_lock_release(m_rx_lock);
+
+        m_rx_held = false;
+    }
+
+    xSemaphoreGive(m_mutex);
+#endif
+
+    return SCHED_STOP;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+PowerManager g_PowerManager;
+
+////////////////////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,98 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef POWER_MANAGER_H_
+#define	POWER_MANAGER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "esp_err.h"
+#include "esp_pm.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- With CONFIG_POWER_SAVE the CPU clock scales down when nothing is running and the chip
+// --- goes to light sleep between the datagrams. The UART receive pins wake it up again, the
+// --- edges doing so are lost, so after receiving data we keep the chip awake for
+// --- POWER_RX_HOLD_MS to get the rest of the sensor's burst completely.
+// --- Without CONFIG_POWER_SAVE all functions do nothing.
+
+class PowerManager
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- the sensor UARTs, called while they are set up
+
+    void SetupUart(uart_port_t f_uart, gpio_num_t f_rx_pin);
+
+    // --- called by the receive tasks when data came in
+
+    void RxActivity(void);
+
+    // --- the job releasing the receive lock after the hold time
+
+    uint32_t ProcessRxHold(void);
+
+    // --- statistics
+
+    bool IsEnabled(void) const          { return m_enabled; }
+    bool IsRxHeld(void) const           { return m_rx_held; }
+    uint32_t GetRxHolds(void) const     { return m_rx_holds; }
+
+private:
+    bool                    m_enabled;
+
+#ifdef CONFIG_POWER_SAVE
+    esp_pm_lock_handle_t    m_rx_lock;
+#endif
+    SemaphoreHandle_t       m_mutex;
+    int                     m_job;
+    volatile bool           m_rx_held;
+    uint32_t                m_rx_holds;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern PowerManager g_PowerManager;
+
+
+#endif
@@ -0,0 +1,416 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+
+#include "config_manager.h"
+#include "config_manager_defines.h"
+#include "mqtt_manager.h"
+#include "quantiles.h"
+#include "scheduler.h"
+#include "sensor_manager.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "Quantiles";
+
+static const int64_t s_window_ms[QWindow_Cnt] = { 3600LL * 1000, 86400LL * 1000 };
+static const char *s_window_name[QWindow_Cnt] = { "hour", "day" };
+
+// --- the receive tasks add, the REST server and the scheduler read
+
+static portMUX_TYPE s_quantile_mux = portMUX_INITIALIZER_UNLOCKED;
+
+QuantileManager g_Quantiles;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void P2Quantile::Begin(float f_p)
+{
+    m_p     = f_p;
+    m_count = 0;
+
+    // --- positions 0 .. 4, the markers aim at min, p/2, p, (1+p)/2 and max
+
+    for (int i = 0; i < 5; ++i) m_n[i] = i;
+
+    m_want[0] = 0.0f;
+    m_want[1] = 2.0f * f_p;
+    m_want[2] = 4.0f * f_p;
+    m_want[3] = 2.0f + 2.0f * f_p;
+    m_want[4] = 4.0f;
+
+    m_step[0] = 0.0f;
+    m_step[1] = f_p / 2.0f;
+    m_step[2] = f_p;
+    m_step[3] = (1.0f + f_p) / 2.0f;
+    m_step[4] = 1.0f;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void P2Quantile::Add(float f_value)
+{
+    if (m_count < 5)
+    {
+        // --- the first five sorted in
+
+        int i = m_count++;
+
+        while (i > 0 && m_q[i - 1] > f_value)
+        {
+            m_q[i] = m_q[i - 1];
+            --i;
+        }
+
+        m_q[i] = f_value;
+        return;
+    }
+
+    // --- the cell of the new value, the outer markers follow min and max
+
+    int k;
+
+    if (f_value < m_q[0])
+    {
+        m_q[0] = f_value;
+        k = 0;
+    }
+    else if (f_value >= m_q[4])
+    {
+        m_q[4] = f_value;
+        k = 3;
+    }
+    else
+    {
+        k = 0;
+        while (f_value >= m_q[k + 1]) ++k;
+    }
+
+    for (int i = k + 1; i < 5; ++i) ++m_n[i];
+    for (int i = 0; i < 5; ++i) m_want[i] += m_step[i];
+
+    ++m_count;
+
+    // --- move the inner markers by one if they are off by one or more
+
+    for (int i = 1; i < 4; ++i)
+    {
+        float l_off = m_want[i] - m_n[i];
+
+        if ((l_off >= 1.0f && m_n[i + 1] - m_n[i] > 1) || (l_off <= -1.0f && m_n[i - 1] - m_n[i] < -1))
+        {
+            int l_d = l_off > 0 ? 1 : -1;
+            float l_q = Parabolic(i, l_d);
+
+            if (!(m_q[i - 1] < l_q && l_q < m_q[i + 1])) l_q = Linear(i, l_d);
+
+            m_q[i] = l_q;
+            m_n[i] += l_d;
+        }
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+float P2Quantile::Get(void) const
+{
+    if (!m_count) return 0.0f;
+
+    // --- up to five values are kept sorted, that is exact
+
+    if (m_count < 5) return m_q[(int)roundf(m_p * (m_count - 1))];
+
+    return m_q[2];
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+float P2Quantile::Parabolic(int i, int d) const
+{
+    float l_span = (float)(m_n[i + 1] - m_n[i - 1]);
+    float l_up   = (m_n[i] - m_n[i - 1] + d) * (m_q[i + 1] - m_q[i]) / (m_n[i + 1] - m_n[i]);
+    float l_down = (m_n[i + 1] - m_n[i] - d) * (m_q[i] - m_q[i - 1]) / (m_n[i] - m_n[i - 1]);
+
+    return m_q[i] + d * (l_up + l_down) / l_span;
+}
+
+float P2Quantile::Linear(int i, int d) const
+{
+    return m_q[i] + d * (m_q[i + d] - m_q[i]) / (m_n[i + d] - m_n[i]);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void prvQuantileConfigChanged(uint32_t f_changed, void *f_ctx)
+{
+    QuantileManager *l_mgr = (QuantileManager *)f_ctx;
+
+    l_mgr->UpdateConfig();
+}
+
+static void prvQuantileWindowHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    QuantileManager *l_mgr = (QuantileManager *)f_ctx;
+
+    l_mgr->PublishLast(f_event.m_arg >> 8, (QuantileWindow)(f_event.m_arg & 0xff));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t QuantileManager::InitManager(void)
+{
+    m_cnt = 0;
+
+    UpdateConfig();
+
+    g_ConfigManager.RegisterListener(prvQuantileConfigChanged, this, CFMGR_KEYBIT(CFMGR_QUANTILES));
+    g_Scheduler.AddHandler(SchedEvent_QuantileWindow, prvQuantileWindowHandler, this);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::UpdateConfig(void)
+{
+    std::string l_text = g_ConfigManager.GetStringValue(CFMGR_QUANTILES);
+
+    // --- a list of percentages, whatever is not between 0 and 100 is skipped
+
+    double l_p[QUANTILE_MAX];
+    int l_cnt = 0;
+    const char *l_pos = l_text.c_str();
+
+    while (*l_pos && l_cnt < QUANTILE_MAX)
+    {
+        char *l_end;
+        double l_value = strtod(l_pos, &l_end);
+
+        if (l_end == l_pos)
+        {
+            ++l_pos;
+            continue;
+        }
+
+        if (l_value > 0.0 && l_value < 100.0) l_p[l_cnt++] = l_value;
+
+        l_pos = l_end;
+    }
+
+    ESP_LOGI(TAG, "%d quantiles from '%s'", l_cnt, l_text.c_str());
+
+    // --- everything starts again
+
+    portENTER_CRITICAL(&s_quantile_mux);
+
+    m_cnt = l_cnt;
+    memcpy(m_p, l_p, sizeof(double) * l_cnt);
+
+    for (int s = 0; s < CONFIG_TEMP_SENSOR_CNT; ++s)
+    {
+        for (int w = 0; w < QWindow_Cnt; ++w)
+        {
+            ResetWindow(m_windows[s][w], -1);
+            memset(&m_windows[s][w].m_last, 0, sizeof(QuantileState));
+        }
+    }
+
+    portEXIT_CRITICAL(&s_quantile_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::ResetWindow(Window &f_win, int64_t f_start)
+{
+    f_win.m_start = f_start;
+
+    for (int q = 0; q < m_cnt; ++q) f_win.m_est[q].Begin((float)(m_p[q] / 100.0));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::Add(int f_sensor, uint16_t f_pm2)
+{
+    struct timeval l_now;
+    gettimeofday(&l_now, NULL);
+
+    Add(f_sensor, (int64_t)l_now.tv_sec * 1000 + l_now.tv_usec / 1000, f_pm2);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::Add(int f_sensor, int64_t f_time_ms, uint16_t f_pm2)
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    uint32_t l_ended = 0;
+
+    portENTER_CRITICAL(&s_quantile_mux);
+
+    for (int w = 0; w < QWindow_Cnt; ++w)
+    {
+        Window &l_win = m_windows[f_sensor][w];
+        int64_t l_start = f_time_ms - f_time_ms % s_window_ms[w];
+
+        if (l_start != l_win.m_start)
+        {
+            // --- a new window (or the clock was set): keep the result of the old one
+
+            if (l_win.m_start >= 0 && m_cnt && l_win.m_est[0].GetCount())
+            {
+                FillState(l_win, &l_win.m_last);
+                l_ended |= 1 << w;
+            }
+
+            ResetWindow(l_win, l_start);
+        }
+
+        for (int q = 0; q < m_cnt; ++q) l_win.m_est[q].Add(f_pm2);
+    }
+
+    portEXIT_CRITICAL(&s_quantile_mux);
+
+    for (int w = 0; w < QWindow_Cnt; ++w)
+    {
+        if (l_ended & (1 << w)) g_Scheduler.Post(SchedEvent_QuantileWindow, (f_sensor << 8) | w);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::FillState(const Window &f_win, QuantileState *f_state) const
+{
+    f_state->m_start = f_win.m_start;
+    f_state->m_count = m_cnt ? f_win.m_est[0].GetCount() : 0;
+
+    for (int q = 0; q < m_cnt; ++q) f_state->m_value[q] = f_win.m_est[q].Get();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool QuantileManager::GetCurrent(int f_sensor, QuantileWindow f_window, QuantileState *f_state) const
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return false;
+
+    portENTER_CRITICAL(&s_quantile_mux);
+    FillState(m_windows[f_sensor][f_window], f_state);
+    portEXIT_CRITICAL(&s_quantile_mux);
+
+    return f_state->m_count > 0;
+}
+
+bool QuantileManager::GetLast(int f_sensor, QuantileWindow f_window, QuantileState *f_state) const
+{
+    if (f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return false;
+
+    portENTER_CRITICAL(&s_quantile_mux);
+    *f_state = m_windows[f_sensor][f_window].m_last;
+    portEXIT_CRITICAL(&s_quantile_mux);
+
+    return f_state->m_count > 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::AddState(cJSON *f_obj, const QuantileState &f_state) const
+{
+    cJSON_AddNumberToObject(f_obj, "start", (double)f_state.m_start);
+    cJSON_AddNumberToObject(f_obj, "count", f_state.m_count);
+
+    for (int q = 0; q < m_cnt; ++q)
+    {
+        char l_name[16];
+
+        snprintf(l_name, sizeof(l_name), "p%g", m_p[q]);
+        cJSON_AddNumberToObject(f_obj, l_name, roundf(f_state.m_value[q] * 10.0f) / 10.0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::AddToJson(int f_sensor, cJSON *f_obj) const
+{
+    cJSON *l_list = cJSON_AddArrayToObject(f_obj, "quantiles");
+
+    for (int q = 0; q < m_cnt; ++q) cJSON_AddItemToArray(l_list, cJSON_CreateNumber(m_p[q]));
+
+    for (int w = 0; w < QWindow_Cnt; ++w)
+    {
+        QuantileState l_state;
+        cJSON *l_win = cJSON_AddObjectToObject(f_obj, s_window_name[w]);
+
+        if (GetCurrent(f_sensor, (QuantileWindow)w, &l_state)) AddState(l_win, l_state);
+        if (GetLast(f_sensor, (QuantileWindow)w, &l_state)) AddState(cJSON_AddObjectToObject(l_win, "last"), l_state);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void QuantileManager::PublishLast(int f_sensor, QuantileWindow f_window)
+{
+    QuantileState l_state;
+
+    if (f_window >= QWindow_Cnt || !GetLast(f_sensor, f_window, &l_state)) return;
+
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(root, "window", s_window_name[f_window]);
+    g_SensorManager.GetSensor(f_sensor).GetHealth().AddToJson(root);
+    AddState(root, l_state);
+
+    char *l_json = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    if (!l_json)
+    {
+        ESP_LOGE(TAG, "Error creating the quantile report");
+        return;
+    }
+
+    char l_topic[32];
+    snprintf(l_topic, sizeof(l_topic), "quantiles/sensor%d", f_sensor + 1);
+
+    g_MqttManager.Publish(l_topic, l_json);
+
+    free(l_json);
+}
@@ -0,0 +1,158 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef QUANTILES_H_
+#define	QUANTILES_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "cJSON.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define QUANTILE_MAX            4       // --- quantiles per window, more in the config are ignored
+
+enum QuantileWindow
+{
+    QWindow_Hour,
+    QWindow_Day,
+
+    QWindow_Cnt
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- The P² estimator (Jain/Chlamtac): one quantile of a stream in five markers, which
+// --- are moved towards their ideal positions with a parabolic fit as values come in.
+// --- Constant memory and time per value, exact for the first five.
+
+class P2Quantile
+{
+
+public:
+    void Begin(float f_p);
+    void Add(float f_value);
+
+    float Get(void) const;
+    uint32_t GetCount(void) const       { return m_count; }
+
+private:
+    float Parabolic(int i, int d) const;
+    float Linear(int i, int d) const;
+
+    float       m_p;
+    uint32_t    m_count;
+    float       m_q[5];                 // --- marker heights
+    int32_t     m_n[5];                 // --- marker positions
+    float       m_want[5];              // --- desired positions
+    float       m_step[5];              // --- their increment per value
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- A window of one sensor: its start (ms since the epoch) and the estimators
+
+struct QuantileState
+{
+    int64_t     m_start;
+    uint32_t    m_count;
+    float       m_value[QUANTILE_MAX];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Streaming PM2.5 quantiles per sensor over the running hour and day (UTC, like
+// --- the wall clock). The receive task adds every datagram. When a window ends its
+// --- result is kept as the last one and published via MQTT (<topic>/quantiles/sensor<n>)
+// --- from the scheduler. The quantiles are the "quantiles" config key in percent, e.g.
+// --- "50,95,98". Changing it starts all windows again.
+
+class QuantileManager
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- a new datagram, time stamped with the wall clock
+
+    void Add(int f_sensor, uint16_t f_pm2);
+    void Add(int f_sensor, int64_t f_time_ms, uint16_t f_pm2);
+
+    // --- the running and the last complete window
+
+    bool GetCurrent(int f_sensor, QuantileWindow f_window, QuantileState *f_state) const;
+    bool GetLast(int f_sensor, QuantileWindow f_window, QuantileState *f_state) const;
+
+    int GetQuantileCnt(void) const      { return m_cnt; }
+    double GetQuantile(int f_idx) const { return m_p[f_idx]; }
+
+    // --- adds the quantiles, both windows and their last results to f_obj
+
+    void AddToJson(int f_sensor, cJSON *f_obj) const;
+
+    // --- called from the scheduler when a window has ended
+
+    void PublishLast(int f_sensor, QuantileWindow f_window);
+
+    void UpdateConfig(void);
+
+private:
+    struct Window
+    {
+        int64_t     m_start;
+        P2Quantile  m_est[QUANTILE_MAX];
+        QuantileState m_last;
+    };
+
+    void ResetWindow(Window &f_win, int64_t f_start);
+    void FillState(const Window &f_win, QuantileState *f_state) const;
+    void AddState(cJSON *f_obj, const QuantileState &f_state) const;
+
+    int         m_cnt;
+    double      m_p[QUANTILE_MAX];      // --- in percent, as configured
+
+    Window      m_windows[CONFIG_TEMP_SENSOR_CNT][QWindow_Cnt];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern QuantileManager g_Quantiles;
+
+
+#endif
@@ -0,0 +1,192 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "cJSON.h"
+
+#include "response_cache.h"
+#include "sensor_manager.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "RespCache";
+
+// --- guards the front index and the reference counts, never held while rendering
+
+static portMUX_TYPE s_cache_mux = portMUX_INITIALIZER_UNLOCKED;
+
+ResponseCache g_ResponseCache;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t ResponseCache::InitManager(void)
+{
+    memset(m_slots, 0, sizeof(m_slots));
+
+    m_hits      = 0;
+    m_renders   = 0;
+
+    ESP_LOGI(TAG, "Response cache for %d sensors, %d bytes", CONFIG_TEMP_SENSOR_CNT, (int)sizeof(m_slots));
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t ResponseCache::GetHealthStamp(const SensorHealthInfo &f_info)
+{
+    uint32_t l_age_s = f_info.m_age_ms / 1000;
+
+    return (uint32_t)f_info.m_state << 24 | (l_age_s < 0xffffff ? l_age_s : 0xffffff);
+}
+
+int ResponseCache::Render(int f_sensor, char *f_buf, size_t f_size, uint32_t *f_version, uint32_t *f_health)
+{
+    CVindriktning &l_sensor = g_SensorManager.GetSensor(f_sensor);
+
+    // --- a consistent snapshot: the receive task may write new values meanwhile
+
+    uint32_t l_version;
+    float l_pm1, l_pm2, l_pm10;
+
+    for (;;)
+    {
+        l_version = l_sensor.GetVersion();
+        __sync_synchronize();
+
+        l_pm1   = l_sensor.GetPM1();
+        l_pm2   = l_sensor.GetPM2();
+        l_pm10  = l_sensor.GetPM10();
+
+        __sync_synchronize();
+
+        if (!(l_version & 1) && l_version == l_sensor.GetVersion()) break;
+    }
+
+    SensorHealthInfo l_health = l_sensor.GetHealth().GetInfo(esp_timer_get_time());
+
+    cJSON *root = cJSON_CreateObject();
+    
+    cJSON_AddNumberToObject(root, "pm1", l_pm1);
+    cJSON_AddNumberToObject(root, "pm2", l_pm2);
+    cJSON_AddNumberToObject(root, "pm10", l_pm10);
+
+    SensorHealth::AddToJson(l_health, root);
+
+    bool l_ok = cJSON_PrintPreallocated(root, f_buf, f_size, true);
+
+    cJSON_Delete(root);
+
+    if (!l_ok) return -1;
+
+    *f_version  = l_version;
+    *f_health   = GetHealthStamp(l_health);
+
+    return strlen(f_buf);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+const CachedResponse *ResponseCache::Acquire(int f_sensor)
+{
+    Slot &l_slot = m_slots[f_sensor];
+    CVindriktning &l_sensor = g_SensorManager.GetSensor(f_sensor);
+
+    uint32_t l_version  = l_sensor.GetVersion();
+    uint32_t l_health   = GetHealthStamp(l_sensor.GetHealth().GetInfo(esp_timer_get_time()));
+
+    portENTER_CRITICAL(&s_cache_mux);
+
+    CachedResponse *l_front = &l_slot.m_buf[l_slot.m_front];
+
+    if (l_front->m_len && l_front->m_version == l_version && l_front->m_health == l_health)
+    {
+        ++l_front->m_refs;
+        ++m_hits;
+
+        portEXIT_CRITICAL(&s_cache_mux);
+        return l_front;
+    }
+
+    // --- outdated: render into the back buffer, unless a request is still sending it
+
+    CachedResponse *l_back = &l_slot.m_buf[l_slot.m_front ^ 1];
+
+    if (l_back->m_refs)
+    {
+        portEXIT_CRITICAL(&s_cache_mux);
+        return NULL;
+    }
+
+    l_back->m_refs = 1;
+
+    portEXIT_CRITICAL(&s_cache_mux);
+
+    int l_len = Render(f_sensor, l_back->m_data, sizeof(l_back->m_data), &l_back->m_version, &l_back->m_health);
+
+    portENTER_CRITICAL(&s_cache_mux);
+
+    if (l_len < 0)
+    {
+        l_back->m_len   = 0;
+        l_back->m_refs  = 0;
+
+        portEXIT_CRITICAL(&s_cache_mux);
+        return NULL;
+    }
+
+    l_back->m_len   = l_len;
+    l_slot.m_front ^= 1;
+    ++m_renders;
+
+    portEXIT_CRITICAL(&s_cache_mux);
+
+    return l_back;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void ResponseCache::Release(const CachedResponse *f_resp)
+{
+    portENTER_CRITICAL(&s_cache_mux);
+
+    --((CachedResponse *)f_resp)->m_refs;
+
+    portEXIT_CRITICAL(&s_cache_mux);
+}
@@ -0,0 +1,114 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef RESPONSE_CACHE_H_
+#define	RESPONSE_CACHE_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "sensor_health.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define RESP_CACHE_BUF_SIZE     128     // --- {"pm1": ..., "pm2": ..., "pm10": ..., "health": ..., "age": ...} as printed by cJSON
+
+// --- one rendered response and the number of requests sending it right now
+
+struct CachedResponse
+{
+    uint32_t    m_version;              // --- the sensor version it was rendered from
+    uint32_t    m_health;               // --- and the health stamp, see GetHealthStamp()
+    uint16_t    m_len;
+    uint8_t     m_refs;
+    char        m_data[RESP_CACHE_BUF_SIZE];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- The JSON of /api/v1/air/<n> only changes with a new datagram or the health of the
+// --- sensor (its state and the age in seconds), so it is rendered once per sensor version
+// --- and health and every request sends the same bytes until the next one. Each
+// --- sensor has two buffers: requests send the front one while the next version is
+// --- rendered into the back one, which then becomes the front. A buffer still being sent
+// --- is never overwritten, if both are busy the caller renders its own response.
+
+class ResponseCache
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- the current response of a sensor, rendered if the sensor has a new version.
+    // --- NULL if it cannot be served from the cache. Release() it after sending
+
+    const CachedResponse *Acquire(int f_sensor);
+    void Release(const CachedResponse *f_resp);
+
+    // --- the JSON of a sensor into f_buf, returns the length or -1
+
+    static int Render(int f_sensor, char *f_buf, size_t f_size, uint32_t *f_version, uint32_t *f_health);
+
+    // --- state and age of a sensor in one word, a response is outdated when it changes
+
+    static uint32_t GetHealthStamp(const SensorHealthInfo &f_info);
+
+    // --- statistics
+
+    uint32_t GetHits(void) const        { return m_hits; }
+    uint32_t GetRenders(void) const     { return m_renders; }
+
+private:
+    struct Slot
+    {
+        CachedResponse  m_buf[2];
+        uint8_t         m_front;
+    };
+
+    Slot        m_slots[CONFIG_TEMP_SENSOR_CNT];
+    uint32_t    m_hits;
+    uint32_t    m_renders;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern ResponseCache g_ResponseCache;
+
+
+#endif
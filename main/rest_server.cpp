@@ -46,11 +46,21 @@
 #include "driver/uart.h"
 #include "nvs_flash.h"
 #include "esp_wifi.h"
+#include "esp_timer.h"
 
 #include "sensor_manager.h"
 #include "config_manager.h"
 #include "config_manager_defines.h"
 #include "mqtt_manager.h"
+#include "diag_manager.h"
+#include "evlog.h"
+#include "response_cache.h"
+#include "history.h"
+#include "quantiles.h"
+#include "aqi.h"
+#include "alarm_manager.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -59,7 +69,11 @@ static const char *REST_TAG = "esp-rest";
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 128)
 #define SCRATCH_BUFSIZE (10240)
 
+#ifdef CONFIG_STATIC_ALLOC
+#define DEFAULT_SCAN_LIST_SIZE 32       // --- static pool: room for the strongest APs only
+#else
 #define DEFAULT_SCAN_LIST_SIZE 128
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -68,6 +82,15 @@ typedef struct rest_server_context {
     char scratch[SCRATCH_BUFSIZE];
 } rest_server_context_t;
 
+#ifdef CONFIG_STATIC_ALLOC
+
+// --- the server runs one handler at a time, so they can share the pools
+
+static rest_server_context_t s_rest_context;
+static wifi_ap_record_t s_ap_info[DEFAULT_SCAN_LIST_SIZE];
+
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 std::string SanetizedString(const char *f_s)
@@ -239,13 +262,11 @@ static esp_err_t system_info_get_handler(httpd_req_t *req)
 
 static esp_err_t dust_data_get_handler(httpd_req_t *req)
 {
-    ESP_LOGI(REST_TAG,"dust_data_get_handler %s",req->uri);
-
     httpd_resp_set_type(req, "application/json");
 
     // ---- find trailing backslash
 
-    char *l_sensorint = strrchr(req->uri,'/');
+    const char *l_sensorint = strrchr(req->uri,'/');
     if (!l_sensorint)
     {
         ESP_LOGE(REST_TAG, "dust_data_get_handler: Illegal URI");
@@ -266,6 +287,20 @@ static esp_err_t dust_data_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
+    EVLOG(RestAir, l_sensor_idx);
+
+    // ---- the response rendered for the current sample, shared by all clients
+
+    const CachedResponse *l_cached = g_ResponseCache.Acquire(l_sensor_idx-1);
+
+    if (l_cached)
+    {
+        esp_err_t l_err = httpd_resp_send(req, l_cached->m_data, l_cached->m_len);
+
+        g_ResponseCache.Release(l_cached);
+        return l_err;
+    }
+
     // ---- now ask the sensor for the values and create a JSON from that    
 
     cJSON *root = cJSON_CreateObject();
@@ -273,6 +308,8 @@ static esp_err_t dust_data_get_handler(httpd_req_t *req)
     cJSON_AddNumberToObject(root, "pm1", g_SensorManager.GetSensor(l_sensor_idx-1).GetPM1());
     cJSON_AddNumberToObject(root, "pm2", g_SensorManager.GetSensor(l_sensor_idx-1).GetPM2());
     cJSON_AddNumberToObject(root, "pm10", g_SensorManager.GetSensor(l_sensor_idx-1).GetPM10());
+
+    g_SensorManager.GetSensor(l_sensor_idx-1).GetHealth().AddToJson(root);
     
     const char *sys_info = cJSON_Print(root);
     httpd_resp_sendstr(req, sys_info);
@@ -287,7 +324,7 @@ static esp_err_t dust_data_get_handler(httpd_req_t *req)
 
 static esp_err_t dust_cnt_get_handler(httpd_req_t *req)
 {
-    ESP_LOGI(REST_TAG,"dust_cnt_get_handler %s",req->uri);
+    EVLOG(RestSensorCnt);
 
     httpd_resp_set_type(req, "application/json");
 
@@ -308,6 +345,411 @@ static esp_err_t dust_cnt_get_handler(httpd_req_t *req)
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+static esp_err_t diag_get_handler(httpd_req_t *req)
+{
+    EVLOG(RestDiag);
+
+    httpd_resp_set_type(req, "application/json");
+
+    // ---- heap and stack report of the diagnostics manager
+
+    char *l_report = g_DiagManager.CreateReport(true);
+    if (!l_report)
+    {
+        ESP_LOGE(REST_TAG, "diag_get_handler: No memory for report");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No memory for report");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, l_report);
+
+    free(l_report);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t cpu_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    // ---- optional sampling window: /api/v1/cpu?window_ms=1000
+
+    uint32_t l_window_ms = 0;
+    char l_query[64];
+    char l_value[16];
+
+    if (httpd_req_get_url_query_str(req, l_query, sizeof(l_query)) == ESP_OK &&
+        httpd_query_key_value(l_query, "window_ms", l_value, sizeof(l_value)) == ESP_OK)
+    {
+        l_window_ms = strtoul(l_value, NULL, 10);
+    }
+
+    EVLOG(RestCpu, l_window_ms);
+
+    char *l_report = g_DiagManager.CreateCpuReport(l_window_ms);
+    if (!l_report)
+    {
+        ESP_LOGE(REST_TAG, "cpu_get_handler: No CPU report available");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No CPU report available");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, l_report);
+
+    free(l_report);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t evlog_get_handler(httpd_req_t *req)
+{
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+
+    // ---- optional first record: /api/v1/evlog?since=1234, default the oldest one
+
+    uint32_t l_from = g_EventLog.GetFirstSeq();
+    char l_query[64];
+    char l_value[16];
+
+    if (httpd_req_get_url_query_str(req, l_query, sizeof(l_query)) == ESP_OK &&
+        httpd_query_key_value(l_query, "since", l_value, sizeof(l_value)) == ESP_OK)
+    {
+        l_from = strtoul(l_value, NULL, 10);
+    }
+
+    EVLOG(RestEvlog, l_from);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+
+    // ---- the stream header, then the ring in blocks of the scratch buffer size. Events
+    // ---- coming in meanwhile are left for the next request
+
+    EvlogStreamHeader l_hdr;
+
+    memcpy(l_hdr.m_magic, EVLOG_STREAM_MAGIC, sizeof(l_hdr.m_magic));
+    l_hdr.m_next_seq    = g_EventLog.GetNextSeq();
+    l_hdr.m_uptime_ms   = (uint32_t)(esp_timer_get_time() / 1000);
+
+    if (httpd_resp_send_chunk(req, (const char *)&l_hdr, sizeof(l_hdr)) != ESP_OK) return ESP_FAIL;
+
+    char *l_chunk = rest_context->scratch;
+
+    while ((int32_t)(l_from - l_hdr.m_next_seq) < 0)
+    {
+        EvlogBlockHeader l_block;
+        uint32_t l_first, l_count;
+
+        size_t l_bytes = g_EventLog.Read(l_from, (uint8_t *)l_chunk + sizeof(l_block), SCRATCH_BUFSIZE - sizeof(l_block), &l_first, &l_count);
+        if (!l_count) break;
+
+        l_block.m_first_seq = l_first;
+        l_block.m_count     = l_count;
+        l_block.m_bytes     = l_bytes;
+
+        memcpy(l_chunk, &l_block, sizeof(l_block));
+
+        if (httpd_resp_send_chunk(req, l_chunk, sizeof(l_block) + l_bytes) != ESP_OK) return ESP_FAIL;
+
+        l_from = l_first + l_count;
+    }
+
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t history_get_handler(httpd_req_t *req)
+{
+    rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
+
+    // ---- the sensor index is the last part of the URI: /api/v1/history/1?from=...
+
+    char l_uri[32];
+    strlcpy(l_uri, req->uri, sizeof(l_uri));
+
+    char *l_query_start = strchr(l_uri, '?');
+    if (l_query_start) *l_query_start = 0;
+
+    const char *l_sensorint = strrchr(l_uri, '/');
+    int l_sensor_idx = l_sensorint ? atoi(l_sensorint + 1) : 0;
+
+    if (l_sensor_idx < 1 || l_sensor_idx > CONFIG_TEMP_SENSOR_CNT)
+    {
+        ESP_LOGE(REST_TAG, "history_get_handler: Illegal sensor index %d", l_sensor_idx);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Illegal sensor index");
+        return ESP_FAIL;
+    }
+
+    // ---- optional: samples from this time on (ms since the epoch), the compressed blocks,
+    // ---- at most this many points (downsampled for charts)
+
+    int64_t l_from = 0;
+    bool l_binary = false;
+    int l_points = 0;
+    char l_query[80];
+    char l_value[24];
+
+    if (httpd_req_get_url_query_str(req, l_query, sizeof(l_query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(l_query, "from", l_value, sizeof(l_value)) == ESP_OK) l_from = strtoll(l_value, NULL, 10);
+        if (httpd_query_key_value(l_query, "format", l_value, sizeof(l_value)) == ESP_OK) l_binary = !strcmp(l_value, "bin");
+        if (httpd_query_key_value(l_query, "points", l_value, sizeof(l_value)) == ESP_OK) l_points = atoi(l_value);
+    }
+
+    if (l_points > HISTORY_MAX_POINTS) l_points = HISTORY_MAX_POINTS;
+
+    EVLOG(RestHistory, l_sensor_idx, l_binary);
+
+    // ---- the blocks are copied one by one to the end of the scratch buffer (two of them
+    // ---- when downsampling), the front collects the output
+
+    char *l_out = rest_context->scratch;
+    uint8_t *l_block = (uint8_t *)rest_context->scratch + SCRATCH_BUFSIZE - 2 * TSC_BLOCK_SIZE;
+    size_t l_out_max = SCRATCH_BUFSIZE - 2 * TSC_BLOCK_SIZE;
+    size_t l_pos = 0;
+
+    uint32_t l_seq = g_History.GetFirstSeq(l_sensor_idx - 1);
+    size_t l_len;
+
+    if (l_binary)
+    {
+        httpd_resp_set_type(req, "application/octet-stream");
+
+        if (httpd_resp_send_chunk(req, HISTORY_STREAM_MAGIC, 4) != ESP_OK) return ESP_FAIL;
+
+        while ((l_len = g_History.ReadBlock(l_sensor_idx - 1, &l_seq, l_block)) > 0)
+        {
+            uint8_t l_hdr[2] = { (uint8_t)l_len, (uint8_t)(l_len >> 8) };
+
+            if (httpd_resp_send_chunk(req, (const char *)l_hdr, sizeof(l_hdr)) != ESP_OK) return ESP_FAIL;
+            if (httpd_resp_send_chunk(req, (const char *)l_block, l_len) != ESP_OK) return ESP_FAIL;
+
+            ++l_seq;
+        }
+
+        httpd_resp_send_chunk(req, NULL, 0);
+
+        return ESP_OK;
+    }
+
+    httpd_resp_set_type(req, "application/json");
+
+    l_pos = snprintf(l_out, l_out_max, "{\"sensor\":%d,\"samples\":[", l_sensor_idx);
+
+    // ---- both walk the ring block by block, the size of the history does not matter
+
+    HistoryCursor l_cursor;
+    HistoryDownsampler l_sampler;
+    TsSample l_sample;
+    bool l_first = true;
+
+    if (l_points > 0) l_sampler.Begin(l_sensor_idx - 1, l_from, l_points, l_block);
+    else l_cursor.Begin(l_sensor_idx - 1, l_from, INT64_MAX, l_block);
+
+    while (l_points > 0 ? l_sampler.Next(&l_sample) : l_cursor.Next(&l_sample))
+    {
+        // ---- [time, pm1, pm2, pm10]
+
+        if (l_pos > l_out_max - 64)
+        {
+            if (httpd_resp_send_chunk(req, l_out, l_pos) != ESP_OK) return ESP_FAIL;
+            l_pos = 0;
+        }
+
+        l_pos += snprintf(l_out + l_pos, l_out_max - l_pos, "%s[%lld,%u,%u,%u]", l_first ? "" : ",",
+                          (long long)l_sample.m_time_ms, l_sample.m_val[0], l_sample.m_val[1], l_sample.m_val[2]);
+        l_first = false;
+    }
+
+    l_pos += snprintf(l_out + l_pos, l_out_max - l_pos, "]}");
+
+    if (httpd_resp_send_chunk(req, l_out, l_pos) != ESP_OK) return ESP_FAIL;
+
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t quantiles_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    // ---- the sensor index is the last part of the URI: /api/v1/quantiles/1
+
+    const char *l_sensorint = strrchr(req->uri, '/');
+    int l_sensor_idx = l_sensorint ? atoi(l_sensorint + 1) : 0;
+
+    if (l_sensor_idx < 1 || l_sensor_idx > CONFIG_TEMP_SENSOR_CNT)
+    {
+        ESP_LOGE(REST_TAG, "quantiles_get_handler: Illegal sensor index %d", l_sensor_idx);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Illegal sensor index");
+        return ESP_FAIL;
+    }
+
+    EVLOG(RestQuantiles, l_sensor_idx);
+
+    // ---- the running hour and day of PM2.5 and the last complete ones
+
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "sensor", l_sensor_idx);
+    g_SensorManager.GetSensor(l_sensor_idx - 1).GetHealth().AddToJson(root);
+    g_Quantiles.AddToJson(l_sensor_idx - 1, root);
+
+    const char *sys_info = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, sys_info);
+
+    free((void *)sys_info);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t aqi_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    // ---- the sensor index is the last part of the URI: /api/v1/aqi/1
+
+    const char *l_sensorint = strrchr(req->uri, '/');
+    int l_sensor_idx = l_sensorint ? atoi(l_sensorint + 1) : 0;
+
+    if (l_sensor_idx < 1 || l_sensor_idx > CONFIG_TEMP_SENSOR_CNT)
+    {
+        ESP_LOGE(REST_TAG, "aqi_get_handler: Illegal sensor index %d", l_sensor_idx);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Illegal sensor index");
+        return ESP_FAIL;
+    }
+
+    EVLOG(RestAqi, l_sensor_idx);
+
+    // ---- the rolling means and the indices, without data just the sensor
+
+    AqiResult l_result;
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "sensor", l_sensor_idx);
+    g_SensorManager.GetSensor(l_sensor_idx - 1).GetHealth().AddToJson(root);
+
+    if (g_Aqi.GetResult(l_sensor_idx - 1, &l_result)) g_Aqi.AddToJson(l_result, root);
+
+    const char *sys_info = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, sys_info);
+
+    free((void *)sys_info);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t frame_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    EVLOG(RestFrame);
+
+    if (!g_Frames.IsEnabled())
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Frames are off, set frame_window");
+        return ESP_FAIL;
+    }
+
+    // ---- the last frame of all sensors, before the first one just the window
+
+    SensorFrame l_frame;
+    cJSON *root = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(root, "window", g_Frames.GetWindow());
+
+    if (g_Frames.GetLast(&l_frame)) FrameAssembler::AddToJson(l_frame, esp_timer_get_time(), root);
+
+    const char *sys_info = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, sys_info);
+
+    free((void *)sys_info);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t fused_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    EVLOG(RestFused);
+
+    if (!g_Fusion.IsEnabled())
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Sensor fusion is off, set fusion");
+        return ESP_FAIL;
+    }
+
+    // ---- the fused value and the health of every sensor it is made of
+
+    cJSON *root = cJSON_CreateObject();
+
+    g_Fusion.AddToJson(root);
+
+    cJSON *l_sensors = cJSON_AddArrayToObject(root, "health");
+
+    for (int i = 0; i < g_SensorManager.GetSensorCount(); ++i)
+    {
+        cJSON *l_sensor = cJSON_CreateObject();
+
+        cJSON_AddNumberToObject(l_sensor, "sensor", i + 1);
+        g_SensorManager.GetSensor(i).GetHealth().AddToJson(l_sensor);
+
+        cJSON_AddItemToArray(l_sensors, l_sensor);
+    }
+
+    const char *sys_info = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, sys_info);
+
+    free((void *)sys_info);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static esp_err_t rules_get_handler(httpd_req_t *req)
+{
+    httpd_resp_set_type(req, "application/json");
+
+    EVLOG(RestRules);
+
+    // ---- the rules with the sensors they are active for and the alert counters
+
+    cJSON *root = cJSON_CreateObject();
+
+    g_AlarmManager.AddToJson(root);
+
+    const char *sys_info = cJSON_PrintUnformatted(root);
+    httpd_resp_sendstr(req, sys_info);
+
+    free((void *)sys_info);
+    cJSON_Delete(root);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
 static esp_err_t config_apscan_handler(httpd_req_t *req)
 {
     ESP_LOGI(REST_TAG,"config_apscan_handler %s",req->uri);
@@ -323,7 +765,11 @@ static esp_err_t config_apscan_handler(httpd_req_t *req)
     // --- initiate a wifi scan 
 
     uint16_t number = DEFAULT_SCAN_LIST_SIZE;
+#ifdef CONFIG_STATIC_ALLOC
+    wifi_ap_record_t *ap_info = s_ap_info;
+#else
     wifi_ap_record_t *ap_info = new wifi_ap_record_t[DEFAULT_SCAN_LIST_SIZE];
+#endif
     uint16_t ap_count = 0;
     memset((void *)ap_info, 0, sizeof(wifi_ap_record_t) * DEFAULT_SCAN_LIST_SIZE);
 
@@ -371,7 +817,9 @@ static esp_err_t config_apscan_handler(httpd_req_t *req)
         ESP_LOGI(REST_TAG, "RSSI \t\t%d", ap_info[i].rssi);
     }
 
-    delete ap_info;
+#ifndef CONFIG_STATIC_ALLOC
+    delete[] ap_info;
+#endif
 
     // --- now create JSON and send back
     
@@ -388,23 +836,31 @@ static esp_err_t config_apscan_handler(httpd_req_t *req)
 
 static esp_err_t config_get_handler(httpd_req_t *req)
 {
-    ESP_LOGI(REST_TAG,"config_get_handler %s",req->uri);
+    EVLOG(RestConfigGet);
 
     httpd_resp_set_type(req, "application/json");
 
-    // ---- just return the sensor count
+    // ---- one entry per key of the config schema. Secrets are never sent back
     
     cJSON *root = cJSON_CreateObject();
-    
-    cJSON_AddNumberToObject(root, CFMGR_BOOTSTRAP_DONE, g_ConfigManager.GetIntValue(CFMGR_BOOTSTRAP_DONE));
-    cJSON_AddStringToObject(root, CFMGR_WIFI_SSID,      g_ConfigManager.GetStringValue(CFMGR_WIFI_SSID).c_str());
-    cJSON_AddStringToObject(root, CFMGR_WIFI_PASSWORD,  g_ConfigManager.GetStringValue(CFMGR_WIFI_PASSWORD).c_str());
-    cJSON_AddStringToObject(root, CFMGR_DEVICE_NAME,    g_ConfigManager.GetStringValue(CFMGR_DEVICE_NAME).c_str());
 
-    cJSON_AddStringToObject(root, CFMGR_MQTT_SERVER,    g_ConfigManager.GetStringValue(CFMGR_MQTT_SERVER).c_str());
-    cJSON_AddStringToObject(root, CFMGR_MQTT_TOPIC,     g_ConfigManager.GetStringValue(CFMGR_MQTT_TOPIC).c_str());
-    cJSON_AddNumberToObject(root, CFMGR_MQTT_TIME,      g_ConfigManager.GetIntValue(CFMGR_MQTT_TIME));
-    cJSON_AddNumberToObject(root, CFMGR_MQTT_ENABLE,    g_ConfigManager.GetIntValue(CFMGR_MQTT_ENABLE));
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT; ++l_key)
+    {
+        const ConfigKeyDesc &l_desc = g_ConfigSchema[l_key];
+
+        if (l_desc.m_type == CfgType_Int)
+        {
+            cJSON_AddNumberToObject(root, l_desc.m_name, g_ConfigManager.GetIntValue((ConfigKey)l_key));
+        }
+        else if (l_desc.m_flags & CFMGR_F_SECRET)
+        {
+            cJSON_AddStringToObject(root, l_desc.m_name, "");
+        }
+        else
+        {
+            cJSON_AddStringToObject(root, l_desc.m_name, g_ConfigManager.GetStringValue((ConfigKey)l_key).c_str());
+        }
+    }
 
     // --- now create JSON and send back
     
@@ -420,66 +876,99 @@ static esp_err_t config_get_handler(httpd_req_t *req)
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
-esp_err_t ProcessJsonString(cJSON *f_root,const char *f_name, bool f_onlysetifnotempty = false)
+// --- stage the value of one config key found in the JSON object. Returns ESP_ERR_NOT_FOUND
+// --- if the key is not part of the request
+
+static esp_err_t ProcessJsonValue(ConfigTransaction &f_txn,cJSON *f_root,ConfigKey f_key)
 {
-    cJSON *l_js = cJSON_GetObjectItem(f_root, f_name);
+    const ConfigKeyDesc &l_desc = g_ConfigSchema[f_key];
+
+    cJSON *l_js = cJSON_GetObjectItem(f_root, l_desc.m_name);
 
-    if (!l_js)
+    if (!l_js) return ESP_ERR_NOT_FOUND;
+
+    if (l_desc.m_flags & CFMGR_F_READONLY)
     {
-        ESP_LOGE(REST_TAG, "Config %s not found", f_name);
-        return ESP_FAIL;
+        ESP_LOGE(REST_TAG, "Config %s is read only", l_desc.m_name);
+        return ESP_ERR_INVALID_ARG;
     }
 
-    const char *l_s = l_js->valuestring;
-    if (!l_s)
+    if (l_desc.m_type == CfgType_Int)
     {
-        ESP_LOGE(REST_TAG, "Config %s is null", f_name);
-        return ESP_FAIL;
-        
+        if (!cJSON_IsNumber(l_js))
+        {
+            ESP_LOGE(REST_TAG, "Config %s is not a number", l_desc.m_name);
+            return ESP_ERR_INVALID_ARG;
+        }
+
+        ESP_LOGI(REST_TAG, "Config %s, value '%d'", l_desc.m_name,l_js->valueint);
+
+        return f_txn.SetIntValue(f_key,l_js->valueint);
     }
 
-    // --- if flag is set and string is empty - do noting
+    if (!cJSON_IsString(l_js))
+    {
+        ESP_LOGE(REST_TAG, "Config %s is not a string", l_desc.m_name);
+        return ESP_ERR_INVALID_ARG;
+    }
 
-    if (f_onlysetifnotempty && strlen(l_s) == 0)
+    // --- an empty secret means "keep the current one"
+
+    if ((l_desc.m_flags & CFMGR_F_SECRET) && strlen(l_js->valuestring) == 0)
     {
-        ESP_LOGI(REST_TAG, "Config %s empty - not set!", f_name);
+        ESP_LOGI(REST_TAG, "Config %s empty - not set!", l_desc.m_name);
         return ESP_OK;
     }
 
-    // --- now tell the config mgr
-
-    g_ConfigManager.SetStringValue(f_name,SanetizedString(l_s));
-    ESP_LOGI(REST_TAG, "Config %s, value '%s'", f_name,l_s);
+    if (!(l_desc.m_flags & CFMGR_F_SECRET)) ESP_LOGI(REST_TAG, "Config %s, value '%s'", l_desc.m_name,l_js->valuestring);
 
-    return ESP_OK;
+    return f_txn.SetStringValue(f_key,SanetizedString(l_js->valuestring));
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
-esp_err_t ProcessJsonInt(cJSON *f_root,const char *f_name)
+// --- stage all keys of the schema found in the request. With f_partial unset every
+// --- writable key is expected (POST), otherwise unknown fields are rejected (PATCH)
+
+static esp_err_t ProcessJsonConfig(ConfigTransaction &f_txn,cJSON *f_root,bool f_partial)
 {
-    cJSON *l_js = cJSON_GetObjectItem(f_root, f_name);
+    int l_found = 0;
 
-    if (!l_js)
+    for (int l_key = 0; l_key < CFMGR_KEY_CNT; ++l_key)
     {
-        ESP_LOGE(REST_TAG, "Config %s not found", f_name);
-        return ESP_FAIL;
-    }
+        // --- a full config may echo the read only keys of a GET, just skip them
 
-    // --- now tell the config mgr
+        if (!f_partial && (g_ConfigSchema[l_key].m_flags & CFMGR_F_READONLY)) continue;
 
-    g_ConfigManager.SetIntValue(f_name,l_js->valueint);
-    ESP_LOGI(REST_TAG, "Config %s, value '%d'", f_name,l_js->valueint);
+        esp_err_t l_err = ProcessJsonValue(f_txn,f_root,(ConfigKey)l_key);
+
+        if (l_err == ESP_ERR_NOT_FOUND)
+        {
+            if (!f_partial) ESP_LOGE(REST_TAG, "Config %s not found", g_ConfigSchema[l_key].m_name);
+
+            continue;
+        }
+
+        if (l_err != ESP_OK) return l_err;
+
+        ++l_found;
+    }
+
+    if (f_partial && l_found != cJSON_GetArraySize(f_root))
+    {
+        ESP_LOGE(REST_TAG, "Request contains unknown config keys");
+        return ESP_ERR_INVALID_ARG;
+    }
 
     return ESP_OK;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////
 
-static esp_err_t config_post_handler(httpd_req_t *req)
-{
-    ESP_LOGI(REST_TAG,"config_post_handler %s",req->uri);
+// --- read the full request body into the scratch buffer and parse it as JSON
 
+static cJSON *receive_json_body(httpd_req_t *req)
+{
     // --- check if we have enough space to process full post request
 
     int total_len = req->content_len;
@@ -490,18 +979,18 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     {
         // --- Respond with 500 Internal Server Error
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
-        return ESP_FAIL;
+        return NULL;
     }
 
     // --- okay, now read the full request
 
     while (cur_len < total_len) 
     {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
+        received = httpd_req_recv(req, buf + cur_len, total_len - cur_len);
         if (received <= 0) 
         {
             httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post control value");
-            return ESP_FAIL;
+            return NULL;
         }
         cur_len += received;
     }
@@ -510,29 +999,50 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     // --- convert the JSON string to a JSON object
 
     cJSON *root = cJSON_Parse(buf);
-    
-    // --- set config to config mgr
+    if (!root)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid JSON");
+    }
 
-    ProcessJsonString(root,CFMGR_WIFI_SSID);
-    ProcessJsonString(root,CFMGR_WIFI_PASSWORD,true);
-    ProcessJsonString(root,CFMGR_DEVICE_NAME);  
-    ProcessJsonString(root,CFMGR_MQTT_SERVER);
-    ProcessJsonString(root,CFMGR_MQTT_TOPIC);
+    return root;
+}
 
-    ProcessJsonInt(root,CFMGR_MQTT_TIME);
-    ProcessJsonInt(root,CFMGR_MQTT_ENABLE);
+///////////////////////////////////////////////////////////////////////////////////////
 
-    // --- flag now as bootstrap done
+static esp_err_t config_post_handler(httpd_req_t *req)
+{
+    ESP_LOGI(REST_TAG,"config_post_handler %s",req->uri);
+
+    cJSON *root = receive_json_body(req);
+    if (!root) return ESP_FAIL;
     
-    g_ConfigManager.SetIntValue(CFMGR_BOOTSTRAP_DONE,1);
+    // --- stage all values, then hand them to the config mgr in one go
+
+    ConfigTransaction l_txn;
 
-    // ---- tell the mqtt manager that the config might have changed
+    esp_err_t l_err = ProcessJsonConfig(l_txn,root,false);
 
-    g_MqttManager.UpdateConfig();
+    // --- flag now as bootstrap done
+    
+    l_txn.SetIntValue(CFMGR_BOOTSTRAP_DONE,1);
 
     // --- free up the JSON object
 
     cJSON_Delete(root);
+
+    if (l_err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid config value");
+        return ESP_FAIL;
+    }
+
+    // --- single commit. The mqtt manager and the wifi client listen to config changes themselves
+
+    if (g_ConfigManager.Commit(l_txn) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store configuration");
+        return ESP_FAIL;
+    }
     
     // --- send status to server
 
@@ -540,13 +1050,103 @@ static esp_err_t config_post_handler(httpd_req_t *req)
     
     return ESP_OK;
 }
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- POST: {"rules":[...]} replaces all alarm rules, an empty array removes them
+
+static esp_err_t rules_post_handler(httpd_req_t *req)
+{
+    ESP_LOGI(REST_TAG,"rules_post_handler %s",req->uri);
+
+    cJSON *root = receive_json_body(req);
+    if (!root) return ESP_FAIL;
+
+    AlarmRule l_rules[ALARM_MAX_RULES];
+    int l_cnt = 0;
+
+    esp_err_t l_err = g_AlarmManager.RulesFromJson(root, l_rules, &l_cnt);
+
+    cJSON_Delete(root);
+
+    if (l_err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid alarm rule");
+        return ESP_FAIL;
+    }
+
+    if (g_AlarmManager.SetRules(l_rules, l_cnt) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store the rules");
+        return ESP_FAIL;
+    }
+
+    httpd_resp_sendstr(req, "Post control value successfully");
+
+    return ESP_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+// --- PATCH: only the fields present in the request are changed. The request is 
+// --- rejected as a whole if one of the fields is unknown or invalid
+
+static esp_err_t config_patch_handler(httpd_req_t *req)
+{
+    ESP_LOGI(REST_TAG,"config_patch_handler %s",req->uri);
+
+    cJSON *root = receive_json_body(req);
+    if (!root) return ESP_FAIL;
+
+    ConfigTransaction l_txn;
+
+    esp_err_t l_err = ProcessJsonConfig(l_txn,root,true);
+
+    cJSON_Delete(root);
+
+    if (l_err != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown config key or invalid value");
+        return ESP_FAIL;
+    }
+
+    // --- all or nothing
+
+    uint32_t l_changed = 0;
+
+    if (g_ConfigManager.Commit(l_txn,&l_changed) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to store configuration");
+        return ESP_FAIL;
+    }
+
+    // --- tell the client how many keys really changed
+
+    httpd_resp_set_type(req, "application/json");
+
+    cJSON *l_resp = cJSON_CreateObject();
+    cJSON_AddNumberToObject(l_resp, "changed", __builtin_popcount(l_changed));
+
+    const char *sys_info = cJSON_Print(l_resp);
+    httpd_resp_sendstr(req, sys_info);
+    
+    free((void *)sys_info);
+    cJSON_Delete(l_resp);
+    
+    return ESP_OK;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 esp_err_t start_rest_server(const char *base_path)
 {
     assert(base_path);
 
+#ifdef CONFIG_STATIC_ALLOC
+    rest_server_context_t *rest_context = &s_rest_context;
+#else
     rest_server_context_t *rest_context = (rest_server_context_t *)calloc(1, sizeof(rest_server_context_t));
+#endif
     if (!rest_context)
     {
         ESP_LOGE(REST_TAG, "No memory for rest context");
@@ -559,6 +1159,7 @@ esp_err_t start_rest_server(const char *base_path)
 
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_resp_headers = 16;
+    config.max_uri_handlers = 20;
 
     config.uri_match_fn = httpd_uri_match_wildcard;
 
@@ -602,6 +1203,17 @@ esp_err_t start_rest_server(const char *base_path)
     
     httpd_register_uri_handler(server, &config_post_uri);
 
+    // ---- URI handler for changing single values of the current configuration
+
+    httpd_uri_t config_patch_uri;
+    
+    config_patch_uri.uri      = "/api/v1/config";
+    config_patch_uri.user_ctx = rest_context;
+    config_patch_uri.method   = HTTP_PATCH;
+    config_patch_uri.handler  = config_patch_handler;
+    
+    httpd_register_uri_handler(server, &config_patch_uri);
+
     // ---- URI handler for getting the number iof sensors
 
     httpd_uri_t dust_cnt_get_uri;
@@ -624,6 +1236,114 @@ esp_err_t start_rest_server(const char *base_path)
     
     httpd_register_uri_handler(server, &dust_data_get_uri);
 
+    // ---- URI handler for getting the diagnostics report
+
+    httpd_uri_t diag_get_uri;
+    
+    diag_get_uri.uri      = "/api/v1/diag";
+    diag_get_uri.user_ctx = rest_context;
+    diag_get_uri.method   = HTTP_GET;
+    diag_get_uri.handler  = diag_get_handler;
+    
+    httpd_register_uri_handler(server, &diag_get_uri);
+
+    // ---- URI handler for getting the CPU usage
+
+    httpd_uri_t cpu_get_uri;
+    
+    cpu_get_uri.uri      = "/api/v1/cpu";
+    cpu_get_uri.user_ctx = rest_context;
+    cpu_get_uri.method   = HTTP_GET;
+    cpu_get_uri.handler  = cpu_get_handler;
+    
+    httpd_register_uri_handler(server, &cpu_get_uri);
+
+    // ---- URI handler for downloading the binary event log
+
+    httpd_uri_t evlog_get_uri;
+    
+    evlog_get_uri.uri      = "/api/v1/evlog";
+    evlog_get_uri.user_ctx = rest_context;
+    evlog_get_uri.method   = HTTP_GET;
+    evlog_get_uri.handler  = evlog_get_handler;
+    
+    httpd_register_uri_handler(server, &evlog_get_uri);
+
+    // ---- URI handler for getting the compressed history of a sensor
+
+    httpd_uri_t history_get_uri;
+    
+    history_get_uri.uri      = "/api/v1/history/*";
+    history_get_uri.user_ctx = rest_context;
+    history_get_uri.method   = HTTP_GET;
+    history_get_uri.handler  = history_get_handler;
+    
+    httpd_register_uri_handler(server, &history_get_uri);
+
+    // ---- URI handler for getting the PM2.5 quantiles of a sensor
+
+    httpd_uri_t quantiles_get_uri;
+
+    quantiles_get_uri.uri      = "/api/v1/quantiles/*";
+    quantiles_get_uri.user_ctx = rest_context;
+    quantiles_get_uri.method   = HTTP_GET;
+    quantiles_get_uri.handler  = quantiles_get_handler;
+
+    httpd_register_uri_handler(server, &quantiles_get_uri);
+
+    // ---- URI handler for getting the air quality indices of a sensor
+
+    httpd_uri_t aqi_get_uri;
+
+    aqi_get_uri.uri      = "/api/v1/aqi/*";
+    aqi_get_uri.user_ctx = rest_context;
+    aqi_get_uri.method   = HTTP_GET;
+    aqi_get_uri.handler  = aqi_get_handler;
+
+    httpd_register_uri_handler(server, &aqi_get_uri);
+
+    // ---- URI handlers for the alarm rules
+
+    httpd_uri_t rules_get_uri;
+
+    rules_get_uri.uri      = "/api/v1/rules";
+    rules_get_uri.user_ctx = rest_context;
+    rules_get_uri.method   = HTTP_GET;
+    rules_get_uri.handler  = rules_get_handler;
+
+    httpd_register_uri_handler(server, &rules_get_uri);
+
+    httpd_uri_t rules_post_uri;
+
+    rules_post_uri.uri      = "/api/v1/rules";
+    rules_post_uri.user_ctx = rest_context;
+    rules_post_uri.method   = HTTP_POST;
+    rules_post_uri.handler  = rules_post_handler;
+
+    httpd_register_uri_handler(server, &rules_post_uri);
+
+    // ---- URI handler for the last frame of all sensors
+
+    httpd_uri_t frame_get_uri;
+
+    frame_get_uri.uri      = "/api/v1/frame";
+    frame_get_uri.user_ctx = rest_context;
+    frame_get_uri.method   = HTTP_GET;
+    frame_get_uri.handler  = frame_get_handler;
+
+    httpd_register_uri_handler(server, &frame_get_uri);
+
+    // ---- URI handler for the fused value of all sensors
+
+    httpd_uri_t fused_get_uri;
+
+    fused_get_uri.uri      = "/api/v1/fused";
+    fused_get_uri.user_ctx = rest_context;
+    fused_get_uri.method   = HTTP_GET;
+    fused_get_uri.handler  = fused_get_handler;
+
+    httpd_register_uri_handler(server, &fused_get_uri);
+
     // ---- URI handler for getting web server files 
 
     httpd_uri_t common_get_uri;
@@ -0,0 +1,386 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "scheduler.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "Scheduler";
+
+// --- guards the active time, there are no 64 bit atomics on the ESP32
+
+static portMUX_TYPE s_active_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#ifdef CONFIG_STATIC_ALLOC
+
+// --- the event queue and the mutex live in .bss
+
+static uint8_t              s_queue_storage[SCHED_QUEUE_LEN * sizeof(SchedEvent)];
+static StaticQueue_t        s_queue_buf;
+static StaticSemaphore_t    s_mutex_buf;
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t Scheduler::InitManager(void)
+{
+    m_job_cnt = 0;
+    m_handler_cnt = 0;
+    m_wakeups = 0;
+    m_active_us = 0;
+    m_events = 0;
+    m_stop = false;
+    m_task = NULL;
+
+#ifdef CONFIG_STATIC_ALLOC
+    m_queue = xQueueCreateStatic(SCHED_QUEUE_LEN, sizeof(SchedEvent), s_queue_storage, &s_queue_buf);
+    m_mutex = xSemaphoreCreateMutexStatic(&s_mutex_buf);
+#else
+    m_queue = xQueueCreate(SCHED_QUEUE_LEN, sizeof(SchedEvent));
+    m_mutex = xSemaphoreCreateMutex();
+#endif
+
+    if (!m_queue || !m_mutex)
+    {
+        ESP_LOGE(TAG, "Error creating the event queue");
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+int Scheduler::AddJob(const char *f_name, SchedJobFn f_fn, void *f_ctx, uint32_t f_delay_ms)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    if (m_job_cnt >= SCHED_MAX_JOBS)
+    {
+        xSemaphoreGive(m_mutex);
+        ESP_LOGE(TAG, "No room for job %s, raise SCHED_MAX_JOBS", f_name);
+        return -1;
+    }
+
+    int l_id = m_job_cnt++;
+    Job &l_job = m_jobs[l_id];
+
+    l_job.m_name        = f_name;
+    l_job.m_fn          = f_fn;
+    l_job.m_ctx         = f_ctx;
+    l_job.m_active      = f_delay_ms != SCHED_STOP;
+    l_job.m_due_us      = esp_timer_get_time() + (int64_t)(l_job.m_active ? f_delay_ms : 0) * 1000;
+    l_job.m_rescheduled = false;
+    l_job.m_runs        = 0;
+
+    xSemaphoreGive(m_mutex);
+
+    WakeLoop();
+
+    return l_id;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void Scheduler::SetJobDelay(int f_job, uint32_t f_delay_ms)
+{
+    if (f_job < 0 || f_job >= m_job_cnt) return;
+
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    Job &l_job = m_jobs[f_job];
+
+    l_job.m_active      = f_delay_ms != SCHED_STOP;
+    l_job.m_due_us      = esp_timer_get_time() + (int64_t)(l_job.m_active ? f_delay_ms : 0) * 1000;
+    l_job.m_rescheduled = true;
+
+    xSemaphoreGive(m_mutex);
+
+    WakeLoop();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool Scheduler::AddHandler(SchedEventType f_type, SchedHandlerFn f_fn, void *f_ctx)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    if (m_handler_cnt >= SCHED_MAX_HANDLERS)
+    {
+        xSemaphoreGive(m_mutex);
+        ESP_LOGE(TAG, "No room for event handler, raise SCHED_MAX_HANDLERS");
+        return false;
+    }
+
+    Handler &l_handler = m_handlers[m_handler_cnt++];
+
+    l_handler.m_type    = f_type;
+    l_handler.m_fn      = f_fn;
+    l_handler.m_ctx     = f_ctx;
+
+    xSemaphoreGive(m_mutex);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool Scheduler::Post(SchedEventType f_type, uint32_t f_arg)
+{
+    SchedEvent l_event = { f_type, f_arg };
+
+    // --- a full queue already wakes the loop, dropping a wakeup is fine
+
+    if (xQueueSend(m_queue, &l_event, 0) != pdTRUE)
+    {
+        if (f_type != SchedEvent_Wakeup) ESP_LOGW(TAG, "Event queue full, event %d dropped", f_type);
+        return false;
+    }
+
+    return true;
+}
+
+bool IRAM_ATTR Scheduler::PostFromISR(SchedEventType f_type, uint32_t f_arg)
+{
+    SchedEvent l_event = { f_type, f_arg };
+    BaseType_t l_woken = pdFALSE;
+
+    BaseType_t l_ok = xQueueSendFromISR(m_queue, &l_event, &l_woken);
+
+    if (l_woken) portYIELD_FROM_ISR();
+
+    return l_ok == pdTRUE;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the loop has to recalculate its timeout. Not needed when a job or handler changed
+// --- the deadlines, the loop looks at them anyway before it sleeps again
+
+void Scheduler::WakeLoop(void)
+{
+    if (m_task && xTaskGetCurrentTaskHandle() == m_task) return;
+
+    Post(SchedEvent_Wakeup, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void Scheduler::CountWakeup(void)
+{
+    __atomic_add_fetch(&m_wakeups, 1, __ATOMIC_RELAXED);
+}
+
+void Scheduler::CountActive(int64_t f_awake_us)
+{
+    int64_t l_active_us = esp_timer_get_time() - f_awake_us;
+
+    if (l_active_us <= 0) return;
+
+    portENTER_CRITICAL(&s_active_mux);
+    m_active_us += (uint64_t)l_active_us;
+    portEXIT_CRITICAL(&s_active_mux);
+}
+
+uint64_t Scheduler::GetActiveUs(void) const
+{
+    portENTER_CRITICAL(&s_active_mux);
+    uint64_t l_active_us = m_active_us;
+    portEXIT_CRITICAL(&s_active_mux);
+
+    return l_active_us;
+}
+
+// --- share of the uptime the counted tasks were awake, summed up over all of them
+
+float Scheduler::GetDutyPercent(void) const
+{
+    int64_t l_uptime_us = esp_timer_get_time();
+
+    if (l_uptime_us <= 0) return 0;
+
+    return (float)((double)GetActiveUs() * 100.0 / (double)l_uptime_us);
+}
+
+uint32_t Scheduler::GetWakeupsPerHour(void) const
+{
+    int64_t l_uptime_us = esp_timer_get_time();
+
+    if (l_uptime_us < 1000000) return 0;
+
+    return (uint32_t)((uint64_t)m_wakeups * 3600ULL * 1000000ULL / (uint64_t)l_uptime_us);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- runs all jobs which are due and returns the time until the next one
+
+TickType_t Scheduler::RunDueJobs(void)
+{
+    xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+    for (int i = 0; i < m_job_cnt; ++i)
+    {
+        Job &l_job = m_jobs[i];
+
+        if (!l_job.m_active || l_job.m_due_us > esp_timer_get_time()) continue;
+
+        // --- run it without the lock, the job may reschedule itself or others
+
+        l_job.m_rescheduled = false;
+
+        xSemaphoreGive(m_mutex);
+        uint32_t l_next_ms = l_job.m_fn(l_job.m_ctx);
+        xSemaphoreTake(m_mutex, portMAX_DELAY);
+
+        ++l_job.m_runs;
+
+        // --- a SetJobDelay() while running wins over the return value
+
+        if (l_job.m_rescheduled) continue;
+
+        if (l_next_ms == SCHED_STOP)
+        {
+            l_job.m_active = false;
+        }
+        else
+        {
+            // --- periodic jobs do not drift: the next deadline counts from the last one, 
+            // --- unless we are late by more than a period
+
+            l_job.m_due_us += (int64_t)l_next_ms * 1000;
+
+            if (l_job.m_due_us < esp_timer_get_time()) l_job.m_due_us = esp_timer_get_time() + (int64_t)l_next_ms * 1000;
+        }
+    }
+
+    // --- the earliest deadline
+
+    int64_t l_next_us = INT64_MAX;
+
+    for (int i = 0; i < m_job_cnt; ++i)
+    {
+        if (m_jobs[i].m_active && m_jobs[i].m_due_us < l_next_us) l_next_us = m_jobs[i].m_due_us;
+    }
+
+    xSemaphoreGive(m_mutex);
+
+    if (l_next_us == INT64_MAX) return portMAX_DELAY;
+
+    int64_t l_wait_us = l_next_us - esp_timer_get_time();
+    if (l_wait_us <= 0) return 0;
+
+    // --- round up, waking up a tick early would just mean another wakeup
+
+    int64_t l_tick_us = (int64_t)portTICK_PERIOD_MS * 1000;
+
+    return (TickType_t)((l_wait_us + l_tick_us - 1) / l_tick_us);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void Scheduler::Dispatch(const SchedEvent &f_event)
+{
+    ++m_events;
+
+    for (int i = 0; i < m_handler_cnt; ++i)
+    {
+        if (m_handlers[i].m_type == f_event.m_type) m_handlers[i].m_fn(f_event, m_handlers[i].m_ctx);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void Scheduler::Run(void)
+{
+    ESP_LOGI(TAG, "Scheduler running with %d jobs and %d event handlers", m_job_cnt, m_handler_cnt);
+
+    m_task = xTaskGetCurrentTaskHandle();
+
+    int64_t l_awake_us = esp_timer_get_time();
+
+    while (!m_stop)
+    {
+        TickType_t l_wait = RunDueJobs();
+        if (m_stop) break;
+
+        SchedEvent l_event;
+
+        CountActive(l_awake_us);
+
+        BaseType_t l_received = xQueueReceive(m_queue, &l_event, l_wait);
+
+        l_awake_us = esp_timer_get_time();
+
+        if (l_received == pdTRUE)
+        {
+            if (l_event.m_type != SchedEvent_Wakeup) Dispatch(l_event);
+
+            // --- handle everything which queued up meanwhile in the same wakeup
+
+            while (xQueueReceive(m_queue, &l_event, 0) == pdTRUE)
+            {
+                if (l_event.m_type != SchedEvent_Wakeup) Dispatch(l_event);
+            }
+        }
+
+        CountWakeup();
+    }
+}
+
+void Scheduler::Stop(void)
+{
+    m_stop = true;
+
+    WakeLoop();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+Scheduler g_Scheduler;
+
+////////////////////////////////////////////////////////////////////////////////////////
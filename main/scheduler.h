@@ -0,0 +1,173 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SCHEDULER_H_
+#define	SCHEDULER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define SCHED_MAX_JOBS          8
+#define SCHED_MAX_HANDLERS      12
+#define SCHED_QUEUE_LEN         16
+
+// --- a job returning this is not run again until SetJobDelay()
+
+#define SCHED_STOP              0xffffffff
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+enum SchedEventType
+{
+    SchedEvent_Wakeup,          // --- internal: the deadlines changed
+    SchedEvent_SensorData,      // --- a sensor delivered a datagram, arg: uart number
+    SchedEvent_ButtonEdge,      // --- raw interrupt of the bootstrap button, arg: pin level
+    SchedEvent_ShortPress,      // --- the bootstrap button was pressed shortly (debounced)
+    SchedEvent_LongPress,       // --- the bootstrap button is held for BUTTON_LONG_PRESS_MS
+    SchedEvent_MqttConnected,   // --- the mqtt client is connected to the broker
+    SchedEvent_MqttDisconnected,// --- the mqtt client lost the broker
+    SchedEvent_MqttPublished,   // --- the broker acknowledged a message, arg: message id
+    SchedEvent_QuantileWindow,  // --- a quantile window has ended, arg: sensor index << 8 | window
+    SchedEvent_Alarm,           // --- an alarm rule fired or cleared, arg: sensor index
+    SchedEvent_MqttConfig,      // --- the mqtt settings were changed, arg: changed key bits
+
+    SchedEvent_Cnt
+};
+
+struct SchedEvent
+{
+    SchedEventType  m_type;
+    uint32_t        m_arg;
+};
+
+// --- jobs return the delay until their next run in ms or SCHED_STOP
+
+typedef uint32_t (*SchedJobFn)(void *f_ctx);
+typedef void (*SchedHandlerFn)(const SchedEvent &f_event, void *f_ctx);
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- One task which does all the periodic and event driven work of the managers. It sleeps
+// --- on its event queue until an event arrives or the earliest job deadline is reached, so
+// --- the device only wakes up when something is due. Run() is the main loop of app_main,
+// --- jobs and handlers run there and must not block for long.
+
+class Scheduler
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    // --- jobs: first run after f_delay_ms (SCHED_STOP: not scheduled yet). Returns the job id or -1
+
+    int AddJob(const char *f_name, SchedJobFn f_fn, void *f_ctx, uint32_t f_delay_ms);
+    void SetJobDelay(int f_job, uint32_t f_delay_ms);
+
+    // --- events
+
+    bool AddHandler(SchedEventType f_type, SchedHandlerFn f_fn, void *f_ctx);
+    bool Post(SchedEventType f_type, uint32_t f_arg);
+    bool PostFromISR(SchedEventType f_type, uint32_t f_arg);
+
+    // --- wakeup statistics, other tasks count their wakeups and the time until they
+    // --- sleep again (CountActive with the esp_timer time of the wakeup) here too
+
+    void CountWakeup(void);
+    void CountActive(int64_t f_awake_us);
+
+    uint32_t GetWakeups(void) const         { return m_wakeups; }
+    uint32_t GetEvents(void) const          { return m_events; }
+    uint32_t GetWakeupsPerHour(void) const;
+    uint64_t GetActiveUs(void) const;
+    float GetDutyPercent(void) const;
+
+    // --- the loop, returns after Stop()
+
+    void Run(void);
+    void Stop(void);
+
+private:
+    struct Job
+    {
+        const char     *m_name;
+        SchedJobFn      m_fn;
+        void           *m_ctx;
+        int64_t         m_due_us;
+        bool            m_active;
+        bool            m_rescheduled;
+        uint32_t        m_runs;
+    };
+
+    struct Handler
+    {
+        SchedEventType  m_type;
+        SchedHandlerFn  m_fn;
+        void           *m_ctx;
+    };
+
+    TickType_t RunDueJobs(void);
+    void WakeLoop(void);
+    void Dispatch(const SchedEvent &f_event);
+
+    QueueHandle_t       m_queue;
+    SemaphoreHandle_t   m_mutex;
+    TaskHandle_t        m_task;
+
+    Job                 m_jobs[SCHED_MAX_JOBS];
+    int                 m_job_cnt;
+
+    Handler             m_handlers[SCHED_MAX_HANDLERS];
+    int                 m_handler_cnt;
+
+    volatile uint32_t   m_wakeups;
+    uint64_t            m_active_us;
+    uint32_t            m_events;
+    volatile bool       m_stop;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern Scheduler g_Scheduler;
+
+
+#endif
@@ -0,0 +1,447 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "driver/sdmmc_host.h"
+#include "sdmmc_cmd.h"
+
+#include "sdcard_logger.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- D0 of the card is GPIO 2, the info LED must not drive it
+
+#if defined(CONFIG_SDCARD_LOG) && CONFIG_INFOLED_GPIO == 2
+#error "SDCARD_LOG uses GPIO 2 as D0 of the SD card, move INFOLED_GPIO to another GPIO"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "SdLogger";
+
+#define SDLOG_STACK_SIZE        3072
+#define SDLOG_PATH_MAX          64
+#define SDLOG_LINE_MAX          64
+
+#ifdef CONFIG_SDCARD_LOG
+
+#ifdef CONFIG_STATIC_ALLOC
+
+// --- the block buffer, the queue and the writer task live in .bss
+
+static char                 s_block[SDLOG_BLOCK_SIZE];
+static uint8_t              s_queue_storage[CONFIG_SDCARD_LOG_QUEUE_LEN * sizeof(SdLogRecord)];
+static StaticQueue_t        s_queue_buf;
+static StaticSemaphore_t    s_synced_buf;
+static StackType_t          s_stack[SDLOG_STACK_SIZE];
+static StaticTask_t         s_tcb;
+
+#endif
+
+#endif
+
+SdLogger g_SdLogger;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONFIG_SDCARD_LOG
+
+static void prvWriterTask(void *f_ctx)
+{
+    SdLogger *l_logger = (SdLogger *)f_ctx;
+
+    for (;;) l_logger->Process();
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t SdLogger::InitManager(const char *f_mount_point)
+{
+    m_mount         = f_mount_point;
+    m_queue         = NULL;
+    m_synced        = NULL;
+    m_buf           = NULL;
+    m_fill          = 0;
+    m_target        = SDLOG_BLOCK_SIZE;
+    m_fd            = -1;
+    m_file_size     = 0;
+    m_file_day      = 0;
+    m_last_flush    = 0;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+
+#ifdef CONFIG_SDCARD_LOG
+
+    // --- SDMMC slot 1 in 1-bit mode: CLK GPIO 14, CMD GPIO 15, D0 GPIO 2
+
+    sdmmc_host_t l_host = SDMMC_HOST_DEFAULT();
+    sdmmc_slot_config_t l_slot = SDMMC_SLOT_CONFIG_DEFAULT();
+
+    l_slot.width = 1;
+    l_slot.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    // --- never format the card of the user, the cluster size only applies to cards we format
+
+    esp_vfs_fat_sdmmc_mount_config_t l_mount_config = {};
+
+    l_mount_config.format_if_mount_failed   = false;
+    l_mount_config.max_files                = 2;
+    l_mount_config.allocation_unit_size     = SDLOG_CLUSTER_SIZE;
+
+    sdmmc_card_t *l_card = NULL;
+
+    esp_err_t l_err = esp_vfs_fat_sdmmc_mount(f_mount_point, &l_host, &l_slot, &l_mount_config, &l_card);
+
+    if (l_err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Cannot mount the SD card: %s", esp_err_to_name(l_err));
+        return l_err;
+    }
+
+    sdmmc_card_print_info(stdout, l_card);
+
+#ifdef CONFIG_STATIC_ALLOC
+    m_buf       = s_block;
+    m_queue     = xQueueCreateStatic(CONFIG_SDCARD_LOG_QUEUE_LEN, sizeof(SdLogRecord), s_queue_storage, &s_queue_buf);
+    m_synced    = xSemaphoreCreateBinaryStatic(&s_synced_buf);
+
+    xTaskCreateStatic(prvWriterTask, "sdlog", SDLOG_STACK_SIZE, this, 5, s_stack, &s_tcb);
+#else
+    m_buf       = (char *)malloc(SDLOG_BLOCK_SIZE);
+    m_synced    = xSemaphoreCreateBinary();
+
+    if (!m_buf || !m_synced)
+    {
+        ESP_LOGE(TAG, "No memory for the SD card logger");
+        return ESP_ERR_NO_MEM;
+    }
+
+    m_queue     = xQueueCreate(CONFIG_SDCARD_LOG_QUEUE_LEN, sizeof(SdLogRecord));
+
+    if (!m_queue || xTaskCreate(prvWriterTask, "sdlog", SDLOG_STACK_SIZE, this, 5, NULL) != pdPASS)
+    {
+        ESP_LOGE(TAG, "Cannot start the SD card writer");
+        m_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+#endif
+
+    m_last_flush = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "Logging the datagrams to %s, queue for %d datagrams", f_mount_point, CONFIG_SDCARD_LOG_QUEUE_LEN);
+
+    return ESP_OK;
+
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SdLogger::Log(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    if (!m_queue) return;
+
+    struct timeval l_now;
+    gettimeofday(&l_now, NULL);
+
+    SdLogRecord l_rec;
+
+    l_rec.m_time_s      = (uint32_t)l_now.tv_sec;
+    l_rec.m_time_ms     = (uint16_t)(l_now.tv_usec / 1000);
+    l_rec.m_sensor      = (uint8_t)f_sensor;
+    l_rec.m_reserved    = 0;
+    l_rec.m_pm1         = f_pm1;
+    l_rec.m_pm2         = f_pm2;
+    l_rec.m_pm10        = f_pm10;
+
+    Push(l_rec, 0);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool SdLogger::Push(const SdLogRecord &f_rec, TickType_t f_wait)
+{
+    if (!m_queue) return false;
+
+    if (xQueueSend(m_queue, &f_rec, f_wait) != pdTRUE)
+    {
+        ++m_stats.m_dropped;
+        return false;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t SdLogger::Sync(TickType_t f_wait)
+{
+    if (!m_queue) return ESP_ERR_INVALID_STATE;
+
+    SdLogRecord l_rec;
+
+    memset(&l_rec, 0, sizeof(l_rec));
+    l_rec.m_sensor = SDLOG_SENSOR_SYNC;
+
+    // --- a sync that timed out before may have left the semaphore given
+
+    xSemaphoreTake(m_synced, 0);
+
+    if (xQueueSend(m_queue, &l_rec, f_wait) != pdTRUE) return ESP_ERR_TIMEOUT;
+
+    return xSemaphoreTake(m_synced, f_wait) == pdTRUE ? ESP_OK : ESP_ERR_TIMEOUT;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SdLogger::GetQueued(void) const
+{
+    return m_queue ? uxQueueMessagesWaiting(m_queue) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SdLogger::Process(void)
+{
+    // --- without buffered data sleep until the next datagram, otherwise at most until
+    // --- the buffer is due
+
+    TickType_t l_wait = portMAX_DELAY;
+
+    if (m_fill)
+    {
+        int64_t l_left_ms = (int64_t)CONFIG_SDCARD_LOG_FLUSH_INTERVAL * 1000 - (esp_timer_get_time() - m_last_flush) / 1000;
+
+        l_wait = l_left_ms > 0 ? pdMS_TO_TICKS(l_left_ms) : 0;
+    }
+
+    SdLogRecord l_rec;
+
+    if (xQueueReceive(m_queue, &l_rec, l_wait) != pdTRUE)
+    {
+        Flush();
+        return;
+    }
+
+    if (l_rec.m_sensor == SDLOG_SENSOR_SYNC)
+    {
+        Flush();
+        xSemaphoreGive(m_synced);
+        return;
+    }
+
+    // --- a new day starts a new file
+
+    time_t l_time = l_rec.m_time_s;
+    struct tm l_tm;
+
+    gmtime_r(&l_time, &l_tm);
+
+    uint32_t l_day = (l_tm.tm_year + 1900) * 10000 + (l_tm.tm_mon + 1) * 100 + l_tm.tm_mday;
+
+    if (m_fd < 0 || l_day != m_file_day)
+    {
+        Flush();
+        CloseFile();
+
+        if (!OpenFile(l_rec))
+        {
+            ++m_stats.m_errors;
+            return;
+        }
+
+        m_file_day = l_day;
+    }
+
+    char l_line[SDLOG_LINE_MAX];
+
+    int l_len = snprintf(l_line, sizeof(l_line), "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ,%u,%u,%u,%u\n",
+                         l_tm.tm_year + 1900, l_tm.tm_mon + 1, l_tm.tm_mday, l_tm.tm_hour, l_tm.tm_min, l_tm.tm_sec,
+                         l_rec.m_time_ms, l_rec.m_sensor, l_rec.m_pm1, l_rec.m_pm2, l_rec.m_pm10);
+
+    if (Append(l_line, l_len)) ++m_stats.m_records;
+
+    if (esp_timer_get_time() - m_last_flush >= (int64_t)CONFIG_SDCARD_LOG_FLUSH_INTERVAL * 1000000) Flush();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- fills the buffer up to the next block boundary of the file and writes it
+
+bool SdLogger::Append(const char *f_data, int f_len)
+{
+    while (f_len > 0)
+    {
+        int l_chunk = m_target - m_fill;
+
+        if (l_chunk > f_len) l_chunk = f_len;
+
+        memcpy(m_buf + m_fill, f_data, l_chunk);
+
+        m_fill  += l_chunk;
+        f_data  += l_chunk;
+        f_len   -= l_chunk;
+
+        if (m_fill == m_target && !WriteBlock()) return false;
+    }
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool SdLogger::WriteBlock(void)
+{
+    if (!m_fill) return true;
+
+    int l_written = write(m_fd, m_buf, m_fill);
+
+    if (l_written != m_fill)
+    {
+        ESP_LOGE(TAG, "Error writing to the SD card: %s", strerror(errno));
+
+        // --- the card may be gone, the next datagram opens the file again
+
+        ++m_stats.m_errors;
+        CloseFile();
+
+        return false;
+    }
+
+    ++m_stats.m_writes;
+    if (m_fill < m_target) ++m_stats.m_partial;
+
+    m_stats.m_bytes += m_fill;
+    m_file_size     += m_fill;
+
+    // --- after a partial block the next one gets the file back to the block boundary
+
+    m_fill      = 0;
+    m_target    = SDLOG_BLOCK_SIZE - m_file_size % SDLOG_BLOCK_SIZE;
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool SdLogger::OpenFile(const SdLogRecord &f_rec)
+{
+    time_t l_time = f_rec.m_time_s;
+    struct tm l_tm;
+
+    gmtime_r(&l_time, &l_tm);
+
+    // --- one directory per year keeps the directories small
+
+    char l_path[SDLOG_PATH_MAX];
+
+    snprintf(l_path, sizeof(l_path), "%s/%04d", m_mount, l_tm.tm_year + 1900);
+
+    if (mkdir(l_path, 0755) != 0 && errno != EEXIST)
+    {
+        ESP_LOGE(TAG, "Cannot create %s: %s", l_path, strerror(errno));
+        return false;
+    }
+
+    snprintf(l_path, sizeof(l_path), "%s/%04d/%02d%02d.csv", m_mount, l_tm.tm_year + 1900, l_tm.tm_mon + 1, l_tm.tm_mday);
+
+    m_fd = open(l_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    if (m_fd < 0)
+    {
+        ESP_LOGE(TAG, "Cannot open %s: %s", l_path, strerror(errno));
+        return false;
+    }
+
+    // --- appending after a reboot: the first block ends at the next block boundary
+
+    struct stat l_st;
+
+    m_file_size = fstat(m_fd, &l_st) == 0 ? (uint32_t)l_st.st_size : 0;
+    m_fill      = 0;
+    m_target    = SDLOG_BLOCK_SIZE - m_file_size % SDLOG_BLOCK_SIZE;
+
+    ++m_stats.m_files;
+
+    ESP_LOGI(TAG, "Logging to %s", l_path);
+
+    static const char s_header[] = "time,sensor,pm1,pm2,pm10\n";
+
+    if (!m_file_size) return Append(s_header, sizeof(s_header) - 1);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SdLogger::CloseFile(void)
+{
+    if (m_fd >= 0) close(m_fd);
+
+    m_fd    = -1;
+    m_fill  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- write what is buffered, even if it is no full block, and get it onto the card
+
+void SdLogger::Flush(void)
+{
+    m_last_flush = esp_timer_get_time();
+
+    if (m_fd < 0) return;
+
+    if (m_fill && !WriteBlock()) return;
+
+    fsync(m_fd);
+}
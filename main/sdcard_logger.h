@@ -0,0 +1,156 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SDCARD_LOGGER_H_
+#define	SDCARD_LOGGER_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef CONFIG_SDCARD_LOG
+#undef CONFIG_SDCARD_LOG_QUEUE_LEN
+#undef CONFIG_SDCARD_LOG_FLUSH_INTERVAL
+#define CONFIG_SDCARD_LOG_QUEUE_LEN         8
+#define CONFIG_SDCARD_LOG_FLUSH_INTERVAL    60
+#endif
+
+// --- the file is written in blocks of this size at offsets aligned to it, a divisor of
+// --- the FAT cluster size (the card is formatted with SDLOG_CLUSTER_SIZE if needed)
+
+#define SDLOG_BLOCK_SIZE        4096
+#define SDLOG_CLUSTER_SIZE      (16 * 1024)
+
+#define SDLOG_SENSOR_SYNC       0xff    // --- no datagram: write out what is buffered
+
+// --- one datagram on its way to the card
+
+struct SdLogRecord
+{
+    uint32_t    m_time_s;               // --- wall clock (UTC) when it was received
+    uint16_t    m_time_ms;
+    uint8_t     m_sensor;
+    uint8_t     m_reserved;
+    uint16_t    m_pm1;
+    uint16_t    m_pm2;
+    uint16_t    m_pm10;
+};
+
+struct SdLogStats
+{
+    uint32_t    m_records;              // --- lines written
+    uint32_t    m_dropped;              // --- the queue was full
+    uint32_t    m_writes;               // --- write() calls, whole blocks except when syncing
+    uint32_t    m_partial;              // --- writes of less than a block
+    uint64_t    m_bytes;
+    uint32_t    m_files;                // --- files opened, one per day
+    uint32_t    m_errors;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- With CONFIG_SDCARD_LOG every datagram of every sensor is written to the SD card as
+// --- a CSV line, one file per day (<mount>/<year>/<month><day>.csv). The receive task
+// --- only puts the datagram into a bounded queue and never waits: when the card is slow
+// --- the queue fills and the datagrams are counted as dropped. A background task formats
+// --- the lines into a block buffer and writes it when it is full, or every
+// --- SDCARD_LOG_FLUSH_INTERVAL seconds. Without CONFIG_SDCARD_LOG nothing is logged.
+
+class SdLogger
+{
+
+public:
+    // --- mounts the card at f_mount_point and starts the writer task
+
+    esp_err_t InitManager(const char *f_mount_point);
+
+    // --- a new datagram, called by the receive task
+
+    void Log(int f_sensor, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+
+    // --- a datagram with its own time stamp, waits up to f_wait if the queue is full
+
+    bool Push(const SdLogRecord &f_rec, TickType_t f_wait);
+
+    // --- write out what is buffered and wait until it is on the card
+
+    esp_err_t Sync(TickType_t f_wait);
+
+    // --- called by the writer task
+
+    void Process(void);
+
+    // --- statistics
+
+    bool IsEnabled(void) const          { return m_queue != NULL; }
+    const SdLogStats &GetStats(void) const { return m_stats; }
+    uint32_t GetQueued(void) const;
+
+private:
+    bool Append(const char *f_data, int f_len);
+    bool WriteBlock(void);
+    bool OpenFile(const SdLogRecord &f_rec);
+    void CloseFile(void);
+    void Flush(void);
+
+    const char          *m_mount;
+    QueueHandle_t       m_queue;
+    SemaphoreHandle_t   m_synced;
+
+    char                *m_buf;
+    int                 m_fill;
+    int                 m_target;       // --- m_buf is written when it holds this much
+    int                 m_fd;
+    uint32_t            m_file_size;
+    uint32_t            m_file_day;     // --- yyyymmdd of the open file
+    int64_t             m_last_flush;
+
+    SdLogStats          m_stats;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern SdLogger g_SdLogger;
+
+
+#endif
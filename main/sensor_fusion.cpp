@@ -0,0 +1,343 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sensor_fusion.h"
+#include "config_manager.h"
+#include "config_manager_defines.h"
+#include "sensor_manager.h"
+#include "evlog.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static const char *TAG = "Fusion";
+
+// --- the receive tasks fuse, the REST server, MQTT and the diagnostics read
+
+static portMUX_TYPE s_fusion_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *s_mode_names[FusionMode_Cnt] = { "off", "median", "mean" };
+
+static_assert(CONFIG_TEMP_SENSOR_CNT <= FUSION_MAX_SENSORS, "a bit per sensor in the fusion result");
+
+SensorFusion g_Fusion;
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+static void prvFusionConfigChanged(uint32_t f_changed, void *f_ctx)
+{
+    SensorFusion *l_fusion = (SensorFusion *)f_ctx;
+
+    l_fusion->SetConfig((FusionMode)g_ConfigManager.GetIntValue(CFMGR_FUSION), g_ConfigManager.GetIntValue(CFMGR_FUSION_TOL));
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+esp_err_t SensorFusion::InitManager(void)
+{
+    m_mode      = FusionMode_Off;
+    m_have      = 0;
+    m_time_us   = 0;
+
+    memset(&m_result, 0, sizeof(m_result));
+    memset(&m_stats, 0, sizeof(m_stats));
+
+    prvFusionConfigChanged(0, this);
+
+    g_ConfigManager.RegisterListener(prvFusionConfigChanged, this, CFMGR_KEYBIT(CFMGR_FUSION) | CFMGR_KEYBIT(CFMGR_FUSION_TOL));
+
+    ESP_LOGI(TAG, "Fusion %s, tolerance %u%%", GetModeName(m_mode), m_tol_pct);
+
+    return ESP_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SensorFusion::SetConfig(FusionMode f_mode, uint32_t f_tol_pct)
+{
+    if (f_mode >= FusionMode_Cnt) f_mode = FusionMode_Off;
+
+    portENTER_CRITICAL(&s_fusion_mux);
+
+    // --- another mode starts from scratch, the flags of the old one are dropped
+
+    if (f_mode != m_mode)
+    {
+        ClearDeviating(m_result.m_deviating);
+
+        m_have      = 0;
+        m_time_us   = 0;
+
+        memset(&m_result, 0, sizeof(m_result));
+    }
+
+    m_mode      = f_mode;
+    m_tol_pct   = f_tol_pct;
+
+    portEXIT_CRITICAL(&s_fusion_mux);
+}
+
+// --- with the fusion lock held, so the health flags always follow m_result.m_deviating
+
+void SensorFusion::ClearDeviating(uint8_t f_sensors)
+{
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        if (f_sensors & (1 << i)) g_SensorManager.GetSensor(i).GetHealth().SetDeviating(false);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- sorts the few values in place
+
+static uint16_t prvMedian(uint16_t *f_values, int f_cnt)
+{
+    for (int i = 1; i < f_cnt; ++i)
+    {
+        uint16_t l_value = f_values[i];
+        int j = i;
+
+        for (; j > 0 && f_values[j - 1] > l_value; --j) f_values[j] = f_values[j - 1];
+
+        f_values[j] = l_value;
+    }
+
+    if (f_cnt & 1) return f_values[f_cnt / 2];
+
+    return (uint16_t)((f_values[f_cnt / 2 - 1] + f_values[f_cnt / 2] + 1) / 2);
+}
+
+static int prvBitCount(uint8_t f_bits)
+{
+    int l_cnt = 0;
+
+    for (; f_bits; f_bits &= f_bits - 1) ++l_cnt;
+
+    return l_cnt;
+}
+
+void SensorFusion::Fuse(FusionMode f_mode, uint32_t f_tol_pct, const FusionInput *f_in, int f_cnt, uint8_t f_prev, FusionResult *f_result)
+{
+    memset(f_result, 0, sizeof(FusionResult));
+
+    f_result->m_agree = true;
+
+    if (f_cnt > FUSION_MAX_SENSORS) f_cnt = FUSION_MAX_SENSORS;
+
+    // --- the median PM2.5 of the healthy sensors is the reference
+
+    uint16_t l_values[FUSION_MAX_SENSORS];
+    int l_valid_cnt = 0;
+
+    for (int i = 0; i < f_cnt; ++i)
+    {
+        if (!f_in[i].m_valid) continue;
+
+        f_result->m_valid |= 1 << i;
+        l_values[l_valid_cnt++] = f_in[i].m_pm[1];
+    }
+
+    if (!l_valid_cnt) return;
+
+    int32_t l_median    = prvMedian(l_values, l_valid_cnt);
+    int32_t l_tol       = l_median * (int32_t)f_tol_pct / 100;
+
+    if (l_tol < FUSION_TOL_MIN) l_tol = FUSION_TOL_MIN;
+
+    // --- a deviating sensor has to come closer than the tolerance to be back
+
+    for (int i = 0; i < f_cnt; ++i)
+    {
+        if (!f_in[i].m_valid) continue;
+
+        int32_t l_limit = f_prev & (1 << i) ? l_tol * FUSION_CLEAR_PCT / 100 : l_tol;
+
+        if (abs((int32_t)f_in[i].m_pm[1] - l_median) > l_limit) f_result->m_deviating |= 1 << i;
+    }
+
+    // --- no majority left: there is no telling which one is wrong, so all are used
+
+    if (prvBitCount(f_result->m_valid & ~f_result->m_deviating) * 2 <= l_valid_cnt && l_valid_cnt > 1)
+    {
+        f_result->m_agree       = false;
+        f_result->m_deviating   = 0;
+    }
+
+    f_result->m_used = f_result->m_valid & ~f_result->m_deviating;
+
+    for (int v = 0; v < 3; ++v)
+    {
+        uint32_t l_sum = 0;
+        int l_cnt = 0;
+
+        for (int i = 0; i < f_cnt; ++i)
+        {
+            if (!(f_result->m_used & (1 << i))) continue;
+
+            l_values[l_cnt++] = f_in[i].m_pm[v];
+            l_sum += f_in[i].m_pm[v];
+        }
+
+        if (f_mode == FusionMode_Mean) f_result->m_pm[v] = (uint16_t)((l_sum + l_cnt / 2) / l_cnt);
+        else f_result->m_pm[v] = prvMedian(l_values, l_cnt);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SensorFusion::Add(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    if (m_mode == FusionMode_Off || f_sensor < 0 || f_sensor >= CONFIG_TEMP_SENSOR_CNT) return;
+
+    FusionInput l_in[CONFIG_TEMP_SENSOR_CNT];
+    FusionResult l_result;
+
+    // --- one step under the lock, from reading the health to flagging it: with a receive
+    // --- task per sensor two steps must not interleave, or the flags of the older one win
+
+    portENTER_CRITICAL(&s_fusion_mux);
+
+    m_latest[f_sensor][0]   = f_pm1;
+    m_latest[f_sensor][1]   = f_pm2;
+    m_latest[f_sensor][2]   = f_pm10;
+    m_have                  |= 1 << f_sensor;
+
+    // --- the health decides whether the latest sample of a sensor still counts: stale,
+    // --- stuck and broken sensors are left out, deviating ones are judged again
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        SensorState l_state = g_SensorManager.GetSensor(i).GetHealth().GetInfo(f_time_us).m_state;
+
+        l_in[i].m_valid = (m_have & (1 << i)) && (l_state == SensorState_Ok || l_state == SensorState_Deviating);
+        memcpy(l_in[i].m_pm, m_latest[i], sizeof(l_in[i].m_pm));
+    }
+
+    uint8_t l_prev = m_result.m_deviating;
+
+    Fuse(m_mode, m_tol_pct, l_in, CONFIG_TEMP_SENSOR_CNT, l_prev, &l_result);
+
+    m_result    = l_result;
+    m_time_us   = f_time_us;
+
+    ++m_stats.m_updates;
+    if (!l_result.m_agree) ++m_stats.m_conflicts;
+    m_stats.m_deviations += prvBitCount(l_result.m_deviating & ~l_prev);
+
+    // --- the flags go to the health of the sensors, which is in every message
+
+    uint8_t l_changed = l_prev ^ l_result.m_deviating;
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        if (l_changed & (1 << i)) g_SensorManager.GetSensor(i).GetHealth().SetDeviating((l_result.m_deviating & (1 << i)) != 0);
+    }
+
+    portEXIT_CRITICAL(&s_fusion_mux);
+
+    // --- every change is logged once, by the step which made it
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT && l_changed; ++i)
+    {
+        if (l_changed & (1 << i)) EVLOG(FusionDeviating, i + 1, l_in[i].m_pm[1], l_result.m_pm[1], (l_result.m_deviating & (1 << i)) != 0);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool SensorFusion::GetResult(FusionResult *f_result, int64_t *f_time_us) const
+{
+    portENTER_CRITICAL(&s_fusion_mux);
+
+    *f_result   = m_result;
+    *f_time_us  = m_time_us;
+
+    portEXIT_CRITICAL(&s_fusion_mux);
+
+    return *f_time_us != 0 && f_result->m_used != 0;
+}
+
+FusionStats SensorFusion::GetStats(void) const
+{
+    portENTER_CRITICAL(&s_fusion_mux);
+
+    FusionStats l_stats = m_stats;
+
+    portEXIT_CRITICAL(&s_fusion_mux);
+
+    return l_stats;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SensorFusion::AddToJson(cJSON *f_obj) const
+{
+    cJSON_AddStringToObject(f_obj, "method", GetModeName(m_mode));
+
+    FusionResult l_result;
+    int64_t l_time_us;
+
+    if (!GetResult(&l_result, &l_time_us)) return;
+
+    cJSON_AddNumberToObject(f_obj, "pm1", l_result.m_pm[0]);
+    cJSON_AddNumberToObject(f_obj, "pm2", l_result.m_pm[1]);
+    cJSON_AddNumberToObject(f_obj, "pm10", l_result.m_pm[2]);
+
+    cJSON *l_used       = cJSON_AddArrayToObject(f_obj, "sensors");
+    cJSON *l_deviating  = cJSON_AddArrayToObject(f_obj, "deviating");
+
+    for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
+    {
+        if (l_result.m_used & (1 << i)) cJSON_AddItemToArray(l_used, cJSON_CreateNumber(i + 1));
+        if (l_result.m_deviating & (1 << i)) cJSON_AddItemToArray(l_deviating, cJSON_CreateNumber(i + 1));
+    }
+
+    cJSON_AddBoolToObject(f_obj, "agree", l_result.m_agree);
+
+    int64_t l_age_us = esp_timer_get_time() - l_time_us;
+
+    cJSON_AddNumberToObject(f_obj, "age", l_age_us > 0 ? (double)(l_age_us / 1000000) : 0.0);
+}
+
+const char *SensorFusion::GetModeName(FusionMode f_mode)
+{
+    return f_mode < FusionMode_Cnt ? s_mode_names[f_mode] : "unknown";
+}
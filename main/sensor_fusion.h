@@ -0,0 +1,144 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SENSOR_FUSION_H_
+#define	SENSOR_FUSION_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+#include "cJSON.h"
+#include "esp_err.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define FUSION_MAX_SENSORS      8
+#define FUSION_TOL_MIN          5       // --- ug/m3, smaller differences are noise
+#define FUSION_CLEAR_PCT        75      // --- a deviating sensor is back within this share of the tolerance
+
+enum FusionMode
+{
+    FusionMode_Off,
+    FusionMode_Median,                  // --- the median of the agreeing sensors
+    FusionMode_Mean,                    // --- the mean of the agreeing sensors
+
+    FusionMode_Cnt
+};
+
+// --- the latest sample of a sensor, valid if its health is ok
+
+struct FusionInput
+{
+    bool        m_valid;
+    uint16_t    m_pm[3];                // --- PM1, PM2.5, PM10
+};
+
+struct FusionResult
+{
+    uint16_t    m_pm[3];                // --- fused, PM1, PM2.5, PM10
+    uint8_t     m_valid;                // --- bit per sensor: a healthy sample
+    uint8_t     m_used;                 // --- bit per sensor: in the fused value
+    uint8_t     m_deviating;            // --- bit per sensor: too far from the median
+    bool        m_agree;                // --- false: no majority, e.g. two sensors which disagree
+};
+
+struct FusionStats
+{
+    uint32_t    m_updates;
+    uint32_t    m_deviations;           // --- a sensor started to deviate
+    uint32_t    m_conflicts;            // --- updates without a majority
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Combines co-located sensors into one value, with every datagram in the receive
+// --- task: the latest sample of every healthy sensor is compared against the median
+// --- PM2.5, sensors off by more than fusion_tol percent (at least FUSION_TOL_MIN) are
+// --- flagged as deviating in their health and left out, the rest is fused by median
+// --- or mean. With two sensors which disagree there is no telling which one is right:
+// --- both are used and the result says so. Served at /api/v1/fused and published
+// --- next to the per-sensor values. The config key fusion selects the mode, 0 = off.
+
+class SensorFusion
+{
+
+public:
+    esp_err_t InitManager(void);
+
+    void SetConfig(FusionMode f_mode, uint32_t f_tol_pct);
+    FusionMode GetMode(void) const      { return m_mode; }
+    bool IsEnabled(void) const          { return m_mode != FusionMode_Off; }
+
+    // --- the receive tasks, after the health has seen the datagram
+
+    void Add(int f_sensor, int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+
+    // --- the last fused value and its esp_timer time, false without one
+
+    bool GetResult(FusionResult *f_result, int64_t *f_time_us) const;
+
+    FusionStats GetStats(void) const;
+
+    // --- "method":"median","pm1":3,"pm2":5,"pm10":6,"sensors":[1,3],"deviating":[2],
+    // --- "agree":true,"age":<s>. Just the method before the first value
+
+    void AddToJson(cJSON *f_obj) const;
+
+    // --- one step: f_prev are the sensors deviating so far. Also used by the benchmark
+
+    static void Fuse(FusionMode f_mode, uint32_t f_tol_pct, const FusionInput *f_in, int f_cnt, uint8_t f_prev, FusionResult *f_result);
+
+    static const char *GetModeName(FusionMode f_mode);
+
+private:
+    void ClearDeviating(uint8_t f_sensors);
+
+    FusionMode      m_mode;
+    uint32_t        m_tol_pct;
+    uint8_t         m_have;             // --- bit per sensor: a sample since fusion is on
+    uint16_t        m_latest[CONFIG_TEMP_SENSOR_CNT][3];
+    FusionResult    m_result;
+    int64_t         m_time_us;          // --- of the last result, 0 = none
+    FusionStats     m_stats;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+
+extern SensorFusion g_Fusion;
+
+
+#endif
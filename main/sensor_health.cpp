@@ -0,0 +1,214 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+
+#include "sensor_health.h"
+#include "evlog.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- the receive tasks write, the REST server, the scheduler and the diagnostics read
+
+static portMUX_TYPE s_health_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *s_state_names[SensorState_Cnt] = { "nodata", "ok", "stale", "stuck", "errors", "deviating" };
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SensorHealth::Init(int f_index)
+{
+    portENTER_CRITICAL(&s_health_mux);
+
+    m_index         = f_index;
+    m_last_us       = 0;
+    m_same_us       = 0;
+    m_cadence_ms    = HEALTH_CADENCE_MS;
+    m_datagrams     = 0;
+    m_errors        = 0;
+    m_error_rate    = 0;
+    m_same_cnt      = 0;
+    m_deviating     = false;
+
+    memset(m_last, 0, sizeof(m_last));
+
+    portEXIT_CRITICAL(&s_health_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+uint32_t SensorHealth::GetStaleMs(void) const
+{
+    uint32_t l_stale = m_cadence_ms * HEALTH_STALE_FACTOR;
+
+    return l_stale > HEALTH_STALE_MIN_MS ? l_stale : HEALTH_STALE_MIN_MS;
+}
+
+void SensorHealth::OnDatagram(int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10)
+{
+    uint32_t l_gap_ms = 0;
+
+    portENTER_CRITICAL(&s_health_mux);
+
+    if (m_datagrams)
+    {
+        uint32_t l_interval = (uint32_t)((f_time_us - m_last_us) / 1000);
+
+        if (l_interval > GetStaleMs()) l_gap_ms = l_interval;
+
+        // --- the largest interval, decaying over the short ones of a burst. Longer
+        // --- gaps are outages, not the cadence
+
+        if (l_interval > m_cadence_ms && l_interval <= HEALTH_CADENCE_MAX_MS)
+        {
+            m_cadence_ms = l_interval;
+        }
+        else
+        {
+            m_cadence_ms -= m_cadence_ms / 64;
+        }
+    }
+
+    // --- the same values again
+
+    if (m_datagrams && f_pm1 == m_last[0] && f_pm2 == m_last[1] && f_pm10 == m_last[2])
+    {
+        if (m_same_cnt < 0xffff) ++m_same_cnt;
+    }
+    else
+    {
+        m_same_cnt  = 0;
+        m_same_us   = f_time_us;
+
+        m_last[0]   = f_pm1;
+        m_last[1]   = f_pm2;
+        m_last[2]   = f_pm10;
+    }
+
+    m_last_us = f_time_us;
+    ++m_datagrams;
+
+    m_error_rate -= m_error_rate / 16;
+
+    portEXIT_CRITICAL(&s_health_mux);
+
+    if (l_gap_ms) EVLOG(SensorBack, m_index + 1, l_gap_ms / 1000);
+}
+
+void SensorHealth::OnErrors(uint32_t f_errors)
+{
+    // --- only the receive task writes the counter
+
+    if (f_errors == m_errors) return;
+
+    portENTER_CRITICAL(&s_health_mux);
+
+    // --- every broken frame moves the average towards 1000 permille
+
+    for (uint32_t i = m_errors; i != f_errors && i - m_errors < 16; ++i)
+    {
+        m_error_rate += 1000 - m_error_rate / 16;
+    }
+
+    m_errors = f_errors;
+
+    portEXIT_CRITICAL(&s_health_mux);
+}
+
+void SensorHealth::SetDeviating(bool f_deviating)
+{
+    portENTER_CRITICAL(&s_health_mux);
+
+    m_deviating = f_deviating;
+
+    portEXIT_CRITICAL(&s_health_mux);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+SensorHealthInfo SensorHealth::GetInfo(int64_t f_now_us) const
+{
+    SensorHealthInfo l_info;
+
+    portENTER_CRITICAL(&s_health_mux);
+
+    // --- the datagram may be newer than the caller's clock reading
+
+    int64_t l_age_us = m_datagrams && f_now_us > m_last_us ? f_now_us - m_last_us : 0;
+
+    l_info.m_age_ms         = (uint32_t)(l_age_us / 1000);
+    l_info.m_cadence_ms     = m_cadence_ms;
+    l_info.m_datagrams      = m_datagrams;
+    l_info.m_errors         = m_errors;
+    l_info.m_error_permille = (uint16_t)(m_error_rate / 16);
+    l_info.m_same_cnt       = m_same_cnt;
+
+    if (!m_datagrams) l_info.m_state = SensorState_NoData;
+    else if (l_info.m_age_ms > GetStaleMs()) l_info.m_state = SensorState_Stale;
+    else if (m_same_cnt >= HEALTH_STUCK_CNT && m_last_us - m_same_us >= (int64_t)HEALTH_STUCK_MS * 1000) l_info.m_state = SensorState_Stuck;
+    else if (l_info.m_error_permille > HEALTH_ERROR_PERMILLE) l_info.m_state = SensorState_Errors;
+    else if (m_deviating) l_info.m_state = SensorState_Deviating;
+    else l_info.m_state = SensorState_Ok;
+
+    portEXIT_CRITICAL(&s_health_mux);
+
+    return l_info;
+}
+
+SensorState SensorHealth::GetState(void) const
+{
+    return GetInfo(esp_timer_get_time()).m_state;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void SensorHealth::AddToJson(cJSON *f_obj) const
+{
+    AddToJson(GetInfo(esp_timer_get_time()), f_obj);
+}
+
+void SensorHealth::AddToJson(const SensorHealthInfo &f_info, cJSON *f_obj)
+{
+    cJSON_AddStringToObject(f_obj, "health", s_state_names[f_info.m_state]);
+
+    if (f_info.m_state != SensorState_NoData) cJSON_AddNumberToObject(f_obj, "age", f_info.m_age_ms / 1000);
+}
+
+const char *SensorHealth::GetStateName(SensorState f_state)
+{
+    return f_state < SensorState_Cnt ? s_state_names[f_state] : "unknown";
+}
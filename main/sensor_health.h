@@ -0,0 +1,131 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef SENSOR_HEALTH_H_
+#define	SENSOR_HEALTH_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stdint.h>
+
+#include "cJSON.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#define HEALTH_CADENCE_MS       30000   // --- assumed at the start
+#define HEALTH_CADENCE_MAX_MS   300000  // --- longer intervals are outages
+#define HEALTH_STALE_FACTOR     3       // --- stale after this many intervals without a datagram
+#define HEALTH_STALE_MIN_MS     5000
+#define HEALTH_STUCK_CNT        30      // --- identical datagrams in a row ...
+#define HEALTH_STUCK_MS         600000  // --- ... for at least 10 minutes
+#define HEALTH_ERROR_PERMILLE   100     // --- of the recent frames broken
+
+enum SensorState
+{
+    SensorState_NoData,                 // --- no valid datagram since boot
+    SensorState_Ok,
+    SensorState_Stale,                  // --- the datagrams stopped, the values are old
+    SensorState_Stuck,                  // --- the values do not change anymore
+    SensorState_Errors,                 // --- too many broken frames
+    SensorState_Deviating,              // --- disagrees with the other sensors (sensor fusion)
+
+    SensorState_Cnt
+};
+
+// --- a snapshot of the health of a sensor
+
+struct SensorHealthInfo
+{
+    SensorState m_state;
+    uint32_t    m_age_ms;               // --- since the last valid datagram
+    uint32_t    m_cadence_ms;           // --- the expected interval
+    uint32_t    m_datagrams;
+    uint32_t    m_errors;               // --- broken frames (checksum, length)
+    uint16_t    m_error_permille;       // --- of the recent frames
+    uint16_t    m_same_cnt;             // --- identical datagrams in a row
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- The health of one sensor, updated by its receive task with every frame at the
+// --- cost of a few compares. The expected cadence is the largest interval between
+// --- datagrams, slowly decaying, so the bursts of the VINDRIKTNING count as one. Whether
+// --- the data is stale is decided when the state is read, so a dead sensor needs no
+// --- timer.
+
+class SensorHealth
+{
+
+public:
+    void Init(int f_index);
+
+    // --- the receive task: a valid datagram, and the error counters of the receiver
+
+    void OnDatagram(int64_t f_time_us, uint16_t f_pm1, uint16_t f_pm2, uint16_t f_pm10);
+    void OnErrors(uint32_t f_errors);
+
+    // --- the sensor fusion, a healthy sensor is reported as deviating while set
+
+    void SetDeviating(bool f_deviating);
+
+    // --- everyone else, at esp_timer time f_now_us
+
+    SensorHealthInfo GetInfo(int64_t f_now_us) const;
+    SensorState GetState(void) const;
+
+    // --- "health":"ok","age":<s since the last datagram> for the REST and MQTT messages
+
+    void AddToJson(cJSON *f_obj) const;
+    static void AddToJson(const SensorHealthInfo &f_info, cJSON *f_obj);
+
+    static const char *GetStateName(SensorState f_state);
+
+private:
+    uint32_t GetStaleMs(void) const;
+
+    int         m_index;
+    int64_t     m_last_us;
+    int64_t     m_same_us;              // --- since when the values are the same
+    uint32_t    m_cadence_ms;
+    uint32_t    m_datagrams;
+    uint32_t    m_errors;
+    uint32_t    m_error_rate;           // --- permille * 16, moving average over the frames
+    uint16_t    m_same_cnt;
+    uint16_t    m_last[3];
+    bool        m_deviating;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
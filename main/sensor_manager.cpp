@@ -40,7 +40,9 @@
 #include "driver/gpio.h"
 #include "esp_log.h"
 
+#include "scheduler.h"
 #include "sensor_manager.h"
+#include "evlog.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -64,13 +66,22 @@ void SensorManager::ProcessMeasurements(void)
         }
         else
         {
-            ESP_LOGI(TAG, "Sensor %d: pm1 %f, pm2.5 %f, pm10 %f",i,m_Sensors[i].GetPM1(),m_Sensors[i].GetPM2(),m_Sensors[i].GetPM10());
+            EVLOG(SensorValues, i, (int)m_Sensors[i].GetPM1(), (int)m_Sensors[i].GetPM2(), (int)m_Sensors[i].GetPM10());
         }
     }
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+static void prvSensorDataHandler(const SchedEvent &f_event, void *f_ctx)
+{
+    SensorManager *l_sensormgr = (SensorManager *)f_ctx;
+
+    l_sensormgr->ProcessMeasurements();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
 void SensorManager::InitSensors(void)
 {
     // --- first get the #define config data into an array
@@ -102,9 +113,13 @@ void SensorManager::InitSensors(void)
     for (int i = 0; i < CONFIG_TEMP_SENSOR_CNT; ++i)
     {
         ESP_LOGI(TAG, "Sensor %d GPIOs: DATA %d", i,l_DATA[i]);
-        if (!m_Sensors[i].SetupSensor(l_DATA[i],l_UART[0]))
+        if (!m_Sensors[i].SetupSensor(l_DATA[i],l_UART[i]))
         {
             ESP_LOGE(TAG, "Failed to initialize sensor %d", i);
         }
     }
+
+    // --- log the values whenever a sensor delivers new ones
+
+    g_Scheduler.AddHandler(SchedEvent_SensorData, prvSensorDataHandler, this);
 }
\ No newline at end of file
@@ -37,6 +37,8 @@
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
+#include <assert.h>
+
 #include "vindriktning.h"
 #include "sdkconfig.h"
 
@@ -0,0 +1,227 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "tscodec.h"
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- zig-zag: small negative and positive numbers both get small codes
+
+static inline uint64_t ZigZag(int64_t f_val)
+{
+    return ((uint64_t)f_val << 1) ^ (uint64_t)(f_val >> 63);
+}
+
+static inline int64_t UnZigZag(uint64_t f_val)
+{
+    return (int64_t)(f_val >> 1) ^ -(int64_t)(f_val & 1);
+}
+
+// --- 7 bits per byte, the high bit tells that more follow
+
+static inline size_t PutVarint(uint8_t *f_buf, uint64_t f_val)
+{
+    size_t l_len = 0;
+
+    while (f_val >= 0x80)
+    {
+        f_buf[l_len++] = (uint8_t)f_val | 0x80;
+        f_val >>= 7;
+    }
+
+    f_buf[l_len++] = (uint8_t)f_val;
+
+    return l_len;
+}
+
+static inline bool GetVarint(const uint8_t *f_buf, size_t f_len, size_t *f_pos, uint64_t *f_val)
+{
+    uint64_t l_val = 0;
+
+    for (int l_shift = 0; l_shift < 64 && *f_pos < f_len; l_shift += 7)
+    {
+        uint8_t l_byte = f_buf[(*f_pos)++];
+
+        l_val |= (uint64_t)(l_byte & 0x7f) << l_shift;
+
+        if (!(l_byte & 0x80))
+        {
+            *f_val = l_val;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- encoder
+////////////////////////////////////////////////////////////////////////////////////////
+
+TsBlockEncoder::TsBlockEncoder(void)
+{
+    m_buf   = NULL;
+    m_size  = 0;
+    m_pos   = 0;
+    m_count = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+void TsBlockEncoder::Begin(uint8_t *f_buf, size_t f_size)
+{
+    m_buf           = f_buf;
+    m_size          = f_size;
+    m_pos           = TSC_HEADER_LEN;
+    m_count         = 0;
+    m_prev_time     = 0;
+    m_prev_delta    = 0;
+
+    memset(m_prev_val, 0, sizeof(m_prev_val));
+
+    if (m_size >= TSC_HEADER_LEN)
+    {
+        m_buf[0] = 0;
+        m_buf[1] = 0;
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool TsBlockEncoder::Add(const TsSample &f_sample)
+{
+    if (!m_buf || m_count == 0xffff) return false;
+
+    // --- encode into a scratch first, only a complete sample goes into the block
+
+    uint8_t l_tmp[TSC_SAMPLE_MAX];
+    size_t l_len;
+
+    int64_t l_delta = f_sample.m_time_ms - m_prev_time;
+
+    l_len = PutVarint(l_tmp, ZigZag(l_delta - m_prev_delta));
+
+    for (int i = 0; i < TSC_CHANNELS; ++i)
+    {
+        l_len += PutVarint(l_tmp + l_len, ZigZag((int64_t)f_sample.m_val[i] - m_prev_val[i]));
+    }
+
+    if (m_pos + l_len > m_size) return false;
+
+    memcpy(m_buf + m_pos, l_tmp, l_len);
+    m_pos += l_len;
+
+    // --- the first delta is the absolute time, the second sample starts over from zero
+
+    m_prev_time     = f_sample.m_time_ms;
+    m_prev_delta    = m_count ? l_delta : 0;
+
+    memcpy(m_prev_val, f_sample.m_val, sizeof(m_prev_val));
+
+    ++m_count;
+
+    m_buf[0] = (uint8_t)m_count;
+    m_buf[1] = (uint8_t)(m_count >> 8);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+// --- decoder
+////////////////////////////////////////////////////////////////////////////////////////
+
+TsBlockDecoder::TsBlockDecoder(void)
+{
+    m_buf   = NULL;
+    m_len   = 0;
+    m_pos   = 0;
+    m_count = 0;
+    m_done  = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool TsBlockDecoder::Begin(const uint8_t *f_buf, size_t f_len)
+{
+    m_buf           = f_buf;
+    m_len           = f_len;
+    m_pos           = TSC_HEADER_LEN;
+    m_done          = 0;
+    m_prev_time     = 0;
+    m_prev_delta    = 0;
+
+    memset(m_prev_val, 0, sizeof(m_prev_val));
+
+    if (f_len < TSC_HEADER_LEN)
+    {
+        m_count = 0;
+        return false;
+    }
+
+    m_count = f_buf[0] | (f_buf[1] << 8);
+
+    return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+bool TsBlockDecoder::Next(TsSample *f_sample)
+{
+    if (m_done >= m_count) return false;
+
+    uint64_t l_raw;
+
+    if (!GetVarint(m_buf, m_len, &m_pos, &l_raw)) return false;
+
+    m_prev_delta    += UnZigZag(l_raw);
+    m_prev_time     += m_prev_delta;
+
+    f_sample->m_time_ms = m_prev_time;
+
+    if (!m_done) m_prev_delta = 0;
+
+    for (int i = 0; i < TSC_CHANNELS; ++i)
+    {
+        if (!GetVarint(m_buf, m_len, &m_pos, &l_raw)) return false;
+
+        m_prev_val[i]       = (uint16_t)(m_prev_val[i] + UnZigZag(l_raw));
+        f_sample->m_val[i]  = m_prev_val[i];
+    }
+
+    ++m_done;
+
+    return true;
+}
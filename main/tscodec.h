@@ -0,0 +1,126 @@
+/*
+    --------------------------------------------------------------------------------
+
+    ESPDustLogger       
+    
+    ESP32 based IoT Device for air quality logging featuring an MQTT client and 
+    REST API acess. Works in conjunction with a VINDRIKTNING air sensor from IKEA.
+    
+    --------------------------------------------------------------------------------
+
+    Copyright (c) 2021 Tim Hagemann / way2.net Services
+
+    Permission is hereby granted, free of charge, to any person obtaining a copy
+    of this software and associated documentation files (the "Software"), to deal
+    in the Software without restriction, including without limitation the rights
+    to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+    copies of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be included in all
+    copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+    IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+    FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+    AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+    LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+    SOFTWARE.
+    --------------------------------------------------------------------------------
+*/
+
+///////////////////////////////////////////////////////////////////////////////////////
+
+#ifndef TSCODEC_H_
+#define	TSCODEC_H_
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#include <stddef.h>
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- Compression of sample series in independent blocks. A block starts with the number
+// --- of samples (u16, little endian), then per sample the delta-of-delta of the time
+// --- stamp and the delta of every value to the previous sample, each zig-zag encoded as
+// --- a varint. The first sample of a block is encoded against zero, so every block can
+// --- be decoded on its own. PM values change slowly and the sensor sends at a steady
+// --- rate, so most samples take 1 byte per field instead of 8 + 3 * 2.
+
+#define TSC_CHANNELS            3               // --- pm1, pm2.5, pm10
+#define TSC_BLOCK_SIZE          256
+#define TSC_HEADER_LEN          2
+#define TSC_SAMPLE_MAX          (10 + TSC_CHANNELS * 3)   // --- worst case of one sample
+
+struct TsSample
+{
+    int64_t     m_time_ms;
+    uint16_t    m_val[TSC_CHANNELS];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+// --- fills one block. The count in the header is kept up to date, so the block can be
+// --- decoded at any time while it is still being filled
+
+class TsBlockEncoder
+{
+
+public:
+    TsBlockEncoder(void);
+
+    void Begin(uint8_t *f_buf, size_t f_size);
+
+    // --- false if the sample does not fit anymore, start the next block then
+
+    bool Add(const TsSample &f_sample);
+
+    uint16_t GetCount(void) const       { return m_count; }
+    size_t GetSize(void) const          { return m_pos; }
+
+private:
+    uint8_t     *m_buf;
+    size_t      m_size;
+    size_t      m_pos;
+    uint16_t    m_count;
+
+    int64_t     m_prev_time;
+    int64_t     m_prev_delta;
+    uint16_t    m_prev_val[TSC_CHANNELS];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+class TsBlockDecoder
+{
+
+public:
+    TsBlockDecoder(void);
+
+    // --- false if the block is too short for its header
+
+    bool Begin(const uint8_t *f_buf, size_t f_len);
+
+    // --- the next sample, false at the end or if the block is broken
+
+    bool Next(TsSample *f_sample);
+
+    uint16_t GetCount(void) const       { return m_count; }
+
+private:
+    const uint8_t   *m_buf;
+    size_t          m_len;
+    size_t          m_pos;
+    uint16_t        m_count;
+    uint16_t        m_done;
+
+    int64_t         m_prev_time;
+    int64_t         m_prev_delta;
+    uint16_t        m_prev_val[TSC_CHANNELS];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#endif
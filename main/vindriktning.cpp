@@ -41,183 +41,312 @@
 #include <stdio.h>
 #include <cstring>
 #include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
 #include "driver/uart.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_task_wdt.h"
+#include "esp_timer.h"
 
 #include "vindriktning.h"
+#include "pm1006.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "evlog.h"
+#include "sdcard_logger.h"
+#include "history.h"
+#include "quantiles.h"
+#include "aqi.h"
+#include "alarm_manager.h"
+#include "frame_assembler.h"
+#include "sensor_fusion.h"
+
+#ifdef CONFIG_PM1006_SIMULATOR
+#include "pm1006_sim.h"
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
 #define BUF_SIZE (1024)
-#define STACK_SIZE (2048)
-#define DATAGRAM_LEN 30
+// --- the receive task runs the whole per-datagram pipeline (alarms, history, frames, fusion,
+// --- quantiles, aqi, sd card log), 2048 bytes were only enough for the bare parser
+
+#define STACK_SIZE (4096)
+#define QUEUE_LEN (10)
+
+// --- shared receiver: the driver ring must be larger than the 128 byte hardware FIFO,
+// --- a burst of the sensor is a few 20 byte datagrams
+
+#define SHARED_RING_SIZE (256)
+#define SHARED_BUF_SIZE (128)
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
 static const char *TAG = "vindriktning";
 
-////////////////////////////////////////////////////////////////////////////////////////
+// --- the sensors set up so far, a receive task knows its sensor by the index
 
-// --- this is a debug stub "sending" a valid message for test purposes
+static CVindriktning 	*s_rx_sensors[CONFIG_TEMP_SENSOR_CNT];
+static int 				s_rx_cnt = 0;
 
-uint8_t g_TestMessage[] = { 0x16, 0x11, 0x0b, 0x00,0x00,0x03,0xe8,0x00,0x00,0x07,0xd0,0x00,0x00,0x0B,0xb8,0x00,0x00,0x00,0x00,0x49};
+#ifdef CONFIG_SENSOR_SHARED_RX
 
-int stub_uart_read_bytes(uart_port_t uart_num, void* buf, uint32_t length, TickType_t ticks_to_wait)
-{
-	assert(length >= sizeof(g_TestMessage));
+// --- one receive task for all sensors, waiting on the set of their UART event queues
 
-	memcpy(buf,g_TestMessage,sizeof(g_TestMessage));
+static QueueSetHandle_t s_rx_set = NULL;
+static uint8_t 			s_rx_buf[SHARED_BUF_SIZE];
 
-	return sizeof(g_TestMessage);
-}
+#ifdef CONFIG_STATIC_ALLOC
+static StackType_t 		s_rx_stack[STACK_SIZE];
+static StaticTask_t 	s_rx_tcb;
+#endif
 
-////////////////////////////////////////////////////////////////////////////////////////
+#elif defined(CONFIG_STATIC_ALLOC)
+
+// --- stacks, control blocks and read buffers of the receive tasks
+
+static StackType_t 		s_rx_stacks[CONFIG_TEMP_SENSOR_CNT][STACK_SIZE];
+static StaticTask_t 	s_rx_tcbs[CONFIG_TEMP_SENSOR_CNT];
+static uint8_t 			s_rx_bufs[CONFIG_TEMP_SENSOR_CNT][BUF_SIZE];
 
-typedef enum {
-    PM1006_HEADER,
-    PM1006_LENGTH,
-    PM1006_DATA,
-    PM1006_CHECK
-} pm1006_state_t;
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
-class CReceiver
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////
+
+CVindriktning::CVindriktning(void)
 {
+	m_Initialized		= false;
 
-public:
+	m_pin_data			= (gpio_num_t)0;
+	m_index				= 0;
+	m_uart 				= (uart_port_t)0;
+	m_uart_queue		= NULL;
+	
+	m_pm1				= 0;
+	m_pm2				= 0;
+	m_pm10				= 0;
+	m_version			= 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
 
-	CReceiver(void)
+void CVindriktning::ProcessBytes(const uint8_t *f_data, int f_len)
+{
+	// --- add them to the shifter
+
+	for (int i=0;i < f_len;++i)
 	{
-		_state 		= PM1006_HEADER;
-		_rxlen 		= 0;
-		_index 		= 0;
-		_checksum 	= 0;		
+		//ESP_LOGI(TAG, "received byte %x",f_data[i]);
 
-		memset(_rxbuf, 0, sizeof(_rxbuf));
-	}
+		if (m_receiver.process_rx(f_data[i]))
+		{
+				const uint16_t pm25 = m_receiver.GetPM25();
+				const uint16_t pm1  = m_receiver.GetPM1();
+				const uint16_t pm10 = m_receiver.GetPM10();
 
-	// --------------------------------------------
+				EVLOG(SensorDatagram, m_uart, pm25, pm1, pm10);
 
-	void dump(void)
-	{
-		char l_s[100];
+				//m_receiver.dump();
 
-		strcpy(l_s,"Buffer:");
+				const int64_t l_now = esp_timer_get_time();
 
-		for (int i=0;i<_rxlen;++i)
-		{
-			char l_buf[5];
-			snprintf(l_buf,5,"%0x ",_rxbuf[i]);
-			strcat(l_s,l_buf);
-		}
-		ESP_LOGI(TAG, "%s",l_s); 
+				SetValues(pm25,pm1,pm10);
+				m_health.OnDatagram(l_now, pm1, pm25, pm10);
+
+				// --- the alarm rules first, their alerts go out right away
 
+				g_AlarmManager.Evaluate(m_index, l_now, pm1, pm25, pm10);
+
+				// --- every datagram into the RAM history, the quantiles, the indices and to the SD card,
+				// --- which never waits. With frames the history gets the aligned frames instead
+
+				if (!g_Frames.IsEnabled()) g_History.Add(m_index, pm1, pm25, pm10);
+
+				g_Frames.Add(m_index, l_now, pm1, pm25, pm10);
+				g_Fusion.Add(m_index, l_now, pm1, pm25, pm10);
+				g_Quantiles.Add(m_index, pm25);
+				g_Aqi.Add(m_index, pm25, pm10);
+
+				g_SdLogger.Log(m_index, pm1, pm25, pm10);
+
+				// --- tell the scheduler there is something new
+
+				g_Scheduler.Post(SchedEvent_SensorData, m_uart);
+		}
 	}
 
-	// --------------------------------------------
+	// --- broken frames count against the health
+
+	m_health.OnErrors(m_receiver.GetChecksumErrors() + m_receiver.GetLengthErrors());
+}
 
-	bool process_rx(uint8_t c)
+////////////////////////////////////////////////////////////////////////////////////////
+
+void CVindriktning::ReceiveEvent(const uart_event_t &f_event, uint8_t *f_buf, int f_size)
+{
+	switch (f_event.type)
 	{
-		//ESP_LOGI(TAG, "process_rx(%x): IN state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+		case UART_DATA:
+		{
+			// --- stay awake for the rest of the burst
 
-		switch (_state) {
-		case PM1006_HEADER:
-			_checksum = c;
-			if (c == 0x16) {
-				_state = PM1006_LENGTH;
-			}
-			break;
+			g_PowerManager.RxActivity();
+
+			// --- a buffer smaller than the event takes several reads
+
+			int l_left = f_event.size;
 
-		case PM1006_LENGTH:
-			_checksum += c;
-			if (c <= sizeof(_rxbuf)) {
-				_rxlen = c;
-				_index = 0;
-				_state = (_rxlen > 0) ? PM1006_DATA : PM1006_CHECK;
-			} 
-			else 
+			while (l_left > 0)
 			{
-				ESP_LOGE(TAG, "process_rx(%x): message too long for buffer!",c);
-				_state = PM1006_HEADER;
-			}
-			break;
+				int len = uart_read_bytes(m_uart, f_buf, l_left < f_size ? l_left : f_size, 0);
 
-		case PM1006_DATA:
-			_checksum += c;
-			_rxbuf[_index++] = c;
-			if (_index == _rxlen) {
-				_state = PM1006_CHECK;
+				if (len <= 0) break;
+
+				ProcessBytes(f_buf, len);
+				l_left -= len;
 			}
 			break;
+		}
 
-		case PM1006_CHECK:
-			_checksum += c;
-			_state = PM1006_HEADER;
-	
-			if (_checksum) ESP_LOGE(TAG, "process_rx(%x): checksum error. Expected 0, got %x",c,_checksum);
+		case UART_FIFO_OVF:
+		case UART_BUFFER_FULL:
+			ESP_LOGW(TAG, "UART %d overflow, input flushed", m_uart);
+			uart_flush_input(m_uart);
 
-			//ESP_LOGI(TAG, "process_rx(%x): OUT state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+#ifndef CONFIG_SENSOR_SHARED_RX
+			// --- drop the events of the flushed data. A queue in the shared set has to stay in
+			// --- step with the set, there the stale events just read nothing
 
-			return (_checksum == 0);
+			xQueueReset(m_uart_queue);
+#endif
+			break;
 
 		default:
-			_state = PM1006_HEADER;
 			break;
+	}
+}
+
+////////////////////////////////////////////////////////////////////////////////////////
+
+#ifdef CONFIG_SENSOR_SHARED_RX
+
+static void shared_rx_task(void *arg)
+{
+	ESP_LOGI(TAG,"Shared UART read task started");
+
+	// --- never ending loop, counting the time until we sleep again as active
+
+	int64_t l_awake_us = esp_timer_get_time();
+
+	while (1)
+	{
+		// --- sleep until one of the drivers reports something
+
+		g_Scheduler.CountActive(l_awake_us);
+
+		QueueSetMemberHandle_t l_member = xQueueSelectFromSet(s_rx_set, portMAX_DELAY);
+
+		l_awake_us = esp_timer_get_time();
+
+		if (!l_member) continue;
+
+		g_Scheduler.CountWakeup();
+
+		// --- find the sensor the queue belongs to
+
+		CVindriktning *l_sensor = NULL;
+
+		for (int i = 0; i < s_rx_cnt && !l_sensor; ++i)
+		{
+			if (s_rx_sensors[i]->GetUartQueue() == l_member) l_sensor = s_rx_sensors[i];
 		}
 
-		//ESP_LOGI(TAG, "process_rx(%x): OUT state %d checksum %d _rxlen %d index %d",c,_state,_checksum,_rxlen,_index);
+		uart_event_t l_event;
 
-		return false;
+		if (!l_sensor || xQueueReceive(l_member, &l_event, 0) != pdTRUE) continue;
+
+		l_sensor->ReceiveEvent(l_event, s_rx_buf, sizeof(s_rx_buf));
 	}
+}
 
-	// --------------------------------------------
+////////////////////////////////////////////////////////////////////////////////////////
+
+static bool shared_rx_add(CVindriktning *f_sensor)
+{
+	// --- the set holds the pending events of all queues. There is no static version of
+	// --- it, it is allocated once with the first sensor
 
-	uint8_t GetByte(int f_idx)
+	if (!s_rx_set)
 	{
-		assert(f_idx < DATAGRAM_LEN);
-		
-		return _rxbuf[f_idx];
+		s_rx_set = xQueueCreateSet(CONFIG_TEMP_SENSOR_CNT * QUEUE_LEN);
+
+		if (!s_rx_set)
+		{
+			ESP_LOGE(TAG,"Cannot create the UART queue set");
+			return false;
+		}
 	}
 
-	// --------------------------------------------
+	// --- only an empty queue can join a set, but the driver is already receiving. Drop
+	// --- what came in since the install, the receiver syncs on the next header anyway
 
-    pm1006_state_t 	_state;
-    size_t 			_rxlen;
-    size_t 			_index;
-    uint8_t 		_rxbuf[DATAGRAM_LEN];
-    uint8_t 		_checksum;
- 
-};
+	int l_tries = 3;
 
-////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////
+	do
+	{
+		uart_flush_input(f_sensor->GetUart());
+		xQueueReset(f_sensor->GetUartQueue());
+	}
+	while (xQueueAddToSet(f_sensor->GetUartQueue(), s_rx_set) != pdPASS && --l_tries);
 
-CVindriktning::CVindriktning(void)
-{
-	m_Initialized		= false;
+	if (!l_tries)
+	{
+		ESP_LOGE(TAG,"Cannot add the queue of uart %d to the set", f_sensor->GetUart());
+		return false;
+	}
 
-	m_pin_data			= (gpio_num_t)0;
-	m_uart 				= (uart_port_t)0;
-	
-	m_pm1				= 0;
-	m_pm2				= 0;
-	m_pm10				= 0;
+	// --- the first sensor starts the task
+
+	if (s_rx_cnt == 1) 
+	{
+#ifdef CONFIG_STATIC_ALLOC
+		xTaskCreateStatic(shared_rx_task, "sensor_rx", STACK_SIZE, NULL, 10, s_rx_stack, &s_rx_tcb);
+#else
+		xTaskCreate(shared_rx_task, "sensor_rx", STACK_SIZE, NULL, 10, NULL);
+#endif
+	}
+
+	return true;
 }
 
+#else
+
 ////////////////////////////////////////////////////////////////////////////////////////
 
 static void uart_task(void *arg)
 {
-	CVindriktning 	*l_this = (CVindriktning *)arg;
+	int 			l_idx = (int)(intptr_t)arg;
+	CVindriktning 	*l_this = s_rx_sensors[l_idx];
 	
-	// ---- local instance of our shifter for the datagram
+#ifdef CONFIG_PM1006_SIMULATOR
+
+	// ---- no sensor attached: take the datagrams from the simulator
+
+	Pm1006SimConfig l_simconfig;
 
-	CReceiver l_receiver;
+	l_simconfig.m_seed 				= l_this->GetUart() + 1;
+	l_simconfig.m_checksum_permille = CONFIG_PM1006_SIM_ERROR_PERMILLE;
+	l_simconfig.m_noise_permille 	= CONFIG_PM1006_SIM_ERROR_PERMILLE;
+
+	CPm1006Simulator l_sim;
+	l_sim.Init(l_simconfig);
+
+#endif
 
 	// ---- tell the monitor where we are 
 
@@ -225,44 +354,60 @@ static void uart_task(void *arg)
 
     // --- Configure a temporary buffer for the incoming data
 
+#ifdef CONFIG_STATIC_ALLOC
+	uint8_t *l_data = s_rx_bufs[l_idx];
+#else
     uint8_t *l_data = (uint8_t *) malloc(BUF_SIZE);
 	assert(l_data);
+#endif
 
-	// --- never ending loop 
+	// --- never ending loop, counting the time until we sleep again as active
+
+	int64_t l_awake_us = esp_timer_get_time();
 
 	while (1) 
 	{
         // --- Read data from the UART. This might be one or more bytes in the middle of a datagram
 
-        int len = uart_read_bytes(l_this->GetUart(), l_data, BUF_SIZE, 20 / portTICK_RATE_MS);
+#ifdef CONFIG_PM1006_SIMULATOR
+		uint32_t l_now_ms = esp_timer_get_time() / 1000;
+        int len = l_sim.Read(l_data, BUF_SIZE, l_now_ms);
 
-		// --- add them to the shifter
+		// --- nothing on the line yet: sleep until the next piece arrives
 
-		for (int i=0;i < len;++i)
+		if (!len)
 		{
-			//ESP_LOGI(TAG, "received byte %x",l_data[i]);
+			TickType_t l_wait = l_sim.GetWaitMs(l_now_ms) / portTICK_PERIOD_MS;
 
-			if (l_receiver.process_rx(l_data[i]))
-			{
-					// --- header and length are not stored in the receiver. We start with "0x0B" --> idx0, DF1 --> idx 1
+			g_Scheduler.CountActive(l_awake_us);
+			vTaskDelay(l_wait ? l_wait : 1);
+			l_awake_us = esp_timer_get_time();
+			g_Scheduler.CountWakeup();
+			continue;
+		}
 
-					const uint16_t pm25 = (l_receiver.GetByte(3) << 8) | l_receiver.GetByte(4);
-					const uint16_t pm1  = (l_receiver.GetByte(7) << 8) | l_receiver.GetByte(8);
-					const uint16_t pm10 = (l_receiver.GetByte(11) << 8) | l_receiver.GetByte(12);
+		l_this->ProcessBytes(l_data, len);
+#else
+		// --- sleep until the driver reports something
 
-					ESP_LOGI(TAG, "Datagram valid pm25 %d pm1 %d pm10 %d",pm25,pm1,pm10);
+		uart_event_t l_event;
 
-					//l_receiver.dump();
+		g_Scheduler.CountActive(l_awake_us);
 
-					l_this->SetValues(pm25,pm1,pm10);
-			}
-		}
+		BaseType_t l_received = xQueueReceive(l_this->GetUartQueue(), &l_event, portMAX_DELAY);
+
+		l_awake_us = esp_timer_get_time();
 
-		vTaskDelay(3000 / portTICK_PERIOD_MS);
+		if (l_received != pdTRUE) continue;
 
+		g_Scheduler.CountWakeup();
+
+		l_this->ReceiveEvent(l_event, l_data, BUF_SIZE);
+#endif
     }
 }
 
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -273,6 +418,14 @@ bool CVindriktning::SetupSensor(gpio_num_t f_data,uart_port_t f_uart)
 
 	ESP_LOGI(TAG,"Setting up sensor on uart %d on GPIO pin %d", GetUart(), GetDataPin());
 
+	if (s_rx_cnt >= CONFIG_TEMP_SENSOR_CNT) return false;
+
+	// --- the sensors are set up in the order of the sensor manager
+
+	m_index		= s_rx_cnt;
+
+	m_health.Init(m_index);
+
     // --- Configure parameters of an UART driver, communication pins and install the driver 
 
     uart_config_t uart_config = {
@@ -281,16 +434,47 @@ bool CVindriktning::SetupSensor(gpio_num_t f_data,uart_port_t f_uart)
         .parity    = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+#ifdef CONFIG_POWER_SAVE
+        .source_clk = UART_SCLK_REF_TICK,       // --- keeps the baud rate when the APB clock scales
+#else
         .source_clk = UART_SCLK_APB,
+#endif
     };
 
-    ESP_ERROR_CHECK(uart_driver_install(m_uart, BUF_SIZE * 2, 0, 0, NULL, 0));
+#ifndef CONFIG_PM1006_SIMULATOR
+#ifdef CONFIG_SENSOR_SHARED_RX
+    ESP_ERROR_CHECK(uart_driver_install(m_uart, SHARED_RING_SIZE, 0, QUEUE_LEN, &m_uart_queue, 0));
+
+	// --- join the shared receive task before the first byte can come in
+
+	s_rx_sensors[s_rx_cnt++] = this;
+
+	if (!shared_rx_add(this)) return false;
+#else
+    ESP_ERROR_CHECK(uart_driver_install(m_uart, BUF_SIZE * 2, 0, QUEUE_LEN, &m_uart_queue, 0));
+#endif
     ESP_ERROR_CHECK(uart_param_config(m_uart, &uart_config));
     ESP_ERROR_CHECK(uart_set_pin(m_uart, UART_PIN_NO_CHANGE, m_pin_data, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
 
+	g_PowerManager.SetupUart(m_uart, m_pin_data);
+#else
+	(void)uart_config;
+#endif
+
+#ifndef CONFIG_SENSOR_SHARED_RX
+
 	// --- now start a free rtos task to receive the sensor data
 
-    xTaskCreate(uart_task, "CVindriktning__uart_task", STACK_SIZE, this, 10, NULL);
+	int l_idx = s_rx_cnt++;
+
+	s_rx_sensors[l_idx] = this;
+
+#ifdef CONFIG_STATIC_ALLOC
+    xTaskCreateStatic(uart_task, "CVindriktning__uart_task", STACK_SIZE, (void *)(intptr_t)l_idx, 10, s_rx_stacks[l_idx], &s_rx_tcbs[l_idx]);
+#else
+    xTaskCreate(uart_task, "CVindriktning__uart_task", STACK_SIZE, (void *)(intptr_t)l_idx, 10, NULL);
+#endif
+#endif
 
 	m_Initialized = true;
 
@@ -39,6 +39,12 @@
 
 #include <unistd.h>
 #include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "driver/gpio.h"
+#include "driver/uart.h"
+#include "pm1006.h"
+#include "sensor_health.h"
 
 ////////////////////////////////////////////////////////////////////////////////////////
 
@@ -73,16 +79,47 @@ public:
 		return m_pm10;
 	}
 
+	// --- changes with every new sample, odd while the values are written. A reader
+	// --- that sees the same even version before and after has a consistent snapshot
+
+	uint32_t GetVersion(void) const
+	{
+		return m_version;
+	}
+
+	// --- last datagram, cadence, stuck values and broken frames
+
+	const SensorHealth &GetHealth(void) const
+	{
+		return m_health;
+	}
+
+	// --- the sensor fusion flags deviating sensors in their health
+
+	SensorHealth &GetHealth(void)
+	{
+		return m_health;
+	}
+
 	// --- internal funcitons do not use
 
 	gpio_num_t GetDataPin(void) { return m_pin_data; }
 	uart_port_t GetUart(void) { return m_uart; }
+	QueueHandle_t GetUartQueue(void) { return m_uart_queue; }
+	int GetIndex(void) { return m_index; }
+
+	void ProcessBytes(const uint8_t *f_data, int f_len);
+	void ReceiveEvent(const uart_event_t &f_event, uint8_t *f_buf, int f_size);
 
 	void SetValues(const uint16_t f_pm2,const uint16_t f_pm1,const uint16_t f_pm10)
 	{
+		m_version = m_version + 1;
+		__sync_synchronize();
 		m_pm2 	= f_pm2;
 		m_pm10 	= f_pm10;
 		m_pm1 	= f_pm1;
+		__sync_synchronize();
+		m_version = m_version + 1;
 	}
 
 private:
@@ -90,9 +127,17 @@ private:
 	float m_pm2;
 	float m_pm10;
 	float m_pm1;
+	volatile uint32_t m_version;
 	
 	gpio_num_t m_pin_data;
 	uart_port_t m_uart;
+	int m_index;
+	QueueHandle_t m_uart_queue;
+
+	// --- byte wise decoder state, all this sensor needs in the shared receive task
+
+	CPm1006Receiver m_receiver;
+	SensorHealth m_health;
 	
 	bool m_Initialized;
 };